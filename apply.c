@@ -0,0 +1,340 @@
+/*
+ * apply.c
+ *
+ * Copyright 2013 Matthew <mbrush@codebrainz.ca>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "apply.h"
+#include "docstate.h"
+#include "format.h"
+#include "trace.h"
+
+// Time spent changing the text per main loop iteration, leaving the
+// rest of a 16ms frame for input and drawing
+#define APPLY_SLICE_USEC 8000
+
+// Most bytes deleted or inserted by a single replace
+#define APPLY_PIECE_SIZE 65536
+
+typedef struct
+{
+  size_t offset, length; // the range replaced, in the text before
+  const char *text;
+  size_t text_len;
+} Edit;
+
+typedef struct FmtApply FmtApply;
+
+struct FmtApply
+{
+  GeanyDocument *doc;
+  GArray *edits; // Edit, sorted by offset and made from the last one
+  bool owns_text;
+  // How much of the last edit is done, from its end
+  size_t done_old, done_new;
+  size_t cursor_pos;
+  int first_line;
+  bool was_changed, changed;
+  unsigned int idle_id;
+  gulong key_handler, button_handler;
+  GdkWindow *frozen; // the editor's window while its updates are held
+};
+
+static bool is_continuation(char c)
+{
+  return ((unsigned char)c & 0xC0) == 0x80;
+}
+
+// Replaces the next piece of the last edit, false once all are made
+static bool replace_piece(FmtApply *apply)
+{
+  ScintillaObject *sci = apply->doc->editor->sci;
+  size_t old_left, new_left, del, ins, start;
+  Edit *edit;
+
+  if (apply->edits->len == 0)
+    return false;
+
+  edit = &g_array_index(apply->edits, Edit, apply->edits->len - 1);
+  old_left = edit->length - apply->done_old;
+  new_left = edit->text_len - apply->done_new;
+
+  // Pieces start on characters, never inside a multi-byte one
+  del = MIN(old_left, APPLY_PIECE_SIZE);
+  while (del < old_left &&
+         is_continuation(sci_get_char_at(sci, edit->offset + old_left - del)))
+    del++;
+  ins = MIN(new_left, APPLY_PIECE_SIZE);
+  while (ins < new_left && is_continuation(edit->text[new_left - ins]))
+    ins++;
+
+  start = edit->offset + old_left - del;
+  scintilla_send_message(sci, SCI_SETTARGETSTART, start, 0);
+  scintilla_send_message(sci, SCI_SETTARGETEND, start + del, 0);
+  scintilla_send_message(sci, SCI_REPLACETARGET, ins,
+                         (sptr_t)(edit->text + new_left - ins));
+
+  apply->done_old += del;
+  apply->done_new += ins;
+  if (apply->done_old == edit->length && apply->done_new == edit->text_len)
+  {
+    if (apply->owns_text)
+      g_free((char *)edit->text);
+    g_array_set_size(apply->edits, apply->edits->len - 1);
+    apply->done_old = apply->done_new = 0;
+  }
+
+  return apply->edits->len > 0;
+}
+
+// Makes changes until @a deadline (or all when 0), true once done
+static bool run_slice(FmtApply *apply, gint64 deadline)
+{
+  ScintillaObject *sci = apply->doc->editor->sci;
+  bool more;
+
+  scintilla_send_message(sci, SCI_SETREADONLY, false, 0);
+  do
+    more = replace_piece(apply);
+  while (more && (deadline == 0 || g_get_monotonic_time() < deadline));
+  scintilla_send_message(sci, SCI_SETREADONLY, more, 0);
+
+  return !more;
+}
+
+static void complete(FmtApply *apply)
+{
+  GeanyDocument *doc = apply->doc;
+  ScintillaObject *sci = doc->editor->sci;
+  FmtDocState *state = fmt_doc_state_lookup(doc);
+  int new_first_line;
+
+  if (state && state->apply == apply)
+    state->apply = NULL;
+  if (apply->idle_id > 0)
+    g_source_remove(apply->idle_id);
+  if (apply->key_handler > 0)
+    g_signal_handler_disconnect(sci, apply->key_handler);
+  if (apply->button_handler > 0)
+    g_signal_handler_disconnect(sci, apply->button_handler);
+
+  scintilla_send_message(sci, SCI_SETREADONLY, doc->readonly, 0);
+  scintilla_send_message(sci, SCI_GOTOPOS, apply->cursor_pos, 0);
+  new_first_line = scintilla_send_message(sci, SCI_GETFIRSTVISIBLELINE, 0, 0);
+  scintilla_send_message(sci, SCI_LINESCROLL, 0,
+                         apply->first_line - new_first_line);
+  scintilla_send_message(sci, SCI_ENDUNDOACTION, 0, 0);
+
+  // Updates were held back since the first slice that didn't finish
+  if (apply->frozen)
+  {
+    gdk_window_thaw_updates(apply->frozen);
+    g_object_unref(apply->frozen);
+  }
+
+  document_set_text_changed(doc, apply->was_changed || apply->changed);
+  fmt_trace_apply(doc);
+
+  if (apply->owns_text)
+  {
+    for (unsigned int i = 0; i < apply->edits->len; i++)
+      g_free((char *)g_array_index(apply->edits, Edit, i).text);
+  }
+  g_array_free(apply->edits, true);
+  g_free(apply);
+}
+
+static gboolean on_apply_idle(FmtApply *apply)
+{
+  if (!run_slice(apply, g_get_monotonic_time() + APPLY_SLICE_USEC))
+    return true;
+
+  apply->idle_id = 0;
+  complete(apply);
+  return false;
+}
+
+// The user wants the document back, the rest can't wait
+static gboolean on_input_event(G_GNUC_UNUSED GtkWidget *widget,
+                               G_GNUC_UNUSED GdkEvent *event, FmtApply *apply)
+{
+  fmt_apply_finish(apply->doc);
+  return false;
+}
+
+// Runs before Geany's own handler, which would beep at the attempt
+static gboolean on_editor_notify(G_GNUC_UNUSED GObject *obj,
+                                 GeanyEditor *editor, SCNotification *notif,
+                                 G_GNUC_UNUSED gpointer user_data)
+{
+  FmtDocState *state;
+
+  if (notif->nmhdr.code != SCN_MODIFYATTEMPTRO)
+    return false;
+
+  state = fmt_doc_state_lookup(editor->document);
+  if (!state || !state->apply)
+    return false;
+
+  // Scintilla lets the edit go ahead once the document is writable
+  fmt_apply_finish(editor->document);
+  return true;
+}
+
+static void start(GeanyDocument *doc, GArray *edits, size_t cursor_pos,
+                  bool changed)
+{
+  ScintillaObject *sci = doc->editor->sci;
+  FmtApply *apply;
+
+  fmt_apply_finish(doc);
+
+  // Scintilla would refuse the changes anyway
+  if (doc->readonly)
+  {
+    g_array_free(edits, true);
+    return;
+  }
+
+  apply = g_new0(FmtApply, 1);
+  apply->doc = doc;
+  apply->edits = edits;
+  apply->cursor_pos = cursor_pos;
+  apply->was_changed = doc->changed;
+  apply->changed = changed;
+  apply->first_line =
+      scintilla_send_message(sci, SCI_GETFIRSTVISIBLELINE, 0, 0);
+
+  // Known from the first slice on, so its edits aren't taken for the
+  // user's
+  fmt_doc_state_get(doc)->apply = apply;
+
+  scintilla_send_message(sci, SCI_BEGINUNDOACTION, 0, 0);
+  if (run_slice(apply, g_get_monotonic_time() + APPLY_SLICE_USEC))
+  {
+    complete(apply);
+    return;
+  }
+
+  // The texts given belong to the caller, keep what's still needed
+  for (unsigned int i = 0; i < edits->len; i++)
+  {
+    Edit *edit = &g_array_index(edits, Edit, i);
+    char *copy = g_malloc(edit->text_len + 1);
+    memcpy(copy, edit->text, edit->text_len);
+    edit->text = copy;
+  }
+  apply->owns_text = true;
+
+  // Half-changed text isn't worth showing, nor are the scrolling and
+  // caret jumps along the way. Tabs never shown have nothing to hold.
+  apply->frozen = gtk_widget_get_window(GTK_WIDGET(sci));
+  if (apply->frozen)
+  {
+    g_object_ref(apply->frozen);
+    gdk_window_freeze_updates(apply->frozen);
+  }
+  apply->key_handler = g_signal_connect(sci, "key-press-event",
+                                        G_CALLBACK(on_input_event), apply);
+  apply->button_handler = g_signal_connect(
+      sci, "button-press-event", G_CALLBACK(on_input_event), apply);
+  apply->idle_id = g_idle_add_full(G_PRIORITY_DEFAULT_IDLE,
+                                   (GSourceFunc)on_apply_idle, apply, NULL);
+}
+
+void fmt_apply_text(GeanyDocument *doc, const char *text, size_t len,
+                    size_t cursor_pos, bool changed)
+{
+  ScintillaObject *sci = doc->editor->sci;
+  size_t sci_len = sci_get_length(sci), prefix = 0, suffix = 0;
+  const char *sci_buf;
+  GArray *edits = g_array_new(false, false, sizeof(Edit));
+  Edit edit;
+
+  fmt_apply_finish(doc);
+  sci_buf =
+      (const char *)scintilla_send_message(sci, SCI_GETCHARACTERPOINTER, 0, 0);
+
+  // Replacing just what differs is quicker, and keeps markers and
+  // folds around it
+  while (prefix < len && prefix < sci_len && text[prefix] == sci_buf[prefix])
+    prefix++;
+  while (prefix > 0 && prefix < sci_len && is_continuation(sci_buf[prefix]))
+    prefix--;
+  while (suffix < len - prefix && suffix < sci_len - prefix &&
+         text[len - suffix - 1] == sci_buf[sci_len - suffix - 1])
+    suffix++;
+  while (suffix > 0 && is_continuation(sci_buf[sci_len - suffix]))
+    suffix--;
+
+  edit.offset = prefix;
+  edit.length = sci_len - prefix - suffix;
+  edit.text = text + prefix;
+  edit.text_len = len - prefix - suffix;
+  if (edit.length > 0 || edit.text_len > 0)
+    g_array_append_val(edits, edit);
+
+  start(doc, edits, cursor_pos, changed);
+}
+
+void fmt_apply_replacements(GeanyDocument *doc, GArray *repls,
+                            size_t cursor_pos, bool changed)
+{
+  GArray *edits = g_array_sized_new(false, false, sizeof(Edit), repls->len);
+
+  for (unsigned int i = 0; i < repls->len; i++)
+  {
+    FmtReplacement *repl = &g_array_index(repls, FmtReplacement, i);
+    Edit edit = { repl->offset, repl->length, repl->text,
+                  strlen(repl->text) };
+    g_array_append_val(edits, edit);
+  }
+
+  start(doc, edits, cursor_pos, changed);
+}
+
+void fmt_apply_finish(GeanyDocument *doc)
+{
+  FmtDocState *state = fmt_doc_state_lookup(doc);
+
+  if (!state || !state->apply)
+    return;
+
+  run_slice(state->apply, 0);
+  complete(state->apply);
+}
+
+void fmt_apply_init(void)
+{
+  plugin_signal_connect(geany_plugin, NULL, "editor-notify", FALSE,
+                        G_CALLBACK(on_editor_notify), NULL);
+}
+
+void fmt_apply_deinit(void)
+{
+  guint i;
+
+  foreach_document(i)
+  {
+    fmt_apply_finish(documents[i]);
+  }
+}
@@ -0,0 +1,63 @@
+/*
+ * apply.h
+ *
+ * Copyright 2013 Matthew <mbrush@codebrainz.ca>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+
+#ifndef FMT_APPLY_H
+#define FMT_APPLY_H
+
+#include "plugin.h"
+
+G_BEGIN_DECLS
+
+void fmt_apply_init(void);
+void fmt_apply_deinit(void);
+
+/**
+ * Replaces the text of @a doc with @a text, as a single undo action,
+ * and moves the cursor to @a cursor_pos without scrolling the view.
+ * Only the part between the unchanged start and end is replaced.
+ *
+ * Changes too large to make within a frame are made in slices from
+ * idle callbacks instead. Until the last one the document is read-only
+ * and not redrawn, and keystrokes, clicks or any other attempt to edit
+ * it finish the changes first. @a text is copied when needed.
+ *
+ * @a changed tells whether to mark the document as changed afterwards.
+ */
+void fmt_apply_text(GeanyDocument *doc, const char *text, size_t len,
+                    size_t cursor_pos, bool changed);
+
+/**
+ * Like fmt_apply_text() but makes only the changes in @a repls, which
+ * must be sorted and not overlap, so markers and folds on the lines
+ * in between are kept.
+ */
+void fmt_apply_replacements(GeanyDocument *doc, GArray *repls,
+                            size_t cursor_pos, bool changed);
+
+/**
+ * Makes the changes still pending on @a doc right away. Must be called
+ * before anything reads or edits the document's text on its own.
+ */
+void fmt_apply_finish(GeanyDocument *doc);
+
+G_END_DECLS
+
+#endif // FMT_APPLY_H
@@ -0,0 +1,286 @@
+/*
+ * breaker.c
+ *
+ * Copyright 2013 Matthew <mbrush@codebrainz.ca>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "breaker.h"
+#include "format.h"
+#include "stats.h"
+
+// Failures in a row that open a breaker
+#define BREAKER_THRESHOLD 3
+
+// How long a breaker first stays open, doubled each time it reopens
+#define BREAKER_MIN_BACKOFF_MS 2000
+#define BREAKER_MAX_BACKOFF_MS (10 * 60 * 1000)
+
+// Bytes of a document to edit for another attempt before that, also
+// doubled each time
+#define BREAKER_MIN_EDIT_VOLUME 64
+#define BREAKER_MAX_EDIT_VOLUME (64 * 1024)
+
+typedef enum
+{
+  BREAKER_CLOSED = 0,
+  BREAKER_OPEN,
+  BREAKER_HALF_OPEN, // due for another attempt
+} BreakerState;
+
+typedef struct
+{
+  FmtBreaker breaker;
+  char *name;               // the .clang-format file or preset style
+  GeanyDocument *first_doc; // the first document that failed
+  bool several_docs;        // whether others failed too
+} ConfigBreaker;
+
+// config hash -> ConfigBreaker*, for configurations that failed since
+// they last worked
+static GHashTable *configs = NULL;
+
+static void config_breaker_free(ConfigBreaker *cb)
+{
+  g_free(cb->name);
+  g_free(cb);
+}
+
+static BreakerState breaker_state(const FmtBreaker *b, size_t volume,
+                                  gint64 now)
+{
+  if (b->retry_at == 0)
+    return BREAKER_CLOSED;
+  if (now >= b->retry_at || (b->retry_volume > 0 && volume >= b->retry_volume))
+    return BREAKER_HALF_OPEN;
+  return BREAKER_OPEN;
+}
+
+// Holds attempts back for the current backoff, and for documents until
+// enough is edited too
+static void breaker_arm(FmtBreaker *b, size_t volume, bool by_volume)
+{
+  unsigned int shift = MIN(b->n_opened - 1, 20);
+  gint64 backoff_ms =
+      MIN((gint64)BREAKER_MIN_BACKOFF_MS << shift, BREAKER_MAX_BACKOFF_MS);
+
+  b->retry_at = g_get_monotonic_time() + backoff_ms * 1000;
+  b->retry_volume = 0;
+  if (by_volume)
+  {
+    b->retry_volume = volume + MIN((size_t)BREAKER_MIN_EDIT_VOLUME << shift,
+                                   BREAKER_MAX_EDIT_VOLUME);
+  }
+}
+
+// Returns whether the failure opened the breaker for the first time
+static bool breaker_fail(FmtBreaker *b, size_t volume, bool by_volume,
+                         bool may_open)
+{
+  b->failures++;
+
+  // Once open, every failed attempt opens it again for longer
+  if (b->n_opened == 0 && (b->failures < BREAKER_THRESHOLD || !may_open))
+    return false;
+
+  b->n_opened++;
+  breaker_arm(b, volume, by_volume);
+  return b->n_opened == 1;
+}
+
+static unsigned int seconds_until(gint64 when)
+{
+  gint64 now = g_get_monotonic_time();
+  return when > now ? (unsigned int)((when - now + 999999) / 1000000) : 0;
+}
+
+void fmt_breaker_init(void)
+{
+  if (configs)
+    return;
+  configs = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                                  (GDestroyNotify)config_breaker_free);
+}
+
+void fmt_breaker_deinit(void)
+{
+  if (configs)
+  {
+    g_hash_table_destroy(configs);
+    configs = NULL;
+  }
+}
+
+bool fmt_breaker_allows(GeanyDocument *doc)
+{
+  gint64 now = g_get_monotonic_time();
+  BreakerState doc_state, config_state = BREAKER_CLOSED;
+  ConfigBreaker *cb = NULL;
+  FmtDocState *state;
+
+  g_return_val_if_fail(DOC_VALID(doc), false);
+
+  state = fmt_doc_state_get(doc);
+  doc_state = breaker_state(&state->breaker, state->edit_volume, now);
+
+  // No need to hash the configuration while none is failing
+  if (doc->real_path && g_hash_table_size(configs) > 0)
+  {
+    char *hash = fmt_config_hash(doc->real_path);
+    cb = g_hash_table_lookup(configs, hash);
+    g_free(hash);
+    if (cb)
+      config_state = breaker_state(&cb->breaker, 0, now);
+  }
+
+  if (doc_state == BREAKER_OPEN || config_state == BREAKER_OPEN)
+    return false;
+
+  // A single attempt goes ahead, the next ones wait for how it went
+  if (doc_state == BREAKER_HALF_OPEN)
+    breaker_arm(&state->breaker, state->edit_volume, true);
+  if (config_state == BREAKER_HALF_OPEN)
+    breaker_arm(&cb->breaker, 0, false);
+
+  return true;
+}
+
+void fmt_breaker_record(FmtJob *job)
+{
+  GeanyDocument *doc = job->doc;
+  FmtDocState *state;
+  ConfigBreaker *cb = NULL;
+  char *hash = NULL, *name;
+
+  // Cancelled jobs and ones with nothing to format say nothing
+  if (job->cancelled || (!job->failed && !job->result) || !DOC_VALID(doc))
+    return;
+
+  state = fmt_doc_state_lookup(doc);
+  if (!state)
+    return;
+
+  if (doc->real_path && (job->failed || g_hash_table_size(configs) > 0))
+  {
+    hash = fmt_config_hash(doc->real_path);
+    cb = g_hash_table_lookup(configs, hash);
+  }
+
+  name = document_get_basename_for_display(doc, -1);
+
+  if (!job->failed)
+  {
+    if (state->breaker.n_opened > 0 || (cb && cb->breaker.n_opened > 0))
+      msgwin_status_add(_("Code Format: formatting %s works again"), name);
+    memset(&state->breaker, 0, sizeof(state->breaker));
+    if (cb)
+      g_hash_table_remove(configs, hash);
+    g_free(hash);
+    g_free(name);
+    return;
+  }
+
+  if (breaker_fail(&state->breaker, state->edit_volume, true, true))
+  {
+    msgwin_status_add(_("Code Format: formatting %s failed %u times in a "
+                        "row, auto-formatting it is paused for a while"),
+                      name, state->breaker.failures);
+  }
+
+  // Failures spread over documents point at the configuration instead
+  if (hash && !cb)
+  {
+    cb = g_new0(ConfigBreaker, 1);
+    cb->name = fmt_stats_config_key(doc);
+    cb->first_doc = doc;
+    g_hash_table_insert(configs, hash, cb);
+    hash = NULL;
+  }
+  else if (cb && cb->first_doc != doc)
+    cb->several_docs = true;
+
+  if (cb && breaker_fail(&cb->breaker, 0, false, cb->several_docs))
+  {
+    msgwin_status_add(_("Code Format: formatting with %s failed %u times "
+                        "in a row, auto-formatting with it is paused for "
+                        "a while"),
+                      cb->name, cb->breaker.failures);
+  }
+
+  g_free(hash);
+  g_free(name);
+}
+
+static void show_breaker(GeanyDocument *doc, const char *name,
+                         const FmtBreaker *b, size_t volume)
+{
+  switch (breaker_state(b, volume, g_get_monotonic_time()))
+  {
+    case BREAKER_CLOSED:
+      msgwin_msg_add(COLOR_BLACK, -1, doc,
+                     _("%s: formatting failed %u times in a row"), name,
+                     b->failures);
+      break;
+    case BREAKER_OPEN:
+      msgwin_msg_add(COLOR_RED, -1, doc,
+                     _("%s: formatting failed %u times in a row, "
+                       "auto-formatting paused for %u s%s"),
+                     name, b->failures, seconds_until(b->retry_at),
+                     b->retry_volume > 0 ? _(" or until edited further")
+                                         : "");
+      break;
+    case BREAKER_HALF_OPEN:
+      msgwin_msg_add(COLOR_RED, -1, doc,
+                     _("%s: formatting failed %u times in a row, "
+                       "auto-formatting will try again"),
+                     name, b->failures);
+      break;
+  }
+}
+
+void fmt_breaker_show(void)
+{
+  GHashTableIter iter;
+  gpointer value;
+  guint i;
+
+  foreach_document(i)
+  {
+    FmtDocState *state = fmt_doc_state_lookup(documents[i]);
+    char *name;
+
+    if (!state || state->breaker.failures == 0)
+      continue;
+
+    name = document_get_basename_for_display(documents[i], -1);
+    show_breaker(documents[i], name, &state->breaker, state->edit_volume);
+    g_free(name);
+  }
+
+  g_hash_table_iter_init(&iter, configs);
+  while (g_hash_table_iter_next(&iter, NULL, &value))
+  {
+    ConfigBreaker *cb = value;
+    char *name = g_strdup_printf(_("Configuration %s"), cb->name);
+    show_breaker(NULL, name, &cb->breaker, 0);
+    g_free(name);
+  }
+}
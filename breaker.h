@@ -0,0 +1,58 @@
+/*
+ * breaker.h
+ *
+ * Copyright 2013 Matthew <mbrush@codebrainz.ca>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+
+#ifndef FMT_BREAKER_H
+#define FMT_BREAKER_H
+
+#include "docstate.h"
+#include "sched.h"
+
+G_BEGIN_DECLS
+
+void fmt_breaker_init(void);
+void fmt_breaker_deinit(void);
+
+/**
+ * Whether auto-formatting, or other formatting nobody asked for, may
+ * run clang-format on @a doc.
+ *
+ * After a few failures in a row on a document, or on documents sharing
+ * a configuration, this says no until a timeout passes or, for a
+ * document, enough of it was edited since. Both double each time the
+ * attempt that follows fails again, and a success resets them.
+ * Explicit formatting always goes ahead, and its outcome counts too.
+ */
+bool fmt_breaker_allows(GeanyDocument *doc);
+
+/**
+ * Counts the outcome of a finished job, called by the scheduler.
+ */
+void fmt_breaker_record(FmtJob *job);
+
+/**
+ * Lists documents and configurations formatting is failing for in the
+ * message window, after the statistics.
+ */
+void fmt_breaker_show(void);
+
+G_END_DECLS
+
+#endif // FMT_BREAKER_H
@@ -0,0 +1,351 @@
+/*
+ * check.c
+ *
+ * Copyright 2013 Matthew <mbrush@codebrainz.ca>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "check.h"
+#include "apply.h"
+#include "breaker.h"
+#include "docstate.h"
+#include "format.h"
+#include "prefs.h"
+
+// Scintilla indicator used to mark misformatted lines, chosen well
+// clear of the ones Geany itself uses
+#define CHECK_INDICATOR 19
+
+// How long a document must be left alone before an idle check
+#define CHECK_IDLE_DELAY_MS 2000
+
+// The icon added to the notebook tab of checked documents
+#define CHECK_ICON_KEY "code-format-check-icon"
+#define CHECK_ICON_CLEAN "emblem-default"
+#define CHECK_ICON_DIRTY "dialog-warning"
+
+static GeanyDocument *idle_doc = NULL;
+static unsigned int idle_timer = 0;
+
+static char *check_hash(GeanyDocument *doc, const char *code, size_t len)
+{
+  GChecksum *sum;
+  char *config, *hash;
+
+  config = fmt_config_hash(doc->real_path);
+  sum = g_checksum_new(G_CHECKSUM_SHA1);
+  g_checksum_update(sum, (const guchar *)config, -1);
+  g_checksum_update(sum, (const guchar *)code, len);
+  hash = g_strdup(g_checksum_get_string(sum));
+  g_checksum_free(sum);
+  g_free(config);
+
+  return hash;
+}
+
+static void clear_marks(GeanyDocument *doc)
+{
+  ScintillaObject *sci = doc->editor->sci;
+  scintilla_send_message(sci, SCI_SETINDICATORCURRENT, CHECK_INDICATOR, 0);
+  scintilla_send_message(sci, SCI_INDICATORCLEARRANGE, 0, sci_get_length(sci));
+}
+
+static GtkWidget *get_tab_label(GeanyDocument *doc)
+{
+  GtkWidget *notebook = geany_data->main_widgets->notebook;
+  GtkWidget *label = gtk_notebook_get_tab_label(
+      GTK_NOTEBOOK(notebook), document_get_notebook_child(doc));
+
+  // Geany's tab labels are boxes holding the name and close button
+  return GTK_IS_BOX(label) ? label : NULL;
+}
+
+// Shows the result of checking @a doc on its notebook tab
+static void set_status(GeanyDocument *doc, FmtDocState *state,
+                       FmtCheckStatus status)
+{
+  GtkWidget *label, *icon;
+  bool clean = status == FMT_CHECK_CLEAN;
+
+  state->check_status = status;
+
+  label = get_tab_label(doc);
+  if (!label)
+    return;
+  icon = g_object_get_data(G_OBJECT(label), CHECK_ICON_KEY);
+
+  if (status == FMT_CHECK_UNKNOWN)
+  {
+    if (icon)
+      gtk_widget_hide(icon);
+    return;
+  }
+
+  if (!icon)
+  {
+    icon = gtk_image_new();
+    gtk_box_pack_start(GTK_BOX(label), icon, false, false, 0);
+    gtk_box_reorder_child(GTK_BOX(label), icon, 0);
+    g_object_set_data(G_OBJECT(label), CHECK_ICON_KEY, icon);
+  }
+  gtk_image_set_from_icon_name(GTK_IMAGE(icon),
+                               clean ? CHECK_ICON_CLEAN : CHECK_ICON_DIRTY,
+                               GTK_ICON_SIZE_MENU);
+  gtk_widget_set_tooltip_text(icon, clean ? _("Formatted")
+                                          : _("Needs formatting"));
+  gtk_widget_show(icon);
+}
+
+static void remove_status(GeanyDocument *doc)
+{
+  GtkWidget *label = get_tab_label(doc);
+  GtkWidget *icon;
+
+  if (!label)
+    return;
+  icon = g_object_get_data(G_OBJECT(label), CHECK_ICON_KEY);
+  if (icon)
+  {
+    gtk_widget_destroy(icon);
+    g_object_set_data(G_OBJECT(label), CHECK_ICON_KEY, NULL);
+  }
+}
+
+static void mark_lines(GeanyDocument *doc, GArray *ranges)
+{
+  ScintillaObject *sci = doc->editor->sci;
+
+  scintilla_send_message(sci, SCI_INDICSETSTYLE, CHECK_INDICATOR,
+                         INDIC_SQUIGGLE);
+  scintilla_send_message(sci, SCI_INDICSETFORE, CHECK_INDICATOR, 0x0080ff);
+  scintilla_send_message(sci, SCI_SETINDICATORCURRENT, CHECK_INDICATOR, 0);
+
+  for (unsigned int i = 0; i < ranges->len; i++)
+  {
+    FmtLineRange *range = &g_array_index(ranges, FmtLineRange, i);
+    int start = sci_get_position_from_line(sci, range->first - 1);
+    int end = sci_get_line_end_position(sci, range->last - 1);
+    if (end > start)
+      scintilla_send_message(sci, SCI_INDICATORFILLRANGE, start, end - start);
+  }
+}
+
+static void report_ranges(GeanyDocument *doc, GArray *repls, GArray *ranges)
+{
+  char *name = document_get_basename_for_display(doc, -1);
+
+  for (unsigned int i = 0; i < ranges->len; i++)
+  {
+    FmtLineRange *range = &g_array_index(ranges, FmtLineRange, i);
+    if (range->first == range->last)
+    {
+      msgwin_msg_add(COLOR_RED, range->first, doc,
+                     _("%s:%u: needs formatting"), name, range->first);
+    }
+    else
+    {
+      msgwin_msg_add(COLOR_RED, range->first, doc,
+                     _("%s:%u: lines %u-%u need formatting"), name,
+                     range->first, range->first, range->last);
+    }
+  }
+
+  if (repls->len == 0)
+    msgwin_msg_add(COLOR_BLACK, -1, doc, _("%s: formatted"), name);
+  else
+  {
+    msgwin_msg_add(COLOR_BLACK, -1, doc,
+                   _("%s: %u replacements in %u line ranges"), name,
+                   repls->len, ranges->len);
+  }
+
+  g_free(name);
+}
+
+static void on_check_job_done(FmtJob *job, gpointer report)
+{
+  FmtDocState *state;
+  GArray *repls, *ranges;
+
+  if (job->cancelled || !DOC_VALID(job->doc))
+    return;
+
+  state = fmt_doc_state_lookup(job->doc);
+  if (!state || state->version != job->doc_version)
+    return;
+
+  if (!job->result)
+  {
+    if (report)
+      msgwin_msg_add(COLOR_RED, -1, job->doc, _("Failed to check formatting"));
+    return;
+  }
+
+  repls = fmt_replacements_parse(job->result->str, job->code->str,
+                                 job->code->len);
+  if (!repls)
+  {
+    g_warning("Failed to parse clang-format replacements");
+    return;
+  }
+
+  ranges = fmt_replacements_line_ranges(repls, job->code->str,
+                                        job->code->len);
+
+  clear_marks(job->doc);
+  g_free(state->clean_hash);
+  state->clean_hash = NULL;
+
+  if (repls->len == 0)
+  {
+    set_status(job->doc, state, FMT_CHECK_CLEAN);
+    state->clean_hash =
+        check_hash(job->doc, job->code->str, job->code->len);
+  }
+  else
+  {
+    set_status(job->doc, state, FMT_CHECK_DIRTY);
+    mark_lines(job->doc, ranges);
+  }
+
+  if (report)
+    report_ranges(job->doc, repls, ranges);
+
+  g_array_free(ranges, true);
+  g_array_free(repls, true);
+}
+
+void fmt_check_document(GeanyDocument *doc, FmtJobClass job_class,
+                        bool report)
+{
+  ScintillaObject *sci;
+  FmtDocState *state;
+  const char *buf;
+  size_t len;
+  FmtJob *job;
+
+  if (!DOC_VALID(doc) || !doc->real_path || !fmt_is_supported_ft(doc))
+    return;
+
+  fmt_apply_finish(doc);
+  sci = doc->editor->sci;
+  state = fmt_doc_state_get(doc);
+  len = sci_get_length(sci);
+  buf = (const char *)scintilla_send_message(sci, SCI_GETCHARACTERPOINTER, 0,
+                                             0);
+
+  // Skip the spawn if this exact text already passed
+  if (state->clean_hash)
+  {
+    char *hash = check_hash(doc, buf, len);
+    bool clean = g_strcmp0(hash, state->clean_hash) == 0;
+    g_free(hash);
+    if (clean)
+    {
+      set_status(doc, state, FMT_CHECK_CLEAN);
+      if (report)
+      {
+        char *name = document_get_basename_for_display(doc, -1);
+        msgwin_msg_add(COLOR_BLACK, -1, doc, _("%s: formatted"), name);
+        g_free(name);
+      }
+      return;
+    }
+  }
+
+  if (len == 0)
+    return;
+
+  job = fmt_job_new(job_class, doc->file_name, buf, len,
+                    sci_get_current_position(sci), 0, len, true);
+  job->doc = doc;
+  job->doc_version = state->version;
+  fmt_sched_submit(job, on_check_job_done, GINT_TO_POINTER(report));
+}
+
+void fmt_check_session(void)
+{
+  guint i;
+
+  msgwin_clear_tab(MSG_MESSAGE);
+  msgwin_switch_tab(MSG_MESSAGE, false);
+
+  foreach_document(i)
+  {
+    // Session class jobs run in parallel up to its limit
+    fmt_check_document(documents[i], FMT_JOB_SESSION, true);
+  }
+}
+
+static gboolean on_check_idle_timeout(G_GNUC_UNUSED gpointer user_data)
+{
+  GeanyDocument *doc = idle_doc;
+
+  idle_timer = 0;
+  idle_doc = NULL;
+
+  if (DOC_VALID(doc) && doc == document_get_current() &&
+      fmt_breaker_allows(doc))
+    fmt_check_document(doc, FMT_JOB_BACKGROUND, false);
+
+  return false;
+}
+
+void fmt_check_schedule_idle(GeanyDocument *doc)
+{
+  FmtDocState *state;
+
+  // The text may have changed, whatever was known about it is stale
+  state = fmt_doc_state_lookup(doc);
+  if (state && state->check_status != FMT_CHECK_UNKNOWN)
+    set_status(doc, state, FMT_CHECK_UNKNOWN);
+
+  if (!fmt_prefs_get_check_on_idle() || !fmt_is_supported_ft(doc))
+    return;
+
+  if (idle_timer > 0)
+    g_source_remove(idle_timer);
+  idle_doc = doc;
+  idle_timer = g_timeout_add_full(G_PRIORITY_LOW, CHECK_IDLE_DELAY_MS,
+                                  on_check_idle_timeout, NULL, NULL);
+}
+
+void fmt_check_init(void)
+{
+  idle_doc = NULL;
+  idle_timer = 0;
+}
+
+void fmt_check_deinit(void)
+{
+  guint i;
+
+  if (idle_timer > 0)
+    g_source_remove(idle_timer);
+  idle_timer = 0;
+  idle_doc = NULL;
+
+  foreach_document(i)
+  {
+    clear_marks(documents[i]);
+    remove_status(documents[i]);
+  }
+}
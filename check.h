@@ -0,0 +1,57 @@
+/*
+ * check.h
+ *
+ * Copyright 2013 Matthew <mbrush@codebrainz.ca>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+
+#ifndef FMT_CHECK_H
+#define FMT_CHECK_H
+
+#include "plugin.h"
+#include "sched.h"
+
+G_BEGIN_DECLS
+
+void fmt_check_init(void);
+void fmt_check_deinit(void);
+
+/**
+ * Checks whether @a doc is formatted, without changing it.
+ *
+ * Lines needing formatting are marked in the editor, and when
+ * @a report is @c true they're also listed in the message window.
+ * Documents whose text and configuration already passed are not
+ * checked again.
+ */
+void fmt_check_document(GeanyDocument *doc, FmtJobClass job_class,
+                        bool report);
+
+/**
+ * Checks all open supported documents in parallel.
+ */
+void fmt_check_session(void);
+
+/**
+ * (Re)starts the idle timer after which @a doc gets checked in the
+ * background, when the check-on-idle preference is enabled.
+ */
+void fmt_check_schedule_idle(GeanyDocument *doc);
+
+G_END_DECLS
+
+#endif // FMT_CHECK_H
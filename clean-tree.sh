@@ -4,4 +4,6 @@
 rm -f *.o *.a *.so *.dll *.lib *.dylib *.lo *.la config.*
 rm -rf .deps/ .libs/ autom4te.cache/ build-aux/ m4/
 rm -f configure stamp-h1 aclocal.m4 libtool Makefile Makefile.in
-rm -f compile_commands.json
+rm -f compile_commands.json code-format-daemon code-format-replay \
+	code-format-stress code-format-indent-check
+rm -f *.log *.trs
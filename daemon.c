@@ -0,0 +1,890 @@
+/*
+ * daemon.c
+ *
+ * Copyright 2013 Matthew <mbrush@codebrainz.ca>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+
+/*
+ * code-format-daemon, the formatting service.
+ *
+ * Runs formatter commands sent over a per-user Unix socket (see
+ * protocol.h) on behalf of every Geany instance and tool of the user,
+ * and remembers recent results, keyed by the command, its input, the
+ * formatter binary and the style of the .clang-format files it would
+ * use. It exits by itself once unused for a while.
+ *
+ * With --run, it's instead a client for scripts and hooks: the command
+ * following it is run through the service, which is started if needed,
+ * or directly when that fails.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE // struct ucred
+#endif
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "dotfile.h"
+#include "protocol.h"
+
+#include <glib.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+#define MAX_WORKERS 8
+#define CACHE_LIMIT (64 * 1024 * 1024)
+#define DEFAULT_IDLE_EXIT 600 // seconds
+#define START_TIMEOUT_MS 1000
+#define LOW_PRIORITY_NICE 10
+#define IO_BUF_SIZE 65536
+// How long a client may take to send its request
+#define REQUEST_TIMEOUT 60 // seconds
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+typedef struct
+{
+  char *key;
+  guint32 status;
+  char *out;
+  size_t out_len;
+  GList *link; // in cache_lru
+} CacheEntry;
+
+// Results, most recently used first
+static GMutex cache_lock;
+static GHashTable *cache = NULL;
+static GQueue cache_lru = G_QUEUE_INIT;
+static size_t cache_bytes = 0;
+
+static GMutex worker_lock;
+static GCond worker_cond;
+static unsigned int n_workers = 0;
+static gint64 last_activity = 0;
+
+static volatile sig_atomic_t quit_requested = 0;
+
+//======================================================================
+//
+// I/O helpers
+//
+
+static bool read_all(int fd, void *buf, size_t len)
+{
+  char *p = buf;
+  while (len > 0)
+  {
+    ssize_t n = read(fd, p, len);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    p += n;
+    len -= n;
+  }
+  return true;
+}
+
+static bool write_all(int fd, const void *buf, size_t len)
+{
+  const char *p = buf;
+  while (len > 0)
+  {
+    ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+    if (n < 0 && errno == ENOTSOCK)
+      n = write(fd, p, len);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    p += n;
+    len -= n;
+  }
+  return true;
+}
+
+static bool read_u32(int fd, guint32 *value)
+{
+  if (!read_all(fd, value, sizeof(*value)))
+    return false;
+  *value = GUINT32_FROM_BE(*value);
+  return true;
+}
+
+static char *read_string(int fd)
+{
+  guint32 len;
+  char *str;
+
+  if (!read_u32(fd, &len) || len > FMT_PROTOCOL_MAX_STRING)
+    return NULL;
+  str = g_malloc(len + 1);
+  if (!read_all(fd, str, len))
+  {
+    g_free(str);
+    return NULL;
+  }
+  str[len] = '\0';
+  return str;
+}
+
+static void append_u32(GByteArray *buf, guint32 value)
+{
+  value = GUINT32_TO_BE(value);
+  g_byte_array_append(buf, (const guint8 *)&value, sizeof(value));
+}
+
+static void append_string(GByteArray *buf, const char *str)
+{
+  size_t len = strlen(str);
+  append_u32(buf, len);
+  g_byte_array_append(buf, (const guint8 *)str, len);
+}
+
+static int connect_socket(const char *path)
+{
+  struct sockaddr_un addr;
+  int fd;
+
+  if (strlen(path) >= sizeof(addr.sun_path))
+    return -1;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, path);
+
+  fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0)
+    return -1;
+  fcntl(fd, F_SETFD, FD_CLOEXEC);
+  if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0)
+  {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+//======================================================================
+//
+// Fingerprints
+//
+
+// Identifies the program run by @a argv0, so upgrading it invalidates
+// the results it produced
+static char *program_fingerprint(const char *work_dir, const char *argv0)
+{
+  char *path, *result;
+  struct stat st;
+
+  if (strchr(argv0, '/'))
+    path = g_path_is_absolute(argv0) ? g_strdup(argv0)
+                                     : g_build_filename(work_dir, argv0, NULL);
+  else
+    path = g_find_program_in_path(argv0);
+
+  if (!path || stat(path, &st) != 0)
+  {
+    g_free(path);
+    return NULL;
+  }
+
+  result = g_strdup_printf("%s:%lld:%lld", path, (long long)st.st_mtime,
+                           (long long)st.st_size);
+  g_free(path);
+  return result;
+}
+
+static char *request_key(const char *work_dir, char **argv,
+                         const GByteArray *input)
+{
+  GChecksum *sum;
+  char *part, *key;
+
+  part = program_fingerprint(work_dir, argv[0]);
+  if (!part)
+    return NULL;
+
+  sum = g_checksum_new(G_CHECKSUM_SHA256);
+  g_checksum_update(sum, (const guchar *)part, strlen(part) + 1);
+  g_free(part);
+
+  part = fmt_dot_file_fingerprint(work_dir, NULL);
+  g_checksum_update(sum, (const guchar *)part, strlen(part) + 1);
+  g_free(part);
+
+  for (unsigned int i = 0; argv[i]; i++)
+    g_checksum_update(sum, (const guchar *)argv[i], strlen(argv[i]) + 1);
+  g_checksum_update(sum, input->data, input->len);
+
+  key = g_strdup(g_checksum_get_string(sum));
+  g_checksum_free(sum);
+  return key;
+}
+
+//======================================================================
+//
+// Result cache
+//
+
+static void cache_entry_free(CacheEntry *entry)
+{
+  g_free(entry->key);
+  g_free(entry->out);
+  g_free(entry);
+}
+
+// Returns a copy of the remembered output, if any
+static char *cache_lookup(const char *key, size_t *out_len, guint32 *status)
+{
+  CacheEntry *entry;
+  char *out = NULL;
+
+  g_mutex_lock(&cache_lock);
+  entry = g_hash_table_lookup(cache, key);
+  if (entry)
+  {
+    g_queue_unlink(&cache_lru, entry->link);
+    g_queue_push_head_link(&cache_lru, entry->link);
+    out = g_malloc(entry->out_len + 1);
+    memcpy(out, entry->out, entry->out_len + 1);
+    *out_len = entry->out_len;
+    *status = entry->status;
+  }
+  g_mutex_unlock(&cache_lock);
+
+  return out;
+}
+
+static void cache_store(const char *key, const char *out, size_t out_len,
+                        guint32 status)
+{
+  CacheEntry *entry;
+
+  if (out_len > CACHE_LIMIT / 4)
+    return;
+
+  entry = g_new0(CacheEntry, 1);
+  entry->key = g_strdup(key);
+  entry->out = g_malloc(out_len + 1);
+  memcpy(entry->out, out, out_len);
+  entry->out[out_len] = '\0';
+  entry->out_len = out_len;
+  entry->status = status;
+
+  g_mutex_lock(&cache_lock);
+  g_hash_table_remove(cache, key);
+  g_queue_push_head(&cache_lru, entry);
+  entry->link = cache_lru.head;
+  g_hash_table_insert(cache, entry->key, entry);
+  cache_bytes += out_len;
+  while (cache_bytes > CACHE_LIMIT && cache_lru.tail)
+  {
+    CacheEntry *old = cache_lru.tail->data;
+    g_hash_table_remove(cache, old->key);
+  }
+  g_mutex_unlock(&cache_lock);
+}
+
+// Called with cache_lock held, by g_hash_table_remove()
+static void cache_entry_remove(CacheEntry *entry)
+{
+  g_queue_delete_link(&cache_lru, entry->link);
+  cache_bytes -= entry->out_len;
+  cache_entry_free(entry);
+}
+
+//======================================================================
+//
+// Running commands
+//
+
+// How a command is run, from the request's flags
+typedef struct
+{
+  bool low_priority;
+  guint64 memory_limit; // in bytes, 0 for none
+} Limits;
+
+static void setup_child(gpointer user_data)
+{
+  const Limits *limits = user_data;
+
+  // Runs in the child between fork() and exec()
+  if (limits->memory_limit > 0)
+  {
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_AS, &limit) == 0 &&
+        (limit.rlim_max == RLIM_INFINITY ||
+         limit.rlim_max > limits->memory_limit))
+    {
+      limit.rlim_cur = limit.rlim_max = limits->memory_limit;
+      setrlimit(RLIMIT_AS, &limit);
+    }
+  }
+
+  if (!limits->low_priority)
+    return;
+  if (setpriority(PRIO_PROCESS, 0, LOW_PRIORITY_NICE) != 0)
+    errno = 0;
+#if defined(__linux__) && defined(SYS_ioprio_set)
+  {
+    // IOPRIO_WHO_PROCESS, IOPRIO_CLASS_IDLE
+    const int who_process = 1, class_idle = 3, class_shift = 13;
+    syscall(SYS_ioprio_set, who_process, 0, class_idle << class_shift);
+  }
+#endif
+}
+
+// Runs @a argv with @a input, giving up when the client hangs up.
+// Returns @c false if it couldn't be run or was given up on.
+static bool run_command(int client_fd, const char *work_dir, char **argv,
+                        const Limits *limits, const GByteArray *input,
+                        GString *out, guint32 *status)
+{
+  GPid pid;
+  int fd_in = -1, fd_out = -1, wstatus = 0;
+  size_t in_off = 0;
+  bool hung_up = false;
+  GError *error = NULL;
+
+  if (!g_spawn_async_with_pipes(work_dir, argv, NULL,
+                                G_SPAWN_SEARCH_PATH |
+                                    G_SPAWN_DO_NOT_REAP_CHILD |
+                                    G_SPAWN_STDERR_TO_DEV_NULL,
+                                setup_child, (gpointer)limits, &pid, &fd_in,
+                                &fd_out, NULL, &error))
+  {
+    g_message("Failed to run %s: %s", argv[0], error->message);
+    g_error_free(error);
+    return false;
+  }
+
+  fcntl(fd_in, F_SETFL, fcntl(fd_in, F_GETFL) | O_NONBLOCK);
+  if (input->len == 0)
+  {
+    close(fd_in);
+    fd_in = -1;
+  }
+
+  while (fd_out >= 0)
+  {
+    struct pollfd fds[3];
+    char buf[IO_BUF_SIZE];
+    nfds_t n = 0;
+
+    fds[n].fd = fd_out;
+    fds[n++].events = POLLIN;
+    fds[n].fd = client_fd;
+    fds[n++].events = 0; // only hang-ups
+    if (fd_in >= 0)
+    {
+      fds[n].fd = fd_in;
+      fds[n++].events = POLLOUT;
+    }
+
+    if (poll(fds, n, -1) < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      break;
+    }
+
+    if (fds[1].revents & (POLLHUP | POLLERR))
+    {
+      hung_up = true;
+      break;
+    }
+
+    if (fd_in >= 0 && fds[2].revents)
+    {
+      ssize_t w = write(fd_in, input->data + in_off,
+                        MIN(input->len - in_off, IO_BUF_SIZE));
+      if (w > 0)
+        in_off += w;
+      if ((w < 0 && errno != EAGAIN && errno != EINTR) ||
+          in_off == input->len)
+      {
+        close(fd_in);
+        fd_in = -1;
+      }
+    }
+
+    if (fds[0].revents)
+    {
+      ssize_t r = read(fd_out, buf, sizeof(buf));
+      if (r > 0)
+        g_string_append_len(out, buf, r);
+      else if (r == 0 || errno != EINTR)
+      {
+        close(fd_out);
+        fd_out = -1;
+      }
+    }
+  }
+
+  if (fd_in >= 0)
+    close(fd_in);
+  if (fd_out >= 0)
+    close(fd_out);
+  if (hung_up)
+    kill(pid, SIGKILL);
+  while (waitpid(pid, &wstatus, 0) < 0 && errno == EINTR)
+    ;
+  g_spawn_close_pid(pid);
+
+  *status = (guint32)wstatus;
+  return !hung_up;
+}
+
+//======================================================================
+//
+// Serving clients
+//
+
+static bool peer_is_same_user(int fd)
+{
+#if defined(SO_PEERCRED)
+  struct ucred cred;
+  socklen_t len = sizeof(cred);
+  if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) != 0)
+    return false;
+  return cred.uid == getuid();
+#elif defined(__APPLE__) || defined(__FreeBSD__) || defined(__OpenBSD__) || \
+    defined(__NetBSD__)
+  uid_t uid;
+  gid_t gid;
+  return getpeereid(fd, &uid, &gid) == 0 && uid == getuid();
+#else
+  // Only reachable through the private runtime directory anyway
+  return true;
+#endif
+}
+
+static GByteArray *read_input(int fd)
+{
+  GByteArray *input = g_byte_array_new();
+  guint8 buf[IO_BUF_SIZE];
+
+  for (;;)
+  {
+    ssize_t n = read(fd, buf, sizeof(buf));
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0 || input->len + n > FMT_PROTOCOL_MAX_INPUT)
+    {
+      g_byte_array_free(input, true);
+      return NULL;
+    }
+    if (n == 0)
+      return input;
+    g_byte_array_append(input, buf, n);
+  }
+}
+
+static void serve_request(int fd)
+{
+  char magic[FMT_PROTOCOL_MAGIC_LEN];
+  guint32 flags, limit_mb = 0, argc, status = 0;
+  Limits limits;
+  char *work_dir = NULL, *key = NULL, *cached;
+  char **argv = NULL;
+  GByteArray *input = NULL;
+  GString *out = NULL;
+  size_t out_len = 0;
+  bool ok;
+
+  if (!read_all(fd, magic, sizeof(magic)) ||
+      memcmp(magic, FMT_PROTOCOL_MAGIC, sizeof(magic)) != 0 ||
+      !read_u32(fd, &flags) ||
+      ((flags & FMT_PROTOCOL_FLAG_MEMORY_LIMIT) && !read_u32(fd, &limit_mb)) ||
+      !read_u32(fd, &argc) || argc == 0 || argc > FMT_PROTOCOL_MAX_ARGS ||
+      !(work_dir = read_string(fd)))
+    goto out;
+  limits.low_priority = flags & FMT_PROTOCOL_FLAG_LOW_PRIORITY;
+  limits.memory_limit = (guint64)limit_mb << 20;
+
+  argv = g_new0(char *, argc + 1);
+  for (guint32 i = 0; i < argc; i++)
+  {
+    if (!(argv[i] = read_string(fd)))
+      goto out;
+  }
+
+  input = read_input(fd);
+  if (!input)
+    goto out;
+
+  key = request_key(work_dir, argv, input);
+  cached = key ? cache_lookup(key, &out_len, &status) : NULL;
+  if (cached)
+  {
+    out = g_string_new_len(cached, out_len);
+    g_free(cached);
+  }
+  else
+  {
+    out = g_string_new(NULL);
+    if (!run_command(fd, work_dir, argv, &limits, input, out, &status))
+      goto out;
+    // Failures may depend on things outside the key
+    if (key && WIFEXITED(status) && WEXITSTATUS(status) == 0)
+      cache_store(key, out->str, out->len, status);
+  }
+
+  status = GUINT32_TO_BE(status);
+  ok = write_all(fd, FMT_PROTOCOL_MAGIC, FMT_PROTOCOL_MAGIC_LEN) &&
+       write_all(fd, &status, sizeof(status)) &&
+       write_all(fd, out->str, out->len);
+  if (!ok)
+    g_message("Client went away before the response was sent");
+
+out:
+  if (out)
+    g_string_free(out, true);
+  if (input)
+    g_byte_array_free(input, true);
+  g_strfreev(argv);
+  g_free(work_dir);
+  g_free(key);
+}
+
+static gpointer worker_thread(gpointer data)
+{
+  int fd = GPOINTER_TO_INT(data);
+  struct timeval timeout = { REQUEST_TIMEOUT, 0 };
+
+  // A stuck client mustn't hold on to a worker
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+  if (peer_is_same_user(fd))
+    serve_request(fd);
+  close(fd);
+
+  g_mutex_lock(&worker_lock);
+  n_workers--;
+  last_activity = g_get_monotonic_time();
+  g_cond_signal(&worker_cond);
+  g_mutex_unlock(&worker_lock);
+
+  return NULL;
+}
+
+static void on_quit_signal(G_GNUC_UNUSED int sig)
+{
+  quit_requested = 1;
+}
+
+static int listen_socket(const char *path)
+{
+  struct sockaddr_un addr;
+  mode_t old_mask;
+  int fd;
+
+  if (strlen(path) >= sizeof(addr.sun_path))
+  {
+    g_printerr("Socket path too long: %s\n", path);
+    return -1;
+  }
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, path);
+
+  fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0)
+    return -1;
+  fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+  // Left over by a service that didn't exit cleanly, the lock says
+  // nobody else is listening on it
+  unlink(path);
+
+  old_mask = umask(077);
+  if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+      listen(fd, 16) != 0)
+  {
+    g_printerr("Failed to listen on %s: %s\n", path, g_strerror(errno));
+    umask(old_mask);
+    close(fd);
+    return -1;
+  }
+  umask(old_mask);
+
+  return fd;
+}
+
+static int serve(const char *path, unsigned int idle_exit)
+{
+  struct sigaction sa;
+  char *lock_path;
+  int lock_fd, listen_fd;
+
+  // Only one service per socket, the lock goes away with the process
+  lock_path = g_strconcat(path, ".lock", NULL);
+  lock_fd = open(lock_path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+  g_free(lock_path);
+  if (lock_fd < 0 || flock(lock_fd, LOCK_EX | LOCK_NB) != 0)
+    return 0;
+
+  listen_fd = listen_socket(path);
+  if (listen_fd < 0)
+    return 1;
+
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = on_quit_signal;
+  sigaction(SIGTERM, &sa, NULL);
+  sigaction(SIGINT, &sa, NULL);
+  signal(SIGPIPE, SIG_IGN);
+
+  cache = g_hash_table_new_full(g_str_hash, g_str_equal, NULL,
+                                (GDestroyNotify)cache_entry_remove);
+  last_activity = g_get_monotonic_time();
+
+  while (!quit_requested)
+  {
+    struct pollfd pfd = { listen_fd, POLLIN, 0 };
+    bool idle;
+    int fd;
+
+    g_mutex_lock(&worker_lock);
+    while (n_workers >= MAX_WORKERS)
+      g_cond_wait(&worker_cond, &worker_lock);
+    idle = n_workers == 0 &&
+           g_get_monotonic_time() - last_activity >
+               (gint64)idle_exit * G_USEC_PER_SEC;
+    g_mutex_unlock(&worker_lock);
+
+    if (idle)
+      break;
+
+    if (poll(&pfd, 1, 1000) <= 0)
+      continue;
+
+    fd = accept(listen_fd, NULL, NULL);
+    if (fd < 0)
+      continue;
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+    g_mutex_lock(&worker_lock);
+    n_workers++;
+    last_activity = g_get_monotonic_time();
+    g_mutex_unlock(&worker_lock);
+
+    g_thread_unref(
+        g_thread_new("code-format-worker", worker_thread,
+                     GINT_TO_POINTER(fd)));
+  }
+
+  // Stop accepting before giving up the lock, workers still running
+  // are cut short by exiting
+  unlink(path);
+  close(listen_fd);
+  close(lock_fd);
+
+  return 0;
+}
+
+//======================================================================
+//
+// Client mode
+//
+
+static void start_self(const char *self, const char *path)
+{
+  pid_t pid = fork();
+
+  if (pid == 0)
+  {
+    // Double fork so the service isn't our child
+    if (fork() == 0)
+    {
+      int null_fd = open("/dev/null", O_RDWR);
+      setsid();
+      if (null_fd >= 0)
+      {
+        dup2(null_fd, STDIN_FILENO);
+        dup2(null_fd, STDOUT_FILENO);
+        dup2(null_fd, STDERR_FILENO);
+      }
+      execlp(self, self, "--socket", path, (char *)NULL);
+      _exit(127);
+    }
+    _exit(0);
+  }
+  else if (pid > 0)
+    waitpid(pid, NULL, 0);
+}
+
+static int run_client(const char *self, const char *path, char **argv,
+                      bool low_priority)
+{
+  GByteArray *req;
+  GByteArray *input;
+  char *cwd;
+  char header[FMT_PROTOCOL_MAGIC_LEN + sizeof(guint32)];
+  char buf[IO_BUF_SIZE];
+  guint32 status;
+  ssize_t n;
+  int fd, argc;
+
+  fd = connect_socket(path);
+  if (fd < 0)
+  {
+    start_self(self, path);
+    for (int waited = 0; fd < 0 && waited < START_TIMEOUT_MS; waited += 20)
+    {
+      g_usleep(20 * 1000);
+      fd = connect_socket(path);
+    }
+  }
+  if (fd < 0)
+  {
+    // Better slow than not at all
+    execvp(argv[0], argv);
+    g_printerr("Failed to run %s: %s\n", argv[0], g_strerror(errno));
+    return 127;
+  }
+
+  input = read_input(STDIN_FILENO);
+  if (!input)
+  {
+    g_printerr("Failed to read standard input\n");
+    return 1;
+  }
+
+  for (argc = 0; argv[argc]; argc++)
+    ;
+  cwd = g_get_current_dir();
+  req = g_byte_array_new();
+  g_byte_array_append(req, (const guint8 *)FMT_PROTOCOL_MAGIC,
+                      FMT_PROTOCOL_MAGIC_LEN);
+  append_u32(req, low_priority ? FMT_PROTOCOL_FLAG_LOW_PRIORITY : 0);
+  append_u32(req, argc);
+  append_string(req, cwd);
+  for (int i = 0; i < argc; i++)
+    append_string(req, argv[i]);
+  g_byte_array_append(req, input->data, input->len);
+  g_free(cwd);
+  g_byte_array_free(input, true);
+
+  signal(SIGPIPE, SIG_IGN);
+  if (!write_all(fd, req->data, req->len) || shutdown(fd, SHUT_WR) != 0 ||
+      !read_all(fd, header, sizeof(header)) ||
+      memcmp(header, FMT_PROTOCOL_MAGIC, FMT_PROTOCOL_MAGIC_LEN) != 0)
+  {
+    g_printerr("The formatting service failed to run %s\n", argv[0]);
+    g_byte_array_free(req, true);
+    return 127;
+  }
+  g_byte_array_free(req, true);
+
+  while ((n = read(fd, buf, sizeof(buf))) != 0)
+  {
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0 || !write_all(STDOUT_FILENO, buf, n))
+      return 1;
+  }
+  close(fd);
+
+  memcpy(&status, header + FMT_PROTOCOL_MAGIC_LEN, sizeof(status));
+  status = GUINT32_FROM_BE(status);
+  if (WIFEXITED(status))
+    return WEXITSTATUS(status);
+  return 128 + WTERMSIG(status);
+}
+
+static void usage(const char *self)
+{
+  g_printerr("Usage: %s [--socket PATH] [--idle-exit SECONDS]\n"
+             "       %s [--socket PATH] --run [--low-priority] -- "
+             "COMMAND [ARG...]\n",
+             self, self);
+}
+
+int main(int argc, char **argv)
+{
+  char *path = NULL;
+  unsigned int idle_exit = DEFAULT_IDLE_EXIT;
+  bool client = false, low_priority = false;
+  int i, ret;
+
+  for (i = 1; i < argc; i++)
+  {
+    if (strcmp(argv[i], "--socket") == 0 && i + 1 < argc)
+      path = g_strdup(argv[++i]);
+    else if (strcmp(argv[i], "--idle-exit") == 0 && i + 1 < argc)
+      idle_exit = strtoul(argv[++i], NULL, 10);
+    else if (strcmp(argv[i], "--run") == 0)
+      client = true;
+    else if (strcmp(argv[i], "--low-priority") == 0)
+      low_priority = true;
+    else if (strcmp(argv[i], "--") == 0)
+    {
+      i++;
+      break;
+    }
+    else
+    {
+      usage(argv[0]);
+      return 2;
+    }
+  }
+
+  if (!path)
+  {
+    path = g_build_filename(g_get_user_runtime_dir(),
+                            FMT_PROTOCOL_SOCKET_NAME, NULL);
+  }
+
+  if (client)
+  {
+    if (i >= argc)
+    {
+      usage(argv[0]);
+      return 2;
+    }
+    ret = run_client(argv[0], path, argv + i, low_priority);
+  }
+  else
+    ret = serve(path, idle_exit);
+
+  g_free(path);
+  return ret;
+}
@@ -0,0 +1,405 @@
+/*
+ * diff.c
+ *
+ * Copyright 2013 Matthew <mbrush@codebrainz.ca>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "diff.h"
+#include "process.h"
+#include "verify.h"
+
+// Beyond this many edits the diff gives up and treats everything
+// between the common prefix and suffix as changed
+#define MAX_EDITS 1000
+
+typedef struct
+{
+  const char *str;
+  size_t len;
+  unsigned int hash;
+} Line;
+
+// Splits text into lines, each including its line ending
+static GArray *split_lines(const char *text, size_t len)
+{
+  GArray *lines = g_array_new(false, false, sizeof(Line));
+  size_t start = 0;
+
+  for (size_t i = 0; i < len; i++)
+  {
+    bool eol = text[i] == '\n' ||
+               (text[i] == '\r' && (i + 1 >= len || text[i + 1] != '\n'));
+    if (eol || i + 1 == len)
+    {
+      Line line = { text + start, i + 1 - start, 5381 };
+      for (size_t j = 0; j < line.len; j++)
+        line.hash = line.hash * 33 + (unsigned char)line.str[j];
+      g_array_append_val(lines, line);
+      start = i + 1;
+    }
+  }
+
+  return lines;
+}
+
+static inline bool lines_equal(const Line *a, const Line *b)
+{
+  return a->hash == b->hash && a->len == b->len &&
+         memcmp(a->str, b->str, a->len) == 0;
+}
+
+// Marks a deletion at line @a y of the new text
+static void mark_deletion(guint8 *changed, size_t n_new, size_t y)
+{
+  if (n_new == 0)
+    return;
+  changed[MIN(y, n_new - 1)] = 1;
+}
+
+// Myers' O(ND) diff over a[0..n) and b[0..m), marking the lines of b
+// which were inserted or border a deletion. Returns false if more than
+// MAX_EDITS edits are needed.
+static bool myers_mark(const Line *a, size_t n, const Line *b, size_t m,
+                       guint8 *changed, size_t n_new, size_t b_base)
+{
+  gssize max_d = MIN((gssize)(n + m), MAX_EDITS);
+  gssize off = max_d + 1;
+  gssize *v = g_new0(gssize, 2 * max_d + 3);
+  GPtrArray *trace = g_ptr_array_new_with_free_func(g_free);
+  gssize d, x = 0, y = 0;
+  bool found = false;
+
+  for (d = 0; d <= max_d && !found; d++)
+  {
+    // Keep the part of v this round reads from, for backtracking
+    gssize *saved = g_new(gssize, 2 * d + 3);
+    memcpy(saved, v + off - d - 1, (2 * d + 3) * sizeof(gssize));
+    g_ptr_array_add(trace, saved);
+
+    for (gssize k = -d; k <= d; k += 2)
+    {
+      if (k == -d || (k != d && v[off + k - 1] < v[off + k + 1]))
+        x = v[off + k + 1];
+      else
+        x = v[off + k - 1] + 1;
+      y = x - k;
+      while (x < (gssize)n && y < (gssize)m && lines_equal(&a[x], &b[y]))
+      {
+        x++;
+        y++;
+      }
+      v[off + k] = x;
+      if (x >= (gssize)n && y >= (gssize)m)
+      {
+        found = true;
+        break;
+      }
+    }
+  }
+
+  g_free(v);
+
+  if (!found)
+  {
+    g_ptr_array_free(trace, true);
+    return false;
+  }
+
+  x = n;
+  y = m;
+  for (d = trace->len - 1; d > 0; d--)
+  {
+    gssize *vd = (gssize *)trace->pdata[d] + d + 1; // index by k
+    gssize k = x - y, prev_k, prev_x, prev_y;
+
+    if (k == -d || (k != d && vd[k - 1] < vd[k + 1]))
+      prev_k = k + 1;
+    else
+      prev_k = k - 1;
+    prev_x = vd[prev_k];
+    prev_y = prev_x - prev_k;
+
+    while (x > prev_x && y > prev_y)
+    {
+      x--;
+      y--;
+    }
+
+    if (x == prev_x) // b[prev_y] was inserted
+      changed[b_base + prev_y] = 1;
+    else // a[prev_x] was deleted
+      mark_deletion(changed, n_new, b_base + prev_y);
+
+    x = prev_x;
+    y = prev_y;
+  }
+
+  g_ptr_array_free(trace, true);
+  return true;
+}
+
+GArray *fmt_diff_changed_lines(const char *old_text, size_t old_len,
+                               const char *new_text, size_t new_len)
+{
+  GArray *a, *b, *ranges;
+  const Line *la, *lb;
+  size_t n, m, prefix = 0, suffix = 0;
+  guint8 *changed;
+
+  a = split_lines(old_text, old_len);
+  b = split_lines(new_text, new_len);
+  la = (const Line *)a->data;
+  lb = (const Line *)b->data;
+  n = a->len;
+  m = b->len;
+
+  // Most saves touch a few lines, trim what's obviously unchanged
+  while (prefix < n && prefix < m && lines_equal(&la[prefix], &lb[prefix]))
+    prefix++;
+  while (suffix < n - prefix && suffix < m - prefix &&
+         lines_equal(&la[n - suffix - 1], &lb[m - suffix - 1]))
+  {
+    suffix++;
+  }
+
+  changed = g_new0(guint8, m + 1);
+
+  if (n - prefix - suffix == 0)
+  {
+    for (size_t i = prefix; i < m - suffix; i++)
+      changed[i] = 1;
+  }
+  else if (m - prefix - suffix == 0)
+    mark_deletion(changed, m, prefix);
+  else if (!myers_mark(la + prefix, n - prefix - suffix, lb + prefix,
+                       m - prefix - suffix, changed, m, prefix))
+  {
+    for (size_t i = prefix; i < m - suffix; i++)
+      changed[i] = 1;
+  }
+
+  ranges = g_array_new(false, false, sizeof(FmtLineRange));
+  for (size_t i = 0; i < m; i++)
+  {
+    if (!changed[i])
+      continue;
+    if (ranges->len > 0 &&
+        g_array_index(ranges, FmtLineRange, ranges->len - 1).last == i)
+    {
+      g_array_index(ranges, FmtLineRange, ranges->len - 1).last = i + 1;
+    }
+    else
+    {
+      FmtLineRange range = { i + 1, i + 1 };
+      g_array_append_val(ranges, range);
+    }
+  }
+
+  g_free(changed);
+  g_array_free(a, true);
+  g_array_free(b, true);
+
+  return ranges;
+}
+
+typedef struct
+{
+  GArray *repls;
+  const char *old_text, *new_text;
+} SpaceEdits;
+
+// Replaces the part of a run of whitespace that changed
+static void add_space_edit(size_t old_pos, size_t old_len, size_t new_pos,
+                           size_t new_len, gpointer user_data)
+{
+  SpaceEdits *edits = user_data;
+  FmtReplacement repl;
+
+  // Re-indenting changes the end of a run, keep what's the same
+  while (old_len > 0 && new_len > 0 &&
+         edits->old_text[old_pos] == edits->new_text[new_pos])
+  {
+    old_pos++;
+    new_pos++;
+    old_len--;
+    new_len--;
+  }
+  while (old_len > 0 && new_len > 0 &&
+         edits->old_text[old_pos + old_len - 1] ==
+             edits->new_text[new_pos + new_len - 1])
+  {
+    old_len--;
+    new_len--;
+  }
+
+  repl.offset = old_pos;
+  repl.length = old_len;
+  repl.text = g_strndup(edits->new_text + new_pos, new_len);
+  g_array_append_val(edits->repls, repl);
+}
+
+GArray *fmt_diff_whitespace(const char *old_text, size_t old_len,
+                            const char *new_text, size_t new_len)
+{
+  SpaceEdits edits = { fmt_replacements_new(), old_text, new_text };
+
+  if (!fmt_verify_whitespace(old_text, old_len, new_text, new_len,
+                             add_space_edit, &edits))
+  {
+    g_array_free(edits.repls, true);
+    return NULL;
+  }
+
+  return edits.repls;
+}
+
+// Finds the top of the git work tree containing @a dir, if any
+static char *find_git_work_tree(const char *dir)
+{
+  char *cur = g_strdup(dir);
+
+  while (true)
+  {
+    char *dot_git = g_build_filename(cur, ".git", NULL);
+    bool found = g_file_test(dot_git, G_FILE_TEST_EXISTS);
+    char *parent;
+
+    g_free(dot_git);
+    if (found)
+      return cur;
+
+    parent = g_path_get_dirname(cur);
+    if (g_strcmp0(parent, cur) == 0)
+    {
+      g_free(parent);
+      g_free(cur);
+      return NULL;
+    }
+    g_free(cur);
+    cur = parent;
+  }
+}
+
+// Looked up once, spawning a missing program would warn on every save
+static bool have_git(void)
+{
+  static int found = -1;
+
+  if (found < 0)
+  {
+    char *path = g_find_program_in_path("git");
+    found = path != NULL;
+    g_free(path);
+  }
+  return found;
+}
+
+// Reads the HEAD version of a file with "git cat-file --batch", which
+// reports missing objects on stdout rather than through its exit code.
+static GString *read_git_head(const char *work_tree, const char *rel_path)
+{
+  static const char *const argv[] = { "git", "cat-file", "--batch", NULL };
+  FmtProcess *proc;
+  GString *out, *contents = NULL;
+  char *request, *nl, *space;
+  size_t size;
+
+  proc = fmt_process_open(work_tree, argv);
+  if (!proc)
+    return NULL;
+
+  request = g_strdup_printf("HEAD:%s\n", rel_path);
+  out = g_string_new(NULL);
+  if (!fmt_process_run(proc, request, strlen(request), out))
+  {
+    g_string_free(out, true);
+    out = NULL;
+  }
+  fmt_process_close(proc);
+  g_free(request);
+
+  if (!out)
+    return NULL;
+
+  // Sample: <sha1> blob <size>\n<contents>\n
+  nl = memchr(out->str, '\n', out->len);
+  if (nl)
+  {
+    *nl = '\0';
+    space = strrchr(out->str, ' ');
+    if (space && strstr(out->str, " blob "))
+    {
+      size = strtoul(space + 1, NULL, 10);
+      if (size <= out->len - (nl + 1 - out->str))
+        contents = g_string_new_len(nl + 1, size);
+    }
+  }
+
+  g_string_free(out, true);
+  return contents;
+}
+
+GString *fmt_diff_read_baseline(const char *locale_path)
+{
+  char *dir, *work_tree, *contents = NULL;
+  gsize len = 0;
+  GString *str;
+
+  dir = g_path_get_dirname(locale_path);
+  work_tree = find_git_work_tree(dir);
+  g_free(dir);
+
+  // Without git, edits to a tracked file can't be told apart from the
+  // committed text, so the whole document is formatted
+  if (work_tree && !have_git())
+  {
+    g_free(work_tree);
+    return NULL;
+  }
+
+  if (work_tree)
+  {
+    size_t wt_len = strlen(work_tree);
+    GString *head = NULL;
+    if (strncmp(locale_path, work_tree, wt_len) == 0 &&
+        G_IS_DIR_SEPARATOR(locale_path[wt_len]))
+    {
+      char *rel_path = g_strdup(locale_path + wt_len + 1);
+#ifdef G_OS_WIN32
+      g_strdelimit(rel_path, "\\", '/');
+#endif
+      head = read_git_head(work_tree, rel_path);
+      g_free(rel_path);
+    }
+    g_free(work_tree);
+    if (head)
+      return head;
+  }
+
+  // Untracked or not in a repository, compare against the saved file
+  if (!g_file_get_contents(locale_path, &contents, &len, NULL))
+    return NULL;
+
+  str = g_string_new_len(contents, len);
+  g_free(contents);
+  return str;
+}
@@ -0,0 +1,66 @@
+/*
+ * diff.h
+ *
+ * Copyright 2013 Matthew <mbrush@codebrainz.ca>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+
+#ifndef FMT_DIFF_H
+#define FMT_DIFF_H
+
+#include "format.h"
+
+G_BEGIN_DECLS
+
+/**
+ * Finds the lines of @a new_text which were added or modified
+ * compared to @a old_text, using a line based diff. Lines next to
+ * deleted text are included so the join gets formatted too.
+ *
+ * @return A new array of FmtLineRange (1-based lines of @a new_text),
+ * empty when the texts have the same lines.
+ */
+GArray *fmt_diff_changed_lines(const char *old_text, size_t old_len,
+                               const char *new_text, size_t new_len);
+
+/**
+ * Turns formatted text back into the edits that produce it, assuming
+ * formatting only changed whitespace between tokens. Both texts are
+ * walked side by side once by fmt_verify_whitespace(), with each
+ * differing run of whitespace becoming a replacement.
+ *
+ * @return A new array of FmtReplacement (offsets in @a old_text),
+ * empty when the texts are the same, or @c NULL when they differ in
+ * anything besides whitespace between tokens.
+ */
+GArray *fmt_diff_whitespace(const char *old_text, size_t old_len,
+                            const char *new_text, size_t new_len);
+
+/**
+ * Reads the version of a file that edits are compared against: the
+ * contents at git's @c HEAD when the file is tracked in a repository,
+ * otherwise the contents on disk.
+ *
+ * @param locale_path The file's path in the locale encoding.
+ * @return The contents or @c NULL if there's no previous version, or
+ * the file is in a repository but @c git can't be found.
+ */
+GString *fmt_diff_read_baseline(const char *locale_path);
+
+G_END_DECLS
+
+#endif // FMT_DIFF_H
@@ -0,0 +1,112 @@
+/*
+ * docstate.c
+ *
+ * Copyright 2013 Matthew <mbrush@codebrainz.ca>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "docstate.h"
+
+// Edits kept per document, older ones are dropped in bulk
+#define MAX_EDIT_LOG 1024
+
+// GeanyDocument* -> FmtDocState*
+static GHashTable *doc_states = NULL;
+
+static void doc_state_free(FmtDocState *state)
+{
+  g_free(state->clean_hash);
+  g_free(state->config_key);
+  if (state->edits)
+    g_array_free(state->edits, true);
+  if (state->spec_repls)
+    g_array_free(state->spec_repls, true);
+  g_free(state->spec_config);
+  g_free(state);
+}
+
+void fmt_doc_state_init(void)
+{
+  if (doc_states)
+    return;
+  doc_states = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL,
+                                     (GDestroyNotify)doc_state_free);
+}
+
+void fmt_doc_state_deinit(void)
+{
+  if (doc_states)
+  {
+    g_hash_table_destroy(doc_states);
+    doc_states = NULL;
+  }
+}
+
+FmtDocState *fmt_doc_state_get(GeanyDocument *doc)
+{
+  FmtDocState *state;
+
+  g_return_val_if_fail(doc_states, NULL);
+  g_return_val_if_fail(DOC_VALID(doc), NULL);
+
+  state = g_hash_table_lookup(doc_states, doc);
+  if (!state)
+  {
+    state = g_new0(FmtDocState, 1);
+    state->doc = doc;
+    g_hash_table_insert(doc_states, doc, state);
+  }
+
+  return state;
+}
+
+FmtDocState *fmt_doc_state_lookup(GeanyDocument *doc)
+{
+  if (!doc_states || !doc)
+    return NULL;
+  return g_hash_table_lookup(doc_states, doc);
+}
+
+void fmt_doc_state_remove(GeanyDocument *doc)
+{
+  if (doc_states && doc)
+    g_hash_table_remove(doc_states, doc);
+}
+
+void fmt_doc_state_record_edit(FmtDocState *state, size_t pos,
+                               size_t deleted, size_t inserted)
+{
+  FmtEdit edit;
+
+  state->version++;
+  state->edit_volume += deleted + inserted;
+
+  if (!state->edits)
+    state->edits = g_array_new(false, false, sizeof(FmtEdit));
+  if (state->edits->len >= 2 * MAX_EDIT_LOG)
+    g_array_remove_range(state->edits, 0, MAX_EDIT_LOG);
+
+  edit.version = state->version;
+  edit.pos = pos;
+  edit.deleted = deleted;
+  edit.inserted = inserted;
+  g_array_append_val(state->edits, edit);
+}
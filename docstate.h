@@ -0,0 +1,138 @@
+/*
+ * docstate.h
+ *
+ * Copyright 2013 Matthew <mbrush@codebrainz.ca>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+
+#ifndef FMT_DOCSTATE_H
+#define FMT_DOCSTATE_H
+
+#include "plugin.h"
+
+G_BEGIN_DECLS
+
+typedef enum
+{
+  FMT_CHECK_UNKNOWN = 0, // not checked since the last edit
+  FMT_CHECK_CLEAN,
+  FMT_CHECK_DIRTY,
+} FmtCheckStatus;
+
+/**
+ * How auto-formatting handles a document, escalated as it gets slower.
+ */
+typedef enum
+{
+  FMT_STRATEGY_DOCUMENT = 0, // re-format the whole document
+  FMT_STRATEGY_REGION,       // re-format only around the trigger
+  FMT_STRATEGY_DEFERRED,     // re-format once typing pauses
+  FMT_STRATEGY_COUNT
+} FmtStrategy;
+
+/**
+ * A single insertion or deletion, with positions in the text as it
+ * was before the edit.
+ */
+typedef struct
+{
+  unsigned long version; // the document version the edit produced
+  size_t pos;
+  size_t deleted;
+  size_t inserted;
+} FmtEdit;
+
+/**
+ * Counts formatting failures in a row, to stop running clang-format
+ * over and over while it can't succeed.
+ */
+typedef struct
+{
+  unsigned int failures;
+  unsigned int n_opened; // times it opened since the last success
+  gint64 retry_at;       // monotonic time of the next attempt, 0 if closed
+  size_t retry_volume;   // or once the edit volume reaches this
+} FmtBreaker;
+
+/**
+ * Per-document bookkeeping kept by the plugin.
+ *
+ * States live from the first time a document is seen until the
+ * document is closed.
+ */
+typedef struct FmtDocState
+{
+  GeanyDocument *doc;
+  // Bumped on every insertion or deletion, used to spot stale results
+  unsigned long version;
+  // The most recent edits, oldest first, for rebasing stale results
+  GArray *edits;
+  // Bytes inserted and deleted so far
+  size_t edit_volume;
+
+  FmtCheckStatus check_status;
+  // Hash of text and configuration that last passed the check
+  char *clean_hash;
+
+  // Moving averages of formatting latency in milliseconds, per strategy
+  double latency_ms[FMT_STRATEGY_COUNT];
+  unsigned int n_samples[FMT_STRATEGY_COUNT];
+  gint64 sampled_at[FMT_STRATEGY_COUNT]; // monotonic time of last update
+  char *config_key; // the configuration the latencies were measured with
+  bool scanned;      // whether it was checked for being pathological
+  bool pathological; // minified or generated, never auto-formatted
+
+  // Speculative formatting replacements, valid while the version
+  // still equals spec_version and the configuration spec_config
+  GArray *spec_repls;
+  unsigned long spec_version;
+  char *spec_config;
+  double spec_cost_ms; // how long producing them took
+  bool spec_running;
+
+  // Brackets left open at trigger_pos, valid while the text before it
+  // is the same as at trigger_version
+  unsigned long trigger_version;
+  size_t trigger_pos;
+  unsigned int trigger_depth;
+
+  // Monotonic time the document was last activated, 0 if never was
+  gint64 last_active;
+  // Session formatting put off until the document is shown or saved
+  bool format_pending;
+  // Formatting result still being applied in slices, if any
+  struct FmtApply *apply;
+  // Holds back auto-formatting while formatting keeps failing
+  FmtBreaker breaker;
+} FmtDocState;
+
+void fmt_doc_state_init(void);
+void fmt_doc_state_deinit(void);
+
+FmtDocState *fmt_doc_state_get(GeanyDocument *doc);
+FmtDocState *fmt_doc_state_lookup(GeanyDocument *doc);
+void fmt_doc_state_remove(GeanyDocument *doc);
+
+/**
+ * Bumps the version of @a state and adds the edit to its log.
+ */
+void fmt_doc_state_record_edit(FmtDocState *state, size_t pos,
+                               size_t deleted, size_t inserted);
+
+G_END_DECLS
+
+#endif // FMT_DOCSTATE_H
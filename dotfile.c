@@ -0,0 +1,881 @@
+/*
+ * dotfile.c
+ *
+ * Copyright 2013 Matthew <mbrush@codebrainz.ca>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "dotfile.h"
+
+#include <string.h>
+#include <sys/stat.h>
+
+#define INHERIT_PARENT "InheritParentConfig"
+
+// The options of one YAML document in a file
+typedef struct
+{
+  char *language;      // NULL for the document without a Language option
+  GHashTable *options; // option path -> canonical value
+} StyleDoc;
+
+typedef struct
+{
+  gint64 mtime, size;
+  GPtrArray *docs; // StyleDoc, NULL when the file couldn't be parsed
+  char *digest;    // of the contents, used when it couldn't
+  bool inherits;
+} DotFile;
+
+static GMutex cache_lock;
+static GHashTable *cache = NULL; // path -> DotFile
+
+static StyleDoc *style_doc_new(const char *language)
+{
+  StyleDoc *doc = g_new0(StyleDoc, 1);
+  doc->language = g_strdup(language);
+  doc->options = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                                       g_free);
+  return doc;
+}
+
+static void style_doc_free(StyleDoc *doc)
+{
+  g_free(doc->language);
+  g_hash_table_destroy(doc->options);
+  g_free(doc);
+}
+
+static void dot_file_free(DotFile *file)
+{
+  if (file->docs)
+    g_ptr_array_free(file->docs, true);
+  g_free(file->digest);
+  g_free(file);
+}
+
+//======================================================================
+//
+// YAML reader
+//
+// Handles the block mappings and sequences and the plain or quoted
+// scalars clang-format's own -dump-config output uses, as well as
+// single-line flow collections, and gives up on anything else (anchors,
+// tags, block scalars, ...).
+//
+
+typedef struct
+{
+  int indent;
+  char *path;
+  bool is_seq;
+  unsigned int count;
+} Block;
+
+typedef struct
+{
+  GPtrArray *docs;
+  StyleDoc *doc;
+  GArray *blocks; // Block, innermost last
+  char *pending;  // option whose value is on the following lines
+  int pending_indent;
+} Parser;
+
+static void block_clear(Block *block)
+{
+  g_free(block->path);
+}
+
+static void push_block(Parser *p, int indent, char *path, bool is_seq)
+{
+  Block block = { indent, path, is_seq, 0 };
+  g_array_append_val(p->blocks, block);
+}
+
+static Block *top_block(Parser *p)
+{
+  return &g_array_index(p->blocks, Block, p->blocks->len - 1);
+}
+
+static void set_option(Parser *p, const char *path, char *value)
+{
+  if (!p->doc)
+    p->doc = style_doc_new(NULL);
+
+  if (strcmp(path, "Language") == 0)
+  {
+    g_free(p->doc->language);
+    p->doc->language = value;
+  }
+  else
+    g_hash_table_replace(p->doc->options, g_strdup(path), value);
+}
+
+static void end_document(Parser *p)
+{
+  if (p->pending)
+  {
+    set_option(p, p->pending, g_strdup(""));
+    g_free(p->pending);
+    p->pending = NULL;
+  }
+
+  if (p->doc)
+    g_ptr_array_add(p->docs, p->doc);
+  p->doc = NULL;
+
+  g_array_set_size(p->blocks, 1);
+}
+
+// Removes a trailing comment and whitespace, in place
+static void strip_comment(char *text)
+{
+  char quote = '\0';
+
+  for (char *c = text; *c; c++)
+  {
+    if (quote)
+    {
+      if (*c == quote)
+        quote = '\0';
+      else if (*c == '\\' && quote == '"' && c[1])
+        c++;
+    }
+    else if (*c == '"' || *c == '\'')
+      quote = *c;
+    else if (*c == '#' && (c == text || g_ascii_isspace(c[-1])))
+    {
+      *c = '\0';
+      break;
+    }
+  }
+
+  g_strchomp(text);
+}
+
+// Offset of the ':' ending a mapping key in @a text, or -1
+static int find_key_end(const char *text)
+{
+  char quote = '\0';
+
+  for (const char *c = text; *c; c++)
+  {
+    if (quote)
+    {
+      if (*c == quote)
+        quote = '\0';
+      else if (*c == '\\' && quote == '"' && c[1])
+        c++;
+    }
+    else if ((*c == '"' || *c == '\'') && c == text)
+      quote = *c;
+    else if (*c == ':' && (c[1] == '\0' || c[1] == ' '))
+      return c - text;
+  }
+
+  return -1;
+}
+
+static char *parse_scalar(const char *text)
+{
+  size_t len = strlen(text);
+  GString *value;
+
+  if (len == 0)
+    return g_strdup("");
+
+  if (text[0] == '"' || text[0] == '\'')
+  {
+    char quote = text[0];
+    if (len < 2 || text[len - 1] != quote)
+      return NULL;
+    value = g_string_sized_new(len);
+    for (size_t i = 1; i < len - 1; i++)
+    {
+      if (quote == '\'' && text[i] == '\'' && text[i + 1] == '\'')
+        i++;
+      else if (quote == '"' && text[i] == '\\')
+      {
+        switch (text[++i])
+        {
+          case 'n':
+            g_string_append_c(value, '\n');
+            continue;
+          case 't':
+            g_string_append_c(value, '\t');
+            continue;
+          case '"':
+          case '\\':
+          case '/':
+            break;
+          default:
+            g_string_free(value, true);
+            return NULL;
+        }
+      }
+      g_string_append_c(value, text[i]);
+    }
+    return g_string_free(value, false);
+  }
+
+  // Anchors, aliases, tags, block scalars and nested collections
+  if (strchr("&*!|>[]{}%@`", text[0]))
+    return NULL;
+
+  if (g_ascii_strcasecmp(text, "true") == 0)
+    return g_strdup("true");
+  if (g_ascii_strcasecmp(text, "false") == 0)
+    return g_strdup("false");
+
+  return g_strdup(text);
+}
+
+static bool set_flow_item(Parser *p, const char *path, bool mapping,
+                          unsigned int index, char *item)
+{
+  char *value, *item_path;
+
+  if (mapping)
+  {
+    int key_end = find_key_end(item);
+    char *key;
+
+    if (key_end <= 0)
+      return false;
+    item[key_end] = '\0';
+    key = parse_scalar(g_strstrip(item));
+    value = parse_scalar(g_strstrip(item + key_end + 1));
+    if (!key || !value || *key == '\0')
+    {
+      g_free(key);
+      g_free(value);
+      return false;
+    }
+    item_path = g_strconcat(path, ".", key, NULL);
+    g_free(key);
+  }
+  else
+  {
+    value = parse_scalar(item);
+    if (!value)
+      return false;
+    item_path = g_strdup_printf("%s[%u]", path, index);
+  }
+
+  set_option(p, item_path, value);
+  g_free(item_path);
+
+  return true;
+}
+
+// Parses a flow sequence or mapping, like "[a, b]" or "{a: 1, b: 2}",
+// as long as they aren't nested
+static bool parse_flow(Parser *p, const char *path, char *text)
+{
+  bool mapping = text[0] == '{';
+  size_t len = strlen(text);
+  unsigned int count = 0;
+  char quote = '\0';
+  char *item;
+
+  if (text[len - 1] != (mapping ? '}' : ']'))
+    return false;
+  text[len - 1] = '\0';
+  item = text + 1;
+
+  for (char *c = item;; c++)
+  {
+    if (quote && *c)
+    {
+      if (*c == quote)
+        quote = '\0';
+      else if (*c == '\\' && quote == '"' && c[1])
+        c++;
+    }
+    else if (*c == '"' || *c == '\'')
+      quote = *c;
+    else if (*c && strchr("[]{}", *c))
+      return false;
+    else if (*c == ',' || *c == '\0')
+    {
+      bool last = *c == '\0';
+
+      *c = '\0';
+      g_strstrip(item);
+      if (*item == '\0' && last && count == 0)
+        break;
+      if (!set_flow_item(p, path, mapping, count++, item))
+        return false;
+      if (last)
+        break;
+      item = c + 1;
+    }
+  }
+
+  if (count == 0)
+    set_option(p, path, g_strdup(mapping ? "{}" : "[]"));
+
+  return true;
+}
+
+static bool parse_entry(Parser *p, int indent, char *text)
+{
+  Block *top = top_block(p);
+  int key_end = find_key_end(text);
+  char *key, *value, *path;
+  bool ok = true;
+
+  if (key_end <= 0)
+    return false;
+
+  text[key_end] = '\0';
+  key = parse_scalar(g_strstrip(text));
+  if (!key || *key == '\0')
+  {
+    g_free(key);
+    return false;
+  }
+
+  path = *top->path ? g_strconcat(top->path, ".", key, NULL) : g_strdup(key);
+  g_free(key);
+  value = g_strstrip(text + key_end + 1);
+
+  if (*value == '\0')
+  {
+    p->pending = path;
+    p->pending_indent = indent;
+    return true;
+  }
+
+  if (*value == '[' || *value == '{')
+    ok = parse_flow(p, path, value);
+  else
+  {
+    char *scalar = parse_scalar(value);
+    if (scalar)
+      set_option(p, path, scalar);
+    ok = scalar != NULL;
+  }
+
+  g_free(path);
+  return ok;
+}
+
+static bool is_sequence_item(const char *text)
+{
+  return text[0] == '-' && (text[1] == ' ' || text[1] == '\0');
+}
+
+static bool parse_line(Parser *p, int indent, char *text)
+{
+  Block *top;
+
+  if (p->pending)
+  {
+    bool is_seq = is_sequence_item(text);
+    if (indent > p->pending_indent ||
+        (indent == p->pending_indent && is_seq))
+    {
+      push_block(p, indent, p->pending, is_seq);
+    }
+    else
+    {
+      set_option(p, p->pending, g_strdup(""));
+      g_free(p->pending);
+    }
+    p->pending = NULL;
+  }
+
+  // Sequences may line up with the key they belong to
+  while (p->blocks->len > 1 &&
+         (top_block(p)->indent > indent ||
+          (top_block(p)->indent == indent && top_block(p)->is_seq &&
+           !is_sequence_item(text))))
+  {
+    g_array_set_size(p->blocks, p->blocks->len - 1);
+  }
+  top = top_block(p);
+  if (top->indent != indent)
+    return false;
+
+  if (is_sequence_item(text))
+  {
+    char *item, *rest;
+    int rest_indent;
+
+    if (!top->is_seq)
+      return false;
+
+    item = g_strdup_printf("%s[%u]", top->path, top->count++);
+    rest = text + 1;
+    while (*rest == ' ')
+      rest++;
+    rest_indent = indent + (rest - text);
+
+    if (*rest == '\0')
+    {
+      p->pending = item;
+      p->pending_indent = indent;
+      return true;
+    }
+
+    // A mapping inside the sequence, its keys line up with this one
+    if (find_key_end(rest) > 0)
+    {
+      push_block(p, rest_indent, item, false);
+      return parse_entry(p, rest_indent, rest);
+    }
+
+    {
+      char *value = parse_scalar(rest);
+      if (value)
+        set_option(p, item, value);
+      g_free(item);
+      return value != NULL;
+    }
+  }
+
+  if (top->is_seq)
+    return false;
+
+  return parse_entry(p, indent, text);
+}
+
+static GPtrArray *parse_style(const char *contents)
+{
+  Parser p = { 0 };
+  char **lines = g_strsplit(contents, "\n", -1);
+  bool ok = true;
+
+  p.docs = g_ptr_array_new_with_free_func((GDestroyNotify)style_doc_free);
+  p.blocks = g_array_new(false, false, sizeof(Block));
+  g_array_set_clear_func(p.blocks, (GDestroyNotify)block_clear);
+  push_block(&p, 0, g_strdup(""), false);
+
+  for (int i = 0; ok && lines[i]; i++)
+  {
+    char *text = lines[i];
+    int indent = 0;
+
+    while (text[indent] == ' ')
+      indent++;
+    if (text[indent] == '\t')
+    {
+      ok = false;
+      break;
+    }
+
+    strip_comment(text);
+    if (strlen(text) <= (size_t)indent || g_str_has_prefix(text, "%"))
+      continue;
+
+    if (g_str_has_prefix(text, "---") || strcmp(text, "...") == 0)
+    {
+      end_document(&p);
+      continue;
+    }
+
+    ok = parse_line(&p, indent, text + indent);
+  }
+
+  if (ok)
+    end_document(&p);
+
+  g_free(p.pending);
+  if (p.doc)
+    style_doc_free(p.doc);
+  g_array_free(p.blocks, true);
+  g_strfreev(lines);
+
+  if (!ok)
+  {
+    g_ptr_array_free(p.docs, true);
+    return NULL;
+  }
+
+  return p.docs;
+}
+
+//======================================================================
+//
+// Effective style
+//
+
+static gint64 stat_mtime(const struct stat *st)
+{
+#ifdef __linux__
+  return (gint64)st->st_mtim.tv_sec * G_USEC_PER_SEC +
+         st->st_mtim.tv_nsec / 1000;
+#else
+  return (gint64)st->st_mtime * G_USEC_PER_SEC;
+#endif
+}
+
+static bool doc_inherits(StyleDoc *doc)
+{
+  const char *based_on = g_hash_table_lookup(doc->options, "BasedOnStyle");
+  return based_on && g_ascii_strcasecmp(based_on, INHERIT_PARENT) == 0;
+}
+
+// Returns the parsed file at @a path, loading it again if it changed.
+// The cache lock must be held.
+static DotFile *dot_file_get(const char *path)
+{
+  DotFile *file;
+  struct stat st;
+  char *contents = NULL;
+  size_t len = 0;
+
+  if (stat(path, &st) != 0 || !S_ISREG(st.st_mode))
+    return NULL;
+
+  file = g_hash_table_lookup(cache, path);
+  if (file && file->mtime == stat_mtime(&st) && file->size == st.st_size)
+    return file;
+
+  if (!g_file_get_contents(path, &contents, &len, NULL))
+    return NULL;
+
+  file = g_new0(DotFile, 1);
+  file->mtime = stat_mtime(&st);
+  file->size = st.st_size;
+  file->digest =
+      g_compute_checksum_for_data(G_CHECKSUM_SHA1, (guchar *)contents, len);
+  file->docs = parse_style(contents);
+  for (unsigned int i = 0; file->docs && i < file->docs->len; i++)
+    file->inherits |= doc_inherits(g_ptr_array_index(file->docs, i));
+  g_free(contents);
+
+  g_hash_table_replace(cache, g_strdup(path), file);
+
+  return file;
+}
+
+// The nearest style file at or above @a dir, like clang-format finds it
+static char *find_dot_file(const char *dir)
+{
+  static const char *const names[] = { ".clang-format", "_clang-format" };
+  char *cur = g_strdup(dir);
+
+  for (;;)
+  {
+    char *parent;
+
+    for (unsigned int i = 0; i < G_N_ELEMENTS(names); i++)
+    {
+      char *path = g_build_filename(cur, names[i], NULL);
+      if (g_file_test(path, G_FILE_TEST_IS_REGULAR))
+      {
+        g_free(cur);
+        return path;
+      }
+      g_free(path);
+    }
+
+    parent = g_path_get_dirname(cur);
+    if (strcmp(parent, cur) == 0)
+    {
+      g_free(parent);
+      break;
+    }
+    g_free(cur);
+    cur = parent;
+  }
+
+  g_free(cur);
+  return NULL;
+}
+
+static StyleDoc *find_doc(GPtrArray *docs, const char *language)
+{
+  for (unsigned int i = 0; i < docs->len; i++)
+  {
+    StyleDoc *doc = g_ptr_array_index(docs, i);
+    if (g_strcmp0(doc->language, language) == 0)
+      return doc;
+  }
+  return NULL;
+}
+
+// Whether @a path is @a option itself or one of its items or fields
+static bool option_contains(const char *option, const char *path)
+{
+  size_t len = strlen(option);
+  return strncmp(path, option, len) == 0 &&
+         (path[len] == '\0' || path[len] == '.' || path[len] == '[');
+}
+
+static gboolean is_replaced_sequence(gpointer key, G_GNUC_UNUSED gpointer val,
+                                     gpointer sequences)
+{
+  for (GList *it = sequences; it; it = it->next)
+  {
+    if (option_contains(it->data, key))
+      return true;
+  }
+  return false;
+}
+
+// Applies @a child over @a merged: options replace the parent's, except
+// that mappings are merged field by field while sequences are replaced
+// as a whole
+static void merge_doc(StyleDoc *merged, StyleDoc *child)
+{
+  bool inherits = doc_inherits(child);
+  GHashTableIter iter;
+  gpointer key, value;
+  GList *sequences = NULL;
+
+  g_hash_table_iter_init(&iter, child->options);
+  while (g_hash_table_iter_next(&iter, &key, &value))
+  {
+    const char *path = key;
+    const char *bracket = strchr(path, '[');
+    if (bracket)
+      sequences = g_list_prepend(sequences, g_strndup(path, bracket - path));
+    else if (strcmp(value, "[]") == 0)
+      sequences = g_list_prepend(sequences, g_strdup(path));
+  }
+  g_hash_table_foreach_remove(merged->options, is_replaced_sequence,
+                              sequences);
+  g_list_free_full(sequences, g_free);
+
+  g_hash_table_iter_init(&iter, child->options);
+  while (g_hash_table_iter_next(&iter, &key, &value))
+  {
+    // The parent's base stays in effect
+    if (inherits && strcmp(key, "BasedOnStyle") == 0)
+      continue;
+    g_hash_table_replace(merged->options, g_strdup(key), g_strdup(value));
+  }
+}
+
+static void append_canonical(GString *out, StyleDoc *doc)
+{
+  GList *keys = g_list_sort(g_hash_table_get_keys(doc->options),
+                            (GCompareFunc)strcmp);
+
+  g_string_append_printf(out, "--- %s\n",
+                         doc->language ? doc->language : "*");
+  for (GList *it = keys; it; it = it->next)
+  {
+    const char *value = g_hash_table_lookup(doc->options, it->data);
+    // Preset names are case-insensitive
+    if (strcmp(it->data, "BasedOnStyle") == 0)
+    {
+      char *lower = g_ascii_strdown(value, -1);
+      g_string_append_printf(out, "%s: %s\n", (char *)it->data, lower);
+      g_free(lower);
+    }
+    else
+      g_string_append_printf(out, "%s: %s\n", (char *)it->data, value);
+  }
+  g_list_free(keys);
+}
+
+static int compare_docs(StyleDoc **a, StyleDoc **b)
+{
+  return g_strcmp0((*a)->language, (*b)->language);
+}
+
+// Merges the style files that apply in @a dir into one StyleDoc per
+// language. Files whose options are unknown are added to @a raw by their
+// digest instead. The cache lock must be held.
+static GPtrArray *merge_effective_style(const char *dir, GString *raw)
+{
+  GPtrArray *merged;
+  GPtrArray *chain = g_ptr_array_new(); // DotFile, nearest first
+  char *path = find_dot_file(dir);
+
+  while (path)
+  {
+    DotFile *file = dot_file_get(path);
+    char *parent_dir, *above;
+
+    if (!file)
+      break;
+    g_ptr_array_add(chain, file);
+    if (!file->docs || !file->inherits)
+      break;
+
+    // Continue above the directory the file is in
+    parent_dir = g_path_get_dirname(path);
+    above = g_path_get_dirname(parent_dir);
+    g_free(path);
+    path = strcmp(above, parent_dir) != 0 ? find_dot_file(above) : NULL;
+    g_free(above);
+    g_free(parent_dir);
+  }
+  g_free(path);
+
+  merged = g_ptr_array_new_with_free_func((GDestroyNotify)style_doc_free);
+  for (unsigned int i = chain->len; i > 0; i--)
+  {
+    DotFile *file = g_ptr_array_index(chain, i - 1);
+
+    if (!file->docs)
+    {
+      // Its options are unknown, so it's identified by its contents
+      g_string_append_printf(raw, "raw %s\n", file->digest);
+      continue;
+    }
+
+    for (unsigned int j = 0; j < file->docs->len; j++)
+    {
+      StyleDoc *child = g_ptr_array_index(file->docs, j);
+      StyleDoc *doc = find_doc(merged, child->language);
+      if (!doc)
+      {
+        doc = style_doc_new(child->language);
+        g_ptr_array_add(merged, doc);
+      }
+      else if (!doc_inherits(child))
+        g_hash_table_remove_all(doc->options);
+      merge_doc(doc, child);
+    }
+  }
+
+  // Without a file, or a base, clang-format falls back to LLVM's style.
+  // Documents for a language are based on the one without a language.
+  if (!find_doc(merged, NULL) && (chain->len == 0 || merged->len > 0))
+    g_ptr_array_add(merged, style_doc_new(NULL));
+  {
+    StyleDoc *doc = find_doc(merged, NULL);
+    if (doc && !g_hash_table_contains(doc->options, "BasedOnStyle"))
+    {
+      g_hash_table_insert(doc->options, g_strdup("BasedOnStyle"),
+                          g_strdup("LLVM"));
+    }
+  }
+
+  g_ptr_array_free(chain, true);
+
+  return merged;
+}
+
+// Writes the effective style from @a dir to @a out. The cache lock must
+// be held.
+static void append_effective_style(GString *out, const char *dir)
+{
+  GPtrArray *merged = merge_effective_style(dir, out);
+
+  g_ptr_array_sort(merged, (GCompareFunc)compare_docs);
+  for (unsigned int i = 0; i < merged->len; i++)
+    append_canonical(out, g_ptr_array_index(merged, i));
+
+  g_ptr_array_free(merged, true);
+}
+
+static void lock_cache(void)
+{
+  g_mutex_lock(&cache_lock);
+  if (!cache)
+  {
+    cache = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                                  (GDestroyNotify)dot_file_free);
+  }
+}
+
+char *fmt_dot_file_fingerprint(const char *dir, const char *preset)
+{
+  GString *style = g_string_sized_new(1024);
+  char *hash;
+
+  if (preset)
+  {
+    char *lower = g_ascii_strdown(preset, -1);
+    g_string_append_printf(style, "--- *\nBasedOnStyle: %s\n", lower);
+    g_free(lower);
+  }
+  else
+  {
+    lock_cache();
+    append_effective_style(style, dir);
+    g_mutex_unlock(&cache_lock);
+  }
+
+  hash = g_compute_checksum_for_data(G_CHECKSUM_SHA1, (guchar *)style->str,
+                                     style->len);
+  g_string_free(style, true);
+
+  return hash;
+}
+
+GHashTable *fmt_dot_file_options(const char *dir, const char *preset,
+                                 const char *language)
+{
+  GHashTable *options;
+  GPtrArray *merged;
+  GString *raw;
+
+  options = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+  if (preset)
+  {
+    g_hash_table_insert(options, g_strdup("BasedOnStyle"), g_strdup(preset));
+    return options;
+  }
+
+  raw = g_string_new(NULL);
+  lock_cache();
+  merged = merge_effective_style(dir, raw);
+  g_mutex_unlock(&cache_lock);
+
+  if (raw->len > 0)
+  {
+    g_hash_table_destroy(options);
+    options = NULL;
+  }
+  else
+  {
+    // The document for the language applies over the one without
+    StyleDoc *docs[] = { find_doc(merged, NULL),
+                         language ? find_doc(merged, language) : NULL };
+
+    for (unsigned int i = 0; i < G_N_ELEMENTS(docs); i++)
+    {
+      GHashTableIter iter;
+      gpointer key, value;
+
+      if (!docs[i])
+        continue;
+      g_hash_table_iter_init(&iter, docs[i]->options);
+      while (g_hash_table_iter_next(&iter, &key, &value))
+        g_hash_table_replace(options, g_strdup(key), g_strdup(value));
+    }
+  }
+
+  if (options && !g_hash_table_contains(options, "BasedOnStyle"))
+    g_hash_table_insert(options, g_strdup("BasedOnStyle"), g_strdup("LLVM"));
+
+  g_ptr_array_free(merged, true);
+  g_string_free(raw, true);
+
+  return options;
+}
+
+void fmt_dot_file_clear_cache(void)
+{
+  g_mutex_lock(&cache_lock);
+  if (cache)
+    g_hash_table_destroy(cache);
+  cache = NULL;
+  g_mutex_unlock(&cache_lock);
+}
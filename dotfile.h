@@ -0,0 +1,77 @@
+/*
+ * dotfile.h
+ *
+ * Copyright 2013 Matthew <mbrush@codebrainz.ca>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+
+/*
+ * Reads .clang-format files, which are YAML, just far enough to tell
+ * which style they select. Shared by the plugin and code-format-daemon,
+ * so it only uses GLib.
+ */
+
+#ifndef FMT_DOT_FILE_H
+#define FMT_DOT_FILE_H
+
+#include <glib.h>
+#include <stdbool.h>
+
+G_BEGIN_DECLS
+
+/**
+ * Identifies the style clang-format uses for files in @a dir.
+ *
+ * For a preset, like the ones passed to clang-format's -style option,
+ * that is the preset itself. Otherwise it's the nearest .clang-format
+ * (or _clang-format) file, merged with the ones above it as long as
+ * they use "BasedOnStyle: InheritParentConfig". Files are reduced to
+ * their options in a canonical order, so comments, formatting and the
+ * order of the options don't change the result, and two files with the
+ * same options have the same fingerprint. Parsed files are cached until
+ * they change on disk.
+ *
+ * Files using YAML this reader doesn't understand are identified by
+ * their contents instead, and don't inherit from their parents.
+ *
+ * @param dir The directory to start looking in.
+ * @param preset The preset style, or @c NULL to use the files.
+ * @return A newly allocated hex string.
+ */
+char *fmt_dot_file_fingerprint(const char *dir, const char *preset);
+
+/**
+ * Looks up the options clang-format uses for @a language in @a dir,
+ * from the same files as fmt_dot_file_fingerprint().
+ *
+ * @param dir The directory to start looking in.
+ * @param preset The preset style, or @c NULL to use the files.
+ * @param language The Language option of the files' documents to use,
+ *   like "Cpp".
+ * @return A newly allocated table from option paths, like "IndentWidth"
+ *   or "BraceWrapping.AfterClass", to their values, or @c NULL when the
+ *   files can't be read. Options left to the base style are missing,
+ *   but "BasedOnStyle" is always there.
+ */
+GHashTable *fmt_dot_file_options(const char *dir, const char *preset,
+                                 const char *language);
+
+void fmt_dot_file_clear_cache(void);
+
+G_END_DECLS
+
+#endif // FMT_DOT_FILE_H
@@ -24,23 +24,214 @@
 #endif
 
 #include "format.h"
+#include "dotfile.h"
 #include "style.h"
 #include "prefs.h"
 #include "process.h"
+#include "service.h"
+
+#include <glib/gstdio.h>
+
+#ifdef G_OS_UNIX
+#include <sys/wait.h>
+#endif
 
 extern GeanyFunctions *geany_functions;
 
-static GPtrArray *format_arguments(size_t cursor, size_t offset, size_t length,
-                                   bool xml_replacements)
+static const char *clang_format_path(void)
 {
-  GPtrArray *args = g_ptr_array_new_with_free_func(g_free);
-  const char *path;
+  const char *path = fmt_prefs_get_path();
+  return (path && *path) ? path : "clang-format";
+}
 
-  path = fmt_prefs_get_path();
-  if (path && *path)
-    g_ptr_array_add(args, g_strdup(path));
+// Warns about clang-format failing, given the @a status it was waited
+// for with
+static void warn_exit_status(int status)
+{
+#ifdef G_OS_UNIX
+  if (status >= 0 && WIFEXITED(status))
+    g_warning("clang-format exited with code %d", WEXITSTATUS(status));
+  else if (status >= 0 && WIFSIGNALED(status))
+    g_warning("clang-format killed by signal %d", WTERMSIG(status));
   else
-    g_ptr_array_add(args, g_strdup("clang-format"));
+#endif
+    g_warning("clang-format exited with status %d", status);
+}
+
+static char *version_path = NULL;
+static unsigned int version_number = 0;
+
+// Returns the version of the clang-format at @a path as
+// major * 100 + minor, or 0 when it can't be determined. The result is
+// remembered until the path changes.
+static unsigned int clang_format_version(const char *path)
+{
+  const char *argv[] = { path, "--version", NULL };
+  FmtProcess *proc;
+  GString *out;
+  const char *ver;
+
+  if (version_path && g_strcmp0(version_path, path) == 0)
+    return version_number;
+
+  g_free(version_path);
+  version_path = g_strdup(path);
+  version_number = 0;
+
+  proc = fmt_process_open(NULL, argv);
+  if (!proc)
+    return 0;
+
+  out = g_string_new(NULL);
+  if (fmt_process_run(proc, NULL, 0, out))
+  {
+    // Sample: Ubuntu clang-format version 14.0.0-1ubuntu1
+    ver = strstr(out->str, "version ");
+    if (ver)
+    {
+      char *end = NULL;
+      unsigned long major = strtoul(ver + 8, &end, 10);
+      unsigned long minor = 0;
+      if (end && *end == '.')
+        minor = strtoul(end + 1, NULL, 10);
+      version_number = major * 100 + minor;
+    }
+  }
+  g_string_free(out, true);
+  fmt_process_close(proc);
+
+  return version_number;
+}
+
+// Whether repeated -offset/-length pairs and -lines are understood,
+// older releases silently format only a single range
+static bool supports_multiple_ranges(const char *path)
+{
+  return clang_format_version(path) >= 305;
+}
+
+void fmt_clang_format_forget_version(void)
+{
+  g_free(version_path);
+  version_path = NULL;
+  version_number = 0;
+}
+
+// Identifies the clang-format binary by its location, size and
+// modification time, so upgrading it changes the result
+static char *clang_format_identity(void)
+{
+  const char *path = clang_format_path();
+  char *full_path = g_find_program_in_path(path);
+  GStatBuf st;
+  char *identity;
+
+  if (!full_path || g_stat(full_path, &st) != 0)
+  {
+    g_free(full_path);
+    return g_strdup(path);
+  }
+
+  identity = g_strdup_printf("%s:%" G_GINT64_FORMAT ":%" G_GINT64_FORMAT,
+                             full_path, (gint64)st.st_mtime,
+                             (gint64)st.st_size);
+  g_free(full_path);
+
+  return identity;
+}
+
+static void string_free(GString *str)
+{
+  g_string_free(str, true);
+}
+
+// clang-format identity and preset -> -dump-config output
+static GHashTable *default_configs = NULL;
+
+void fmt_clang_format_forget_configs(void)
+{
+  if (default_configs)
+    g_hash_table_destroy(default_configs);
+  default_configs = NULL;
+  fmt_dot_file_clear_cache();
+}
+
+// Converts line ranges to the single byte range covering all of them
+static FmtRange covering_lines_range(const char *code, size_t code_len,
+                                     GArray *lines)
+{
+  FmtRange span = { 0, 0 };
+  unsigned int first = G_MAXUINT, last = 0, line = 1;
+  size_t start = code_len, end = code_len;
+
+  for (unsigned int i = 0; i < lines->len; i++)
+  {
+    FmtLineRange *range = &g_array_index(lines, FmtLineRange, i);
+    first = MIN(first, range->first);
+    last = MAX(last, range->last);
+  }
+
+  if (first <= 1)
+    start = 0;
+  for (size_t i = 0; i < code_len; i++)
+  {
+    if (code[i] != '\n')
+      continue;
+    line++;
+    if (line == first)
+      start = i + 1;
+    else if (line == last + 1)
+    {
+      end = i;
+      break;
+    }
+  }
+
+  if (start < end)
+  {
+    span.offset = start;
+    span.length = end - start;
+  }
+  return span;
+}
+
+// Converts byte ranges to the single byte range covering all of them
+static FmtRange covering_range(GArray *ranges)
+{
+  FmtRange span = { 0, 0 };
+  size_t start = G_MAXSIZE, end = 0;
+
+  for (unsigned int i = 0; i < ranges->len; i++)
+  {
+    FmtRange *range = &g_array_index(ranges, FmtRange, i);
+    start = MIN(start, range->offset);
+    end = MAX(end, range->offset + range->length);
+  }
+
+  if (start < end)
+  {
+    span.offset = start;
+    span.length = end - start;
+  }
+  return span;
+}
+
+static void add_range_argument(GPtrArray *args, const FmtRange *range)
+{
+  g_ptr_array_add(args, g_strdup_printf("-offset=%lu", range->offset));
+  g_ptr_array_add(args, g_strdup_printf("-length=%lu", range->length));
+}
+
+// Either @a ranges (FmtRange) or @a lines (FmtLineRange) select what's
+// formatted, @a lines taking precedence
+static GPtrArray *format_arguments(const char *code, size_t code_len,
+                                   size_t cursor, GArray *ranges,
+                                   GArray *lines, bool xml_replacements)
+{
+  GPtrArray *args = g_ptr_array_new_with_free_func(g_free);
+  const char *path = clang_format_path();
+
+  g_ptr_array_add(args, g_strdup(path));
 
   if (xml_replacements)
     g_ptr_array_add(args, g_strdup("-output-replacements-xml"));
@@ -50,13 +241,58 @@ static GPtrArray *format_arguments(size_t cursor, size_t offset, size_t length,
                             fmt_style_get_cmd_name(fmt_prefs_get_style())));
 
   g_ptr_array_add(args, g_strdup_printf("-cursor=%lu", cursor));
-  g_ptr_array_add(args, g_strdup_printf("-offset=%lu", offset));
-  g_ptr_array_add(args, g_strdup_printf("-length=%lu", length));
+
+  if (lines && supports_multiple_ranges(path))
+  {
+    for (unsigned int i = 0; i < lines->len; i++)
+    {
+      FmtLineRange *range = &g_array_index(lines, FmtLineRange, i);
+      g_ptr_array_add(args, g_strdup_printf("-lines=%u:%u", range->first,
+                                            range->last));
+    }
+  }
+  else if (lines)
+  {
+    FmtRange span = covering_lines_range(code, code_len, lines);
+    add_range_argument(args, &span);
+  }
+  else if (ranges->len == 1 || supports_multiple_ranges(path))
+  {
+    // All ranges are formatted by this one process
+    for (unsigned int i = 0; i < ranges->len; i++)
+      add_range_argument(args, &g_array_index(ranges, FmtRange, i));
+  }
+  else
+  {
+    FmtRange span = covering_range(ranges);
+    add_range_argument(args, &span);
+  }
+
   g_ptr_array_add(args, NULL);
 
   return args;
 }
 
+static GArray *single_range(size_t offset, size_t length)
+{
+  FmtRange range = { offset, length };
+  GArray *ranges = g_array_sized_new(false, false, sizeof(FmtRange), 1);
+  g_array_append_val(ranges, range);
+  return ranges;
+}
+
+static bool ranges_are_empty(GArray *ranges)
+{
+  if (!ranges)
+    return true;
+  for (unsigned int i = 0; i < ranges->len; i++)
+  {
+    if (g_array_index(ranges, FmtRange, i).length > 0)
+      return false;
+  }
+  return true;
+}
+
 #define INVALID_CURSOR ((size_t) - 1)
 
 static size_t extract_cursor(GString *str)
@@ -115,26 +351,30 @@ static size_t extract_cursor(GString *str)
   return cursor_pos;
 }
 
-GString *fmt_clang_format(const char *file_name, const char *code,
-                          size_t code_len, size_t *cursor, size_t offset,
-                          size_t length, bool xml_replacements)
+static GString *run_clang_format(const char *file_name, const char *code,
+                                 size_t code_len, size_t *cursor,
+                                 GArray *ranges, GArray *lines,
+                                 bool xml_replacements)
 {
   char *work_dir;
   GPtrArray *args;
   GString *out;
   size_t cursor_pos;
   FmtProcess *proc;
+  int status;
 
   g_return_val_if_fail(file_name, NULL);
   g_return_val_if_fail(code, NULL);
   g_return_val_if_fail(code_len, NULL);
   g_return_val_if_fail(cursor, NULL);
-  g_return_val_if_fail(length, NULL);
+  g_return_val_if_fail(lines || !ranges_are_empty(ranges), NULL);
 
-  args = format_arguments(*cursor, offset, length, xml_replacements);
+  args = format_arguments(code, code_len, *cursor, ranges, lines,
+                          xml_replacements);
   work_dir = g_path_get_dirname(file_name);
 
-  proc = fmt_process_open(work_dir, (const char * const *)args->pdata);
+  proc = fmt_service_open(work_dir, (const char * const *)args->pdata,
+                          FMT_PROCESS_PRIORITY_NORMAL);
 
   g_ptr_array_free(args, TRUE);
   g_free(work_dir);
@@ -151,18 +391,15 @@ GString *fmt_clang_format(const char *file_name, const char *code,
     return NULL;
   }
 
-// FIXME: clang-format returns non-zero when it can't find the
-// .clang-format file, handle this case specially
-#if 1
-  fmt_process_close(proc);
-#else
-  if (fmt_process_close(proc) != 0)
+  // Problems like an invalid .clang-format file end with a non-zero
+  // exit and nothing useful on the output
+  status = fmt_process_close(proc);
+  if (status != 0)
   {
-    g_warning("Subprocess returned non-zero exit code");
+    warn_exit_status(status);
     g_string_free(out, true);
     return NULL;
   }
-#endif
 
   if (!xml_replacements)
   {
@@ -180,43 +417,479 @@ GString *fmt_clang_format(const char *file_name, const char *code,
   return out;
 }
 
+GString *fmt_clang_format(const char *file_name, const char *code,
+                          size_t code_len, size_t *cursor, size_t offset,
+                          size_t length, bool xml_replacements)
+{
+  GArray *ranges = single_range(offset, length);
+  GString *out = run_clang_format(file_name, code, code_len, cursor, ranges,
+                                  NULL, xml_replacements);
+  g_array_free(ranges, true);
+  return out;
+}
+
+GString *fmt_clang_format_ranges(const char *file_name, const char *code,
+                                 size_t code_len, size_t *cursor,
+                                 GArray *ranges, bool xml_replacements)
+{
+  g_return_val_if_fail(ranges && ranges->len > 0, NULL);
+  return run_clang_format(file_name, code, code_len, cursor, ranges, NULL,
+                          xml_replacements);
+}
+
+GString *fmt_clang_format_lines(const char *file_name, const char *code,
+                                size_t code_len, size_t *cursor, GArray *lines,
+                                bool xml_replacements)
+{
+  g_return_val_if_fail(lines && lines->len > 0, NULL);
+  return run_clang_format(file_name, code, code_len, cursor, NULL, lines,
+                          xml_replacements);
+}
+
+typedef struct
+{
+  FmtFormatFunc callback;
+  gpointer user_data;
+  bool xml_replacements;
+  size_t cursor;
+} AsyncFormat;
+
+static void on_async_format_done(FmtProcess *proc, bool success, GString *out,
+                                 AsyncFormat *fmt)
+{
+  size_t cursor_pos = fmt->cursor;
+  int status = fmt_process_close(proc);
+
+  if (success && status != 0)
+  {
+    warn_exit_status(status);
+    success = false;
+  }
+
+  if (!success)
+  {
+    g_string_free(out, true);
+    out = NULL;
+  }
+  else if (!fmt->xml_replacements)
+  {
+    cursor_pos = extract_cursor(out);
+    if (cursor_pos == INVALID_CURSOR)
+    {
+      g_warning(
+          "Failed to parse resulting cursor position from resulting code");
+      g_string_free(out, true);
+      out = NULL;
+    }
+  }
+
+  fmt->callback(out, cursor_pos, fmt->user_data);
+  g_free(fmt);
+}
+
+FmtProcess *fmt_clang_format_async(const char *file_name, const char *code,
+                                   size_t code_len, size_t cursor,
+                                   GArray *ranges, GArray *lines,
+                                   bool xml_replacements,
+                                   FmtProcessPriority priority,
+                                   FmtFormatFunc callback, gpointer user_data)
+{
+  char *work_dir;
+  GPtrArray *args;
+  FmtProcess *proc;
+  AsyncFormat *fmt;
+  GString *out;
+
+  g_return_val_if_fail(file_name, NULL);
+  g_return_val_if_fail(code, NULL);
+  g_return_val_if_fail(code_len, NULL);
+  g_return_val_if_fail(lines || !ranges_are_empty(ranges), NULL);
+  g_return_val_if_fail(callback, NULL);
+
+  args = format_arguments(code, code_len, cursor, ranges, lines,
+                          xml_replacements);
+  work_dir = g_path_get_dirname(file_name);
+
+  proc = fmt_service_open(work_dir, (const char * const *)args->pdata,
+                          priority);
+
+  g_ptr_array_free(args, TRUE);
+  g_free(work_dir);
+
+  if (!proc)
+    return NULL;
+
+  fmt = g_new0(AsyncFormat, 1);
+  fmt->callback = callback;
+  fmt->user_data = user_data;
+  fmt->xml_replacements = xml_replacements;
+  fmt->cursor = cursor;
+
+  out = g_string_sized_new(code_len);
+  if (!fmt_process_run_async(proc, code, code_len, out,
+                             (FmtProcessFunc)on_async_format_done, fmt))
+  {
+    g_string_free(out, true);
+    g_free(fmt);
+    fmt_process_close(proc);
+    return NULL;
+  }
+
+  return proc;
+}
+
 GString *fmt_clang_format_default_config(const char *based_on_name)
 {
+  const char *style =
+      fmt_style_get_cmd_name(fmt_style_from_name(based_on_name));
+  const char *argv[] = { clang_format_path(), NULL, "-dump-config", NULL };
+  char *identity, *key, *style_arg;
   GString *str;
-  GPtrArray *args = g_ptr_array_new_with_free_func(g_free);
   FmtProcess *proc;
-  const char *path;
 
-  path = fmt_prefs_get_path();
+  identity = clang_format_identity();
+  key = g_strconcat(identity, "\n", style, NULL);
+  g_free(identity);
 
-  if (path && *path)
-    g_ptr_array_add(args, g_strdup(path));
-  else
-    g_ptr_array_add(args, g_strdup("clang-format"));
+  if (!default_configs)
+  {
+    default_configs = g_hash_table_new_full(
+        g_str_hash, g_str_equal, g_free, (GDestroyNotify)string_free);
+  }
 
-  g_ptr_array_add(
-      args, g_strdup_printf(
-                "-style=%s",
-                fmt_style_get_cmd_name(fmt_style_from_name(based_on_name))));
-  g_ptr_array_add(args, g_strdup("-dump-config"));
-  g_ptr_array_add(args, NULL);
+  str = g_hash_table_lookup(default_configs, key);
+  if (str)
+  {
+    g_free(key);
+    return g_string_new_len(str->str, str->len);
+  }
 
-  proc = fmt_process_open(NULL, (const char * const *)args->pdata);
-  g_ptr_array_free(args, true);
+  style_arg = g_strdup_printf("-style=%s", style);
+  argv[1] = style_arg;
+  proc = fmt_process_open(NULL, argv);
+  g_free(style_arg);
 
   if (!proc)
+  {
+    g_free(key);
     return NULL;
+  }
 
   str = g_string_sized_new(1024);
   if (!fmt_process_run(proc, NULL, 0, str))
   {
     g_string_free(str, true);
     fmt_process_close(proc);
+    g_free(key);
     return NULL;
   }
   fmt_process_close(proc);
 
-  return str;
+  // An unknown style gives an error message instead
+  if (str->len == 0)
+  {
+    g_free(key);
+    return str;
+  }
+
+  g_hash_table_insert(default_configs, key, str);
+
+  return g_string_new_len(str->str, str->len);
+}
+
+static void replacement_clear(FmtReplacement *repl)
+{
+  g_free(repl->text);
+}
+
+// Decodes the few entities clang-format emits, plus numeric ones
+static char *xml_unescape(const char *str, size_t len)
+{
+  GString *out = g_string_sized_new(len);
+  const char *end = str + len;
+
+  while (str < end)
+  {
+    const char *semi;
+
+    if (*str != '&' || (semi = memchr(str, ';', end - str)) == NULL)
+    {
+      g_string_append_c(out, *str++);
+      continue;
+    }
+
+    if (str[1] == '#')
+    {
+      unsigned long ch;
+      if (str[2] == 'x' || str[2] == 'X')
+        ch = strtoul(str + 3, NULL, 16);
+      else
+        ch = strtoul(str + 2, NULL, 10);
+      if (ch < 0x80)
+        g_string_append_c(out, (char)ch);
+      else
+        g_string_append_unichar(out, (gunichar)ch);
+    }
+    else if (strncmp(str, "&lt;", 4) == 0)
+      g_string_append_c(out, '<');
+    else if (strncmp(str, "&gt;", 4) == 0)
+      g_string_append_c(out, '>');
+    else if (strncmp(str, "&amp;", 5) == 0)
+      g_string_append_c(out, '&');
+    else if (strncmp(str, "&apos;", 6) == 0)
+      g_string_append_c(out, '\'');
+    else if (strncmp(str, "&quot;", 6) == 0)
+      g_string_append_c(out, '"');
+    else
+      g_string_append_len(out, str, semi - str + 1);
+
+    str = semi + 1;
+  }
+
+  return g_string_free(out, false);
+}
+
+static bool parse_attribute(const char *tag, const char *tag_end,
+                            const char *name, size_t *value)
+{
+  const char *it = tag;
+  size_t name_len = strlen(name);
+
+  while ((it = strstr(it, name)) != NULL && it < tag_end)
+  {
+    if (it[name_len] == '=' && (it[name_len + 1] == '\'' ||
+                                it[name_len + 1] == '"'))
+    {
+      char *num_end = NULL;
+      errno = 0;
+      *value = strtoul(it + name_len + 2, &num_end, 10);
+      return errno == 0 && num_end != it + name_len + 2;
+    }
+    it += name_len;
+  }
+
+  return false;
+}
+
+static int compare_replacements(const FmtReplacement *a,
+                                const FmtReplacement *b)
+{
+  if (a->offset != b->offset)
+    return a->offset < b->offset ? -1 : 1;
+  return 0;
+}
+
+GArray *fmt_replacements_new(void)
+{
+  GArray *repls = g_array_new(false, true, sizeof(FmtReplacement));
+  g_array_set_clear_func(repls, (GDestroyNotify)replacement_clear);
+  return repls;
+}
+
+GArray *fmt_replacements_parse(const char *xml, const char *code,
+                               size_t code_len)
+{
+  GArray *repls;
+  const char *it;
+
+  g_return_val_if_fail(xml, NULL);
+
+  if (strstr(xml, "<replacements") == NULL)
+    return NULL;
+
+  repls = fmt_replacements_new();
+
+  // Sample: <replacement offset='5' length='1'>&#10;  </replacement>
+  it = xml;
+  while ((it = strstr(it, "<replacement ")) != NULL)
+  {
+    FmtReplacement repl = { 0, 0, NULL };
+    const char *tag_end = strchr(it, '>');
+    const char *close;
+
+    if (!tag_end || !parse_attribute(it, tag_end, "offset", &repl.offset) ||
+        !parse_attribute(it, tag_end, "length", &repl.length))
+    {
+      g_array_free(repls, true);
+      return NULL;
+    }
+
+    if (tag_end[-1] == '/') // <replacement ... />
+      close = tag_end + 1;
+    else
+    {
+      close = strstr(tag_end + 1, "</replacement>");
+      if (!close)
+      {
+        g_array_free(repls, true);
+        return NULL;
+      }
+    }
+
+    repl.text = xml_unescape(tag_end + 1,
+                             close > tag_end + 1 ? close - tag_end - 1 : 0);
+    it = close;
+
+    // Drop no-ops, and ones that fall outside of the text
+    if (code && (repl.offset + repl.length > code_len ||
+                 (strlen(repl.text) == repl.length &&
+                  memcmp(code + repl.offset, repl.text, repl.length) == 0)))
+    {
+      g_free(repl.text);
+      continue;
+    }
+
+    g_array_append_val(repls, repl);
+  }
+
+  // clang-format emits them in order already, but don't rely on it
+  g_array_sort(repls, (GCompareFunc)compare_replacements);
+
+  return repls;
+}
+
+static unsigned int line_at_offset(GArray *line_starts, size_t offset)
+{
+  unsigned int lo = 0, hi = line_starts->len;
+
+  // Last line starting at or before offset
+  while (hi - lo > 1)
+  {
+    unsigned int mid = lo + (hi - lo) / 2;
+    if (g_array_index(line_starts, size_t, mid) <= offset)
+      lo = mid;
+    else
+      hi = mid;
+  }
+
+  return lo + 1;
+}
+
+GArray *fmt_replacements_line_ranges(GArray *repls, const char *code,
+                                     size_t code_len)
+{
+  GArray *ranges, *line_starts;
+  size_t start = 0;
+
+  ranges = g_array_new(false, false, sizeof(FmtLineRange));
+  if (!repls || repls->len == 0)
+    return ranges;
+
+  line_starts = g_array_new(false, false, sizeof(size_t));
+  g_array_append_val(line_starts, start);
+  for (size_t i = 0; i < code_len; i++)
+  {
+    if (code[i] == '\n' ||
+        (code[i] == '\r' && (i + 1 == code_len || code[i + 1] != '\n')))
+    {
+      start = i + 1;
+      g_array_append_val(line_starts, start);
+    }
+  }
+
+  for (unsigned int i = 0; i < repls->len; i++)
+  {
+    FmtReplacement *repl = &g_array_index(repls, FmtReplacement, i);
+    FmtLineRange range;
+    size_t end = repl->offset + (repl->length > 0 ? repl->length - 1 : 0);
+
+    range.first = line_at_offset(line_starts, repl->offset);
+    range.last = line_at_offset(line_starts, MIN(end, code_len));
+
+    if (ranges->len > 0)
+    {
+      FmtLineRange *prev =
+          &g_array_index(ranges, FmtLineRange, ranges->len - 1);
+      if (range.first <= prev->last + 1)
+      {
+        prev->last = MAX(prev->last, range.last);
+        continue;
+      }
+    }
+    g_array_append_val(ranges, range);
+  }
+
+  g_array_free(line_starts, true);
+  return ranges;
+}
+
+GString *fmt_replacements_apply(const char *code, size_t code_len,
+                                GArray *repls, size_t *cursor)
+{
+  GString *out = g_string_sized_new(code_len + code_len / 8);
+  size_t pos = 0, new_cursor = cursor ? *cursor : 0;
+  bool cursor_done = false;
+
+  for (unsigned int i = 0; i < repls->len; i++)
+  {
+    FmtReplacement *repl = &g_array_index(repls, FmtReplacement, i);
+    size_t text_len = strlen(repl->text);
+
+    if (repl->offset < pos || repl->offset + repl->length > code_len)
+    {
+      g_string_free(out, true);
+      return NULL;
+    }
+
+    g_string_append_len(out, code + pos, repl->offset - pos);
+
+    // Keep the cursor on the same text, or inside what replaced it
+    if (cursor && !cursor_done && *cursor < repl->offset + repl->length)
+    {
+      if (*cursor <= repl->offset)
+        new_cursor = out->len - (repl->offset - *cursor);
+      else
+        new_cursor = out->len + MIN(*cursor - repl->offset, text_len);
+      cursor_done = true;
+    }
+
+    g_string_append_len(out, repl->text, text_len);
+    pos = repl->offset + repl->length;
+  }
+
+  if (cursor && !cursor_done)
+    new_cursor = out->len + (MIN(*cursor, code_len) - pos);
+  g_string_append_len(out, code + pos, code_len - pos);
+
+  if (cursor)
+    *cursor = new_cursor;
+
+  return out;
+}
+
+char *fmt_config_hash(const char *start_at)
+{
+  GChecksum *sum;
+  FmtStyle style = fmt_prefs_get_style();
+  const char *preset = NULL;
+  char *identity, *dir, *style_hash, *hash;
+
+  if (style != FORMAT_STYLE_CUSTOM)
+    preset = fmt_style_get_cmd_name(style);
+
+  // NULL, "." or "" (empty) means use current directory
+  if (!start_at || !*start_at || g_strcmp0(start_at, ".") == 0)
+    dir = g_get_current_dir();
+  else if (g_file_test(start_at, G_FILE_TEST_IS_DIR))
+    dir = g_strdup(start_at);
+  else
+    dir = g_path_get_dirname(start_at);
+
+  identity = clang_format_identity();
+  style_hash = fmt_dot_file_fingerprint(dir, preset);
+
+  sum = g_checksum_new(G_CHECKSUM_SHA1);
+  g_checksum_update(sum, (const guchar *)identity, -1);
+  g_checksum_update(sum, (const guchar *)"\n", 1);
+  g_checksum_update(sum, (const guchar *)style_hash, -1);
+  hash = g_strdup(g_checksum_get_string(sum));
+  g_checksum_free(sum);
+
+  g_free(style_hash);
+  g_free(identity);
+  g_free(dir);
+
+  return hash;
 }
 
 bool fmt_check_clang_format(const char *path)
@@ -23,9 +23,51 @@
 #define FORMAT_H_ 1
 
 #include "plugin.h"
+#include "process.h"
 
 G_BEGIN_DECLS
 
+/**
+ * Called when an asynchronous format finishes.
+ *
+ * @param formatted The formatted text (or XML replacements) which now
+ * belongs to the callee, or @c NULL on error or cancellation.
+ * @param cursor The new cursor position, only meaningful when
+ * @a formatted isn't @c NULL and XML replacements weren't requested.
+ * @param user_data The data passed to fmt_clang_format_async().
+ */
+typedef void (*FmtFormatFunc)(GString *formatted, size_t cursor,
+                              gpointer user_data);
+
+/**
+ * A single edit from clang-format's XML replacements output. The
+ * @a offset and @a length are byte positions in the original text.
+ */
+typedef struct
+{
+  size_t offset;
+  size_t length;
+  char *text;
+} FmtReplacement;
+
+/**
+ * A range of bytes to format.
+ */
+typedef struct
+{
+  size_t offset;
+  size_t length;
+} FmtRange;
+
+/**
+ * An inclusive range of 1-based line numbers.
+ */
+typedef struct
+{
+  unsigned int first;
+  unsigned int last;
+} FmtLineRange;
+
 /**
  * Wrapper around clang-format command-line utility.
  *
@@ -52,9 +94,67 @@ GString *fmt_clang_format(const char *file_name, const char *code,
                           size_t code_len, size_t *cursor, size_t offset,
                           size_t length, bool xml_replacements);
 
+/**
+ * Like fmt_clang_format() but formats several ranges, all in a single
+ * clang-format run.
+ *
+ * @param ranges An array of FmtRange, must not be empty. When the
+ * clang-format in use only understands a single range, the span
+ * covering all of them is formatted instead.
+ */
+GString *fmt_clang_format_ranges(const char *file_name, const char *code,
+                                 size_t code_len, size_t *cursor,
+                                 GArray *ranges, bool xml_replacements);
+
+/**
+ * Like fmt_clang_format() but formats only the given lines, all in a
+ * single clang-format run.
+ *
+ * @param lines An array of FmtLineRange, must not be empty.
+ */
+GString *fmt_clang_format_lines(const char *file_name, const char *code,
+                                size_t code_len, size_t *cursor, GArray *lines,
+                                bool xml_replacements);
+
+/**
+ * Asynchronous version of fmt_clang_format().
+ *
+ * The @a code buffer is not copied and must stay valid until
+ * @a callback is called. The returned process may be cancelled, aborted
+ * or suspended until then, but is closed automatically afterwards.
+ *
+ * @param ranges An array of FmtRange to format, or @c NULL when
+ * @a lines is given.
+ * @param lines An array of FmtLineRange to format instead of
+ * @a ranges, or @c NULL.
+ * @param priority The scheduling priority of the clang-format child.
+ * @return The running process, or @c NULL if it couldn't be started,
+ * in which case @a callback is never called.
+ */
+FmtProcess *fmt_clang_format_async(const char *file_name, const char *code,
+                                   size_t code_len, size_t cursor,
+                                   GArray *ranges, GArray *lines,
+                                   bool xml_replacements,
+                                   FmtProcessPriority priority,
+                                   FmtFormatFunc callback, gpointer user_data);
+
+/**
+ * Frees the remembered clang-format version, which is otherwise
+ * detected once per clang-format path.
+ */
+void fmt_clang_format_forget_version(void);
+
+/**
+ * Frees the remembered fmt_clang_format_default_config() results and
+ * parsed .clang-format files.
+ */
+void fmt_clang_format_forget_configs(void);
+
 /**
  * Generates .clang-format contents based on an existing style.
  *
+ * The result is remembered for each style and clang-format binary.
+ *
  * @param base_on_name The name of the style to base on.
  * @return The text containing the YAML configuration data.
  */
@@ -71,6 +171,57 @@ GString *fmt_clang_format_default_config(const char *based_on_name);
  */
 bool fmt_check_clang_format(const char *path);
 
+/**
+ * Creates an empty array of FmtReplacement, which frees the texts of
+ * its elements.
+ */
+GArray *fmt_replacements_new(void);
+
+/**
+ * Parses the output of clang-format's @c -output-replacements-xml
+ * option.
+ *
+ * @param xml The XML text.
+ * @param code The text that was formatted, replacements which would
+ * not change it are dropped. May be @c NULL to keep all of them.
+ * @param code_len The length of @a code.
+ * @return A new array of FmtReplacement sorted by offset, or @c NULL
+ * when @a xml isn't a valid replacements document. Free it with
+ * g_array_free(), which also frees the replacement texts.
+ */
+GArray *fmt_replacements_parse(const char *xml, const char *code,
+                               size_t code_len);
+
+/**
+ * Converts replacements into the ranges of lines of @a code they
+ * touch. Overlapping and adjacent ranges are merged.
+ *
+ * @return A new array of FmtLineRange.
+ */
+GArray *fmt_replacements_line_ranges(GArray *repls, const char *code,
+                                     size_t code_len);
+
+/**
+ * Applies sorted, non-overlapping replacements to @a code.
+ *
+ * @param cursor When not @c NULL, a position in @a code which is
+ * updated to the matching position in the result.
+ * @return The new text, or @c NULL when the replacements don't fit
+ * @a code.
+ */
+GString *fmt_replacements_apply(const char *code, size_t code_len,
+                                GArray *repls, size_t *cursor);
+
+/**
+ * Hashes everything besides the text itself that affects formatting,
+ * ie. the clang-format binary and the effective style, see
+ * fmt_dot_file_fingerprint().
+ *
+ * @param start_at The file or directory being formatted.
+ * @return A newly allocated hex string.
+ */
+char *fmt_config_hash(const char *start_at);
+
 char *fmt_lookup_clang_format_dot_file(const char *start_at);
 
 bool fmt_can_find_clang_format_dot_file(const char *start_at);
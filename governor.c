@@ -0,0 +1,431 @@
+/*
+ * governor.c
+ *
+ * Copyright 2013 Matthew <mbrush@codebrainz.ca>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "governor.h"
+#include "prefs.h"
+
+#ifdef G_OS_UNIX
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+#endif
+
+// Niceness given to low priority children
+#define LOW_PRIORITY_NICE 10
+
+// How long a reading of the memory pressure is used for
+#define PRESSURE_INTERVAL_US G_USEC_PER_SEC
+
+#define PRESSURE_PATH "/proc/pressure/memory"
+#define CGROUP_ROOT "/sys/fs/cgroup"
+
+struct FmtGovernor
+{
+  size_t n_children, n_suspended, n_low;
+
+  gint64 pressure_read_at;
+  double pressure_some, pressure_full; // percentages over 10 seconds
+
+  // Sub-group with the memory controller that children move into
+  bool cgroup_tried;
+  char *cgroup_own;    // Geany's group, when Geany moved out of it
+  bool cgroup_enabled; // whether the memory controller was enabled
+  char *cgroup_dir;
+  int cgroup_procs;     // its cgroup.procs, written to by the children
+  guint64 cgroup_limit; // what its memory.max is set to
+
+  // Read by children between fork() and exec()
+  guint64 child_limit;
+  bool child_in_cgroup;
+};
+
+static struct FmtGovernor gov = { .cgroup_procs = -1 };
+
+static size_t max_processes(void)
+{
+  unsigned int n = fmt_prefs_get_max_processes();
+  // Always leave room for an interactive job, even on one core
+  if (n == 0)
+    n = MAX(2, g_get_num_processors());
+  return n;
+}
+
+guint64 fmt_governor_get_memory_limit(void)
+{
+  int limit_mb = fmt_prefs_get_memory_limit();
+
+  if (limit_mb > 0)
+    return (guint64)limit_mb * 1024 * 1024;
+#if defined(G_OS_UNIX) && defined(_SC_PHYS_PAGES)
+  if (limit_mb == 0)
+  {
+    long pages = sysconf(_SC_PHYS_PAGES), page_size = sysconf(_SC_PAGESIZE);
+    if (pages > 0 && page_size > 0)
+      return (guint64)pages * page_size / 2;
+  }
+#endif
+  return 0;
+}
+
+// Reads the "avg10" values of Linux's pressure stall information
+static void read_pressure(void)
+{
+  gint64 now = g_get_monotonic_time();
+  char *contents = NULL;
+  char **lines;
+
+  if (gov.pressure_read_at > 0 &&
+      now - gov.pressure_read_at < PRESSURE_INTERVAL_US)
+    return;
+
+  gov.pressure_read_at = now;
+  gov.pressure_some = gov.pressure_full = 0;
+  if (!g_file_get_contents(PRESSURE_PATH, &contents, NULL, NULL))
+    return;
+
+  lines = g_strsplit(contents, "\n", -1);
+  for (int i = 0; lines[i]; i++)
+  {
+    const char *avg = strstr(lines[i], "avg10=");
+    if (!avg)
+      continue;
+    if (g_str_has_prefix(lines[i], "some "))
+      gov.pressure_some = g_ascii_strtod(avg + 6, NULL);
+    else if (g_str_has_prefix(lines[i], "full "))
+      gov.pressure_full = g_ascii_strtod(avg + 6, NULL);
+  }
+
+  g_strfreev(lines);
+  g_free(contents);
+}
+
+static size_t low_priority_limit(void)
+{
+  size_t limit = max_processes();
+  unsigned int threshold = fmt_prefs_get_pressure_threshold();
+
+  if (threshold == 0)
+    return limit;
+
+  read_pressure();
+  // Everything is stalled, keep making progress one file at a time
+  if (gov.pressure_full >= threshold)
+    return 1;
+  if (gov.pressure_some >= threshold)
+    return MAX(1, limit / 2);
+
+  return limit;
+}
+
+bool fmt_governor_may_start(FmtProcessPriority priority)
+{
+  // Suspended processes keep their memory but not a core
+  if (gov.n_children - gov.n_suspended >= max_processes())
+    return false;
+  if (priority == FMT_PROCESS_PRIORITY_LOW)
+    return gov.n_low < low_priority_limit();
+  return true;
+}
+
+bool fmt_governor_is_throttled(void)
+{
+  return low_priority_limit() < max_processes();
+}
+
+#ifdef __linux__
+static bool write_file(const char *dir, const char *name, const char *value)
+{
+  char *path = g_build_filename(dir, name, NULL);
+  size_t len = strlen(value);
+  int fd = open(path, O_WRONLY | O_CLOEXEC);
+  bool written;
+
+  g_free(path);
+  if (fd < 0)
+    return false;
+
+  written = write(fd, value, len) == (ssize_t)len;
+  close(fd);
+
+  return written;
+}
+
+static bool file_has_word(const char *dir, const char *name,
+                          const char *word)
+{
+  char *path = g_build_filename(dir, name, NULL);
+  char *contents = NULL;
+  bool found = false;
+
+  if (g_file_get_contents(path, &contents, NULL, NULL))
+  {
+    char **words = g_strsplit_set(g_strstrip(contents), " \n", -1);
+    for (int i = 0; words[i] && !found; i++)
+      found = strcmp(words[i], word) == 0;
+    g_strfreev(words);
+  }
+
+  g_free(contents);
+  g_free(path);
+
+  return found;
+}
+
+// The directory of this process's cgroup v2 group, NULL if it's the
+// root group or cgroups v2 aren't used
+static char *own_cgroup_dir(void)
+{
+  char *contents = NULL, *dir = NULL;
+  char **lines;
+
+  if (!g_file_get_contents("/proc/self/cgroup", &contents, NULL, NULL))
+    return NULL;
+
+  lines = g_strsplit(contents, "\n", -1);
+  for (int i = 0; lines[i] && !dir; i++)
+  {
+    if (g_str_has_prefix(lines[i], "0::/") && lines[i][4] != '\0')
+      dir = g_build_filename(CGROUP_ROOT, lines[i] + 3, NULL);
+  }
+
+  g_strfreev(lines);
+  g_free(contents);
+
+  return dir;
+}
+
+// Undoes cgroup_init() as far as other processes let it: Geany and the
+// processes it started meanwhile move back into its own group
+static void cgroup_restore(void)
+{
+  if (gov.cgroup_procs >= 0)
+    close(gov.cgroup_procs);
+  gov.cgroup_procs = -1;
+
+  // Fails while children of another instance are still in it, which
+  // then still need the memory controller
+  if (gov.cgroup_own &&
+      (!gov.cgroup_dir || rmdir(gov.cgroup_dir) == 0 || errno == ENOENT))
+  {
+    char *leaf = g_build_filename(gov.cgroup_own, "geany", NULL);
+    char *procs = g_build_filename(leaf, "cgroup.procs", NULL);
+    char *contents = NULL;
+
+    if (gov.cgroup_enabled)
+      write_file(gov.cgroup_own, "cgroup.subtree_control", "-memory");
+    if (g_file_get_contents(procs, &contents, NULL, NULL))
+    {
+      char **pids = g_strsplit(contents, "\n", -1);
+      for (int i = 0; pids[i]; i++)
+      {
+        if (pids[i][0] != '\0')
+          write_file(gov.cgroup_own, "cgroup.procs", pids[i]);
+      }
+      g_strfreev(pids);
+    }
+    rmdir(leaf);
+
+    g_free(contents);
+    g_free(procs);
+    g_free(leaf);
+  }
+
+  g_free(gov.cgroup_own);
+  g_free(gov.cgroup_dir);
+  gov.cgroup_own = gov.cgroup_dir = NULL;
+  gov.cgroup_enabled = false;
+}
+
+// Groups can't have both processes and children with controllers, so
+// Geany moves into a "geany" leaf next to the "code-format" group for
+// its children. This only works when the group is delegated to the
+// user, for example by running Geany with systemd-run's -p Delegate=yes,
+// and is only done when the use-cgroup setting asks for it.
+static void cgroup_init(void)
+{
+  char *own, *leaf, *control;
+
+  gov.cgroup_tried = true;
+
+  own = own_cgroup_dir();
+  if (!own)
+    return;
+
+  control = g_build_filename(own, "cgroup.subtree_control", NULL);
+  if (!file_has_word(own, "cgroup.controllers", "memory") ||
+      access(control, W_OK) != 0)
+  {
+    g_free(control);
+    g_free(own);
+    return;
+  }
+  g_free(control);
+
+  leaf = g_build_filename(own, "geany", NULL);
+  if ((mkdir(leaf, 0755) != 0 && errno != EEXIST) ||
+      !write_file(leaf, "cgroup.procs", "0"))
+  {
+    rmdir(leaf);
+    g_free(leaf);
+    g_free(own);
+    return;
+  }
+  g_free(leaf);
+  gov.cgroup_own = own;
+
+  if (!file_has_word(own, "cgroup.subtree_control", "memory"))
+  {
+    if (!write_file(own, "cgroup.subtree_control", "+memory"))
+    {
+      cgroup_restore();
+      return;
+    }
+    gov.cgroup_enabled = true;
+  }
+
+  gov.cgroup_dir = g_build_filename(own, "code-format", NULL);
+  if (mkdir(gov.cgroup_dir, 0755) == 0 || errno == EEXIST)
+  {
+    char *procs = g_build_filename(gov.cgroup_dir, "cgroup.procs", NULL);
+    gov.cgroup_procs = open(procs, O_WRONLY | O_CLOEXEC);
+    g_free(procs);
+  }
+
+  if (gov.cgroup_procs < 0)
+    cgroup_restore();
+}
+
+static void cgroup_set_limit(guint64 limit)
+{
+  char *value;
+
+  if (gov.cgroup_procs < 0 || limit == gov.cgroup_limit)
+    return;
+
+  value = g_strdup_printf("%" G_GUINT64_FORMAT, limit);
+  if (write_file(gov.cgroup_dir, "memory.max", value))
+    gov.cgroup_limit = limit;
+  g_free(value);
+}
+#endif
+
+void fmt_governor_prepare_spawn(void)
+{
+  guint64 limit = fmt_governor_get_memory_limit();
+
+#ifdef __linux__
+  bool use_cgroup = fmt_prefs_get_use_cgroup();
+
+  if (limit > 0 && use_cgroup && !gov.cgroup_tried)
+    cgroup_init();
+  if (limit > 0)
+    cgroup_set_limit(limit);
+  gov.child_in_cgroup =
+      use_cgroup && gov.cgroup_procs >= 0 && gov.cgroup_limit == limit;
+#endif
+  gov.child_limit = limit;
+}
+
+void fmt_governor_setup_child(gpointer priority)
+{
+#ifdef G_OS_UNIX
+  // Runs in the child between fork() and exec()
+  if (gov.child_limit > 0)
+  {
+    bool in_cgroup = false;
+#ifdef __linux__
+    in_cgroup = gov.child_in_cgroup && write(gov.cgroup_procs, "0", 1) == 1;
+#endif
+    if (!in_cgroup)
+    {
+      struct rlimit limit;
+      if (getrlimit(RLIMIT_AS, &limit) == 0 &&
+          (limit.rlim_max == RLIM_INFINITY || limit.rlim_max > gov.child_limit))
+      {
+        limit.rlim_cur = limit.rlim_max = gov.child_limit;
+        setrlimit(RLIMIT_AS, &limit);
+      }
+    }
+  }
+
+  if (GPOINTER_TO_INT(priority) == FMT_PROCESS_PRIORITY_LOW)
+  {
+    if (setpriority(PRIO_PROCESS, 0, LOW_PRIORITY_NICE) != 0)
+      errno = 0;
+#if defined(__linux__) && defined(SYS_ioprio_set)
+    {
+      // IOPRIO_WHO_PROCESS, IOPRIO_CLASS_IDLE
+      const int who_process = 1, class_idle = 3, class_shift = 13;
+      syscall(SYS_ioprio_set, who_process, 0, class_idle << class_shift);
+    }
+#endif
+  }
+#endif
+}
+
+void fmt_governor_add(FmtProcessPriority priority)
+{
+  gov.n_children++;
+  if (priority == FMT_PROCESS_PRIORITY_LOW)
+    gov.n_low++;
+}
+
+void fmt_governor_remove(FmtProcessPriority priority, bool suspended)
+{
+  g_return_if_fail(gov.n_children > 0);
+
+  gov.n_children--;
+  if (priority == FMT_PROCESS_PRIORITY_LOW)
+    gov.n_low--;
+  if (suspended)
+    gov.n_suspended--;
+}
+
+void fmt_governor_set_suspended(bool suspended)
+{
+  if (suspended)
+    gov.n_suspended++;
+  else if (gov.n_suspended > 0)
+    gov.n_suspended--;
+}
+
+void fmt_governor_init(void)
+{
+  memset(&gov, 0, sizeof(gov));
+  gov.cgroup_procs = -1;
+}
+
+void fmt_governor_deinit(void)
+{
+#ifdef __linux__
+  cgroup_restore();
+#endif
+  memset(&gov, 0, sizeof(gov));
+  gov.cgroup_procs = -1;
+}
@@ -0,0 +1,70 @@
+/*
+ * governor.h
+ *
+ * Copyright 2013 Matthew <mbrush@codebrainz.ca>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+
+#ifndef FMT_GOVERNOR_H
+#define FMT_GOVERNOR_H
+
+#include "plugin.h"
+#include "process.h"
+
+G_BEGIN_DECLS
+
+/*
+ * Limits the formatting processes run by the process layer: how many
+ * may run at once, how much memory each may use and at which priority
+ * they run. Concurrency for low priority work shrinks while the system
+ * is under memory pressure.
+ */
+
+void fmt_governor_init(void);
+void fmt_governor_deinit(void);
+
+/**
+ * Whether another process of @a priority may be started now. Processes
+ * can still be started when it returns @c false, like when a result is
+ * needed right away, they're counted all the same.
+ */
+bool fmt_governor_may_start(FmtProcessPriority priority);
+
+/**
+ * Whether fmt_governor_may_start() currently refuses low priority work
+ * because of memory pressure, which may change without any process
+ * finishing.
+ */
+bool fmt_governor_is_throttled(void);
+
+/**
+ * The memory limit for each formatting process in bytes, @c 0 for none.
+ * Processes run by the formatting service are given it along with the
+ * request, as they aren't started by this process.
+ */
+guint64 fmt_governor_get_memory_limit(void);
+
+// Used by the process layer
+void fmt_governor_prepare_spawn(void);
+void fmt_governor_setup_child(gpointer priority);
+void fmt_governor_add(FmtProcessPriority priority);
+void fmt_governor_remove(FmtProcessPriority priority, bool suspended);
+void fmt_governor_set_suspended(bool suspended);
+
+G_END_DECLS
+
+#endif // FMT_GOVERNOR_H
@@ -0,0 +1,429 @@
+/*
+ * indent-check.c
+ *
+ * Copyright 2013 Matthew <mbrush@codebrainz.ca>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+
+/*
+ * code-format-indent-check, compares the indentation the plugin gives
+ * new lines with the indentation clang-format gives them.
+ *
+ * Every source file in the fixture directory is formatted with each
+ * preset style, and the files in its sub-directories with the
+ * .clang-format file next to them. Then every line of the result is
+ * indented by fmt_indent_compute() from the formatted text above it,
+ * as if it had just been started, and the two are compared. Lines the
+ * plugin leaves alone (continued comments, strings and directives,
+ * lines holding only a comment) are not counted.
+ *
+ * It exits with status 77, which automake takes as skipped, when
+ * clang-format can't be found.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "dotfile.h"
+#include "indent.h"
+#include "prefs.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define EXIT_SKIP 77
+
+typedef enum
+{
+  LEX_CODE,
+  LEX_LINE_COMMENT,
+  LEX_BLOCK_COMMENT,
+  LEX_STRING,
+  LEX_CHAR,
+  LEX_DIRECTIVE,
+} LexState;
+
+typedef struct
+{
+  const char *clang_format;
+  bool verbose;
+  unsigned int n_lines, n_checked, n_mismatched, n_failed;
+} Check;
+
+static const char *const presets[] = { "LLVM", "Google", "Chromium",
+                                       "Mozilla", "WebKit" };
+
+// The indentation only ever looks at the style from the files
+FmtStyle fmt_prefs_get_style(void)
+{
+  return FORMAT_STYLE_CUSTOM;
+}
+
+const char *fmt_style_get_cmd_name(G_GNUC_UNUSED FmtStyle style)
+{
+  return NULL;
+}
+
+//======================================================================
+//
+// Finding the code
+//
+
+/*
+ * Blanks out comments, strings and preprocessor directives of @a text
+ * into @a code, like the plugin does from Scintilla's styling, and
+ * sets @a inert for every line that starts inside one of them.
+ */
+static void split_code(const char *text, char *code, GArray *inert)
+{
+  LexState state = LEX_CODE;
+  bool line_start = true, escaped = false;
+  size_t len = strlen(text);
+
+  for (size_t i = 0; i < len; i++)
+  {
+    LexState before = state;
+    char c = text[i];
+
+    if (line_start)
+    {
+      bool continued = state != LEX_CODE && state != LEX_LINE_COMMENT;
+      g_array_append_val(inert, continued);
+      line_start = false;
+    }
+
+    if (c == '\n')
+    {
+      // Only comments go on without a backslash
+      if (!escaped && state != LEX_BLOCK_COMMENT)
+        state = LEX_CODE;
+      escaped = false;
+      code[i] = c;
+      line_start = true;
+      continue;
+    }
+    if (escaped)
+    {
+      escaped = false;
+      code[i] = ' ';
+      continue;
+    }
+
+    switch (state)
+    {
+      case LEX_CODE:
+        if (c == '/' && text[i + 1] == '/')
+          state = LEX_LINE_COMMENT;
+        else if (c == '/' && text[i + 1] == '*')
+        {
+          state = LEX_BLOCK_COMMENT;
+          code[i++] = ' ';
+        }
+        else if (c == '"')
+          state = LEX_STRING;
+        else if (c == '\'')
+          state = LEX_CHAR;
+        else if (c == '#')
+        {
+          size_t j = i;
+
+          while (j > 0 && (text[j - 1] == ' ' || text[j - 1] == '\t'))
+            j--;
+          if (j == 0 || text[j - 1] == '\n')
+            state = LEX_DIRECTIVE;
+        }
+        break;
+      case LEX_BLOCK_COMMENT:
+        if (c == '*' && text[i + 1] == '/')
+        {
+          code[i++] = ' ';
+          state = LEX_CODE;
+        }
+        break;
+      case LEX_STRING:
+      case LEX_CHAR:
+        if (c == '\\')
+          escaped = true;
+        else if (c == (state == LEX_STRING ? '"' : '\''))
+          state = LEX_CODE;
+        break;
+      case LEX_DIRECTIVE:
+        escaped = c == '\\';
+        break;
+      case LEX_LINE_COMMENT:
+        break;
+    }
+
+    code[i] = (before != LEX_CODE || state != LEX_CODE) ? ' ' : c;
+  }
+  code[len] = '\0';
+}
+
+//======================================================================
+//
+// Comparing
+//
+
+static char *run_clang_format(Check *check, const char *path,
+                              const char *preset)
+{
+  char *style = g_strdup_printf("-style=%s", preset ? preset : "file");
+  const char *argv[] = { check->clang_format, style, path, NULL };
+  char *out = NULL;
+  int status = 0;
+  GError *error = NULL;
+
+  if (!g_spawn_sync(NULL, (char **)argv, NULL, G_SPAWN_STDERR_TO_DEV_NULL,
+                    NULL, NULL, &out, NULL, &status, &error))
+  {
+    g_printerr("Failed to run %s: %s\n", check->clang_format,
+               error->message);
+    g_error_free(error);
+  }
+  else if (!g_spawn_check_exit_status(status, NULL))
+  {
+    g_printerr("%s failed on %s\n", check->clang_format, path);
+    g_free(out);
+    out = NULL;
+  }
+  g_free(style);
+
+  return out;
+}
+
+static unsigned int visible_width(const char *ws, int len, int tab_width)
+{
+  unsigned int col = 0;
+
+  for (int i = 0; i < len; i++)
+    col = ws[i] == '\t' ? (col / tab_width + 1) * tab_width : col + 1;
+  return col;
+}
+
+static void check_file(Check *check, const char *path, const char *preset)
+{
+  char *text, *code, *dir;
+  GHashTable *options;
+  GArray *inert;
+  const char *line, *value;
+  unsigned int n = 0;
+  int tab_width;
+
+  text = run_clang_format(check, path, preset);
+  if (!text)
+  {
+    check->n_failed++;
+    return;
+  }
+
+  dir = g_path_get_dirname(path);
+  options = fmt_dot_file_options(dir, preset, "Cpp");
+  g_free(dir);
+  if (!options)
+  {
+    g_printerr("Failed to read the style of %s\n", path);
+    check->n_failed++;
+    g_free(text);
+    return;
+  }
+
+  value = g_hash_table_lookup(options, "TabWidth");
+  tab_width = value ? atoi(value) : 8;
+  if (tab_width <= 0)
+    tab_width = 8;
+
+  code = g_malloc(strlen(text) + 1);
+  inert = g_array_new(false, false, sizeof(bool));
+  split_code(text, code, inert);
+
+  for (line = text; *line; n++)
+  {
+    const char *end = strchr(line, '\n');
+    int start = line - text, stop = end ? end - text : (int)strlen(text);
+    int old_len = 0;
+    char saved_text, saved_code, *ws;
+
+    while (line[old_len] == ' ' || line[old_len] == '\t')
+      old_len++;
+
+    check->n_lines++;
+    // Blank lines, directives and lines holding only comments
+    if (n < inert->len && g_array_index(inert, bool, n))
+      ws = NULL;
+    else if (start + old_len == stop || code[start + old_len] == ' ' ||
+             code[start + old_len] == '\n')
+      ws = NULL;
+    else
+    {
+      // The text ends with the line, as in the editor
+      saved_text = text[stop];
+      saved_code = code[stop];
+      text[stop] = code[stop] = '\0';
+      ws = fmt_indent_compute(options, text, code, start, false);
+      text[stop] = saved_text;
+      code[stop] = saved_code;
+    }
+
+    if (ws)
+    {
+      check->n_checked++;
+      if (strlen(ws) != (size_t)old_len || strncmp(ws, line, old_len) != 0)
+      {
+        check->n_mismatched++;
+        g_print("%s:%u: %s: clang-format indents by %u, the plugin by %u\n",
+                path, n + 1, preset ? preset : "file",
+                visible_width(line, old_len, tab_width),
+                visible_width(ws, strlen(ws), tab_width));
+        if (check->verbose)
+          g_print("    %.*s\n", stop - start - old_len, line + old_len);
+      }
+      g_free(ws);
+    }
+
+    line = end ? end + 1 : text + stop;
+  }
+
+  g_array_free(inert, true);
+  g_hash_table_destroy(options);
+  g_free(code);
+  g_free(text);
+}
+
+static bool is_source(const char *name)
+{
+  static const char *const exts[] = { ".c", ".cc", ".cpp", ".cxx",
+                                      ".h", ".hh", ".hpp" };
+
+  for (unsigned int i = 0; i < G_N_ELEMENTS(exts); i++)
+  {
+    if (g_str_has_suffix(name, exts[i]))
+      return true;
+  }
+  return false;
+}
+
+static int compare_names(gconstpointer a, gconstpointer b)
+{
+  return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+// The sorted paths of the entries of @a dir
+static GPtrArray *list_dir(const char *dir)
+{
+  GPtrArray *paths = g_ptr_array_new_with_free_func(g_free);
+  GDir *d = g_dir_open(dir, 0, NULL);
+  const char *name;
+
+  if (!d)
+    return paths;
+  while ((name = g_dir_read_name(d)))
+    g_ptr_array_add(paths, g_build_filename(dir, name, NULL));
+  g_dir_close(d);
+  g_ptr_array_sort(paths, compare_names);
+
+  return paths;
+}
+
+static void check_dir(Check *check, const char *dir)
+{
+  GPtrArray *paths = list_dir(dir);
+
+  for (unsigned int i = 0; i < paths->len; i++)
+  {
+    const char *path = paths->pdata[i];
+
+    if (g_file_test(path, G_FILE_TEST_IS_DIR))
+    {
+      GPtrArray *files = list_dir(path);
+
+      for (unsigned int j = 0; j < files->len; j++)
+      {
+        if (is_source(files->pdata[j]))
+          check_file(check, files->pdata[j], NULL);
+      }
+      g_ptr_array_free(files, true);
+    }
+    else if (is_source(path))
+    {
+      for (unsigned int j = 0; j < G_N_ELEMENTS(presets); j++)
+        check_file(check, path, presets[j]);
+    }
+  }
+  g_ptr_array_free(paths, true);
+}
+
+static void usage(const char *self)
+{
+  g_printerr("Usage: %s [--clang-format PATH] [--verbose] [DIR]\n", self);
+}
+
+int main(int argc, char **argv)
+{
+  Check check = { "clang-format", false, 0, 0, 0, 0 };
+  const char *srcdir = g_getenv("srcdir");
+  char *dir = NULL, *clang_format;
+  int i;
+
+  for (i = 1; i < argc; i++)
+  {
+    if (strcmp(argv[i], "--clang-format") == 0 && i + 1 < argc)
+      check.clang_format = argv[++i];
+    else if (strcmp(argv[i], "--verbose") == 0)
+      check.verbose = true;
+    else if (!dir && argv[i][0] != '-')
+      dir = g_strdup(argv[i]);
+    else
+    {
+      usage(argv[0]);
+      g_free(dir);
+      return 2;
+    }
+  }
+
+  clang_format = g_find_program_in_path(check.clang_format);
+  if (!clang_format)
+  {
+    g_print("%s not found, skipping\n", check.clang_format);
+    g_free(dir);
+    return EXIT_SKIP;
+  }
+  check.clang_format = clang_format;
+
+  // Run by "make check", possibly from another build directory
+  if (!dir)
+    dir = g_build_filename(srcdir ? srcdir : ".", "indent-fixtures", NULL);
+  if (!g_file_test(dir, G_FILE_TEST_IS_DIR))
+  {
+    g_printerr("No fixtures in %s\n", dir);
+    g_free(dir);
+    g_free(clang_format);
+    return 2;
+  }
+
+  check_dir(&check, dir);
+  g_print("%u lines, %u indented by the plugin, %u differently from "
+          "clang-format, %u runs failed\n",
+          check.n_lines, check.n_checked, check.n_mismatched,
+          check.n_failed);
+
+  g_free(dir);
+  g_free(clang_format);
+
+  return check.n_mismatched || check.n_failed || check.n_checked == 0;
+}
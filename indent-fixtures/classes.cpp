@@ -0,0 +1,91 @@
+// Classes, namespaces, templates and extern blocks.
+
+#include <map>
+#include <string>
+#include <vector>
+
+extern "C" {
+int c_function(int value);
+}
+
+namespace outer {
+namespace inner {
+
+template <typename T> class Stack
+{
+public:
+  Stack() : items_(), limit_(64) {}
+
+  void push(const T &item)
+  {
+    if (items_.size() < limit_)
+      items_.push_back(item);
+  }
+
+  T pop()
+  {
+    T item = items_.back();
+    items_.pop_back();
+    return item;
+  }
+
+protected:
+  bool empty() const { return items_.empty(); }
+
+private:
+  std::vector<T> items_;
+  size_t limit_;
+};
+
+struct Point
+{
+  int x, y;
+};
+
+} // namespace inner
+
+class Registry
+{
+public:
+  void add(const std::string &name, int value)
+  {
+    entries_[name] = value;
+  }
+
+  int lookup(const std::string &name, int fallback) const
+  {
+    auto it = entries_.find(name);
+
+    for (const auto &entry : entries_)
+    {
+      if (entry.first == name)
+        return entry.second;
+    }
+    return it != entries_.end() ? it->second : fallback;
+  }
+
+private:
+  std::map<std::string, int> entries_;
+};
+
+} // namespace outer
+
+int use_them(int argument_with_a_long_name, int another_long_argument_name)
+{
+  outer::inner::Stack<int> stack;
+  outer::inner::Point origin = { 0, 0 };
+  std::vector<int> values{ 1, 2, 3 };
+  outer::Registry registry;
+
+  stack.push(argument_with_a_long_name + another_long_argument_name);
+  registry.add("origin", origin.x);
+  try
+  {
+    stack.push(c_function(registry.lookup("origin", 0)));
+  }
+  catch (...)
+  {
+    return -1;
+  }
+  return stack.pop() + values[0];
+}
@@ -0,0 +1,36 @@
+// Tabs, wide indents and indented namespaces.
+
+namespace shapes
+{
+	class Shape
+	{
+	public:
+		virtual ~Shape() {}
+		virtual double area() const = 0;
+		virtual int kind() const = 0;
+
+	protected:
+		int sides;
+	};
+
+	double total_area(const Shape *const *shapes, int count,
+	                  double scale_factor)
+	{
+		double total = 0;
+
+		for (int i = 0; i < count; i++)
+		{
+			switch (shapes[i]->kind())
+			{
+			case 0:
+				total += shapes[i]->area() * scale_factor;
+				break;
+			default:
+				if (count > 1)
+					total += shapes[i]->area();
+				break;
+			}
+		}
+		return total;
+	}
+} // namespace shapes
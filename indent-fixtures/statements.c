@@ -0,0 +1,126 @@
+/*
+ * Statements, blocks and the bodies of control statements.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#define MAX_ITEMS 16
+#define SWAP(a, b)                                                             \
+  do {                                                                         \
+    int tmp = (a);                                                             \
+    (a) = (b);                                                                 \
+    (b) = tmp;                                                                 \
+  } while (0)
+
+struct item
+{
+  const char *name;
+  int weight;
+  struct item *next;
+};
+
+enum colour
+{
+  RED,
+  GREEN,
+  BLUE,
+};
+
+static const int primes[] = { 2, 3, 5, 7, 11, 13 };
+
+static int sum(const int *values, int n)
+{
+  int total = 0;
+
+  for (int i = 0; i < n; i++)
+    total += values[i];
+  return total;
+}
+
+static int classify(int value)
+{
+  if (value < 0)
+    return -1;
+  else if (value == 0)
+    return 0;
+  else
+  {
+    // Positive values are bucketed
+    int bucket = value / 10;
+
+    while (bucket > 3)
+      bucket--;
+    return bucket;
+  }
+}
+
+static const char *colour_name(enum colour c)
+{
+  switch (c)
+  {
+    case RED:
+      return "red";
+    case GREEN:
+    {
+      const char *name = "green";
+      return name;
+    }
+    default:
+      break;
+  }
+  return "blue {";
+}
+
+static int find(struct item *list, const char *name)
+{
+  struct item *it;
+  int index = 0;
+
+  for (it = list; it; it = it->next, index++)
+  {
+    if (strcmp(it->name, name) == 0)
+      goto found;
+  }
+  return -1;
+
+found:
+  printf("found %s at %d with a weight of %d\n", it->name, index,
+         it->weight);
+  return index;
+}
+
+static void report(struct item *list, int count, const char *title,
+                   const char *footer)
+{
+  int weights[MAX_ITEMS];
+  int n = 0;
+
+  /* Collect the weights first, then
+     print them all at once */
+  for (struct item *it = list; it && n < MAX_ITEMS; it = it->next)
+    weights[n++] = it->weight;
+
+  if (n > 1)
+    SWAP(weights[0], weights[1]);
+
+  printf("%s: %d items weighing %d in total, of %d expected, %s\n", title, n,
+         sum(weights, n), count, footer);
+  do
+  {
+    n--;
+  } while (n > 0);
+}
+
+int main(void)
+{
+  struct item b = { "b", 2, NULL };
+  struct item a = { "a", 1, &b };
+  int total_of_the_first_primes_and_some_more =
+    sum(primes, 6) + primes[0] * classify(42);
+
+  report(&a, 2, "items", "done");
+  if (find(&a, "b") < 0 || classify(total_of_the_first_primes_and_some_more))
+    return 1;
+  return colour_name(RED)[0] == 'r' ? 0 : 1;
+}
@@ -0,0 +1,972 @@
+/*
+ * indent.c
+ *
+ * Copyright 2013 Matthew <mbrush@codebrainz.ca>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "indent.h"
+#include "dotfile.h"
+#include "prefs.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// How far back to look for the brackets the new line is in
+#define MAX_SCAN 16384
+
+// Style bit set by the C lexer on code in inactive #if branches
+#define INACTIVE_FLAG 0x40
+
+typedef enum
+{
+  TABS_NEVER,
+  TABS_FOR_INDENTATION,
+  TABS_ALIGN_WITH_SPACES,
+  TABS_ALWAYS, // and ForContinuationAndIndentation
+} TabUse;
+
+typedef enum
+{
+  NAMESPACES_NONE,
+  NAMESPACES_INNER,
+  NAMESPACES_ALL,
+} NamespaceIndent;
+
+// The options indentation depends on, named like clang-format's
+typedef struct
+{
+  const char *name;
+  int indent_width;
+  int continuation_width;
+  int access_offset;
+  bool indent_case_labels;
+  bool indent_case_blocks;
+  bool indent_goto_labels;
+  bool align_brackets; // AlignAfterOpenBracket: Align
+  bool cpp11_lists;    // Cpp11BracedListStyle
+  NamespaceIndent namespaces;
+  bool wrap_extern; // whether extern blocks are indented
+  int tab_width;
+  TabUse tabs;
+} IndentStyle;
+
+// The presets indentation is known for; GNU's indents braces themselves
+static const IndentStyle presets[] = {
+  { "LLVM", 2, 4, -2, false, false, true, true, true, NAMESPACES_NONE,
+    false, 8, TABS_NEVER },
+  { "Google", 2, 4, -1, true, false, true, true, true, NAMESPACES_NONE,
+    false, 8, TABS_NEVER },
+  { "Chromium", 2, 4, -1, true, false, true, true, true, NAMESPACES_NONE,
+    false, 8, TABS_NEVER },
+  { "Mozilla", 2, 2, -2, true, false, true, true, false, NAMESPACES_NONE,
+    true, 8, TABS_NEVER },
+  { "WebKit", 4, 4, -4, false, false, true, false, false, NAMESPACES_INNER,
+    false, 8, TABS_NEVER },
+};
+
+// The leading whitespace of a line, in columns
+typedef struct
+{
+  int block; // of the enclosing blocks
+  int cont;  // continuing a statement
+  int align; // lining up with something on the line above
+} Indent;
+
+// The text before the line being indented, and the same with comments,
+// strings and preprocessor directives blanked out, so that only code is
+// left to look at
+typedef struct
+{
+  const char *text;
+  const char *code;
+  int n;
+  int tab_width;
+  bool truncated; // whether the text doesn't start at the document's
+} Scan;
+
+typedef enum
+{
+  BLOCK_CODE,
+  BLOCK_LIST, // braced initializer list
+  BLOCK_ENUM,
+  BLOCK_RECORD,
+  BLOCK_SWITCH,
+  BLOCK_NAMESPACE,
+  BLOCK_EXTERN,
+} BlockKind;
+
+//======================================================================
+//
+// Style options
+//
+
+static bool parse_bool(const char *value, bool fallback)
+{
+  if (!value)
+    return fallback;
+  return g_ascii_strcasecmp(value, "true") == 0 ||
+         g_ascii_strcasecmp(value, "yes") == 0 ||
+         g_ascii_strcasecmp(value, "on") == 0;
+}
+
+static int parse_int(const char *value, int fallback)
+{
+  char *end;
+  long val;
+
+  if (!value)
+    return fallback;
+  val = strtol(value, &end, 10);
+  return (end != value && *end == '\0') ? (int)val : fallback;
+}
+
+static bool is_value(const char *value, const char *name)
+{
+  return value && g_ascii_strcasecmp(value, name) == 0;
+}
+
+// Fills @a style from clang-format @a options, or returns false when
+// indentation can't be worked out for them
+static bool load_style(GHashTable *options, IndentStyle *style)
+{
+  const char *based_on = g_hash_table_lookup(options, "BasedOnStyle");
+  const char *value;
+  bool found = false;
+
+  for (unsigned int i = 0; i < G_N_ELEMENTS(presets); i++)
+  {
+    if (g_ascii_strcasecmp(based_on, presets[i].name) == 0)
+    {
+      *style = presets[i];
+      found = true;
+      break;
+    }
+  }
+  if (!found || parse_bool(g_hash_table_lookup(options, "DisableFormat"),
+                           false))
+    return false;
+
+#define OPTION(name) ((const char *)g_hash_table_lookup(options, name))
+
+  style->indent_width =
+      MAX(parse_int(OPTION("IndentWidth"), style->indent_width), 0);
+  style->continuation_width = MAX(
+      parse_int(OPTION("ContinuationIndentWidth"), style->continuation_width),
+      0);
+  style->access_offset =
+      parse_int(OPTION("AccessModifierOffset"), style->access_offset);
+  style->indent_case_labels =
+      parse_bool(OPTION("IndentCaseLabels"), style->indent_case_labels);
+  style->indent_case_blocks =
+      parse_bool(OPTION("IndentCaseBlocks"), style->indent_case_blocks);
+  style->indent_goto_labels =
+      parse_bool(OPTION("IndentGotoLabels"), style->indent_goto_labels);
+  style->cpp11_lists =
+      parse_bool(OPTION("Cpp11BracedListStyle"), style->cpp11_lists);
+  style->tab_width = MAX(parse_int(OPTION("TabWidth"), style->tab_width), 1);
+
+  value = OPTION("AlignAfterOpenBracket");
+  if (value)
+  {
+    style->align_brackets =
+        is_value(value, "Align") || parse_bool(value, false);
+  }
+
+  value = OPTION("NamespaceIndentation");
+  if (is_value(value, "None"))
+    style->namespaces = NAMESPACES_NONE;
+  else if (is_value(value, "Inner"))
+    style->namespaces = NAMESPACES_INNER;
+  else if (is_value(value, "All"))
+    style->namespaces = NAMESPACES_ALL;
+
+  value = OPTION("UseTab");
+  if (is_value(value, "Never") || is_value(value, "false"))
+    style->tabs = TABS_NEVER;
+  else if (is_value(value, "ForIndentation"))
+    style->tabs = TABS_FOR_INDENTATION;
+  else if (is_value(value, "AlignWithSpaces"))
+    style->tabs = TABS_ALIGN_WITH_SPACES;
+  else if (value)
+    style->tabs = TABS_ALWAYS;
+
+  // Braces wrapped GNU's and Whitesmiths' way get indented themselves
+  value = OPTION("BreakBeforeBraces");
+  if (is_value(value, "GNU") || is_value(value, "Whitesmiths"))
+    return false;
+  else if (is_value(value, "Allman") || is_value(value, "Mozilla"))
+    style->wrap_extern = true;
+  else if (is_value(value, "Custom"))
+  {
+    if (parse_bool(OPTION("BraceWrapping.IndentBraces"), false))
+      return false;
+    style->wrap_extern = parse_bool(OPTION("BraceWrapping.AfterExternBlock"),
+                                    style->wrap_extern);
+  }
+  else if (value)
+    style->wrap_extern = false;
+
+  value = OPTION("IndentExternBlock");
+  if (is_value(value, "Indent") || is_value(value, "true"))
+    style->wrap_extern = true;
+  else if (is_value(value, "NoIndent") || is_value(value, "false"))
+    style->wrap_extern = false;
+
+#undef OPTION
+
+  return true;
+}
+
+static GHashTable *get_options(GeanyDocument *doc)
+{
+  FmtStyle preset = fmt_prefs_get_style();
+  const char *language;
+  GHashTable *options;
+  char *dir;
+
+  if (doc->real_path)
+    dir = g_path_get_dirname(doc->real_path);
+  else
+    dir = g_get_current_dir();
+  language = doc->file_type->id == GEANY_FILETYPES_OBJECTIVEC ? "ObjC" : "Cpp";
+
+  options = fmt_dot_file_options(
+      dir,
+      preset != FORMAT_STYLE_CUSTOM ? fmt_style_get_cmd_name(preset) : NULL,
+      language);
+  g_free(dir);
+
+  return options;
+}
+
+//======================================================================
+//
+// Scanning
+//
+
+static bool is_word_char(char c)
+{
+  return g_ascii_isalnum(c) || c == '_';
+}
+
+// Whether @a str starts with the keyword @a word
+static bool starts_with_word(const char *str, const char *word)
+{
+  size_t len = strlen(word);
+  return strncmp(str, word, len) == 0 && !is_word_char(str[len]);
+}
+
+static bool word_at(const Scan *s, int i, const char *word)
+{
+  return i < s->n && (i == 0 || !is_word_char(s->code[i - 1])) &&
+         starts_with_word(s->code + i, word);
+}
+
+static int word_end(const Scan *s, int i)
+{
+  while (i < s->n && is_word_char(s->code[i]))
+    i++;
+  return i;
+}
+
+// The last code before @a i, or -1
+static int prev_code(const Scan *s, int i)
+{
+  while (--i >= 0 && g_ascii_isspace(s->code[i]))
+    ;
+  return i;
+}
+
+// The first code at or after @a i, or the end
+static int next_code(const Scan *s, int i)
+{
+  while (i < s->n && g_ascii_isspace(s->code[i]))
+    i++;
+  return i;
+}
+
+// The first token at or after @a i on the same line, which may be a
+// string or comment, or the end when only a line comment follows
+static int next_on_line(const Scan *s, int i)
+{
+  while (i < s->n && (s->text[i] == ' ' || s->text[i] == '\t'))
+    i++;
+  if (i < s->n && (s->text[i] == '\n' || s->text[i] == '\r' ||
+                   strncmp(s->text + i, "//", 2) == 0))
+    return s->n;
+  return i;
+}
+
+static int line_start(const Scan *s, int i)
+{
+  while (i > 0 && s->text[i - 1] != '\n')
+    i--;
+  return i;
+}
+
+static int column(const Scan *s, int i)
+{
+  int col = 0;
+
+  for (int j = line_start(s, i); j < i; j++)
+  {
+    if (s->text[j] == '\t')
+      col = (col / s->tab_width + 1) * s->tab_width;
+    else if (((unsigned char)s->text[j] & 0xC0) != 0x80)
+      col++;
+  }
+  return col;
+}
+
+static int line_indent(const Scan *s, int i)
+{
+  int j = line_start(s, i);
+  while (j < s->n && (s->text[j] == ' ' || s->text[j] == '\t'))
+    j++;
+  return column(s, j);
+}
+
+static bool is_colon(const Scan *s, int i)
+{
+  return s->code[i] == ':' && s->code[i + 1] != ':' &&
+         (i == 0 || s->code[i - 1] != ':');
+}
+
+// The innermost bracket still open at @a to, or -1
+static int find_opener(const Scan *s, int to)
+{
+  int depth = 0;
+
+  for (int i = to - 1; i >= 0; i--)
+  {
+    switch (s->code[i])
+    {
+      case ')':
+      case ']':
+      case '}':
+        depth++;
+        break;
+      case '(':
+      case '[':
+      case '{':
+        if (depth == 0)
+          return i;
+        depth--;
+        break;
+    }
+  }
+  return -1;
+}
+
+static int match_close(const Scan *s, int open)
+{
+  int depth = 0;
+
+  for (int i = open; i < s->n; i++)
+  {
+    if (s->code[i] == '(' || s->code[i] == '[' || s->code[i] == '{')
+      depth++;
+    else if (s->code[i] == ')' || s->code[i] == ']' || s->code[i] == '}')
+    {
+      if (--depth == 0)
+        return i;
+    }
+  }
+  return -1;
+}
+
+// The colon ending a label, like "case 1:", "public:" or a goto target,
+// that starts at @a i, or -1
+static int label_end(const Scan *s, int i)
+{
+  static const char *const access[] = { "public", "protected", "private",
+                                        "signals", "Q_SIGNALS" };
+  int end, j;
+
+  if (word_at(s, i, "case") || word_at(s, i, "default"))
+  {
+    for (j = i; j < s->n; j++)
+    {
+      if (s->code[j] == ';' || s->code[j] == '{' || s->code[j] == '}')
+        return -1;
+      if (is_colon(s, j))
+        return j;
+    }
+    return -1;
+  }
+
+  end = word_end(s, i);
+  if (end == i)
+    return -1;
+  j = next_code(s, end);
+
+  // Qt's "public slots:"
+  for (unsigned int k = 0; k < G_N_ELEMENTS(access); k++)
+  {
+    if (word_at(s, i, access[k]) && j < s->n && is_word_char(s->code[j]))
+    {
+      j = next_code(s, word_end(s, j));
+      break;
+    }
+  }
+
+  return (j < s->n && is_colon(s, j)) ? j : -1;
+}
+
+static int skip_labels(const Scan *s, int i)
+{
+  int colon;
+
+  while ((colon = label_end(s, i)) >= 0)
+    i = next_code(s, colon + 1);
+  return i;
+}
+
+// The start of the statement that @a to is in, after the previous one
+// or the enclosing bracket
+static int statement_start(const Scan *s, int to)
+{
+  int depth = 0, i;
+
+  for (i = to - 1; i >= 0; i--)
+  {
+    char c = s->code[i];
+    if (c == ')' || c == ']')
+      depth++;
+    else if (c == '(' || c == '[')
+    {
+      if (depth == 0)
+        break;
+      depth--;
+    }
+    else if (depth == 0 && (c == ';' || c == '{' || c == '}'))
+      break;
+  }
+
+  return next_code(s, i + 1);
+}
+
+// Skips the heads of control statements, like "if (x)" or "else", that
+// start at @a i, to the statement they control. Sets @a body when one
+// ends right at @a last, so that its statement is yet to come.
+static int skip_control(const Scan *s, int i, int last, bool *body)
+{
+  static const char *const conditions[] = { "if", "for", "while", "switch" };
+
+  *body = false;
+  for (;;)
+  {
+    int end = -1;
+
+    if (word_at(s, i, "else") || word_at(s, i, "do"))
+      end = word_end(s, i) - 1;
+    for (unsigned int k = 0; end < 0 && k < G_N_ELEMENTS(conditions); k++)
+    {
+      int j;
+
+      if (!word_at(s, i, conditions[k]))
+        continue;
+      j = next_code(s, word_end(s, i));
+      if (word_at(s, j, "constexpr"))
+        j = next_code(s, word_end(s, j));
+      if (j < s->n && s->code[j] == '(')
+        end = match_close(s, j);
+      if (end < 0)
+        return i;
+    }
+
+    if (end < 0)
+      return i;
+    if (end >= last)
+    {
+      *body = true;
+      return i;
+    }
+    i = next_code(s, end + 1);
+  }
+}
+
+// Where the statement that the brace at @a open belongs to starts
+static int brace_head(const Scan *s, int open)
+{
+  bool body;
+  int head = skip_labels(s, statement_start(s, open));
+  return skip_control(s, head, prev_code(s, open), &body);
+}
+
+static BlockKind block_kind(const Scan *s, int open, int head)
+{
+  static const char *const records[] = { "class", "struct", "union" };
+  int prev = prev_code(s, open);
+  int depth = 0;
+
+  if (prev >= 0)
+  {
+    char c = s->code[prev];
+    if (c == '=' || c == ',' || c == '(' || c == '[')
+      return BLOCK_LIST;
+    if (c == '{')
+    {
+      return block_kind(s, prev, brace_head(s, prev)) == BLOCK_LIST
+                 ? BLOCK_LIST
+                 : BLOCK_CODE;
+    }
+    if (is_word_char(c))
+    {
+      int start = prev;
+      while (start > 0 && is_word_char(s->code[start - 1]))
+        start--;
+      if (word_at(s, start, "return"))
+        return BLOCK_LIST;
+    }
+  }
+
+  if (word_at(s, head, "namespace") ||
+      (word_at(s, head, "inline") &&
+       word_at(s, next_code(s, word_end(s, head)), "namespace")))
+    return BLOCK_NAMESPACE;
+  if (word_at(s, head, "extern"))
+    return BLOCK_EXTERN;
+  if (word_at(s, head, "switch"))
+    return BLOCK_SWITCH;
+
+  // Declarations can come after "typedef", "template <...>", ...
+  for (int i = head; i < open; i++)
+  {
+    if (s->code[i] == '(')
+      depth++;
+    else if (s->code[i] == ')')
+      depth--;
+    if (depth != 0)
+      continue;
+    if (word_at(s, i, "enum"))
+      return BLOCK_ENUM;
+    for (unsigned int k = 0; k < G_N_ELEMENTS(records); k++)
+    {
+      if (word_at(s, i, records[k]))
+        return BLOCK_RECORD;
+    }
+  }
+
+  return BLOCK_CODE;
+}
+
+// How much further than its head the contents of a block are indented
+static int block_offset(const Scan *s, const IndentStyle *style, int open,
+                        int head, BlockKind kind)
+{
+  int outer;
+
+  switch (kind)
+  {
+    case BLOCK_SWITCH:
+      return style->indent_case_labels ? style->indent_width : 0;
+    case BLOCK_EXTERN:
+      return style->wrap_extern ? style->indent_width : 0;
+    case BLOCK_NAMESPACE:
+      if (style->namespaces == NAMESPACES_ALL)
+        return style->indent_width;
+      if (style->namespaces == NAMESPACES_NONE)
+        return 0;
+      outer = find_opener(s, head);
+      return (outer >= 0 && s->code[outer] == '{' &&
+              block_kind(s, outer, brace_head(s, outer)) == BLOCK_NAMESPACE)
+                 ? style->indent_width
+                 : 0;
+    default:
+      return style->indent_width;
+  }
+}
+
+// Whether a case label of the switch block at @a open came before @a to
+static bool in_case(const Scan *s, int open, int to)
+{
+  int depth = 0;
+
+  for (int i = to - 1; i > open; i--)
+  {
+    char c = s->code[i];
+    if (c == ')' || c == ']' || c == '}')
+      depth++;
+    else if (c == '(' || c == '[' || c == '{')
+      depth--;
+    else if (depth == 0 && (word_at(s, i, "case") || word_at(s, i, "default")))
+      return true;
+  }
+  return false;
+}
+
+// Whether the line starting with @a first is a goto target
+static bool is_goto_label(const char *first)
+{
+  const char *end = first;
+
+  while (is_word_char(*end))
+    end++;
+  if (end == first || starts_with_word(first, "default"))
+    return false;
+  while (*end == ' ' || *end == '\t')
+    end++;
+  return end[0] == ':' && end[1] != ':';
+}
+
+static bool is_access_label(const char *first)
+{
+  static const char *const access[] = { "public", "protected", "private",
+                                        "signals", "Q_SIGNALS" };
+
+  for (unsigned int k = 0; k < G_N_ELEMENTS(access); k++)
+  {
+    if (starts_with_word(first, access[k]))
+      return true;
+  }
+  return false;
+}
+
+// Works out the indentation of a line starting with the code @a first
+// after the text of @a s
+static bool compute_indent(const Scan *s, const IndentStyle *style,
+                           const char *first, Indent *indent)
+{
+  int open = find_opener(s, s->n);
+  int last = prev_code(s, s->n);
+  BlockKind kind = BLOCK_CODE;
+  int head = -1, base = 0, inner = 0;
+  bool fresh, body;
+  int start;
+
+  memset(indent, 0, sizeof(Indent));
+
+  // Directives go where they are typed
+  if (*first == '#')
+    return false;
+
+  if (open >= 0 && s->code[open] == '{')
+  {
+    head = brace_head(s, open);
+    kind = block_kind(s, open, head);
+  }
+
+  // C++11 braced lists are laid out like the arguments of a call
+  if (open >= 0 && (s->code[open] != '{' ||
+                    (kind == BLOCK_LIST && style->cpp11_lists)))
+  {
+    int arg = next_on_line(s, open + 1);
+
+    indent->block = line_indent(s, open);
+    if (*first == ')' || *first == ']' || *first == '}')
+      return true;
+    if (style->align_brackets && arg < s->n)
+      indent->align = column(s, arg) - indent->block;
+    else
+      indent->cont = style->continuation_width;
+    return true;
+  }
+
+  // Without the enclosing brace it's unclear where the line belongs
+  if (open < 0 && s->truncated)
+    return false;
+
+  if (open >= 0)
+  {
+    base = line_indent(s, head);
+    inner = base + block_offset(s, style, open, head, kind);
+  }
+
+  if (*first == '}')
+  {
+    indent->block = base;
+    return true;
+  }
+  if (kind == BLOCK_SWITCH && (starts_with_word(first, "case") ||
+                               starts_with_word(first, "default")))
+  {
+    indent->block = inner;
+    return true;
+  }
+  if (kind == BLOCK_RECORD && is_access_label(first))
+  {
+    indent->block = MAX(inner + style->access_offset, 0);
+    return true;
+  }
+
+  // Does the line start a new statement?
+  start = statement_start(s, s->n);
+  if (last <= open)
+    fresh = true;
+  else if (strchr(";{}", s->code[last]))
+    fresh = true;
+  else if (s->code[last] == ':')
+    fresh = skip_labels(s, start) > last;
+  else
+    fresh = s->code[last] == ',' &&
+            (kind == BLOCK_LIST || kind == BLOCK_ENUM);
+
+  if (fresh)
+  {
+    // Goto targets go one level out, or to the start of the line
+    if (open >= 0 && kind == BLOCK_CODE && is_goto_label(first))
+    {
+      indent->block = style->indent_goto_labels ? base : 0;
+      return true;
+    }
+    indent->block = inner;
+    // A block right after a case label lines up with it by default
+    if (kind == BLOCK_SWITCH && in_case(s, open, s->n) &&
+        (*first != '{' || s->code[last] != ':' || style->indent_case_blocks))
+      indent->block += style->indent_width;
+    return true;
+  }
+
+  // It continues one, or it's the body of an if, else, for, ...
+  start = skip_control(s, skip_labels(s, start), last, &body);
+  indent->block = line_indent(s, start);
+  if (body)
+  {
+    if (*first != '{')
+      indent->block += style->indent_width;
+    return true;
+  }
+
+  // A function's body after its head, where declarations go
+  if (*first == '{' ||
+      (s->code[last] == ')' &&
+       (open < 0 || kind == BLOCK_NAMESPACE || kind == BLOCK_EXTERN ||
+        kind == BLOCK_RECORD)))
+    return true;
+
+  indent->cont = style->continuation_width;
+  return true;
+}
+
+//======================================================================
+//
+// Documents
+//
+
+static bool is_inert_style(int lexer, int style)
+{
+  if (lexer == SCLEX_CPP)
+  {
+    style &= ~INACTIVE_FLAG;
+    if (style == SCE_C_PREPROCESSOR)
+      return true;
+  }
+  return highlighting_is_string_style(lexer, style) ||
+         highlighting_is_comment_style(lexer, style);
+}
+
+// Whether @a line starts inside a comment, string or directive from the
+// line before
+static bool continues_inert(ScintillaObject *sci, int line)
+{
+  int style, end;
+
+  if (line == 0)
+    return false;
+
+  end = sci_get_line_end_position(sci, line - 1);
+  style = sci_get_style_at(sci, sci_get_position_from_line(sci, line) - 1) &
+          ~INACTIVE_FLAG;
+  if (style == SCE_C_COMMENTLINE || style == SCE_C_COMMENTLINEDOC)
+    return false;
+  if (style == SCE_C_PREPROCESSOR)
+    return end > 0 && sci_get_char_at(sci, end - 1) == '\\';
+  return is_inert_style(SCLEX_CPP, style);
+}
+
+// Splits interleaved characters and styles of @a len bytes into the
+// text and its code alone
+static void split_styled(const char *styled, int len, char *text, char *code)
+{
+  bool at_line_start = true, directive = false, continued = false;
+
+  for (int i = 0; i < len; i++)
+  {
+    char c = styled[2 * i];
+    bool inert;
+
+    text[i] = c;
+    if (c == '\n' || c == '\r')
+    {
+      code[i] = c;
+      // Directives go on while lines end with a backslash
+      directive = directive && continued;
+      at_line_start = true;
+      if (c == '\n' || styled[2 * i + 2] != '\n')
+        continued = false;
+      continue;
+    }
+    inert = is_inert_style(SCLEX_CPP, (unsigned char)styled[2 * i + 1]);
+    continued = c == '\\';
+    if (at_line_start && !g_ascii_isspace(c))
+    {
+      at_line_start = false;
+      directive = directive || (c == '#' && !inert);
+    }
+    if (directive || inert)
+      code[i] = ' ';
+    else
+      code[i] = c;
+  }
+  text[len] = code[len] = '\0';
+}
+
+// Lays out @a indent with tabs or spaces, like clang-format would
+static char *make_indent(const IndentStyle *style, const Indent *indent)
+{
+  int total = indent->block + indent->cont + indent->align;
+  int tabbed = 0;
+  GString *str;
+
+  switch (style->tabs)
+  {
+    case TABS_NEVER:
+      break;
+    case TABS_FOR_INDENTATION:
+      tabbed = indent->block;
+      break;
+    case TABS_ALIGN_WITH_SPACES:
+      tabbed = indent->block + indent->cont;
+      break;
+    case TABS_ALWAYS:
+      tabbed = total;
+      break;
+  }
+
+  str = g_string_sized_new(total);
+  for (int i = 0; i < tabbed / style->tab_width; i++)
+    g_string_append_c(str, '\t');
+  for (int i = (tabbed / style->tab_width) * style->tab_width; i < total;
+       i++)
+    g_string_append_c(str, ' ');
+
+  return g_string_free(str, false);
+}
+
+char *fmt_indent_compute(GHashTable *options, const char *text,
+                         const char *code, int start, bool truncated)
+{
+  IndentStyle style;
+  Indent indent;
+  Scan scan;
+  const char *first;
+
+  if (!load_style(options, &style))
+    return NULL;
+
+  scan.text = text;
+  scan.code = code;
+  scan.n = start;
+  scan.tab_width = style.tab_width;
+  scan.truncated = truncated;
+
+  first = code + start;
+  while (g_ascii_isspace(*first))
+    first++;
+  if (!compute_indent(&scan, &style, first, &indent))
+    return NULL;
+
+  return make_indent(&style, &indent);
+}
+
+bool fmt_indent_line(GeanyDocument *doc, int line)
+{
+  ScintillaObject *sci;
+  GHashTable *options;
+  struct Sci_TextRange tr;
+  char *text, *code, *ws;
+  int start, end, from, old_end, pos, len;
+
+  g_return_val_if_fail(DOC_VALID(doc), false);
+
+  sci = doc->editor->sci;
+  if (sci_get_lexer(sci) != SCLEX_CPP)
+    return false;
+
+  start = sci_get_position_from_line(sci, line);
+  end = sci_get_line_end_position(sci, line);
+
+  // Styling normally lags behind typing until the next redraw
+  if (scintilla_send_message(sci, SCI_GETENDSTYLED, 0, 0) < end)
+  {
+    int styled_line = sci_get_line_from_position(
+        sci, scintilla_send_message(sci, SCI_GETENDSTYLED, 0, 0));
+    scintilla_send_message(sci, SCI_COLOURISE,
+                           sci_get_position_from_line(sci, styled_line), end);
+  }
+  if (continues_inert(sci, line))
+    return false;
+
+  options = get_options(doc);
+  if (!options)
+    return false;
+
+  from = MAX(0, start - MAX_SCAN);
+  if (from > 0)
+    from = sci_get_position_from_line(
+        sci, sci_get_line_from_position(sci, from) + 1);
+
+  tr.chrg.cpMin = from;
+  tr.chrg.cpMax = end;
+  tr.lpstrText = g_malloc(2 * (size_t)(end - from) + 2);
+  scintilla_send_message(sci, SCI_GETSTYLEDTEXT, 0, (sptr_t)&tr);
+  text = g_malloc((size_t)(end - from) + 1);
+  code = g_malloc((size_t)(end - from) + 1);
+  split_styled(tr.lpstrText, end - from, text, code);
+  g_free(tr.lpstrText);
+
+  old_end = start - from;
+  while (old_end < end - from &&
+         (text[old_end] == ' ' || text[old_end] == '\t'))
+    old_end++;
+  old_end += from;
+
+  ws = fmt_indent_compute(options, text, code, start - from, from > 0);
+  g_hash_table_destroy(options);
+  g_free(text);
+  g_free(code);
+  if (!ws)
+    return false;
+
+  len = strlen(ws);
+
+  // Leave the document untouched when Geany already got it right
+  if (len != old_end - start ||
+      strncmp(ws, (const char *)scintilla_send_message(
+                      sci, SCI_GETRANGEPOINTER, start, len),
+              len) != 0)
+  {
+    pos = sci_get_current_position(sci);
+    scintilla_send_message(sci, SCI_SETTARGETSTART, start, 0);
+    scintilla_send_message(sci, SCI_SETTARGETEND, old_end, 0);
+    scintilla_send_message(sci, SCI_REPLACETARGET, len, (sptr_t)ws);
+    if (pos >= start && pos <= old_end)
+      pos = start + len;
+    else if (pos > old_end)
+      pos += len - (old_end - start);
+    scintilla_send_message(sci, SCI_GOTOPOS, pos, 0);
+  }
+  g_free(ws);
+
+  return true;
+}
@@ -0,0 +1,62 @@
+/*
+ * indent.h
+ *
+ * Copyright 2013 Matthew <mbrush@codebrainz.ca>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+
+#ifndef FMT_INDENT_H
+#define FMT_INDENT_H
+
+#include "plugin.h"
+
+G_BEGIN_DECLS
+
+/**
+ * Indents @a line of @a doc the way clang-format would, without running
+ * it, using the indentation options of the formatting style and the
+ * brackets and statements above the line.
+ *
+ * Meant for lines just started with Enter, so only the start of the
+ * line is looked at. Lines continuing a comment, string or preprocessor
+ * directive, and documents whose style isn't known well enough (GNU and
+ * Microsoft based styles, or indented braces), are left alone.
+ *
+ * @return Whether the line's indentation is the computed one now.
+ */
+bool fmt_indent_line(GeanyDocument *doc, int line);
+
+/**
+ * Works out the indentation of the line starting at @a start in
+ * @a text, without a document, for fmt_indent_line() and the indent
+ * check.
+ *
+ * @param options The style's options, from fmt_dot_file_options().
+ * @param text The text up to the end of the line.
+ * @param code The same, with comments, strings and preprocessor
+ *   directives replaced by spaces.
+ * @param start The offset of the line in @a text and @a code.
+ * @param truncated Whether @a text starts after the document does.
+ * @return The newly allocated leading whitespace, or @c NULL when the
+ *   line is left alone.
+ */
+char *fmt_indent_compute(GHashTable *options, const char *text,
+                         const char *code, int start, bool truncated);
+
+G_END_DECLS
+
+#endif // FMT_INDENT_H
@@ -23,9 +23,24 @@
 #include "config.h"
 #endif
 
+#include "apply.h"
+#include "breaker.h"
+#include "check.h"
+#include "diff.h"
+#include "docstate.h"
 #include "format.h"
+#include "governor.h"
+#include "indent.h"
 #include "prefs.h"
+#include "rebase.h"
+#include "project.h"
+#include "sched.h"
+#include "speculate.h"
+#include "stats.h"
 #include "style.h"
+#include "trace.h"
+#include "trigger.h"
+#include "verify.h"
 #include "plugin.h"
 
 #ifndef _
@@ -46,11 +61,28 @@ enum
   FORMAT_KEY_REGION,
   FORMAT_KEY_DOCUMENT,
   FORMAT_KEY_SESSION,
+  FORMAT_KEY_CHECK_DOCUMENT,
+  FORMAT_KEY_CHECK_SESSION,
+  FORMAT_KEY_PROJECT,
+  FORMAT_KEY_CHECK_PROJECT,
+  FORMAT_KEY_COUNT,
 };
 
-static GtkWidget *main_menu_item = NULL;
+// How long typing must pause before a deferred auto-format runs
+#define DEFER_DELAY_MS 1000
+
+// Recently used documents formatted ahead of time by lazy session formatting
+#define LAZY_PREFORMAT_DOCS 3
 
-static bool fmt_is_supported_ft(GeanyDocument *doc)
+static GtkWidget *main_menu_item = NULL;
+static GeanyDocument *defer_doc = NULL;
+static unsigned int defer_timer = 0;
+// Pasted text waiting for the paste to finish before it's formatted
+static GeanyDocument *paste_doc = NULL;
+static size_t paste_start = 0, paste_end = 0;
+static unsigned int paste_idle = 0;
+
+bool fmt_is_supported_ft(GeanyDocument *doc)
 {
   int id;
   if (!DOC_VALID(doc))
@@ -62,42 +94,173 @@ static bool fmt_is_supported_ft(GeanyDocument *doc)
           id == GEANY_FILETYPES_OBJECTIVEC);
 }
 
-static void do_format(GeanyDocument *doc, bool entire_doc, bool autof);
+static void do_format(GeanyDocument *doc, bool entire_doc,
+                      FmtJobClass job_class);
 static void do_format_session(void);
+static void do_format_changed_lines(GeanyDocument *doc);
+static void do_auto_format(GeanyDocument *doc, int ch);
+static void schedule_deferred_format(GeanyDocument *doc);
+static gboolean on_paste_idle(gpointer user_data);
 
 bool on_key_binding(int key_id)
 {
+  // Project wide actions don't depend on the current document
+  if (key_id == FORMAT_KEY_PROJECT || key_id == FORMAT_KEY_CHECK_PROJECT)
+  {
+    fmt_project_run(key_id == FORMAT_KEY_CHECK_PROJECT);
+    return true;
+  }
   if (!fmt_is_supported_ft(NULL))
     return true;
   switch (key_id)
   {
     case FORMAT_KEY_REGION:
-      do_format(NULL, false, false);
+      do_format(NULL, false, FMT_JOB_EXPLICIT);
       break;
     case FORMAT_KEY_DOCUMENT:
-      do_format(NULL, true, false);
+      do_format(NULL, true, FMT_JOB_EXPLICIT);
       break;
     case FORMAT_KEY_SESSION:
       do_format_session();
       break;
+    case FORMAT_KEY_CHECK_DOCUMENT:
+      msgwin_clear_tab(MSG_MESSAGE);
+      msgwin_switch_tab(MSG_MESSAGE, false);
+      fmt_check_document(document_get_current(), FMT_JOB_EXPLICIT, true);
+      break;
+    case FORMAT_KEY_CHECK_SESSION:
+      fmt_check_session();
+      break;
     default:
       return false;
   }
   return true;
 }
 
+// Whether an insertion looks like pasted (or dropped) code, rather than
+// typing, indentation or the plugin's own changes
+static bool is_paste(GeanyDocument *doc, SCNotification *notif)
+{
+  FmtDocState *state = fmt_doc_state_lookup(doc);
+
+  if (!(notif->modificationType & SC_PERFORMED_USER) || notif->length < 2 ||
+      !notif->text || (state && state->apply))
+    return false;
+
+  // Reloading the document inserts all of its text
+  if (notif->length >= sci_get_length(doc->editor->sci))
+    return false;
+
+  if (!memchr(notif->text, '\n', notif->length) &&
+      !memchr(notif->text, '\r', notif->length))
+    return false;
+
+  for (int i = 0; i < notif->length; i++)
+  {
+    if (!g_ascii_isspace(notif->text[i]))
+      return true;
+  }
+  return false;
+}
+
+// Where position @a p ends up after an edit at @a pos
+static size_t shift_position(size_t p, size_t pos, size_t deleted,
+                             size_t inserted)
+{
+  if (p <= pos)
+    return p;
+  if (p < pos + deleted)
+    return pos;
+  return p - deleted + inserted;
+}
+
+// Keeps the pasted range over edits made before it gets formatted, and
+// joins further pastes (eg. at other carets) to it
+static void note_paste_edit(GeanyDocument *doc, SCNotification *notif,
+                            bool inserted)
+{
+  size_t pos = notif->position;
+  size_t del = inserted ? 0 : notif->length;
+  size_t ins = inserted ? notif->length : 0;
+
+  if (paste_idle > 0 && paste_doc == doc)
+  {
+    paste_start = shift_position(paste_start, pos, del, ins);
+    paste_end = shift_position(paste_end, pos, del, ins);
+  }
+
+  if (!inserted || !is_paste(doc, notif))
+    return;
+
+  if (paste_idle > 0 && paste_doc == doc)
+  {
+    paste_start = MIN(paste_start, pos);
+    paste_end = MAX(paste_end, pos + ins);
+    return;
+  }
+
+  if (paste_idle > 0)
+    g_source_remove(paste_idle);
+  paste_doc = doc;
+  paste_start = pos;
+  paste_end = pos + ins;
+  paste_idle = g_idle_add(on_paste_idle, NULL);
+}
+
+// Whether typing @a ch ended a line, with CRLF ends seen at the LF
+static bool is_new_line(ScintillaObject *sci, int ch)
+{
+  if (ch == '\r')
+    return sci_get_eol_mode(sci) == SC_EOL_CR;
+  return ch == '\n' && sci_get_eol_mode(sci) != SC_EOL_CR;
+}
+
 static gboolean on_editor_notify(G_GNUC_UNUSED GObject *obj,
                                  G_GNUC_UNUSED GeanyEditor *editor,
                                  SCNotification *notif,
                                  G_GNUC_UNUSED gpointer user_data)
 {
-  if (fmt_prefs_get_auto_format() && fmt_is_supported_ft(editor->document) &&
-      notif->nmhdr.code == SCN_CHARADDED)
+  if (notif->nmhdr.code == SCN_MODIFIED &&
+      (notif->modificationType & (SC_MOD_INSERTTEXT | SC_MOD_DELETETEXT)))
   {
-    if (strchr(fmt_prefs_get_trigger(), notif->ch) != NULL)
-      do_format(NULL, true, true); // FIXME: is it better to use region/line
-                                   // for
-                                   // auto-format?
+    // Invalidates results of formatting jobs still in flight, which
+    // get rebased over the logged edits
+    FmtDocState *state = fmt_doc_state_lookup(editor->document);
+    bool inserted = notif->modificationType & SC_MOD_INSERTTEXT;
+    if (state && inserted)
+      fmt_doc_state_record_edit(state, notif->position, 0, notif->length);
+    else if (state)
+      fmt_doc_state_record_edit(state, notif->position, notif->length, 0);
+    if (fmt_is_supported_ft(editor->document))
+    {
+      fmt_trace_edit(editor->document, notif->position,
+                     inserted ? 0 : notif->length, notif->text,
+                     inserted ? notif->length : 0);
+    }
+    if (fmt_prefs_get_auto_format() && fmt_prefs_get_format_on_paste() &&
+        fmt_is_supported_ft(editor->document))
+      note_paste_edit(editor->document, notif, inserted);
+    fmt_check_schedule_idle(editor->document);
+    fmt_speculate_note_edit(editor->document);
+    // Keep putting off a deferred format while typing goes on
+    if (defer_timer > 0 && defer_doc == editor->document)
+      schedule_deferred_format(editor->document);
+  }
+  else if (fmt_prefs_get_auto_format() &&
+           fmt_is_supported_ft(editor->document) &&
+           notif->nmhdr.code == SCN_CHARADDED)
+  {
+    fmt_trace_char(editor->document, notif->ch);
+    // Geany has indented the new line by now, which gets redone the
+    // formatting style's way instead
+    if (is_new_line(editor->sci, notif->ch))
+    {
+      if (fmt_prefs_get_indent_new_lines())
+        fmt_indent_line(editor->document, sci_get_current_line(editor->sci));
+    }
+    else if (strchr(fmt_prefs_get_trigger(), notif->ch) != NULL &&
+             fmt_trigger_should_format(editor->document, notif->ch))
+      do_auto_format(editor->document, notif->ch);
   }
   return false;
 }
@@ -151,6 +314,43 @@ static void on_project_dialog_close(GObject *obj, GtkWidget *notebook,
   }
 }
 
+// Spot minified and generated files up front, before any trigger
+static void on_document_open(G_GNUC_UNUSED GObject *obj, GeanyDocument *doc,
+                             G_GNUC_UNUSED gpointer user_data)
+{
+  if (fmt_is_supported_ft(doc))
+    fmt_stats_is_pathological(doc);
+}
+
+static void on_show_stats_activate(G_GNUC_UNUSED GtkMenuItem *item,
+                                   G_GNUC_UNUSED gpointer user_data)
+{
+  fmt_stats_show();
+}
+
+static void on_document_activate(G_GNUC_UNUSED GObject *obj,
+                                 GeanyDocument *doc,
+                                 G_GNUC_UNUSED gpointer user_data)
+{
+  FmtDocState *state;
+
+  if (!DOC_VALID(doc))
+    return;
+
+  state = fmt_doc_state_get(doc);
+  state->last_active = g_get_monotonic_time();
+
+  // Left over from formatting the session lazily
+  if (state->format_pending)
+  {
+    state->format_pending = false;
+    do_format(doc, true, FMT_JOB_EXPLICIT);
+  }
+
+  if (state->check_status == FMT_CHECK_UNKNOWN)
+    fmt_check_schedule_idle(doc);
+}
+
 static void on_project_open(GObject *obj, GKeyFile *kf, gpointer user_data)
 {
   fmt_prefs_open_project(kf);
@@ -158,6 +358,7 @@ static void on_project_open(GObject *obj, GKeyFile *kf, gpointer user_data)
 
 static void on_project_close(GObject *obj, GKeyFile *kf, gpointer user_data)
 {
+  fmt_project_cancel();
   fmt_prefs_close_project();
 }
 
@@ -198,6 +399,11 @@ static void on_tools_item_map(GtkWidget *wid, gpointer user_data)
   gtk_widget_set_sensitive(wid, fmt_is_supported_ft(NULL));
 }
 
+static void on_project_item_map(GtkWidget *wid, gpointer user_data)
+{
+  gtk_widget_set_sensitive(wid, geany_data->app->project != NULL);
+}
+
 static void on_auto_format_item_toggled(GtkCheckMenuItem *item,
                                         gpointer user_data)
 {
@@ -212,8 +418,50 @@ static void on_auto_format_item_map(GtkCheckMenuItem *item, gpointer user_data)
 static void on_document_before_save(GObject *obj, GeanyDocument *doc,
                                     gpointer user_data)
 {
-  if (fmt_prefs_get_format_on_save() && fmt_is_supported_ft(doc))
-    do_format(doc, true, false);
+  FmtDocState *state = fmt_doc_state_lookup(doc);
+  bool pending = state && state->format_pending;
+
+  // What gets saved is the text in the editor, all of it must be there
+  fmt_apply_finish(doc);
+
+  // Saved before it was shown after formatting the session lazily
+  if (pending)
+    state->format_pending = false;
+  if (pending && fmt_is_supported_ft(doc))
+    do_format(doc, true, FMT_JOB_SAVE);
+  else if (fmt_prefs_get_format_on_save() && fmt_is_supported_ft(doc))
+  {
+    if (fmt_prefs_get_format_changed_on_save())
+      do_format_changed_lines(doc);
+    else
+      do_format(doc, true, FMT_JOB_SAVE);
+  }
+
+  // Results too large for a single slice would still be pending
+  fmt_apply_finish(doc);
+}
+
+static void on_document_close(GObject *obj, GeanyDocument *doc,
+                              gpointer user_data)
+{
+  fmt_sched_cancel_document(doc);
+  fmt_apply_finish(doc);
+  fmt_doc_state_remove(doc);
+  fmt_trace_close(doc);
+  if (defer_doc == doc)
+  {
+    if (defer_timer > 0)
+      g_source_remove(defer_timer);
+    defer_timer = 0;
+    defer_doc = NULL;
+  }
+  if (paste_doc == doc)
+  {
+    if (paste_idle > 0)
+      g_source_remove(paste_idle);
+    paste_idle = 0;
+    paste_doc = NULL;
+  }
 }
 
 void plugin_init(G_GNUC_UNUSED GeanyData *data)
@@ -222,6 +470,15 @@ void plugin_init(G_GNUC_UNUSED GeanyData *data)
   GtkWidget *menu, *item;
 
   fmt_prefs_init();
+  fmt_trace_init();
+  fmt_doc_state_init();
+  fmt_governor_init();
+  fmt_sched_init();
+  fmt_stats_init();
+  fmt_breaker_init();
+  fmt_check_init();
+  fmt_speculate_init();
+  fmt_apply_init();
 
 #define CONNECT(sig, cb) \
   plugin_signal_connect(geany_plugin, NULL, sig, TRUE, G_CALLBACK(cb), NULL)
@@ -234,10 +491,14 @@ void plugin_init(G_GNUC_UNUSED GeanyData *data)
   CONNECT("project-close", on_project_close);
   CONNECT("project-save", on_project_save);
   CONNECT("document-before-save", on_document_before_save);
+  CONNECT("document-close", on_document_close);
+  CONNECT("document-activate", on_document_activate);
+  CONNECT("document-open", on_document_open);
 
 #undef CONNECT
 
-  group = plugin_set_key_group(geany_plugin, _("Code Formatting"), 3,
+  group = plugin_set_key_group(geany_plugin, _("Code Formatting"),
+                               FORMAT_KEY_COUNT,
                                (GeanyKeyGroupCallback)on_key_binding);
 
   main_menu_item = gtk_menu_item_new_with_label(_("Code Format"));
@@ -279,6 +540,49 @@ void plugin_init(G_GNUC_UNUSED GeanyData *data)
   item = gtk_separator_menu_item_new();
   gtk_menu_shell_append(GTK_MENU_SHELL(menu), item);
 
+  item = gtk_menu_item_new_with_label(_("Check Document"));
+  g_signal_connect(item, "activate", G_CALLBACK(on_menu_item_activate),
+                   GINT_TO_POINTER(FORMAT_KEY_CHECK_DOCUMENT));
+  gtk_menu_shell_append(GTK_MENU_SHELL(menu), item);
+  keybindings_set_item(group, FORMAT_KEY_CHECK_DOCUMENT, NULL, 0, 0,
+                       "check_document",
+                       _("Check formatting of entire document"), item);
+
+  item = gtk_menu_item_new_with_label(_("Check Session"));
+  g_signal_connect(item, "activate", G_CALLBACK(on_menu_item_activate),
+                   GINT_TO_POINTER(FORMAT_KEY_CHECK_SESSION));
+  gtk_menu_shell_append(GTK_MENU_SHELL(menu), item);
+  keybindings_set_item(group, FORMAT_KEY_CHECK_SESSION, NULL, 0, 0,
+                       "check_session",
+                       _("Check formatting of entire session"), item);
+
+  item = gtk_separator_menu_item_new();
+  gtk_menu_shell_append(GTK_MENU_SHELL(menu), item);
+
+  item = gtk_menu_item_new_with_label(_("Format Project"));
+  g_signal_connect(item, "activate", G_CALLBACK(on_menu_item_activate),
+                   GINT_TO_POINTER(FORMAT_KEY_PROJECT));
+  g_signal_connect(item, "map", G_CALLBACK(on_project_item_map), NULL);
+  gtk_menu_shell_append(GTK_MENU_SHELL(menu), item);
+  keybindings_set_item(group, FORMAT_KEY_PROJECT, NULL, 0, 0, "format_project",
+                       _("Format all project files"), item);
+
+  item = gtk_menu_item_new_with_label(_("Check Project"));
+  g_signal_connect(item, "activate", G_CALLBACK(on_menu_item_activate),
+                   GINT_TO_POINTER(FORMAT_KEY_CHECK_PROJECT));
+  g_signal_connect(item, "map", G_CALLBACK(on_project_item_map), NULL);
+  gtk_menu_shell_append(GTK_MENU_SHELL(menu), item);
+  keybindings_set_item(group, FORMAT_KEY_CHECK_PROJECT, NULL, 0, 0,
+                       "check_project",
+                       _("Check formatting of all project files"), item);
+
+  item = gtk_separator_menu_item_new();
+  gtk_menu_shell_append(GTK_MENU_SHELL(menu), item);
+
+  item = gtk_menu_item_new_with_label(_("Show Statistics"));
+  gtk_menu_shell_append(GTK_MENU_SHELL(menu), item);
+  g_signal_connect(item, "activate", G_CALLBACK(on_show_stats_activate), NULL);
+
   item = gtk_menu_item_new_with_label(_("Open Configuration File"));
   gtk_menu_shell_append(GTK_MENU_SHELL(menu), item);
   g_signal_connect(item, "activate", G_CALLBACK(on_open_config_file), NULL);
@@ -292,6 +596,26 @@ void plugin_init(G_GNUC_UNUSED GeanyData *data)
 
 void plugin_cleanup(void)
 {
+  fmt_project_cancel();
+  fmt_check_deinit();
+  fmt_speculate_deinit();
+  if (defer_timer > 0)
+    g_source_remove(defer_timer);
+  defer_timer = 0;
+  defer_doc = NULL;
+  if (paste_idle > 0)
+    g_source_remove(paste_idle);
+  paste_idle = 0;
+  paste_doc = NULL;
+  fmt_sched_deinit();
+  fmt_governor_deinit();
+  fmt_stats_deinit();
+  fmt_breaker_deinit();
+  fmt_apply_deinit();
+  fmt_trace_deinit();
+  fmt_doc_state_deinit();
+  fmt_clang_format_forget_version();
+  fmt_clang_format_forget_configs();
   fmt_prefs_deinit();
   gtk_widget_destroy(main_menu_item);
 }
@@ -312,15 +636,250 @@ void plugin_help(void)
                      NULL);
 }
 
-static void do_format(GeanyDocument *doc, bool entire_doc, bool autof)
+// Replace document text and move cursor to new position
+static void apply_formatted(GeanyDocument *doc, GString *formatted,
+                            size_t cursor_pos, bool autof)
+{
+  ScintillaObject *sci = doc->editor->sci;
+  size_t sci_len;
+  const char *sci_buf;
+  GArray *repls;
+
+  fmt_apply_finish(doc);
+  sci_len = sci_get_length(sci);
+  sci_buf =
+      (const char *)scintilla_send_message(sci, SCI_GETCHARACTERPOINTER, 0, 0);
+
+  if (!fmt_verify_formatted(doc->real_path, sci_buf, sci_len, formatted->str,
+                            formatted->len))
+    return;
+
+  // Just the whitespace that changed is replaced, unless the tokens
+  // changed too (eg. sorted includes)
+  repls = fmt_diff_whitespace(sci_buf, sci_len, formatted->str,
+                              formatted->len);
+  if (repls)
+  {
+    fmt_apply_replacements(doc, repls, cursor_pos, autof || repls->len > 0);
+    g_array_free(repls, true);
+  }
+  else
+    fmt_apply_text(doc, formatted->str, formatted->len, cursor_pos, true);
+}
+
+static void submit_format(GeanyDocument *doc, size_t offset, size_t length,
+                          GArray *ranges, FmtJobClass job_class);
+
+// Applies replacements to the document's current text
+static void apply_replacements(GeanyDocument *doc, GArray *repls, bool autof)
 {
+  ScintillaObject *sci = doc->editor->sci;
+  size_t cursor, sci_len;
+  const char *sci_buf;
   GString *formatted;
-  ScintillaObject *sci;
-  size_t offset = 0, length = 0, sci_len;
-  size_t cursor_pos, old_first_line, new_first_line, line_delta;
+
+  if (repls->len == 0)
+    return;
+
+  fmt_apply_finish(doc);
+  cursor = sci_get_current_position(sci);
+
+  sci_buf =
+      (const char *)scintilla_send_message(sci, SCI_GETCHARACTERPOINTER, 0, 0);
+  sci_len = sci_get_length(sci);
+  formatted = fmt_replacements_apply(sci_buf, sci_len, repls, &cursor);
+  if (!formatted)
+    return;
+
+  // Only the replacements are made, the whole text is for checking them
+  if (fmt_verify_formatted(doc->real_path, sci_buf, sci_len, formatted->str,
+                           formatted->len))
+  {
+    bool changed = autof || formatted->len != sci_len ||
+                   memcmp(formatted->str, sci_buf, sci_len) != 0;
+    fmt_apply_replacements(doc, repls, cursor, changed);
+  }
+  g_string_free(formatted, true);
+}
+
+// Where a position ends up after sorted replacements are applied
+static size_t map_position(GArray *repls, size_t pos)
+{
+  gssize delta = 0;
+
+  for (unsigned int i = 0; i < repls->len; i++)
+  {
+    FmtReplacement *repl = &g_array_index(repls, FmtReplacement, i);
+    if (repl->offset + repl->length <= pos)
+      delta += (gssize)strlen(repl->text) - (gssize)repl->length;
+    else
+    {
+      if (repl->offset < pos)
+        pos = repl->offset;
+      break;
+    }
+  }
+
+  return pos + delta;
+}
+
+static void on_format_job_done(FmtJob *job, G_GNUC_UNUSED gpointer user_data)
+{
+  FmtDocState *state;
+  GArray *repls, *conflicts;
+
+  fmt_stats_record(job);
+
+  // FIXME: handle better
+  if (job->cancelled || job->result == NULL || !DOC_VALID(job->doc))
+    return;
+
+  state = fmt_doc_state_lookup(job->doc);
+  if (!state)
+    return;
+
+  // Rebasing needs the edits of an earlier result in the log
+  fmt_apply_finish(job->doc);
+
+  repls = fmt_replacements_parse(job->result->str, job->code->str,
+                                 job->code->len);
+  if (!repls)
+  {
+    g_warning("Failed to parse clang-format replacements");
+    return;
+  }
+
+  // Move the result over text that was edited while clang-format ran,
+  // only the parts the edits touched need formatting again
+  conflicts = g_array_new(false, false, sizeof(FmtRange));
+  if (!fmt_rebase_replacements(state, job->doc_version, repls, conflicts))
+  {
+    g_array_free(conflicts, true);
+    g_array_free(repls, true);
+    return;
+  }
+
+  for (unsigned int i = 0; i < conflicts->len; i++)
+  {
+    FmtRange *range = &g_array_index(conflicts, FmtRange, i);
+    size_t start = map_position(repls, range->offset);
+    size_t end = map_position(repls, range->offset + range->length);
+    range->offset = start;
+    range->length = MAX(end, start) - start;
+  }
+
+  apply_replacements(job->doc, repls, job->job_class == FMT_JOB_INTERACTIVE);
+  g_array_free(repls, true);
+
+  // clang-format rejects ranges past the end, and empty ones say little
+  for (unsigned int i = 0; i < conflicts->len; i++)
+  {
+    FmtRange *range = &g_array_index(conflicts, FmtRange, i);
+    size_t len = sci_get_length(job->doc->editor->sci);
+    range->offset = MIN(range->offset, len > 0 ? len - 1 : 0);
+    range->length = MIN(MAX(range->length, 1), len - range->offset);
+  }
+
+  if (conflicts->len > 0 && sci_get_length(job->doc->editor->sci) > 0)
+  {
+    FmtRange *first = &g_array_index(conflicts, FmtRange, 0);
+    FmtRange *last = &g_array_index(conflicts, FmtRange, conflicts->len - 1);
+    size_t offset = first->offset;
+    size_t length = last->offset + last->length - offset;
+    submit_format(job->doc, offset, MAX(length, 1), conflicts,
+                  job->job_class);
+  }
+  else
+    g_array_free(conflicts, true);
+}
+
+// Collects every selection, or the line of every caret without one, so
+// multiple selections get formatted by a single clang-format run
+static GArray *selection_ranges(ScintillaObject *sci, int n_sel)
+{
+  GArray *ranges = g_array_sized_new(false, false, sizeof(FmtRange), n_sel);
+
+  for (int i = 0; i < n_sel; i++)
+  {
+    FmtRange range;
+    size_t start = scintilla_send_message(sci, SCI_GETSELECTIONNSTART, i, 0);
+    size_t end = scintilla_send_message(sci, SCI_GETSELECTIONNEND, i, 0);
+    if (start == end)
+    {
+      int line = sci_get_line_from_position(sci, start);
+      start = sci_get_position_from_line(sci, line);
+      end = sci_get_line_end_position(sci, line);
+    }
+    range.offset = start;
+    range.length = end - start;
+    g_array_append_val(ranges, range);
+  }
+
+  return ranges;
+}
+
+// Formats a snapshot of the document, @a ranges (if any) belongs to the
+// job afterwards
+static void submit_format(GeanyDocument *doc, size_t offset, size_t length,
+                          GArray *ranges, FmtJobClass job_class)
+{
+  ScintillaObject *sci = doc->editor->sci;
   const char *sci_buf;
-  bool changed = true;
-  bool was_changed;
+  GString *formatted;
+  size_t cursor;
+  FmtJob *job;
+
+  fmt_apply_finish(doc);
+
+  // Use the result formatted ahead of time if the text is unchanged
+  if (!ranges && offset == 0 && length >= (size_t)sci_get_length(sci) &&
+      fmt_speculate_take(doc, &formatted, &cursor))
+  {
+    if (formatted)
+    {
+      apply_formatted(doc, formatted, cursor,
+                      job_class == FMT_JOB_INTERACTIVE);
+      g_string_free(formatted, true);
+    }
+    return;
+  }
+
+  sci_buf =
+      (const char *)scintilla_send_message(sci, SCI_GETCHARACTERPOINTER, 0, 0);
+
+  // Asynchronous results come back as replacements, which can still be
+  // applied after further edits
+  job = fmt_job_new(job_class, doc->file_name, sci_buf, sci_get_length(sci),
+                    sci_get_current_position(sci), offset, length,
+                    job_class != FMT_JOB_SAVE);
+  job->ranges = ranges;
+  job->doc = doc;
+  job->doc_version = fmt_doc_state_get(doc)->version;
+  job->supersedes = true;
+
+  // The text must be formatted before the save goes ahead
+  if (job_class == FMT_JOB_SAVE)
+  {
+    if (fmt_sched_run_sync(job))
+    {
+      apply_formatted(doc, job->result, job->cursor, false);
+      fmt_apply_finish(doc);
+    }
+    fmt_stats_record(job);
+    fmt_job_free(job);
+    return;
+  }
+
+  fmt_sched_submit(job, on_format_job_done, NULL);
+}
+
+static void do_format(GeanyDocument *doc, bool entire_doc,
+                      FmtJobClass job_class)
+{
+  ScintillaObject *sci;
+  size_t offset = 0, length = 0;
+  GArray *ranges = NULL;
+  int n_sel;
 
   if (doc == NULL)
     doc = document_get_current();
@@ -331,7 +890,6 @@ static void do_format(GeanyDocument *doc, bool entire_doc, bool autof)
     return;
   }
   sci = doc->editor->sci;
-  was_changed = doc->changed;
 
   // FIXME: instead of failing, ask user to save the document once
   if (!doc->real_path)
@@ -340,7 +898,15 @@ static void do_format(GeanyDocument *doc, bool entire_doc, bool autof)
     return;
   }
 
-  if (!entire_doc)
+  n_sel = scintilla_send_message(sci, SCI_GETSELECTIONS, 0, 0);
+
+  if (!entire_doc && n_sel > 1)
+  { // format all selections at once
+    ranges = selection_ranges(sci, n_sel);
+    offset = scintilla_send_message(sci, SCI_GETSELECTIONSTART, 0, 0);
+    length = scintilla_send_message(sci, SCI_GETSELECTIONEND, 0, 0) - offset;
+  }
+  else if (!entire_doc)
   {
     if (sci_has_selection(sci))
     { // format selection
@@ -360,49 +926,207 @@ static void do_format(GeanyDocument *doc, bool entire_doc, bool autof)
     length = sci_get_length(sci);
   }
 
-  cursor_pos = sci_get_current_position(sci);
+  submit_format(doc, offset, length, ranges, job_class);
+}
+
+// Auto-formats just the code around the trigger character, the block
+// a closing bracket ends or else the current line
+static void do_format_trigger_region(GeanyDocument *doc, int ch)
+{
+  ScintillaObject *sci = doc->editor->sci;
+  int pos = sci_get_current_position(sci);
+  int cur_line = sci_get_current_line(sci);
+  int first_line = cur_line;
+  size_t offset, length;
+
+  if ((ch == '}' || ch == ')' || ch == ']') && pos > 0)
+  {
+    int match = scintilla_send_message(sci, SCI_BRACEMATCH, pos - 1, 0);
+    if (match >= 0)
+      first_line = sci_get_line_from_position(sci, match);
+  }
+
+  offset = sci_get_position_from_line(sci, first_line);
+  length = sci_get_line_end_position(sci, cur_line) - offset;
+  if (length == 0)
+    return;
+
+  submit_format(doc, offset, length, NULL, FMT_JOB_INTERACTIVE);
+}
+
+static gboolean on_deferred_format_timeout(G_GNUC_UNUSED gpointer user_data)
+{
+  GeanyDocument *doc = defer_doc;
+
+  defer_timer = 0;
+  defer_doc = NULL;
+
+  if (DOC_VALID(doc) && doc->real_path)
+    do_format(doc, true, FMT_JOB_INTERACTIVE);
+
+  return false;
+}
+
+static void schedule_deferred_format(GeanyDocument *doc)
+{
+  if (defer_timer > 0)
+    g_source_remove(defer_timer);
+  defer_doc = doc;
+  defer_timer =
+      g_timeout_add(DEFER_DELAY_MS, on_deferred_format_timeout, NULL);
+}
+
+// Formats pasted code once the paste is over, large pastes wait for
+// more urgent formatting like any background work
+static gboolean on_paste_idle(G_GNUC_UNUSED gpointer user_data)
+{
+  GeanyDocument *doc = paste_doc;
+  int start = paste_start, end = paste_end;
+  FmtJobClass job_class = FMT_JOB_INTERACTIVE;
+
+  paste_idle = 0;
+  paste_doc = NULL;
+
+  if (!DOC_VALID(doc) || !doc->real_path || fmt_stats_is_pathological(doc) ||
+      end <= start || !fmt_breaker_allows(doc))
+    return false;
+
+  if ((size_t)(end - start) > fmt_prefs_get_paste_background_size())
+    job_class = FMT_JOB_BACKGROUND;
+
+  fmt_trigger_widen_to_statements(doc, &start, &end);
+  submit_format(doc, start, end - start, NULL, job_class);
+
+  return false;
+}
+
+// Picks how to auto-format from the document's measured latency
+static void do_auto_format(GeanyDocument *doc, int ch)
+{
+  if (!doc->real_path || fmt_stats_is_pathological(doc) ||
+      !fmt_breaker_allows(doc))
+    return;
+
+  switch (fmt_stats_get_strategy(doc))
+  {
+    case FMT_STRATEGY_DOCUMENT:
+      do_format(doc, true, FMT_JOB_INTERACTIVE);
+      break;
+    case FMT_STRATEGY_REGION:
+      do_format_trigger_region(doc, ch);
+      break;
+    default:
+      schedule_deferred_format(doc);
+      break;
+  }
+}
+
+// Formats only the lines that differ from git's HEAD or the saved file
+static void do_format_changed_lines(GeanyDocument *doc)
+{
+  ScintillaObject *sci = doc->editor->sci;
+  GString *baseline;
+  GArray *lines;
+  const char *sci_buf;
+  size_t sci_len;
+  FmtJob *job;
+
+  fmt_apply_finish(doc);
+
+  // Without a previous version every line is new
+  baseline = doc->real_path ? fmt_diff_read_baseline(doc->real_path) : NULL;
+  if (!baseline)
+  {
+    do_format(doc, true, FMT_JOB_SAVE);
+    return;
+  }
+
   sci_len = sci_get_length(sci);
   sci_buf =
       (const char *)scintilla_send_message(sci, SCI_GETCHARACTERPOINTER, 0, 0);
 
-  formatted = fmt_clang_format(doc->file_name, sci_buf, sci_len, &cursor_pos,
-                               offset, length, false);
+  lines = fmt_diff_changed_lines(baseline->str, baseline->len, sci_buf,
+                                 sci_len);
+  g_string_free(baseline, true);
 
-  // FIXME: handle better
-  if (formatted == NULL)
+  if (lines->len == 0)
+  {
+    g_array_free(lines, true);
     return;
+  }
+
+  job = fmt_job_new(FMT_JOB_SAVE, doc->file_name, sci_buf, sci_len,
+                    sci_get_current_position(sci), 0, sci_len, false);
+  job->lines = lines;
+  job->doc = doc;
+  job->doc_version = fmt_doc_state_get(doc)->version;
 
-  if (!autof)
+  // Saving goes ahead once this returns, with all of the result
+  if (fmt_sched_run_sync(job))
   {
-    changed = (formatted->len != sci_len) ||
-              (g_strcmp0(formatted->str, sci_buf) != 0);
+    apply_formatted(doc, job->result, job->cursor, false);
+    fmt_apply_finish(doc);
   }
+  fmt_stats_record(job);
+  fmt_job_free(job);
+}
 
-  old_first_line = scintilla_send_message(sci, SCI_GETFIRSTVISIBLELINE, 0, 0);
+// Most recently activated first
+static int compare_last_active(gconstpointer a, gconstpointer b)
+{
+  const FmtDocState *sa = *(const FmtDocState **)a;
+  const FmtDocState *sb = *(const FmtDocState **)b;
+  return (sb->last_active > sa->last_active) -
+         (sb->last_active < sa->last_active);
+}
 
-  // Replace document text and move cursor to new position
-  scintilla_send_message(sci, SCI_BEGINUNDOACTION, 0, 0);
-  scintilla_send_message(sci, SCI_CLEARALL, 0, 0);
-  scintilla_send_message(sci, SCI_ADDTEXT, formatted->len,
-                         (sptr_t)formatted->str);
-  scintilla_send_message(sci, SCI_GOTOPOS, cursor_pos, 0);
-  new_first_line = scintilla_send_message(sci, SCI_GETFIRSTVISIBLELINE, 0, 0);
-  line_delta = new_first_line - old_first_line;
-  scintilla_send_message(sci, SCI_LINESCROLL, 0, -line_delta);
-  scintilla_send_message(sci, SCI_ENDUNDOACTION, 0, 0);
+// Formats the current document, and leaves the others until they are
+// activated or saved, preparing the most recently used ones meanwhile
+static void do_format_session_lazily(void)
+{
+  GeanyDocument *cur = document_get_current();
+  GPtrArray *pending = g_ptr_array_new();
+  guint i;
 
-  document_set_text_changed(doc, (was_changed || changed));
+  foreach_document(i)
+  {
+    GeanyDocument *doc = documents[i];
+    if (!fmt_is_supported_ft(doc) || !doc->real_path)
+      continue;
+    if (doc == cur)
+      do_format(doc, true, FMT_JOB_EXPLICIT);
+    else
+    {
+      FmtDocState *state = fmt_doc_state_get(doc);
+      state->format_pending = true;
+      g_ptr_array_add(pending, state);
+    }
+  }
 
-  g_string_free(formatted, true);
+  g_ptr_array_sort(pending, compare_last_active);
+  for (i = 0; i < MIN(pending->len, LAZY_PREFORMAT_DOCS); i++)
+  {
+    FmtDocState *state = g_ptr_array_index(pending, i);
+    fmt_speculate_document(state->doc);
+  }
+
+  g_ptr_array_free(pending, true);
 }
 
 static void do_format_session(void)
 {
   guint i;
+
+  if (fmt_prefs_get_format_session_lazily())
+  {
+    do_format_session_lazily();
+    return;
+  }
+
   foreach_document(i)
   {
     GeanyDocument *doc = documents[i];
     if (fmt_is_supported_ft(doc))
-        do_format(doc, true, false);
+        do_format(doc, true, FMT_JOB_SESSION);
   }
 }
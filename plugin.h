@@ -51,6 +51,12 @@ extern GeanyPlugin *geany_plugin;
 extern GeanyData *geany_data;
 extern GeanyFunctions *geany_functions;
 
+/**
+ * Checks if @a doc (or the current document when @c NULL) is of a
+ * filetype clang-format can handle.
+ */
+bool fmt_is_supported_ft(GeanyDocument *doc);
+
 G_END_DECLS
 
 #endif // FMT_PLUGIN_H
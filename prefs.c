@@ -31,7 +31,21 @@
 #define PREF_STYLE "style"
 #define PREF_AUTO "auto-format"
 #define PREF_TRIGGER "auto-format-trigger-chars"
+#define PREF_BUDGET "auto-format-latency-budget"
+#define PREF_SPECULATE "speculative-format-delay"
+#define PREF_INDENT "auto-format-indent-new-lines"
+#define PREF_PASTE "auto-format-paste"
+#define PREF_PASTE_SIZE "auto-format-paste-background-size"
 #define PREF_ONSAVE "format-on-save"
+#define PREF_ONSAVE_CHANGED "format-on-save-changed-lines"
+#define PREF_CHECK_IDLE "check-on-idle"
+#define PREF_LAZY_SESSION "format-session-lazily"
+#define PREF_SERVICE "use-format-service"
+#define PREF_MAX_PROCS "max-formatter-processes"
+#define PREF_MEMORY_LIMIT "formatter-memory-limit"
+#define PREF_CGROUP "use-cgroup"
+#define PREF_PRESSURE "memory-pressure-threshold"
+#define PREF_TRACE "session-trace-file"
 
 #define HAS_KEY(key) g_key_file_has_key(kf, PREF_GROUP, key, NULL)
 #define GET_KEY(T, key) g_key_file_get_##T(kf, PREF_GROUP, key, NULL)
@@ -43,7 +57,22 @@ struct FmtPreferences
   FmtStyle style;
   bool auto_format;
   GString *trigger;
+  unsigned int latency_budget;
+  unsigned int speculative_delay;
+  bool indent_new_lines;
+  bool paste;
+  unsigned int paste_background_size;
   bool on_save;
+  bool on_save_changed;
+  bool check_on_idle;
+  bool lazy_session;
+  bool use_service;
+  unsigned int max_processes;
+  int memory_limit;
+  bool use_cgroup;
+  unsigned int pressure_threshold;
+  GString *trace_file;
+  bool verify;
 };
 
 static struct FmtPreferences user_prefs;
@@ -64,6 +93,12 @@ static void deinit_prefs(struct FmtPreferences *prefs)
     prefs->trigger = NULL;
   }
 
+  if (prefs->trace_file)
+  {
+    g_string_free(prefs->trace_file, true);
+    prefs->trace_file = NULL;
+  }
+
   memset(prefs, 0, sizeof(struct FmtPreferences));
 }
 
@@ -75,7 +110,22 @@ static void init_prefs(struct FmtPreferences *prefs)
   prefs->style = FORMAT_STYLE_CUSTOM;
   prefs->auto_format = false;
   prefs->trigger = g_string_new(")}];");
+  prefs->latency_budget = 200;
+  prefs->speculative_delay = 0;
+  prefs->indent_new_lines = true;
+  prefs->paste = false;
+  prefs->paste_background_size = 65536;
   prefs->on_save = false;
+  prefs->on_save_changed = false;
+  prefs->check_on_idle = false;
+  prefs->lazy_session = false;
+  prefs->use_service = false;
+  prefs->max_processes = 0;
+  prefs->memory_limit = 0;
+  prefs->use_cgroup = false;
+  prefs->pressure_threshold = 10;
+  prefs->trace_file = g_string_new("");
+  prefs->verify = true;
 }
 
 static void clone_prefs(struct FmtPreferences *psrc,
@@ -85,7 +135,22 @@ static void clone_prefs(struct FmtPreferences *psrc,
   pdst->auto_format = psrc->auto_format;
   g_string_assign(pdst->path, psrc->path->str);
   g_string_assign(pdst->trigger, psrc->trigger->str);
+  pdst->latency_budget = psrc->latency_budget;
+  pdst->speculative_delay = psrc->speculative_delay;
+  pdst->indent_new_lines = psrc->indent_new_lines;
+  pdst->paste = psrc->paste;
+  pdst->paste_background_size = psrc->paste_background_size;
   pdst->on_save = psrc->on_save;
+  pdst->on_save_changed = psrc->on_save_changed;
+  pdst->check_on_idle = psrc->check_on_idle;
+  pdst->lazy_session = psrc->lazy_session;
+  pdst->use_service = psrc->use_service;
+  pdst->max_processes = psrc->max_processes;
+  pdst->memory_limit = psrc->memory_limit;
+  pdst->use_cgroup = psrc->use_cgroup;
+  pdst->pressure_threshold = psrc->pressure_threshold;
+  g_string_assign(pdst->trace_file, psrc->trace_file->str);
+  pdst->verify = psrc->verify;
 }
 
 static void load_prefs(struct FmtPreferences *prefs, GKeyFile *kf)
@@ -126,8 +191,81 @@ static void load_prefs(struct FmtPreferences *prefs, GKeyFile *kf)
     }
   }
 
+  if (HAS_KEY("auto-format-latency-budget"))
+  {
+    int val = GET_KEY(integer, "auto-format-latency-budget");
+    prefs->latency_budget = MAX(val, 0);
+  }
+
+  if (HAS_KEY("speculative-format-delay"))
+  {
+    int val = GET_KEY(integer, "speculative-format-delay");
+    prefs->speculative_delay = MAX(val, 0);
+  }
+
+  if (HAS_KEY("auto-format-indent-new-lines"))
+  {
+    prefs->indent_new_lines =
+        GET_KEY(boolean, "auto-format-indent-new-lines");
+  }
+
+  if (HAS_KEY("auto-format-paste"))
+    prefs->paste = GET_KEY(boolean, "auto-format-paste");
+
+  if (HAS_KEY("auto-format-paste-background-size"))
+  {
+    int val = GET_KEY(integer, "auto-format-paste-background-size");
+    prefs->paste_background_size = MAX(val, 0);
+  }
+
   if (HAS_KEY("format-on-save"))
     prefs->on_save = GET_KEY(boolean, "format-on-save");
+
+  if (HAS_KEY("format-on-save-changed-lines"))
+  {
+    prefs->on_save_changed =
+        GET_KEY(boolean, "format-on-save-changed-lines");
+  }
+
+  if (HAS_KEY("check-on-idle"))
+    prefs->check_on_idle = GET_KEY(boolean, "check-on-idle");
+
+  if (HAS_KEY("format-session-lazily"))
+    prefs->lazy_session = GET_KEY(boolean, "format-session-lazily");
+
+  if (HAS_KEY("use-format-service"))
+    prefs->use_service = GET_KEY(boolean, "use-format-service");
+
+  if (HAS_KEY("max-formatter-processes"))
+  {
+    int val = GET_KEY(integer, "max-formatter-processes");
+    prefs->max_processes = MAX(val, 0);
+  }
+
+  if (HAS_KEY("formatter-memory-limit"))
+    prefs->memory_limit = GET_KEY(integer, "formatter-memory-limit");
+
+  if (HAS_KEY("use-cgroup"))
+    prefs->use_cgroup = GET_KEY(boolean, "use-cgroup");
+
+  if (HAS_KEY("memory-pressure-threshold"))
+  {
+    int val = GET_KEY(integer, "memory-pressure-threshold");
+    prefs->pressure_threshold = CLAMP(val, 0, 100);
+  }
+
+  if (HAS_KEY("session-trace-file"))
+  {
+    char *val = GET_KEY(string, "session-trace-file");
+    if (val)
+    {
+      g_string_assign(prefs->trace_file, val);
+      g_free(val);
+    }
+  }
+
+  if (HAS_KEY("verify-formatting"))
+    prefs->verify = GET_KEY(boolean, "verify-formatting");
 }
 
 static void save_default_prefs(const char *fn)
@@ -174,7 +312,23 @@ static void save_prefs(struct FmtPreferences *prefs, GKeyFile *kf)
   SET_KEY(string, "style", fmt_style_get_name(prefs->style));
   SET_KEY(boolean, "auto-format", prefs->auto_format);
   SET_KEY(string, "auto-format-trigger-chars", prefs->trigger->str);
+  SET_KEY(integer, "auto-format-latency-budget", prefs->latency_budget);
+  SET_KEY(integer, "speculative-format-delay", prefs->speculative_delay);
+  SET_KEY(boolean, "auto-format-indent-new-lines", prefs->indent_new_lines);
+  SET_KEY(boolean, "auto-format-paste", prefs->paste);
+  SET_KEY(integer, "auto-format-paste-background-size",
+          prefs->paste_background_size);
   SET_KEY(boolean, "format-on-save", prefs->on_save);
+  SET_KEY(boolean, "format-on-save-changed-lines", prefs->on_save_changed);
+  SET_KEY(boolean, "check-on-idle", prefs->check_on_idle);
+  SET_KEY(boolean, "format-session-lazily", prefs->lazy_session);
+  SET_KEY(boolean, "use-format-service", prefs->use_service);
+  SET_KEY(integer, "max-formatter-processes", prefs->max_processes);
+  SET_KEY(integer, "formatter-memory-limit", prefs->memory_limit);
+  SET_KEY(boolean, "use-cgroup", prefs->use_cgroup);
+  SET_KEY(integer, "memory-pressure-threshold", prefs->pressure_threshold);
+  SET_KEY(string, "session-trace-file", prefs->trace_file->str);
+  SET_KEY(boolean, "verify-formatting", prefs->verify);
 }
 
 void fmt_prefs_init(void)
@@ -278,6 +432,56 @@ void fmt_prefs_set_trigger(const char *trigger_chars)
   g_string_assign(cur_prefs->trigger, trigger_chars);
 }
 
+unsigned int fmt_prefs_get_latency_budget(void)
+{
+  return cur_prefs->latency_budget;
+}
+
+void fmt_prefs_set_latency_budget(unsigned int budget_ms)
+{
+  cur_prefs->latency_budget = budget_ms;
+}
+
+unsigned int fmt_prefs_get_speculative_delay(void)
+{
+  return cur_prefs->speculative_delay;
+}
+
+void fmt_prefs_set_speculative_delay(unsigned int delay_ms)
+{
+  cur_prefs->speculative_delay = delay_ms;
+}
+
+bool fmt_prefs_get_indent_new_lines(void)
+{
+  return cur_prefs->indent_new_lines;
+}
+
+void fmt_prefs_set_indent_new_lines(bool indent)
+{
+  cur_prefs->indent_new_lines = indent;
+}
+
+bool fmt_prefs_get_format_on_paste(void)
+{
+  return cur_prefs->paste;
+}
+
+void fmt_prefs_set_format_on_paste(bool on_paste)
+{
+  cur_prefs->paste = on_paste;
+}
+
+unsigned int fmt_prefs_get_paste_background_size(void)
+{
+  return cur_prefs->paste_background_size;
+}
+
+void fmt_prefs_set_paste_background_size(unsigned int size)
+{
+  cur_prefs->paste_background_size = size;
+}
+
 bool fmt_prefs_get_format_on_save(void)
 {
   return cur_prefs->on_save;
@@ -288,6 +492,106 @@ void fmt_prefs_set_format_on_save(bool on_save)
   cur_prefs->on_save = on_save;
 }
 
+bool fmt_prefs_get_format_changed_on_save(void)
+{
+  return cur_prefs->on_save_changed;
+}
+
+void fmt_prefs_set_format_changed_on_save(bool changed_only)
+{
+  cur_prefs->on_save_changed = changed_only;
+}
+
+bool fmt_prefs_get_check_on_idle(void)
+{
+  return cur_prefs->check_on_idle;
+}
+
+void fmt_prefs_set_check_on_idle(bool check_on_idle)
+{
+  cur_prefs->check_on_idle = check_on_idle;
+}
+
+bool fmt_prefs_get_format_session_lazily(void)
+{
+  return cur_prefs->lazy_session;
+}
+
+void fmt_prefs_set_format_session_lazily(bool lazily)
+{
+  cur_prefs->lazy_session = lazily;
+}
+
+bool fmt_prefs_get_use_service(void)
+{
+  return cur_prefs->use_service;
+}
+
+void fmt_prefs_set_use_service(bool use_service)
+{
+  cur_prefs->use_service = use_service;
+}
+
+unsigned int fmt_prefs_get_max_processes(void)
+{
+  return cur_prefs->max_processes;
+}
+
+void fmt_prefs_set_max_processes(unsigned int max_processes)
+{
+  cur_prefs->max_processes = max_processes;
+}
+
+int fmt_prefs_get_memory_limit(void)
+{
+  return cur_prefs->memory_limit;
+}
+
+void fmt_prefs_set_memory_limit(int limit_mb)
+{
+  cur_prefs->memory_limit = limit_mb;
+}
+
+bool fmt_prefs_get_use_cgroup(void)
+{
+  return cur_prefs->use_cgroup;
+}
+
+void fmt_prefs_set_use_cgroup(bool use_cgroup)
+{
+  cur_prefs->use_cgroup = use_cgroup;
+}
+
+unsigned int fmt_prefs_get_pressure_threshold(void)
+{
+  return cur_prefs->pressure_threshold;
+}
+
+void fmt_prefs_set_pressure_threshold(unsigned int percent)
+{
+  cur_prefs->pressure_threshold = percent;
+}
+
+const char *fmt_prefs_get_trace_file(void)
+{
+  return cur_prefs->trace_file->str;
+}
+
+void fmt_prefs_set_trace_file(const char *fn)
+{
+  g_string_assign(cur_prefs->trace_file, fn ? fn : "");
+}
+
+bool fmt_prefs_get_verify(void)
+{
+  return cur_prefs->verify;
+}
+
+void fmt_prefs_set_verify(bool verify)
+{
+  cur_prefs->verify = verify;
+}
+
 //======================================================================
 //
 // UI Stuff
@@ -298,8 +602,14 @@ void fmt_prefs_set_format_on_save(bool on_save)
 #define UI_AUTO PREF_GROUP "-" PREF_AUTO
 #define UI_TRIGGER PREF_GROUP "-" PREF_TRIGGER
 #define UI_ON_SAVE PREF_GROUP "-" PREF_ONSAVE
+#define UI_ON_SAVE_CHANGED PREF_GROUP "-" PREF_ONSAVE_CHANGED
+#define UI_CHECK_IDLE PREF_GROUP "-" PREF_CHECK_IDLE
+#define UI_LAZY_SESSION PREF_GROUP "-" PREF_LAZY_SESSION
+#define UI_SERVICE PREF_GROUP "-" PREF_SERVICE
 #define UI_TRIG_LBL UI_TRIGGER "-label"
 #define UI_TRIG_ENT UI_TRIGGER "-entry"
+#define UI_BUDGET PREF_GROUP "-" PREF_BUDGET
+#define UI_SPECULATE PREF_GROUP "-" PREF_SPECULATE
 #define UI_CREATE UI_STYLE "-create-button"
 
 #define GET_WIDGET(parent, name) g_object_get_data(G_OBJECT(parent), name)
@@ -319,6 +629,15 @@ static void on_pref_auto_format_toggled(GtkToggleButton *btn,
     gtk_widget_set_sensitive(ent, gtk_toggle_button_get_active(btn));
 }
 
+// Only format changed lines makes no sense without format on save
+static void on_pref_on_save_toggled(GtkToggleButton *btn,
+                                    G_GNUC_UNUSED gpointer user_data)
+{
+  GtkWidget *chk = GET_WIDGET(btn, UI_ON_SAVE_CHANGED);
+  if (GTK_IS_WIDGET(chk))
+    gtk_widget_set_sensitive(chk, gtk_toggle_button_get_active(btn));
+}
+
 // Disable Create button when Custom is selected
 static void on_pref_style_changed(GtkComboBox *cb,
                                   G_GNUC_UNUSED gpointer user_data)
@@ -371,7 +690,8 @@ static void on_pref_clang_format_path_changed(GtkEntry *ent,
 
 void fmt_prefs_save_panel(GtkWidget *panel, bool project)
 {
-  GtkWidget *w_path, *w_style, *w_auto, *w_trigger, *w_onsave;
+  GtkWidget *w_path, *w_style, *w_auto, *w_trigger, *w_onsave, *w_changed;
+  GtkWidget *w_check, *w_lazy, *w_service, *w_budget, *w_spec;
   struct FmtPreferences *p = NULL;
 
   if (project && geany_data->app->project)
@@ -383,13 +703,30 @@ void fmt_prefs_save_panel(GtkWidget *panel, bool project)
   w_style = GET_WIDGET(panel, UI_STYLE);
   w_auto = GET_WIDGET(panel, UI_AUTO);
   w_trigger = GET_WIDGET(panel, UI_TRIGGER);
+  w_budget = GET_WIDGET(panel, UI_BUDGET);
+  w_spec = GET_WIDGET(panel, UI_SPECULATE);
   w_onsave = GET_WIDGET(panel, UI_ON_SAVE);
+  w_changed = GET_WIDGET(panel, UI_ON_SAVE_CHANGED);
+  w_check = GET_WIDGET(panel, UI_CHECK_IDLE);
+  w_lazy = GET_WIDGET(panel, UI_LAZY_SESSION);
+  w_service = GET_WIDGET(panel, UI_SERVICE);
 
   g_string_assign(p->path, gtk_entry_get_text(GTK_ENTRY(w_path)));
   p->style = (FmtStyle)gtk_combo_box_get_active(GTK_COMBO_BOX(w_style));
   p->auto_format = gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(w_auto));
   g_string_assign(p->trigger, gtk_entry_get_text(GTK_ENTRY(w_trigger)));
+  p->latency_budget =
+      gtk_spin_button_get_value_as_int(GTK_SPIN_BUTTON(w_budget));
+  p->speculative_delay =
+      gtk_spin_button_get_value_as_int(GTK_SPIN_BUTTON(w_spec));
   p->on_save = gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(w_onsave));
+  p->on_save_changed =
+      gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(w_changed));
+  p->check_on_idle =
+      gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(w_check));
+  p->lazy_session = gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(w_lazy));
+  p->use_service =
+      gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(w_service));
 
   if (p == &user_prefs)
     fmt_prefs_save_user();
@@ -419,7 +756,7 @@ void fmt_prefs_save_panel(GtkWidget *panel, bool project)
 GtkWidget *fmt_prefs_create_panel(bool project)
 {
   int row = 0;
-  GtkWidget *grid, *lbl, *ent, *combo, *chk, *box, *btn, *sep;
+  GtkWidget *grid, *lbl, *ent, *combo, *chk, *onsave_chk, *box, *btn, *sep;
   struct FmtPreferences *p = NULL;
 
   if (project && geany_data->app->project)
@@ -432,7 +769,7 @@ GtkWidget *fmt_prefs_create_panel(bool project)
   gtk_grid_set_column_spacing(GTK_GRID(grid), 6);
   gtk_grid_set_row_spacing(GTK_GRID(grid), 6);
 #else
-  grid = gtk_table_new(7, 3, false);
+  grid = gtk_table_new(13, 3, false);
   gtk_table_set_col_spacings(GTK_TABLE(grid), 5);
   gtk_table_set_row_spacings(GTK_TABLE(grid), 5);
 #endif
@@ -552,6 +889,88 @@ GtkWidget *fmt_prefs_create_panel(bool project)
              "especially useful if you aren't using auto-formatting."));
   SET_WIDGET(grid, UI_ON_SAVE, chk);
   gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(chk), p->on_save);
+  g_signal_connect(chk, "toggled", G_CALLBACK(on_pref_on_save_toggled), NULL);
+  onsave_chk = chk;
+
+  row++;
+
+  chk = gtk_check_button_new_with_label(
+      _("Only format lines changed since the last commit or save."));
+#if GTK_CHECK_VERSION(3, 0, 0)
+  gtk_grid_attach(GTK_GRID(grid), chk, 0, row, 3, 1);
+  gtk_widget_set_hexpand(chk, true);
+#else
+  gtk_table_attach(GTK_TABLE(grid), chk, 0, 3, row, row + 1,
+                   GTK_FILL | GTK_EXPAND, GTK_FILL, 0, 0);
+#endif
+  gtk_widget_set_tooltip_text(
+      chk, _("Enabling this option limits formatting on save to the lines "
+             "which differ from the version in git's HEAD, or from the file "
+             "on disk when it isn't tracked by git. This avoids large "
+             "unrelated changes when editing existing code."));
+  SET_WIDGET(grid, UI_ON_SAVE_CHANGED, chk);
+  SET_WIDGET(onsave_chk, UI_ON_SAVE_CHANGED, chk);
+  gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(chk), p->on_save_changed);
+  gtk_widget_set_sensitive(chk, p->on_save);
+
+  row++;
+
+  chk = gtk_check_button_new_with_label(
+      _("Check formatting of the current document when idle."));
+#if GTK_CHECK_VERSION(3, 0, 0)
+  gtk_grid_attach(GTK_GRID(grid), chk, 0, row, 3, 1);
+  gtk_widget_set_hexpand(chk, true);
+#else
+  gtk_table_attach(GTK_TABLE(grid), chk, 0, 3, row, row + 1,
+                   GTK_FILL | GTK_EXPAND, GTK_FILL, 0, 0);
+#endif
+  gtk_widget_set_tooltip_text(
+      chk, _("Enabling this option causes the current document to be "
+             "checked in the background after a short pause in typing. "
+             "Lines which need formatting are underlined, but the document "
+             "itself is never changed."));
+  SET_WIDGET(grid, UI_CHECK_IDLE, chk);
+  gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(chk), p->check_on_idle);
+
+  row++;
+
+  chk = gtk_check_button_new_with_label(
+      _("Format other documents of the session when they are shown."));
+#if GTK_CHECK_VERSION(3, 0, 0)
+  gtk_grid_attach(GTK_GRID(grid), chk, 0, row, 3, 1);
+  gtk_widget_set_hexpand(chk, true);
+#else
+  gtk_table_attach(GTK_TABLE(grid), chk, 0, 3, row, row + 1,
+                   GTK_FILL | GTK_EXPAND, GTK_FILL, 0, 0);
+#endif
+  gtk_widget_set_tooltip_text(
+      chk, _("Enabling this option makes formatting the entire session "
+             "format only the current document right away. The other "
+             "documents are formatted when they are next shown or saved, "
+             "and the most recently used of them are prepared in the "
+             "background."));
+  SET_WIDGET(grid, UI_LAZY_SESSION, chk);
+  gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(chk), p->lazy_session);
+
+  row++;
+
+  chk = gtk_check_button_new_with_label(
+      _("Share formatting with other instances through a service."));
+#if GTK_CHECK_VERSION(3, 0, 0)
+  gtk_grid_attach(GTK_GRID(grid), chk, 0, row, 3, 1);
+  gtk_widget_set_hexpand(chk, true);
+#else
+  gtk_table_attach(GTK_TABLE(grid), chk, 0, 3, row, row + 1,
+                   GTK_FILL | GTK_EXPAND, GTK_FILL, 0, 0);
+#endif
+  gtk_widget_set_tooltip_text(
+      chk, _("Enabling this option runs clang-format through a background "
+             "service shared by all Geany instances and tools of the user, "
+             "which is started when needed and remembers recent results. "
+             "When the service can't be started, clang-format is run "
+             "directly."));
+  SET_WIDGET(grid, UI_SERVICE, chk);
+  gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(chk), p->use_service);
 
   row++;
 
@@ -609,6 +1028,62 @@ GtkWidget *fmt_prefs_create_panel(bool project)
 
   row++;
 
+  lbl = gtk_label_new(_("Latency Budget (ms):"));
+  gtk_misc_set_alignment(GTK_MISC(lbl), 0.0, 0.5);
+#if GTK_CHECK_VERSION(3, 0, 0)
+  gtk_grid_attach(GTK_GRID(grid), lbl, 0, row, 1, 1);
+  gtk_widget_set_hexpand(lbl, false);
+#else
+  gtk_table_attach(GTK_TABLE(grid), lbl, 0, 1, row, row + 1, GTK_FILL, GTK_FILL,
+                   0, 0);
+#endif
+
+  ent = gtk_spin_button_new_with_range(0, 10000, 10);
+  gtk_spin_button_set_value(GTK_SPIN_BUTTON(ent), p->latency_budget);
+#if GTK_CHECK_VERSION(3, 0, 0)
+  gtk_grid_attach(GTK_GRID(grid), ent, 1, row, 2, 1);
+  gtk_widget_set_hexpand(ent, true);
+#else
+  gtk_table_attach(GTK_TABLE(grid), ent, 1, 3, row, row + 1,
+                   GTK_FILL | GTK_EXPAND, GTK_FILL, 0, 0);
+#endif
+  gtk_widget_set_tooltip_text(
+      ent, _("How long auto-formatting may take before it switches to "
+             "formatting only the code around the trigger character, and "
+             "then to waiting until typing pauses. Set to 0 to always "
+             "format the whole document."));
+  SET_WIDGET(grid, UI_BUDGET, ent);
+
+  row++;
+
+  lbl = gtk_label_new(_("Speculate After (ms):"));
+  gtk_misc_set_alignment(GTK_MISC(lbl), 0.0, 0.5);
+#if GTK_CHECK_VERSION(3, 0, 0)
+  gtk_grid_attach(GTK_GRID(grid), lbl, 0, row, 1, 1);
+  gtk_widget_set_hexpand(lbl, false);
+#else
+  gtk_table_attach(GTK_TABLE(grid), lbl, 0, 1, row, row + 1, GTK_FILL, GTK_FILL,
+                   0, 0);
+#endif
+
+  ent = gtk_spin_button_new_with_range(0, 60000, 100);
+  gtk_spin_button_set_value(GTK_SPIN_BUTTON(ent), p->speculative_delay);
+#if GTK_CHECK_VERSION(3, 0, 0)
+  gtk_grid_attach(GTK_GRID(grid), ent, 1, row, 2, 1);
+  gtk_widget_set_hexpand(ent, true);
+#else
+  gtk_table_attach(GTK_TABLE(grid), ent, 1, 3, row, row + 1,
+                   GTK_FILL | GTK_EXPAND, GTK_FILL, 0, 0);
+#endif
+  gtk_widget_set_tooltip_text(
+      ent, _("When the current document hasn't been edited for this long, "
+             "it is formatted in the background ahead of time, so the next "
+             "auto-format, keybinding or save can use the result right "
+             "away. Set to 0 to disable."));
+  SET_WIDGET(grid, UI_SPECULATE, ent);
+
+  row++;
+
 #if GTK_CHECK_VERSION(3, 0, 0)
   sep = gtk_separator_new(GTK_ORIENTATION_HORIZONTAL);
   gtk_grid_attach(GTK_GRID(grid), sep, 0, row, 3, 1);
@@ -43,8 +43,38 @@ bool fmt_prefs_get_auto_format(void);
 void fmt_prefs_set_auto_format(bool auto_format);
 const char *fmt_prefs_get_trigger(void);
 void fmt_prefs_set_trigger(const char *trigger_chars);
+unsigned int fmt_prefs_get_latency_budget(void);
+void fmt_prefs_set_latency_budget(unsigned int budget_ms);
+unsigned int fmt_prefs_get_speculative_delay(void);
+void fmt_prefs_set_speculative_delay(unsigned int delay_ms);
+bool fmt_prefs_get_indent_new_lines(void);
+void fmt_prefs_set_indent_new_lines(bool indent);
+bool fmt_prefs_get_format_on_paste(void);
+void fmt_prefs_set_format_on_paste(bool on_paste);
+unsigned int fmt_prefs_get_paste_background_size(void);
+void fmt_prefs_set_paste_background_size(unsigned int size);
 bool fmt_prefs_get_format_on_save(void);
 void fmt_prefs_set_format_on_save(bool on_save);
+bool fmt_prefs_get_format_changed_on_save(void);
+void fmt_prefs_set_format_changed_on_save(bool changed_only);
+bool fmt_prefs_get_check_on_idle(void);
+void fmt_prefs_set_check_on_idle(bool check_on_idle);
+bool fmt_prefs_get_format_session_lazily(void);
+void fmt_prefs_set_format_session_lazily(bool lazily);
+bool fmt_prefs_get_use_service(void);
+void fmt_prefs_set_use_service(bool use_service);
+unsigned int fmt_prefs_get_max_processes(void);
+void fmt_prefs_set_max_processes(unsigned int max_processes);
+int fmt_prefs_get_memory_limit(void);
+void fmt_prefs_set_memory_limit(int limit_mb);
+bool fmt_prefs_get_use_cgroup(void);
+void fmt_prefs_set_use_cgroup(bool use_cgroup);
+unsigned int fmt_prefs_get_pressure_threshold(void);
+void fmt_prefs_set_pressure_threshold(unsigned int percent);
+const char *fmt_prefs_get_trace_file(void);
+void fmt_prefs_set_trace_file(const char *fn);
+bool fmt_prefs_get_verify(void);
+void fmt_prefs_set_verify(bool verify);
 
 void fmt_prefs_save_panel(GtkWidget *panel, bool project);
 GtkWidget *fmt_prefs_create_panel(bool project);
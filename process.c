@@ -24,58 +24,82 @@
 #endif
 
 #include "process.h"
+#include "governor.h"
+#include "protocol.h"
+
+#ifdef G_OS_UNIX
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
 
 #define IO_BUF_SIZE 4096
 
 struct FmtProcess
 {
   GPid child_pid;
+  FmtProcessPriority priority;
   GIOChannel *ch_in, *ch_out;
   int return_code;
   unsigned long exit_handler;
+
+  // Asynchronous run state
+  const char *in_buf;
+  size_t in_len, in_off;
+  GString *out;
+  unsigned long in_handler, out_handler;
+  bool exited, out_done, cancelled, suspended;
+  FmtProcessFunc callback;
+  gpointer user_data;
+
+  // Run by the formatting service, its output starts with the response
+  // header at out_start
+  bool remote;
+  size_t out_start;
 };
 
+static void async_maybe_finish(FmtProcess *proc);
+
+// The channels stay with the process until it's closed, whether it ends
+// before, during or after a run. Child watches are removed once they've
+// been dispatched.
 static void on_process_exited(GPid pid, int status, FmtProcess *proc)
 {
   g_spawn_close_pid(pid);
   proc->child_pid = 0;
-
-  // FIXME: is it automatically removed?
-  if (proc->exit_handler > 0)
-  {
-    g_source_remove(proc->exit_handler);
-    proc->exit_handler = 0;
-  }
-
-  if (proc->ch_in)
-  {
-    g_io_channel_shutdown(proc->ch_in, true, NULL);
-    g_io_channel_unref(proc->ch_in);
-    proc->ch_in = NULL;
-  }
-
-  if (proc->ch_out)
-  {
-    g_io_channel_shutdown(proc->ch_out, true, NULL);
-    g_io_channel_unref(proc->ch_out);
-    proc->ch_out = NULL;
-  }
-
+  proc->exit_handler = 0;
   proc->return_code = status;
+  proc->exited = true;
+  if (proc->callback)
+    async_maybe_finish(proc);
 }
 
 FmtProcess *fmt_process_open(const char *work_dir, const char *const *argv)
+{
+  return fmt_process_open_with_priority(work_dir, argv,
+                                        FMT_PROCESS_PRIORITY_NORMAL);
+}
+
+FmtProcess *fmt_process_open_with_priority(const char *work_dir,
+                                           const char *const *argv,
+                                           FmtProcessPriority priority)
 {
   FmtProcess *proc;
   GError *error = NULL;
   int fd_in = -1, fd_out = -1;
 
+  fmt_governor_prepare_spawn();
+
   proc = g_new0(FmtProcess, 1);
 
   if (!g_spawn_async_with_pipes(work_dir, (char **)argv, NULL,
                                 G_SPAWN_SEARCH_PATH | G_SPAWN_DO_NOT_REAP_CHILD,
-                                NULL, NULL, &proc->child_pid, &fd_in, &fd_out,
-                                NULL, &error))
+                                fmt_governor_setup_child,
+                                GINT_TO_POINTER(priority), &proc->child_pid,
+                                &fd_in, &fd_out, NULL, &error))
   {
     g_warning("Failed to create subprocess: %s", error->message);
     g_error_free(error);
@@ -83,6 +107,8 @@ FmtProcess *fmt_process_open(const char *work_dir, const char *const *argv)
     return NULL;
   }
 
+  proc->priority = priority;
+  fmt_governor_add(priority);
   proc->return_code = -1;
   proc->exit_handler = g_child_watch_add(
       proc->child_pid, (GChildWatchFunc)on_process_exited, proc);
@@ -94,34 +120,102 @@ FmtProcess *fmt_process_open(const char *work_dir, const char *const *argv)
   return proc;
 }
 
+// Waits for a child that hasn't been reaped yet, so it doesn't linger as
+// a zombie. Its pipes are closed by then, so it's about to exit.
+static void reap_child(FmtProcess *proc)
+{
+  if (proc->exit_handler > 0)
+    g_source_remove(proc->exit_handler);
+  proc->exit_handler = 0;
+
+#ifdef G_OS_UNIX
+  {
+    int status;
+    pid_t ret;
+
+    // A stopped child can't exit until it's continued
+    if (proc->suspended)
+      kill(proc->child_pid, SIGCONT);
+    do
+      ret = waitpid(proc->child_pid, &status, 0);
+    while (ret < 0 && errno == EINTR);
+    if (ret == proc->child_pid)
+      proc->return_code = status;
+  }
+#endif
+
+  g_spawn_close_pid(proc->child_pid);
+  proc->child_pid = 0;
+}
+
 int fmt_process_close(FmtProcess *proc)
 {
-  int ret_code = proc->return_code;
+  int ret_code;
+
+  if (proc->in_handler > 0)
+    g_source_remove(proc->in_handler);
+  if (proc->out_handler > 0)
+    g_source_remove(proc->out_handler);
 
+  // Unwritten input is dropped, flushing it could block or raise SIGPIPE
   if (proc->ch_in)
   {
-    g_io_channel_shutdown(proc->ch_in, true, NULL);
+    g_io_channel_shutdown(proc->ch_in, false, NULL);
     g_io_channel_unref(proc->ch_in);
   }
 
   if (proc->ch_out)
   {
-    g_io_channel_shutdown(proc->ch_out, true, NULL);
+    g_io_channel_shutdown(proc->ch_out, false, NULL);
     g_io_channel_unref(proc->ch_out);
   }
 
   if (proc->child_pid > 0)
-  {
-    if (proc->exit_handler > 0)
-      g_source_remove(proc->exit_handler);
-    g_spawn_close_pid(proc->child_pid);
-  }
+    reap_child(proc);
+  ret_code = proc->return_code;
 
+  fmt_governor_remove(proc->priority, proc->suspended);
   g_free(proc);
 
   return ret_code;
 }
 
+// Strips the service's response header from @a out, which starts at
+// @a start, keeping the command's exit status
+static bool take_response_status(FmtProcess *proc, GString *out,
+                                 size_t start)
+{
+  guint32 status;
+
+  if (out->len - start < FMT_PROTOCOL_MAGIC_LEN + sizeof(status) ||
+      memcmp(out->str + start, FMT_PROTOCOL_MAGIC, FMT_PROTOCOL_MAGIC_LEN))
+  {
+    g_warning("Invalid response from the formatting service");
+    return false;
+  }
+
+  memcpy(&status, out->str + start + FMT_PROTOCOL_MAGIC_LEN, sizeof(status));
+  proc->return_code = (int)GUINT32_FROM_BE(status);
+  g_string_erase(out, start, FMT_PROTOCOL_MAGIC_LEN + sizeof(status));
+
+  return true;
+}
+
+static void close_input(FmtProcess *proc)
+{
+#ifdef G_OS_UNIX
+  // The other channel still reads from the same socket
+  if (proc->remote && proc->ch_in)
+    shutdown(g_io_channel_unix_get_fd(proc->ch_in), SHUT_WR);
+#endif
+  if (proc->ch_in)
+  {
+    g_io_channel_shutdown(proc->ch_in, true, NULL);
+    g_io_channel_unref(proc->ch_in);
+    proc->ch_in = NULL;
+  }
+}
+
 bool fmt_process_run(FmtProcess *proc, const char *str_in, size_t in_len,
                      GString *str_out)
 {
@@ -129,6 +223,7 @@ bool fmt_process_run(FmtProcess *proc, const char *str_in, size_t in_len,
   GError *error = NULL;
   bool read_complete = false;
   size_t in_off = 0;
+  size_t out_start = str_out->len;
 
   if (str_in && in_len)
   {
@@ -158,9 +253,8 @@ bool fmt_process_run(FmtProcess *proc, const char *str_in, size_t in_len,
   }
 
   // Flush it and close it down
-  g_io_channel_shutdown(proc->ch_in, true, NULL);
-  g_io_channel_unref(proc->ch_in);
-  proc->ch_in = NULL;
+  g_io_channel_flush(proc->ch_in, NULL);
+  close_input(proc);
 
   // All text should be written to process's stdin by now, read the
   // rest of the process's stdout.
@@ -195,5 +289,325 @@ bool fmt_process_run(FmtProcess *proc, const char *str_in, size_t in_len,
     }
   }
 
+  if (proc->remote)
+    return take_response_status(proc, str_out, out_start);
+
+  return true;
+}
+
+static void async_finish(FmtProcess *proc)
+{
+  FmtProcessFunc callback = proc->callback;
+  bool success;
+
+  proc->callback = NULL;
+  if (!callback)
+    return;
+
+  success = !proc->cancelled && proc->out_done;
+  if (success && proc->remote)
+    success = take_response_status(proc, proc->out, proc->out_start);
+#ifdef G_OS_UNIX
+  // A crashed formatter must not be mistaken for empty output
+  if (success && WIFSIGNALED(proc->return_code))
+    success = false;
+#endif
+
+  callback(proc, success, proc->out, proc->user_data);
+}
+
+static void async_maybe_finish(FmtProcess *proc)
+{
+  if (proc->exited && proc->out_done && proc->in_handler == 0)
+    async_finish(proc);
+}
+
+static gboolean on_async_input_ready(GIOChannel *ch, GIOCondition cond,
+                                     FmtProcess *proc)
+{
+  if (!(cond & (G_IO_ERR | G_IO_HUP | G_IO_NVAL)))
+  {
+    do
+    {
+      size_t bytes_written = 0;
+      size_t size_to_write = MIN(proc->in_len - proc->in_off, IO_BUF_SIZE);
+      GError *error = NULL;
+      GIOStatus status =
+          g_io_channel_write_chars(ch, proc->in_buf + proc->in_off,
+                                   size_to_write, &bytes_written, &error);
+      proc->in_off += bytes_written;
+      if (status == G_IO_STATUS_AGAIN)
+        return true; // pipe is full, wait for the child to read some more
+      if (status == G_IO_STATUS_ERROR)
+      {
+        g_warning("Failed writing to subprocess's stdin: %s", error->message);
+        g_error_free(error);
+        break;
+      }
+    } while (proc->in_off < proc->in_len);
+  }
+
+  proc->in_handler = 0;
+  close_input(proc);
+  async_maybe_finish(proc);
+  return false;
+}
+
+static gboolean on_async_output_ready(GIOChannel *ch, GIOCondition cond,
+                                      FmtProcess *proc)
+{
+  char buf[IO_BUF_SIZE];
+
+  if (cond & (G_IO_IN | G_IO_PRI))
+  {
+    for (;;)
+    {
+      size_t bytes_read = 0;
+      GError *error = NULL;
+      GIOStatus status =
+          g_io_channel_read_chars(ch, buf, sizeof(buf), &bytes_read, &error);
+      if (bytes_read > 0)
+        g_string_append_len(proc->out, buf, bytes_read);
+      if (status == G_IO_STATUS_AGAIN)
+        return true;
+      if (status == G_IO_STATUS_EOF)
+        break;
+      if (status == G_IO_STATUS_ERROR)
+      {
+        g_warning("Failed to read subprocess's stdout: %s", error->message);
+        g_error_free(error);
+        proc->cancelled = true;
+        break;
+      }
+    }
+  }
+  else if (!(cond & (G_IO_HUP | G_IO_ERR | G_IO_NVAL)))
+  {
+    return true;
+  }
+
+  proc->out_handler = 0;
+  proc->out_done = true;
+  async_maybe_finish(proc);
+  return false;
+}
+
+static void make_channel_async(GIOChannel *ch)
+{
+  g_io_channel_set_encoding(ch, NULL, NULL);
+  g_io_channel_set_buffered(ch, false);
+  g_io_channel_set_flags(ch, G_IO_FLAG_NONBLOCK, NULL);
+}
+
+bool fmt_process_run_async(FmtProcess *proc, const char *str_in,
+                           size_t in_len, GString *str_out,
+                           FmtProcessFunc callback, gpointer user_data)
+{
+  g_return_val_if_fail(proc, false);
+  g_return_val_if_fail(str_out, false);
+  g_return_val_if_fail(proc->ch_in && proc->ch_out, false);
+
+  proc->in_buf = str_in;
+  proc->in_len = str_in ? in_len : 0;
+  proc->in_off = 0;
+  proc->out = str_out;
+  proc->out_start = str_out->len;
+  proc->callback = callback;
+  proc->user_data = user_data;
+
+  if (proc->remote)
+    proc->exited = true; // only the output is waited for
+
+  make_channel_async(proc->ch_in);
+  make_channel_async(proc->ch_out);
+
+  if (proc->in_len > 0)
+  {
+    proc->in_handler = g_io_add_watch(
+        proc->ch_in, G_IO_OUT | G_IO_ERR | G_IO_HUP | G_IO_NVAL,
+        (GIOFunc)on_async_input_ready, proc);
+  }
+  else
+  {
+    close_input(proc);
+  }
+
+  proc->out_handler = g_io_add_watch(
+      proc->ch_out, G_IO_IN | G_IO_PRI | G_IO_ERR | G_IO_HUP | G_IO_NVAL,
+      (GIOFunc)on_async_output_ready, proc);
+
+  return true;
+}
+
+void fmt_process_cancel(FmtProcess *proc)
+{
+  g_return_if_fail(proc);
+
+  proc->cancelled = true;
+
+  // Writing on to a killed child would only fail
+  if (proc->in_handler > 0)
+  {
+    g_source_remove(proc->in_handler);
+    proc->in_handler = 0;
+    close_input(proc);
+  }
+#ifdef G_OS_UNIX
+  // Hanging up makes the service kill the command and ends the output
+  if (proc->remote && proc->ch_out)
+    shutdown(g_io_channel_unix_get_fd(proc->ch_out), SHUT_RDWR);
+  if (proc->child_pid > 0)
+  {
+    kill(proc->child_pid, SIGKILL);
+    // A stopped child can't die until it's continued
+    if (proc->suspended)
+      kill(proc->child_pid, SIGCONT);
+  }
+#endif
+  if (proc->suspended)
+    fmt_governor_set_suspended(false);
+  proc->suspended = false;
+}
+
+void fmt_process_abort(FmtProcess *proc)
+{
+  g_return_if_fail(proc);
+
+  fmt_process_cancel(proc);
+  if (proc->out_handler > 0)
+  {
+    g_source_remove(proc->out_handler);
+    proc->out_handler = 0;
+  }
+  proc->out_done = true;
+  async_finish(proc);
+}
+
+void fmt_process_suspend(FmtProcess *proc, bool suspend)
+{
+  g_return_if_fail(proc);
+
+  // The service's child can't be stopped from here, so it isn't
+  // counted as suspended either
+  if (proc->suspended == suspend || proc->cancelled || proc->remote)
+    return;
+#ifdef G_OS_UNIX
+  if (proc->child_pid > 0)
+    kill(proc->child_pid, suspend ? SIGSTOP : SIGCONT);
+#endif
+  fmt_governor_set_suspended(suspend);
+  proc->suspended = suspend;
+}
+
+#ifdef G_OS_UNIX
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+static void append_u32(GByteArray *buf, guint32 value)
+{
+  value = GUINT32_TO_BE(value);
+  g_byte_array_append(buf, (const guint8 *)&value, sizeof(value));
+}
+
+static void append_string(GByteArray *buf, const char *str)
+{
+  size_t len = strlen(str);
+  append_u32(buf, len);
+  g_byte_array_append(buf, (const guint8 *)str, len);
+}
+
+static bool write_all(int fd, const guint8 *data, size_t len)
+{
+  while (len > 0)
+  {
+    ssize_t n = send(fd, data, len, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    data += n;
+    len -= n;
+  }
   return true;
 }
+#endif
+
+FmtProcess *fmt_process_connect(const char *socket_path, const char *work_dir,
+                                const char *const *argv,
+                                FmtProcessPriority priority)
+{
+#ifdef G_OS_UNIX
+  struct sockaddr_un addr;
+  FmtProcess *proc;
+  GByteArray *req;
+  guint32 flags = 0;
+  guint64 limit_mb;
+  int fd, fd_in, argc;
+  bool sent;
+
+  g_return_val_if_fail(socket_path, NULL);
+  g_return_val_if_fail(argv && argv[0], NULL);
+
+  if (strlen(socket_path) >= sizeof(addr.sun_path))
+    return NULL;
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, socket_path);
+
+  fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0)
+    return NULL;
+  fcntl(fd, F_SETFD, FD_CLOEXEC);
+  if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0)
+  {
+    close(fd);
+    return NULL;
+  }
+
+  if (priority == FMT_PROCESS_PRIORITY_LOW)
+    flags |= FMT_PROTOCOL_FLAG_LOW_PRIORITY;
+  // The service isn't in the governor's cgroup, it sets an rlimit
+  limit_mb = (fmt_governor_get_memory_limit() + (1 << 20) - 1) >> 20;
+  if (limit_mb > 0)
+    flags |= FMT_PROTOCOL_FLAG_MEMORY_LIMIT;
+  for (argc = 0; argv[argc]; argc++)
+    ;
+
+  req = g_byte_array_new();
+  g_byte_array_append(req, (const guint8 *)FMT_PROTOCOL_MAGIC,
+                      FMT_PROTOCOL_MAGIC_LEN);
+  append_u32(req, flags);
+  if (limit_mb > 0)
+    append_u32(req, MIN(limit_mb, G_MAXUINT32));
+  append_u32(req, argc);
+  append_string(req, work_dir ? work_dir : ".");
+  for (int i = 0; i < argc; i++)
+    append_string(req, argv[i]);
+  sent = write_all(fd, req->data, req->len);
+  g_byte_array_free(req, true);
+
+  fd_in = sent ? fcntl(fd, F_DUPFD_CLOEXEC, 0) : -1;
+  if (fd_in < 0)
+  {
+    close(fd);
+    return NULL;
+  }
+
+  proc = g_new0(FmtProcess, 1);
+  proc->remote = true;
+  proc->priority = priority;
+  fmt_governor_add(priority);
+  proc->return_code = -1;
+  proc->ch_in = g_io_channel_unix_new(fd_in);
+  proc->ch_out = g_io_channel_unix_new(fd);
+  // The response header isn't text
+  g_io_channel_set_encoding(proc->ch_in, NULL, NULL);
+  g_io_channel_set_encoding(proc->ch_out, NULL, NULL);
+
+  return proc;
+#else
+  return NULL;
+#endif
+}
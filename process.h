@@ -28,11 +28,70 @@ G_BEGIN_DECLS
 
 typedef struct FmtProcess FmtProcess;
 
+typedef enum
+{
+  FMT_PROCESS_PRIORITY_NORMAL = 0,
+  FMT_PROCESS_PRIORITY_LOW, // reduced CPU and I/O priority
+} FmtProcessPriority;
+
+/**
+ * Called when an asynchronous run finishes.
+ *
+ * @param proc The process that was run.
+ * @param success @c false if the process failed or was cancelled.
+ * @param str_out The collected standard output of the process.
+ * @param user_data The data passed to fmt_process_run_async().
+ */
+typedef void (*FmtProcessFunc)(FmtProcess *proc, bool success,
+                               GString *str_out, gpointer user_data);
+
 FmtProcess *fmt_process_open(const char *work_dir, const char *const *argv);
+FmtProcess *fmt_process_open_with_priority(const char *work_dir,
+                                           const char *const *argv,
+                                           FmtProcessPriority priority);
+
+/**
+ * Runs @a argv through the formatting service listening on
+ * @a socket_path instead of spawning it, the result is used like that
+ * of fmt_process_open(). The service applies the governor's memory
+ * limit, but such processes can't be suspended.
+ *
+ * @return The process, or @c NULL when the service can't be reached.
+ */
+FmtProcess *fmt_process_connect(const char *socket_path, const char *work_dir,
+                                const char *const *argv,
+                                FmtProcessPriority priority);
 int fmt_process_close(FmtProcess *proc);
 bool fmt_process_run(FmtProcess *proc, const char *str_in, size_t in_len,
                      GString *str_out);
 
+/**
+ * Runs the process without blocking the main loop.
+ *
+ * The @a str_in buffer is not copied and must stay valid until
+ * @a callback is invoked. The @a str_out string receives the process's
+ * output and is passed back to @a callback. The process must still be
+ * closed with fmt_process_close(), usually from inside @a callback.
+ */
+bool fmt_process_run_async(FmtProcess *proc, const char *str_in,
+                           size_t in_len, GString *str_out,
+                           FmtProcessFunc callback, gpointer user_data);
+void fmt_process_cancel(FmtProcess *proc);
+
+/**
+ * Cancels the process and calls the callback of its asynchronous run
+ * right away, instead of from the main loop, so its data can be freed
+ * when nothing will run the main loop anymore.
+ */
+void fmt_process_abort(FmtProcess *proc);
+
+/**
+ * Stops or continues the process, which then no longer counts towards
+ * the governor's limit on running processes. Does nothing for
+ * processes run by the formatting service.
+ */
+void fmt_process_suspend(FmtProcess *proc, bool suspend);
+
 G_END_DECLS
 
 #endif // FMT_PROCESS_H
@@ -0,0 +1,686 @@
+/*
+ * project.c
+ *
+ * Copyright 2013 Matthew <mbrush@codebrainz.ca>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "project.h"
+#include "format.h"
+#include "sched.h"
+#include "verify.h"
+
+#include <glib/gstdio.h>
+
+#define INDEX_MAGIC "code-format-index 1"
+
+// Time spent walking and hashing per main loop iteration
+#define WALK_SLICE_USEC 8000
+
+typedef struct
+{
+  gint64 size, mtime;
+  char *content_hash;
+  char *config_hash;
+} IndexEntry;
+
+typedef struct
+{
+  bool check_only, cancelled, walk_done;
+  char *base_path;
+  char *index_file;
+  gint64 index_time; // when the loaded index was written
+  GHashTable *index;         // path -> IndexEntry*
+  GHashTable *config_hashes; // directory -> config hash
+  GQueue dirs;               // directories left to walk
+  GQueue files;              // files waiting for a formatting slot
+  size_t in_flight, max_in_flight;
+  size_t n_files, n_clean, n_formatted, n_dirty, n_failed, n_skipped;
+  unsigned int idle_id;
+  gint64 started_at;
+} ProjectRun;
+
+typedef struct
+{
+  ProjectRun *run;
+  char *path;
+  char *config_hash;
+  gint64 size, mtime;
+} ProjectFile;
+
+static ProjectRun *current_run = NULL;
+
+static const char *source_extensions[] = {
+  "c", "h", "cc", "cpp", "cxx", "c++", "hh", "hpp", "hxx", "h++", "m", "mm",
+};
+
+static bool is_source_file(const char *name)
+{
+  const char *ext = strrchr(name, '.');
+  if (!ext || ext == name)
+    return false;
+  ext++;
+  for (size_t i = 0; i < G_N_ELEMENTS(source_extensions); i++)
+  {
+    if (g_ascii_strcasecmp(ext, source_extensions[i]) == 0)
+      return true;
+  }
+  return false;
+}
+
+static void index_entry_free(IndexEntry *entry)
+{
+  g_free(entry->content_hash);
+  g_free(entry->config_hash);
+  g_free(entry);
+}
+
+static void project_file_free(ProjectFile *pf)
+{
+  g_free(pf->path);
+  g_free(pf->config_hash);
+  g_free(pf);
+}
+
+// Index files live in the plugin's own config area, one per project
+static char *index_file_for_project(GeanyProject *prj)
+{
+  char *sum, *base, *fn;
+
+  sum = g_compute_checksum_for_string(G_CHECKSUM_SHA1, prj->file_name, -1);
+  base = g_strconcat(sum, ".index", NULL);
+  fn = g_build_filename(geany_data->app->configdir, "plugins", "code-format",
+                        "projects", base, NULL);
+  g_free(base);
+  g_free(sum);
+
+  return fn;
+}
+
+// Line format: size TAB mtime TAB content-hash TAB config-hash TAB path
+static void index_load(ProjectRun *run)
+{
+  char *contents = NULL;
+  char **lines;
+  size_t len = 0;
+
+  if (!g_file_get_contents(run->index_file, &contents, &len, NULL))
+    return;
+
+  lines = g_strsplit(contents, "\n", -1);
+  g_free(contents);
+
+  if (!lines[0] || !g_str_has_prefix(lines[0], INDEX_MAGIC "\t"))
+  {
+    g_strfreev(lines);
+    return;
+  }
+  run->index_time =
+      g_ascii_strtoll(lines[0] + strlen(INDEX_MAGIC "\t"), NULL, 10);
+
+  for (size_t i = 1; lines[i]; i++)
+  {
+    char **fields = g_strsplit(lines[i], "\t", 5);
+    if (g_strv_length(fields) == 5)
+    {
+      IndexEntry *entry = g_new0(IndexEntry, 1);
+      entry->size = g_ascii_strtoll(fields[0], NULL, 10);
+      entry->mtime = g_ascii_strtoll(fields[1], NULL, 10);
+      entry->content_hash = g_strdup(fields[2]);
+      entry->config_hash = g_strdup(fields[3]);
+      g_hash_table_replace(run->index, g_strdup(fields[4]), entry);
+    }
+    g_strfreev(fields);
+  }
+
+  g_strfreev(lines);
+}
+
+static void index_save(ProjectRun *run)
+{
+  GString *out;
+  GHashTableIter iter;
+  gpointer key, value;
+  char *dn;
+
+  out = g_string_sized_new(g_hash_table_size(run->index) * 128);
+  g_string_append_printf(out, "%s\t%" G_GINT64_FORMAT "\n", INDEX_MAGIC,
+                         g_get_real_time() / G_USEC_PER_SEC);
+
+  g_hash_table_iter_init(&iter, run->index);
+  while (g_hash_table_iter_next(&iter, &key, &value))
+  {
+    IndexEntry *entry = value;
+    // Such paths can't be stored in the line format
+    if (strchr(key, '\n') || strchr(key, '\t'))
+      continue;
+    g_string_append_printf(out,
+                           "%" G_GINT64_FORMAT "\t%" G_GINT64_FORMAT
+                           "\t%s\t%s\t%s\n",
+                           entry->size, entry->mtime, entry->content_hash,
+                           entry->config_hash, (const char *)key);
+  }
+
+  dn = g_path_get_dirname(run->index_file);
+  g_mkdir_with_parents(dn, 0755);
+  g_free(dn);
+
+  if (!g_file_set_contents(run->index_file, out->str, out->len, NULL))
+    g_warning("Failed to write project index '%s'", run->index_file);
+
+  g_string_free(out, true);
+}
+
+static const char *config_hash_for_dir(ProjectRun *run, const char *dir)
+{
+  char *hash = g_hash_table_lookup(run->config_hashes, dir);
+  if (!hash)
+  {
+    hash = fmt_config_hash(dir);
+    g_hash_table_insert(run->config_hashes, g_strdup(dir), hash);
+  }
+  return hash;
+}
+
+static void index_record(ProjectRun *run, const char *path, gint64 size,
+                         gint64 mtime, const char *content_hash,
+                         const char *config_hash)
+{
+  IndexEntry *entry = g_new0(IndexEntry, 1);
+  entry->size = size;
+  entry->mtime = mtime;
+  entry->content_hash = g_strdup(content_hash);
+  entry->config_hash = g_strdup(config_hash);
+  g_hash_table_replace(run->index, g_strdup(path), entry);
+}
+
+static bool document_is_open(const char *locale_path)
+{
+  GeanyDocument *doc;
+  char *utf8_path = utils_get_utf8_from_locale(locale_path);
+  doc = document_find_by_filename(utf8_path);
+  g_free(utf8_path);
+  return DOC_VALID(doc);
+}
+
+static void run_free(ProjectRun *run)
+{
+  if (run->idle_id > 0)
+    g_source_remove(run->idle_id);
+  g_queue_foreach(&run->dirs, (GFunc)g_free, NULL);
+  g_queue_clear(&run->dirs);
+  g_queue_foreach(&run->files, (GFunc)project_file_free, NULL);
+  g_queue_clear(&run->files);
+  g_hash_table_destroy(run->index);
+  g_hash_table_destroy(run->config_hashes);
+  g_free(run->base_path);
+  g_free(run->index_file);
+  g_free(run);
+}
+
+static void run_report(ProjectRun *run)
+{
+  double secs =
+      (g_get_monotonic_time() - run->started_at) / (double)G_USEC_PER_SEC;
+
+  if (run->check_only)
+  {
+    msgwin_status_add(_("Code Format: checked %lu files in %.2fs, %lu need "
+                        "formatting, %lu unchanged since last run, %lu "
+                        "failed."),
+                      (unsigned long)run->n_files, secs,
+                      (unsigned long)run->n_dirty, (unsigned long)run->n_clean,
+                      (unsigned long)run->n_failed);
+  }
+  else
+  {
+    msgwin_status_add(_("Code Format: processed %lu files in %.2fs, %lu "
+                        "formatted, %lu unchanged since last run, %lu open "
+                        "in the editor were skipped, %lu failed."),
+                      (unsigned long)run->n_files, secs,
+                      (unsigned long)run->n_formatted,
+                      (unsigned long)run->n_clean,
+                      (unsigned long)run->n_skipped,
+                      (unsigned long)run->n_failed);
+  }
+}
+
+// Called whenever some work finished, ends the run when none is left
+static void run_maybe_finish(ProjectRun *run)
+{
+  if (run->in_flight > 0 || run->idle_id > 0)
+    return;
+  if (!run->cancelled && (!run->walk_done || !g_queue_is_empty(&run->files)))
+    return;
+
+  index_save(run);
+  if (!run->cancelled)
+    run_report(run);
+  if (current_run == run)
+    current_run = NULL;
+  run_free(run);
+}
+
+static void on_project_job_done(FmtJob *job, ProjectFile *pf);
+
+static void submit_file(ProjectRun *run, ProjectFile *pf, GString *contents)
+{
+  FmtJob *job;
+
+  // Checking only needs the replacements, not the whole formatted text
+  job = fmt_job_new(FMT_JOB_BACKGROUND, pf->path, NULL, 0, 0, 0,
+                    contents->len, run->check_only);
+  // Hand the already read contents over instead of copying them
+  g_string_free(job->code, true);
+  job->code = contents;
+  job->tag = run;
+
+  run->in_flight++;
+  fmt_sched_submit(job, (FmtJobFunc)on_project_job_done, pf);
+}
+
+// Reads a file that may need formatting. Returns NULL when the index
+// shows it's already formatted or it can't be read.
+static GString *read_if_changed(ProjectRun *run, ProjectFile *pf)
+{
+  IndexEntry *entry;
+  char *contents = NULL, *hash;
+  size_t len = 0;
+
+  entry = g_hash_table_lookup(run->index, pf->path);
+
+  // Same stat data is trusted, unless the file was modified within
+  // the same second the index was written (it might have changed
+  // again without the mtime moving)
+  if (entry && entry->size == pf->size && entry->mtime == pf->mtime &&
+      entry->mtime < run->index_time &&
+      g_strcmp0(entry->config_hash, pf->config_hash) == 0)
+  {
+    return NULL;
+  }
+
+  if (!g_file_get_contents(pf->path, &contents, &len, NULL))
+  {
+    run->n_failed++;
+    return NULL;
+  }
+
+  hash = g_compute_checksum_for_data(G_CHECKSUM_SHA1, (const guchar *)contents,
+                                     len);
+  if (entry && g_strcmp0(entry->content_hash, hash) == 0 &&
+      g_strcmp0(entry->config_hash, pf->config_hash) == 0)
+  {
+    // Touched but not changed
+    entry->size = pf->size;
+    entry->mtime = pf->mtime;
+    g_free(hash);
+    g_free(contents);
+    return NULL;
+  }
+
+  g_free(hash);
+  return g_string_new_len(contents, len);
+}
+
+static void queue_file(ProjectRun *run, const char *path, GStatBuf *st)
+{
+  ProjectFile *pf;
+  char *dir;
+
+  pf = g_new0(ProjectFile, 1);
+  pf->run = run;
+  pf->path = g_strdup(path);
+  pf->size = st->st_size;
+  pf->mtime = st->st_mtime;
+
+  dir = g_path_get_dirname(path);
+  pf->config_hash = g_strdup(config_hash_for_dir(run, dir));
+  g_free(dir);
+
+  run->n_files++;
+  g_queue_push_tail(&run->files, pf);
+}
+
+static void walk_directory(ProjectRun *run, const char *dn)
+{
+  GDir *dir;
+  const char *name;
+
+  dir = g_dir_open(dn, 0, NULL);
+  if (!dir)
+    return;
+
+  while ((name = g_dir_read_name(dir)) != NULL)
+  {
+    char *path;
+    GStatBuf st;
+
+    // Skip VCS metadata, build trees of dot-dirs and the like
+    if (name[0] == '.')
+      continue;
+
+    path = g_build_filename(dn, name, NULL);
+    // lstat(), so symlinked directories can't cause cycles
+    if (g_lstat(path, &st) == 0)
+    {
+      if (S_ISDIR(st.st_mode))
+      {
+        g_queue_push_tail(&run->dirs, path);
+        continue;
+      }
+      else if (S_ISREG(st.st_mode) && is_source_file(name))
+      {
+        queue_file(run, path, &st);
+      }
+    }
+    g_free(path);
+  }
+
+  g_dir_close(dir);
+}
+
+// Start as many queued files as the in-flight bound allows
+static void fill_slots(ProjectRun *run, gint64 deadline)
+{
+  while (run->in_flight < run->max_in_flight &&
+         !g_queue_is_empty(&run->files) && g_get_monotonic_time() < deadline)
+  {
+    ProjectFile *pf = g_queue_pop_head(&run->files);
+    GString *contents;
+
+    if (!run->check_only && document_is_open(pf->path))
+    {
+      // The editor owns these, they're handled by session formatting
+      run->n_skipped++;
+      project_file_free(pf);
+      continue;
+    }
+
+    contents = read_if_changed(run, pf);
+    if (!contents)
+    {
+      run->n_clean++;
+      project_file_free(pf);
+      continue;
+    }
+
+    submit_file(run, pf, contents);
+  }
+}
+
+static gboolean on_project_walk_idle(ProjectRun *run)
+{
+  gint64 deadline = g_get_monotonic_time() + WALK_SLICE_USEC;
+
+  while (!g_queue_is_empty(&run->dirs) && g_get_monotonic_time() < deadline)
+  {
+    char *dn = g_queue_pop_head(&run->dirs);
+    walk_directory(run, dn);
+    g_free(dn);
+  }
+  run->walk_done = g_queue_is_empty(&run->dirs);
+
+  fill_slots(run, deadline);
+
+  ui_set_statusbar(false, _("Code Format: %lu of %lu project files done"),
+                   (unsigned long)(run->n_files - run->in_flight -
+                                   g_queue_get_length(&run->files)),
+                   (unsigned long)run->n_files);
+
+  // Keep going while there's walking to do or free slots to fill
+  if (!run->walk_done ||
+      (!g_queue_is_empty(&run->files) && run->in_flight < run->max_in_flight))
+  {
+    return true;
+  }
+
+  run->idle_id = 0;
+  run_maybe_finish(run);
+  return false;
+}
+
+static void schedule_walk(ProjectRun *run)
+{
+  if (run->idle_id == 0 && !run->cancelled)
+  {
+    run->idle_id = g_idle_add_full(G_PRIORITY_LOW,
+                                   (GSourceFunc)on_project_walk_idle, run,
+                                   NULL);
+  }
+}
+
+static bool write_if_unchanged(ProjectFile *pf, GString *formatted)
+{
+  GStatBuf st;
+  GError *error = NULL;
+
+  // Never clobber an edit made while clang-format was running
+  if (g_stat(pf->path, &st) != 0 || st.st_size != pf->size ||
+      st.st_mtime != pf->mtime)
+  {
+    return false;
+  }
+
+  // Replaced through a temporary file, so a failed write can't leave it
+  // truncated, with its permissions restored afterwards (the walk only
+  // collects regular files, never symlinks)
+  if (!g_file_set_contents(pf->path, formatted->str, formatted->len,
+                           &error))
+  {
+    g_warning("Failed to write '%s': %s", pf->path, error->message);
+    g_error_free(error);
+    return false;
+  }
+  g_chmod(pf->path, st.st_mode & 07777);
+
+  if (g_stat(pf->path, &st) == 0)
+  {
+    pf->size = st.st_size;
+    pf->mtime = st.st_mtime;
+  }
+
+  return true;
+}
+
+// Lists the lines of a file which need formatting in the message window
+static void report_dirty_file(const char *path, GString *code, GArray *repls)
+{
+  char *utf8_path = utils_get_utf8_from_locale(path);
+  GArray *ranges = fmt_replacements_line_ranges(repls, code->str, code->len);
+
+  msgwin_msg_add(COLOR_RED, -1, NULL,
+                 _("%s: needs formatting (%u replacements)"), utf8_path,
+                 repls->len);
+  for (unsigned int i = 0; i < ranges->len; i++)
+  {
+    FmtLineRange *range = &g_array_index(ranges, FmtLineRange, i);
+    msgwin_msg_add(COLOR_RED, -1, NULL, _("%s:%u: lines %u-%u"), utf8_path,
+                   range->first, range->first, range->last);
+  }
+
+  g_array_free(ranges, true);
+  g_free(utf8_path);
+}
+
+static void on_project_job_done(FmtJob *job, ProjectFile *pf)
+{
+  ProjectRun *run = pf->run;
+  bool clean;
+
+  run->in_flight--;
+
+  if (job->cancelled || run->cancelled)
+  {
+    project_file_free(pf);
+    run_maybe_finish(run);
+    return;
+  }
+
+  if (!job->result)
+  {
+    run->n_failed++;
+    project_file_free(pf);
+    schedule_walk(run);
+    return;
+  }
+
+  if (run->check_only)
+  {
+    GArray *repls = fmt_replacements_parse(job->result->str, job->code->str,
+                                           job->code->len);
+    if (!repls)
+    {
+      run->n_failed++;
+      project_file_free(pf);
+      schedule_walk(run);
+      return;
+    }
+    clean = repls->len == 0;
+    if (!clean)
+      report_dirty_file(pf->path, job->code, repls);
+    g_array_free(repls, true);
+  }
+  else
+  {
+    clean = job->result->len == job->code->len &&
+            memcmp(job->result->str, job->code->str, job->code->len) == 0;
+  }
+
+  if (!clean && run->check_only)
+  {
+    run->n_dirty++;
+  }
+  else if (!clean &&
+           (!fmt_verify_formatted(pf->path, job->code->str, job->code->len,
+                                  job->result->str, job->result->len) ||
+            !write_if_unchanged(pf, job->result)))
+  {
+    run->n_failed++;
+  }
+  else
+  {
+    // A clean file's contents are its formatted contents
+    GString *formatted = clean ? job->code : job->result;
+    char *hash = g_compute_checksum_for_data(
+        G_CHECKSUM_SHA1, (const guchar *)formatted->str, formatted->len);
+    if (!clean)
+      run->n_formatted++;
+    index_record(run, pf->path, pf->size, pf->mtime, hash, pf->config_hash);
+    g_free(hash);
+  }
+
+  project_file_free(pf);
+  schedule_walk(run);
+}
+
+static char *project_base_path(GeanyProject *prj)
+{
+  char *base, *dir, *path;
+
+  if (!prj->base_path || !*prj->base_path)
+    return NULL;
+
+  base = utils_get_locale_from_utf8(prj->base_path);
+  if (g_path_is_absolute(base))
+    return base;
+
+  // Relative base paths are relative to the project file
+  dir = g_path_get_dirname(prj->file_name);
+  path = g_build_filename(dir, base, NULL);
+  g_free(dir);
+  g_free(base);
+
+  return path;
+}
+
+void fmt_project_run(bool check_only)
+{
+  GeanyProject *prj = geany_data->app->project;
+  ProjectRun *run;
+  char *base_path;
+
+  if (!prj)
+  {
+    g_warning("Cannot format project with no project open");
+    return;
+  }
+
+  base_path = project_base_path(prj);
+  if (!base_path || !g_file_test(base_path, G_FILE_TEST_IS_DIR))
+  {
+    g_warning("Project base path '%s' is not a directory",
+              base_path ? base_path : "");
+    g_free(base_path);
+    return;
+  }
+
+  fmt_project_cancel();
+
+  run = g_new0(ProjectRun, 1);
+  run->check_only = check_only;
+  run->base_path = base_path;
+  run->index_file = index_file_for_project(prj);
+  run->index = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                                     (GDestroyNotify)index_entry_free);
+  run->config_hashes =
+      g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+  g_queue_init(&run->dirs);
+  g_queue_init(&run->files);
+  // The scheduler limits concurrency, this bounds memory use
+  run->max_in_flight = MAX(2, g_get_num_processors() * 2);
+  run->started_at = g_get_monotonic_time();
+
+  index_load(run);
+  g_queue_push_tail(&run->dirs, g_strdup(base_path));
+
+  if (check_only)
+    msgwin_clear_tab(MSG_MESSAGE);
+
+  current_run = run;
+  schedule_walk(run);
+}
+
+void fmt_project_cancel(void)
+{
+  ProjectRun *run = current_run;
+
+  if (!run)
+    return;
+
+  current_run = NULL;
+  run->cancelled = true;
+  if (run->idle_id > 0)
+  {
+    g_source_remove(run->idle_id);
+    run->idle_id = 0;
+  }
+
+  // Callbacks of cancelled jobs release the run once all are back
+  run->in_flight++;
+  fmt_sched_cancel_tag(run);
+  run->in_flight--;
+  run_maybe_finish(run);
+}
+
+bool fmt_project_is_running(void)
+{
+  return current_run != NULL;
+}
@@ -0,0 +1,52 @@
+/*
+ * project.h
+ *
+ * Copyright 2013 Matthew <mbrush@codebrainz.ca>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+
+#ifndef FMT_PROJECT_H
+#define FMT_PROJECT_H
+
+#include "plugin.h"
+
+G_BEGIN_DECLS
+
+/**
+ * Formats (or only checks) every supported file below the open
+ * project's base path.
+ *
+ * Files recorded in the project's index as already formatted with the
+ * same effective configuration are skipped without being read. The
+ * run happens in the background, starting a new run cancels the
+ * previous one.
+ *
+ * @param check_only When @c true, files are never rewritten and the
+ * ones needing formatting are listed in the message window instead.
+ */
+void fmt_project_run(bool check_only);
+
+/**
+ * Cancels a running project run, keeping the progress made so far.
+ */
+void fmt_project_cancel(void);
+
+bool fmt_project_is_running(void);
+
+G_END_DECLS
+
+#endif // FMT_PROJECT_H
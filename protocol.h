@@ -0,0 +1,61 @@
+/*
+ * protocol.h
+ *
+ * Copyright 2013 Matthew <mbrush@codebrainz.ca>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+
+/*
+ * Wire format of the formatting service, shared by the plugin and the
+ * code-format-daemon program. Every connection carries one request.
+ *
+ * Request:  "FMT2", u32 flags, the command's memory limit as a u32 in
+ *           MiB when FMT_PROTOCOL_FLAG_MEMORY_LIMIT is set, u32 argc,
+ *           then the working directory and the argc arguments, each as
+ *           a u32 length and that many bytes, then the command's
+ *           standard input until the client shuts down its side of the
+ *           connection for writing.
+ *
+ * Response: "FMT2", u32 wait status of the command as from waitpid(),
+ *           then its standard output until the service closes the
+ *           connection. The connection is closed without a response
+ *           when the command couldn't be run.
+ *
+ * Integers are big-endian. Closing the connection before the response
+ * arrives cancels the request.
+ */
+
+#ifndef FMT_PROTOCOL_H
+#define FMT_PROTOCOL_H
+
+#define FMT_PROTOCOL_MAGIC "FMT2"
+#define FMT_PROTOCOL_MAGIC_LEN 4
+
+// Run the command at reduced CPU and I/O priority
+#define FMT_PROTOCOL_FLAG_LOW_PRIORITY 0x1
+// Limit the command's address space, the limit follows the flags
+#define FMT_PROTOCOL_FLAG_MEMORY_LIMIT 0x2
+
+// Sanity limits on requests
+#define FMT_PROTOCOL_MAX_ARGS 256
+#define FMT_PROTOCOL_MAX_STRING (64 * 1024)
+#define FMT_PROTOCOL_MAX_INPUT (256 * 1024 * 1024)
+
+// Name of the socket in the per-user runtime directory
+#define FMT_PROTOCOL_SOCKET_NAME "geany-code-format.sock"
+
+#endif // FMT_PROTOCOL_H
@@ -0,0 +1,168 @@
+/*
+ * rebase.c
+ *
+ * Copyright 2013 Matthew <mbrush@codebrainz.ca>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "rebase.h"
+
+typedef struct
+{
+  size_t start, end;
+} Span;
+
+// Where an edit lies relative to [start, end)
+typedef enum
+{
+  EDIT_BEFORE,
+  EDIT_AFTER,
+  EDIT_OVERLAPS,
+} EditPlace;
+
+static EditPlace place_edit(const FmtEdit *edit, size_t start, size_t end)
+{
+  // Text typed right at the start goes in front of the replaced text
+  if (edit->pos + edit->deleted <= start &&
+      (edit->deleted > 0 || edit->pos <= start))
+    return EDIT_BEFORE;
+  // ... and right at the end after it
+  if (edit->pos >= end && (end > start || edit->pos > start))
+    return EDIT_AFTER;
+  return EDIT_OVERLAPS;
+}
+
+static void shift_span(Span *span, const FmtEdit *edit)
+{
+  span->start = span->start + edit->inserted - edit->deleted;
+  span->end = span->end + edit->inserted - edit->deleted;
+}
+
+// Widens a span to cover an edit overlapping it
+static void widen_span(Span *span, const FmtEdit *edit)
+{
+  size_t end = MAX(span->end, edit->pos + edit->deleted);
+  span->start = MIN(span->start, edit->pos);
+  span->end = end - edit->deleted + edit->inserted;
+}
+
+static void move_conflicts(GArray *spans, const FmtEdit *edit)
+{
+  for (unsigned int i = 0; i < spans->len; i++)
+  {
+    Span *span = &g_array_index(spans, Span, i);
+    switch (place_edit(edit, span->start, span->end))
+    {
+      case EDIT_BEFORE:
+        shift_span(span, edit);
+        break;
+      case EDIT_OVERLAPS:
+        widen_span(span, edit);
+        break;
+      default:
+        break;
+    }
+  }
+}
+
+static int compare_spans(const Span *a, const Span *b)
+{
+  if (a->start != b->start)
+    return a->start < b->start ? -1 : 1;
+  return 0;
+}
+
+bool fmt_rebase_replacements(FmtDocState *state, unsigned long from_version,
+                             GArray *repls, GArray *conflicts)
+{
+  GArray *spans;
+  unsigned int first = 0;
+
+  if (state->version == from_version)
+    return true;
+
+  // Find the first edit made after from_version, and make sure none of
+  // the ones in between were dropped from the log
+  if (!state->edits || state->edits->len == 0)
+    return false;
+  while (first < state->edits->len &&
+         g_array_index(state->edits, FmtEdit, first).version <= from_version)
+  {
+    first++;
+  }
+  if (first == state->edits->len ||
+      g_array_index(state->edits, FmtEdit, first).version != from_version + 1)
+    return false;
+
+  spans = g_array_new(false, false, sizeof(Span));
+
+  for (unsigned int e = first; e < state->edits->len; e++)
+  {
+    const FmtEdit *edit = &g_array_index(state->edits, FmtEdit, e);
+
+    move_conflicts(spans, edit);
+
+    for (unsigned int i = 0; i < repls->len;)
+    {
+      FmtReplacement *repl = &g_array_index(repls, FmtReplacement, i);
+      Span span = { repl->offset, repl->offset + repl->length };
+
+      switch (place_edit(edit, span.start, span.end))
+      {
+        case EDIT_BEFORE:
+          repl->offset = repl->offset + edit->inserted - edit->deleted;
+          i++;
+          break;
+        case EDIT_AFTER:
+          i++;
+          break;
+        default:
+          widen_span(&span, edit);
+          g_array_append_val(spans, span);
+          g_array_remove_index(repls, i); // keeps the order
+          break;
+      }
+    }
+  }
+
+  // Merge overlapping spans into the ranges to format again
+  g_array_sort(spans, (GCompareFunc)compare_spans);
+  for (unsigned int i = 0; i < spans->len; i++)
+  {
+    Span *span = &g_array_index(spans, Span, i);
+    FmtRange *last = NULL;
+    if (conflicts->len > 0)
+      last = &g_array_index(conflicts, FmtRange, conflicts->len - 1);
+    if (last && span->start <= last->offset + last->length)
+    {
+      size_t end = MAX(last->offset + last->length, span->end);
+      last->length = end - last->offset;
+    }
+    else
+    {
+      FmtRange range = { span->start, span->end - span->start };
+      g_array_append_val(conflicts, range);
+    }
+  }
+
+  g_array_free(spans, true);
+  return true;
+}
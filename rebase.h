@@ -0,0 +1,50 @@
+/*
+ * rebase.h
+ *
+ * Copyright 2013 Matthew <mbrush@codebrainz.ca>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+
+#ifndef FMT_REBASE_H
+#define FMT_REBASE_H
+
+#include "docstate.h"
+#include "format.h"
+
+G_BEGIN_DECLS
+
+/**
+ * Moves replacements made for an older version of a document over the
+ * edits made since, so they apply to its current text.
+ *
+ * Replacements an edit overlaps can't be moved. They're removed from
+ * @a repls and the span of text they covered, in current positions and
+ * widened by the overlapping edits, is added to @a conflicts.
+ *
+ * @param state The document's state holding the edit log.
+ * @param from_version The version @a repls were made for.
+ * @param repls Sorted FmtReplacement, updated in place.
+ * @param conflicts An array of FmtRange receiving the conflicting spans.
+ * @return @c false if the edit log doesn't reach back to
+ * @a from_version, in which case nothing is changed.
+ */
+bool fmt_rebase_replacements(FmtDocState *state, unsigned long from_version,
+                             GArray *repls, GArray *conflicts);
+
+G_END_DECLS
+
+#endif // FMT_REBASE_H
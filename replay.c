@@ -0,0 +1,538 @@
+/*
+ * replay.c
+ *
+ * Copyright 2013 Matthew <mbrush@codebrainz.ca>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+
+/*
+ * code-format-replay, plays back editing sessions recorded with the
+ * session-trace-file setting (see trace.h for the format).
+ *
+ * The documents are rebuilt edit by edit, at the recorded pace or
+ * faster, and every formatting job recorded is run again against the
+ * given clang-format, or a stub that only costs a process, on the text
+ * it was recorded with. It reports how long keystrokes took to be
+ * formatted in the recording and in the replay, so that recordings of
+ * real sessions can compare plugin and clang-format versions. Jobs
+ * are run one after another; when one takes longer than the recording
+ * did, the events after it are late, which shows up as lag.
+ *
+ * The formatter's command line is rebuilt from each "job" record's
+ * style, cursor, XML flag and ranges, with every recorded range passed
+ * as is. The plugin's fallbacks for clang-format versions that take a
+ * single range aren't repeated, format.c depends on Geany and isn't
+ * linked in.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <glib.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define IO_BUF_SIZE 65536
+
+// Job classes, as in sched.h
+#define JOB_INTERACTIVE 0
+
+typedef struct
+{
+  GString *text;
+  char *file_name;
+  gint64 last_char;  // recorded time of the last character typed
+  gint64 trigger;    // ... that caused a job not applied yet, or -1
+  gint64 replay_key; // replay time of that character
+} Document;
+
+typedef struct
+{
+  const char *clang_format;
+  const char *dir;
+  double speed; // 0 for as fast as possible
+  bool run;
+  bool stub;
+
+  GHashTable *docs; // id -> Document
+  gint64 start;     // monotonic time the session started being replayed
+  gint64 max_lag;
+
+  GArray *recorded; // keystroke to applied, in µs
+  GArray *replayed; // keystroke to formatted, in µs
+  GArray *runs;     // formatter run times, in µs
+  unsigned int n_events, n_jobs, n_failed, n_mismatched, n_bad_lines;
+} Replay;
+
+static void document_free(Document *doc)
+{
+  g_string_free(doc->text, true);
+  g_free(doc->file_name);
+  g_free(doc);
+}
+
+static char *text_hash(const GString *text)
+{
+  char *hash = g_compute_checksum_for_data(G_CHECKSUM_SHA1,
+                                           (guchar *)text->str, text->len);
+  hash[16] = '\0';
+  return hash;
+}
+
+//======================================================================
+//
+// Running the formatter
+//
+
+static bool run_formatter(const char *work_dir, char **argv,
+                          const GString *input, GString *out)
+{
+  GPid pid;
+  int fd_in = -1, fd_out = -1, wstatus = 0;
+  size_t in_off = 0;
+  GError *error = NULL;
+
+  if (!g_spawn_async_with_pipes(work_dir, argv, NULL,
+                                G_SPAWN_SEARCH_PATH |
+                                    G_SPAWN_DO_NOT_REAP_CHILD |
+                                    G_SPAWN_STDERR_TO_DEV_NULL,
+                                NULL, NULL, &pid, &fd_in, &fd_out, NULL,
+                                &error))
+  {
+    g_printerr("Failed to run %s: %s\n", argv[0], error->message);
+    g_error_free(error);
+    return false;
+  }
+
+  fcntl(fd_in, F_SETFL, fcntl(fd_in, F_GETFL) | O_NONBLOCK);
+  if (input->len == 0)
+  {
+    close(fd_in);
+    fd_in = -1;
+  }
+
+  while (fd_out >= 0)
+  {
+    struct pollfd fds[2];
+    char buf[IO_BUF_SIZE];
+    nfds_t n = 0;
+
+    fds[n].fd = fd_out;
+    fds[n++].events = POLLIN;
+    if (fd_in >= 0)
+    {
+      fds[n].fd = fd_in;
+      fds[n++].events = POLLOUT;
+    }
+
+    if (poll(fds, n, -1) < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      break;
+    }
+
+    if (fd_in >= 0 && fds[1].revents)
+    {
+      ssize_t w = write(fd_in, input->str + in_off,
+                        MIN(input->len - in_off, IO_BUF_SIZE));
+      if (w > 0)
+        in_off += w;
+      if ((w < 0 && errno != EAGAIN && errno != EINTR) ||
+          in_off == input->len)
+      {
+        close(fd_in);
+        fd_in = -1;
+      }
+    }
+
+    if (fds[0].revents)
+    {
+      ssize_t r = read(fd_out, buf, sizeof(buf));
+      if (r > 0)
+        g_string_append_len(out, buf, r);
+      else if (r == 0 || errno != EINTR)
+      {
+        close(fd_out);
+        fd_out = -1;
+      }
+    }
+  }
+
+  if (fd_in >= 0)
+    close(fd_in);
+  if (fd_out >= 0)
+    close(fd_out);
+  while (waitpid(pid, &wstatus, 0) < 0 && errno == EINTR)
+    ;
+  g_spawn_close_pid(pid);
+
+  return WIFEXITED(wstatus) && WEXITSTATUS(wstatus) == 0;
+}
+
+// The command line of a recorded job, see the top of the file
+static GPtrArray *job_arguments(Replay *r, const char *style,
+                                const char *cursor, bool xml,
+                                const char *ranges)
+{
+  GPtrArray *args = g_ptr_array_new_with_free_func(g_free);
+  char **parts;
+
+  if (r->stub)
+  {
+    g_ptr_array_add(args, g_strdup("cat"));
+    g_ptr_array_add(args, NULL);
+    return args;
+  }
+
+  g_ptr_array_add(args, g_strdup(r->clang_format));
+  if (xml)
+    g_ptr_array_add(args, g_strdup("-output-replacements-xml"));
+  g_ptr_array_add(args, g_strdup_printf("-style=%s", style));
+  g_ptr_array_add(args, g_strdup_printf("-cursor=%s", cursor));
+
+  parts = g_strsplit(ranges, ",", -1);
+  for (char **part = parts; *part; part++)
+  {
+    unsigned long offset, length;
+    unsigned int first, last;
+
+    if (sscanf(*part, "L%u:%u", &first, &last) == 2)
+      g_ptr_array_add(args, g_strdup_printf("-lines=%u:%u", first, last));
+    else if (sscanf(*part, "%lu+%lu", &offset, &length) == 2)
+    {
+      g_ptr_array_add(args, g_strdup_printf("-offset=%lu", offset));
+      g_ptr_array_add(args, g_strdup_printf("-length=%lu", length));
+    }
+  }
+  g_strfreev(parts);
+
+  g_ptr_array_add(args, NULL);
+  return args;
+}
+
+// Where the plugin would have run the job: next to the file if it's
+// still there, else in the directory given
+static char *work_dir(Replay *r, Document *doc)
+{
+  char *dir = g_path_get_dirname(doc->file_name);
+
+  if (r->dir || !g_file_test(dir, G_FILE_TEST_IS_DIR))
+  {
+    g_free(dir);
+    dir = r->dir ? g_strdup(r->dir) : g_get_current_dir();
+  }
+  return dir;
+}
+
+//======================================================================
+//
+// Playing back
+//
+
+// Waits until the replay reaches recorded time @a t, returns how late
+// it is
+static gint64 wait_for(Replay *r, gint64 t)
+{
+  gint64 due, now = g_get_monotonic_time();
+
+  if (r->speed <= 0)
+    return 0;
+
+  due = r->start + (gint64)(t / r->speed);
+  if (due > now)
+  {
+    g_usleep(due - now);
+    return 0;
+  }
+  return now - due;
+}
+
+static Document *lookup_document(Replay *r, const char *id)
+{
+  Document *doc = g_hash_table_lookup(r->docs, id);
+  if (!doc)
+    r->n_bad_lines++;
+  return doc;
+}
+
+static void replay_job(Replay *r, Document *doc, char **fields)
+{
+  GPtrArray *args;
+  GString *out;
+  char *hash, *dir;
+  gint64 started, finished, run_time;
+  int job_class = atoi(fields[4]);
+
+  r->n_jobs++;
+
+  // The text must be what the plugin formatted, or the trace is broken
+  hash = text_hash(doc->text);
+  if (strcmp(hash, fields[6]) != 0)
+    r->n_mismatched++;
+  g_free(hash);
+
+  if (job_class == JOB_INTERACTIVE && doc->last_char >= 0)
+    doc->trigger = doc->last_char;
+
+  if (!r->run)
+    return;
+
+  args = job_arguments(r, fields[5], fields[7], atoi(fields[8]) != 0,
+                       fields[9]);
+  dir = work_dir(r, doc);
+  out = g_string_sized_new(doc->text->len);
+
+  started = g_get_monotonic_time();
+  if (!run_formatter(dir, (char **)args->pdata, doc->text, out))
+    r->n_failed++;
+  finished = g_get_monotonic_time();
+
+  run_time = finished - started;
+  g_array_append_val(r->runs, run_time);
+  if (job_class == JOB_INTERACTIVE && doc->trigger >= 0)
+  {
+    gint64 latency = finished - doc->replay_key;
+    g_array_append_val(r->replayed, latency);
+  }
+
+  g_string_free(out, true);
+  g_free(dir);
+  g_ptr_array_free(args, true);
+}
+
+static void replay_record(Replay *r, char **fields, unsigned int n)
+{
+  const char *type = fields[0];
+  gint64 t = g_ascii_strtoll(fields[1], NULL, 10);
+  Document *doc = NULL;
+  gint64 lag;
+
+  r->n_events++;
+
+  if (strcmp(type, "start") == 0)
+  {
+    // A new session, with new documents and its own clock
+    g_hash_table_remove_all(r->docs);
+    r->start = g_get_monotonic_time();
+    return;
+  }
+
+  lag = wait_for(r, t);
+  r->max_lag = MAX(r->max_lag, lag);
+
+  if (strcmp(type, "open") == 0 && n >= 5)
+  {
+    gsize len;
+    guchar *text = g_base64_decode(fields[4], &len);
+
+    doc = g_new0(Document, 1);
+    doc->text = g_string_new_len((char *)text, len);
+    doc->file_name = g_strcompress(fields[3]);
+    doc->last_char = doc->trigger = -1;
+    g_hash_table_replace(r->docs, g_strdup(fields[2]), doc);
+    g_free(text);
+    return;
+  }
+
+  if (n < 3 || !(doc = lookup_document(r, fields[2])))
+    return;
+
+  if (strcmp(type, "ins") == 0 && n >= 5)
+  {
+    gsize len;
+    guchar *text = g_base64_decode(fields[4], &len);
+    size_t pos = strtoul(fields[3], NULL, 10);
+
+    g_string_insert_len(doc->text, MIN(pos, doc->text->len), (char *)text,
+                        len);
+    g_free(text);
+  }
+  else if (strcmp(type, "del") == 0 && n >= 5)
+  {
+    size_t pos = strtoul(fields[3], NULL, 10);
+    size_t len = strtoul(fields[4], NULL, 10);
+
+    if (pos <= doc->text->len)
+      g_string_erase(doc->text, pos, MIN(len, doc->text->len - pos));
+  }
+  else if (strcmp(type, "char") == 0)
+  {
+    doc->last_char = t;
+    doc->replay_key = g_get_monotonic_time();
+  }
+  else if (strcmp(type, "job") == 0 && n >= 10)
+    replay_job(r, doc, fields);
+  else if (strcmp(type, "apply") == 0)
+  {
+    if (doc->trigger >= 0)
+    {
+      gint64 latency = t - doc->trigger;
+      g_array_append_val(r->recorded, latency);
+    }
+    doc->trigger = -1;
+  }
+  else if (strcmp(type, "close") == 0)
+    g_hash_table_remove(r->docs, fields[2]);
+  else if (strcmp(type, "done") != 0)
+    r->n_bad_lines++;
+}
+
+static int compare_times(gconstpointer a, gconstpointer b)
+{
+  gint64 x = *(const gint64 *)a, y = *(const gint64 *)b;
+  return (x > y) - (x < y);
+}
+
+static void print_times(const char *what, GArray *times)
+{
+  double p50, p90, p99, max;
+
+  if (times->len == 0)
+  {
+    g_print("%-26s none\n", what);
+    return;
+  }
+
+  g_array_sort(times, compare_times);
+#define AT(q) \
+  (g_array_index(times, gint64, (size_t)((times->len - 1) * (q))) / 1000.0)
+  p50 = AT(0.5);
+  p90 = AT(0.9);
+  p99 = AT(0.99);
+  max = AT(1.0);
+#undef AT
+
+  g_print("%-26s n=%u p50=%.1fms p90=%.1fms p99=%.1fms max=%.1fms\n", what,
+          times->len, p50, p90, p99, max);
+}
+
+static void usage(const char *self)
+{
+  g_printerr("Usage: %s [--clang-format PATH | --stub | --no-run] "
+             "[--speed FACTOR] [--dir DIR] TRACE\n",
+             self);
+}
+
+int main(int argc, char **argv)
+{
+  Replay r = { "clang-format", NULL, 1.0, true, false };
+  const char *trace_path = NULL;
+  char *contents = NULL, **lines;
+  GError *error = NULL;
+  int i;
+
+  for (i = 1; i < argc; i++)
+  {
+    if (strcmp(argv[i], "--clang-format") == 0 && i + 1 < argc)
+      r.clang_format = argv[++i];
+    else if (strcmp(argv[i], "--stub") == 0)
+      r.stub = true;
+    else if (strcmp(argv[i], "--no-run") == 0)
+      r.run = false;
+    else if (strcmp(argv[i], "--speed") == 0 && i + 1 < argc)
+      r.speed = g_ascii_strtod(argv[++i], NULL);
+    else if (strcmp(argv[i], "--dir") == 0 && i + 1 < argc)
+      r.dir = argv[++i];
+    else if (!trace_path && argv[i][0] != '-')
+      trace_path = argv[i];
+    else
+    {
+      usage(argv[0]);
+      return 2;
+    }
+  }
+
+  if (!trace_path)
+  {
+    usage(argv[0]);
+    return 2;
+  }
+
+  if (!g_file_get_contents(trace_path, &contents, NULL, &error))
+  {
+    g_printerr("%s\n", error->message);
+    g_error_free(error);
+    return 1;
+  }
+
+  // Only what's recorded matters without running anything
+  if (!r.run)
+    r.speed = 0;
+
+  // A formatter exiting before reading all its input must not kill us
+  signal(SIGPIPE, SIG_IGN);
+
+  r.docs = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                                 (GDestroyNotify)document_free);
+  r.recorded = g_array_new(false, false, sizeof(gint64));
+  r.replayed = g_array_new(false, false, sizeof(gint64));
+  r.runs = g_array_new(false, false, sizeof(gint64));
+  r.start = g_get_monotonic_time();
+
+  lines = g_strsplit(contents, "\n", -1);
+  g_free(contents);
+  for (char **line = lines; *line; line++)
+  {
+    char **fields;
+    unsigned int n;
+
+    if (**line == '\0')
+      continue;
+    fields = g_strsplit(*line, "\t", -1);
+    n = g_strv_length(fields);
+    if (n >= 2)
+      replay_record(&r, fields, n);
+    else
+      r.n_bad_lines++;
+    g_strfreev(fields);
+  }
+  g_strfreev(lines);
+
+  g_print("%u events, %u formatting jobs\n", r.n_events, r.n_jobs);
+  print_times("Recorded keystroke->apply", r.recorded);
+  if (r.run)
+  {
+    print_times("Replayed keystroke->done", r.replayed);
+    print_times("Formatter runs", r.runs);
+    g_print("%u failed runs, lagging behind by up to %.1fms\n", r.n_failed,
+            r.max_lag / 1000.0);
+  }
+  if (r.n_mismatched > 0 || r.n_bad_lines > 0)
+  {
+    g_print("%u jobs on text differing from the recording, "
+            "%u unreadable records\n",
+            r.n_mismatched, r.n_bad_lines);
+  }
+
+  g_hash_table_destroy(r.docs);
+  g_array_free(r.recorded, true);
+  g_array_free(r.replayed, true);
+  g_array_free(r.runs, true);
+
+  return (r.n_mismatched > 0 || r.n_bad_lines > 0) ? 1 : 0;
+}
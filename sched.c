@@ -0,0 +1,461 @@
+/*
+ * sched.c
+ *
+ * Copyright 2013 Matthew <mbrush@codebrainz.ca>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "sched.h"
+#include "breaker.h"
+#include "format.h"
+#include "governor.h"
+#include "trace.h"
+
+// How often held back work is retried while memory is under pressure
+#define THROTTLE_RETRY_MS 1000
+
+struct FmtScheduler
+{
+  GQueue queued[FMT_JOB_N_CLASSES];
+  GList *running;
+  size_t n_running[FMT_JOB_N_CLASSES];
+  size_t limits[FMT_JOB_N_CLASSES];
+  unsigned int next_id;
+  unsigned int retry_source;
+  bool dispatching, redispatch;
+};
+
+static struct FmtScheduler sched;
+
+FmtJob *fmt_job_new(FmtJobClass job_class, const char *file_name,
+                    const char *code, size_t code_len, size_t cursor,
+                    size_t offset, size_t length, bool xml_replacements)
+{
+  FmtJob *job;
+
+  g_return_val_if_fail(job_class < FMT_JOB_N_CLASSES, NULL);
+  g_return_val_if_fail(file_name, NULL);
+
+  job = g_new0(FmtJob, 1);
+  job->job_class = job_class;
+  job->file_name = g_strdup(file_name);
+  job->code = code ? g_string_new_len(code, code_len) : g_string_new(NULL);
+  job->cursor = cursor;
+  job->offset = offset;
+  job->length = length;
+  job->xml_replacements = xml_replacements;
+
+  return job;
+}
+
+void fmt_job_free(FmtJob *job)
+{
+  if (!job)
+    return;
+  g_free(job->file_name);
+  if (job->code)
+    g_string_free(job->code, true);
+  if (job->result)
+    g_string_free(job->result, true);
+  if (job->ranges)
+    g_array_free(job->ranges, true);
+  if (job->lines)
+    g_array_free(job->lines, true);
+  g_free(job);
+}
+
+bool fmt_job_is_whole_document(FmtJob *job)
+{
+  return !job->ranges && !job->lines && job->offset == 0 &&
+         job->length >= job->code->len;
+}
+
+static bool urgent_work_pending(void)
+{
+  return sched.n_running[FMT_JOB_INTERACTIVE] > 0 ||
+         sched.n_running[FMT_JOB_EXPLICIT] > 0 ||
+         !g_queue_is_empty(&sched.queued[FMT_JOB_INTERACTIVE]) ||
+         !g_queue_is_empty(&sched.queued[FMT_JOB_EXPLICIT]);
+}
+
+static FmtProcessPriority class_priority(FmtJobClass job_class)
+{
+  if (job_class >= FMT_JOB_SESSION)
+    return FMT_PROCESS_PRIORITY_LOW;
+  return FMT_PROCESS_PRIORITY_NORMAL;
+}
+
+static void dispatch(void);
+
+// Hand a finished job back to its owner and free it
+static void job_complete(FmtJob *job)
+{
+  job->finished_at = g_get_monotonic_time();
+  fmt_trace_job_done(job);
+  fmt_breaker_record(job);
+  if (job->callback)
+    job->callback(job, job->user_data);
+  fmt_job_free(job);
+}
+
+static void on_job_done(GString *formatted, size_t cursor, FmtJob *job)
+{
+  // The process is closed once this returns
+  job->proc = NULL;
+  job->suspended = false;
+
+  sched.running = g_list_remove(sched.running, job);
+  sched.n_running[job->job_class]--;
+
+  if (formatted && !job->cancelled)
+  {
+    job->result = formatted;
+    job->cursor = cursor;
+  }
+  else if (formatted)
+  {
+    g_string_free(formatted, true);
+  }
+  else if (!job->cancelled)
+    job->failed = true;
+
+  job_complete(job);
+  dispatch();
+}
+
+static bool job_has_work(FmtJob *job)
+{
+  return job->code->len > 0 && (job->length > 0 || job->ranges || job->lines);
+}
+
+static void job_start(FmtJob *job)
+{
+  FmtProcessPriority prio = class_priority(job->job_class);
+
+  job->started_at = g_get_monotonic_time();
+
+  if (job_has_work(job))
+  {
+    GArray *ranges = job->ranges;
+    if (!ranges && !job->lines)
+    {
+      FmtRange range = { job->offset, job->length };
+      ranges = g_array_sized_new(false, false, sizeof(FmtRange), 1);
+      g_array_append_val(ranges, range);
+    }
+    job->proc = fmt_clang_format_async(
+        job->file_name, job->code->str, job->code->len, job->cursor, ranges,
+        job->lines, job->xml_replacements, prio, (FmtFormatFunc)on_job_done,
+        job);
+    if (ranges != job->ranges)
+      g_array_free(ranges, true);
+  }
+
+  if (!job->proc)
+  {
+    // There was something to format, but clang-format couldn't be run
+    job->failed = job_has_work(job);
+    job_complete(job);
+    return;
+  }
+
+  sched.running = g_list_prepend(sched.running, job);
+  sched.n_running[job->job_class]++;
+}
+
+// Stop background children while something more urgent runs
+static void update_suspended(void)
+{
+  bool suspend = urgent_work_pending();
+  for (GList *it = sched.running; it; it = it->next)
+  {
+    FmtJob *job = it->data;
+    if (job->job_class != FMT_JOB_BACKGROUND || job->suspended == suspend)
+      continue;
+    fmt_process_suspend(job->proc, suspend);
+    job->suspended = suspend;
+  }
+}
+
+static gboolean on_retry_dispatch(G_GNUC_UNUSED gpointer user_data)
+{
+  sched.retry_source = 0;
+  dispatch();
+  return false;
+}
+
+// Nothing finishing would dispatch the work the governor held back
+static void schedule_retry(void)
+{
+  bool queued = false;
+
+  for (int c = 0; c < FMT_JOB_N_CLASSES && !queued; c++)
+    queued = !g_queue_is_empty(&sched.queued[c]);
+
+  if (queued && !sched.running && sched.retry_source == 0 &&
+      fmt_governor_is_throttled())
+  {
+    sched.retry_source =
+        g_timeout_add(THROTTLE_RETRY_MS, on_retry_dispatch, NULL);
+  }
+}
+
+static void dispatch(void)
+{
+  if (sched.dispatching)
+  {
+    sched.redispatch = true;
+    return;
+  }
+
+  sched.dispatching = true;
+  do
+  {
+    sched.redispatch = false;
+    update_suspended();
+
+    for (int c = 0; c < FMT_JOB_N_CLASSES; c++)
+    {
+      GQueue *queue = &sched.queued[c];
+
+      // Background work waits for the interactive work to drain
+      if (c == FMT_JOB_BACKGROUND && urgent_work_pending())
+        break;
+
+      while (!g_queue_is_empty(queue) && sched.n_running[c] < sched.limits[c] &&
+             fmt_governor_may_start(class_priority(c)))
+      {
+        job_start(g_queue_pop_head(queue));
+      }
+    }
+  } while (sched.redispatch);
+  sched.dispatching = false;
+
+  schedule_retry();
+}
+
+static void cancel_queued_where(bool (*pred)(FmtJob *, gpointer),
+                                gpointer data)
+{
+  GSList *cancelled = NULL;
+
+  // Owners may submit or cancel jobs from their callbacks, so the queues
+  // aren't touched while those run
+  for (int c = 0; c < FMT_JOB_N_CLASSES; c++)
+  {
+    GList *it = sched.queued[c].head;
+    while (it)
+    {
+      GList *next = it->next;
+      if (pred(it->data, data))
+      {
+        cancelled = g_slist_prepend(cancelled, it->data);
+        g_queue_delete_link(&sched.queued[c], it);
+      }
+      it = next;
+    }
+  }
+
+  cancelled = g_slist_reverse(cancelled);
+  while (cancelled)
+  {
+    FmtJob *job = cancelled->data;
+    cancelled = g_slist_delete_link(cancelled, cancelled);
+    job->cancelled = true;
+    job_complete(job);
+  }
+}
+
+static void cancel_running_where(bool (*pred)(FmtJob *, gpointer),
+                                 gpointer data)
+{
+  for (GList *it = sched.running; it; it = it->next)
+  {
+    FmtJob *job = it->data;
+    if (!job->cancelled && pred(job, data))
+    {
+      // Completion still goes through on_job_done()
+      job->cancelled = true;
+      fmt_process_cancel(job->proc);
+    }
+  }
+}
+
+// Queued jobs made redundant by a new whole-document job, only results
+// that would be applied replace each other
+static bool job_is_superseded(FmtJob *job, gpointer newer)
+{
+  return job->supersedes && job->doc == ((FmtJob *)newer)->doc &&
+         job->job_class >= ((FmtJob *)newer)->job_class;
+}
+
+static bool job_is_for_document(FmtJob *job, gpointer doc)
+{
+  return job->doc == (GeanyDocument *)doc;
+}
+
+static bool job_has_tag(FmtJob *job, gpointer tag)
+{
+  return job->tag == tag;
+}
+
+static bool job_is_in_class(FmtJob *job, gpointer job_class)
+{
+  return job->job_class == (FmtJobClass)GPOINTER_TO_INT(job_class);
+}
+
+static size_t default_limit(FmtJobClass job_class, size_t n_cpus)
+{
+  switch (job_class)
+  {
+    case FMT_JOB_INTERACTIVE:
+    case FMT_JOB_EXPLICIT:
+    case FMT_JOB_SAVE:
+      return 2;
+    case FMT_JOB_SESSION:
+      return MAX(1, n_cpus / 2);
+    case FMT_JOB_BACKGROUND:
+    default:
+      return MAX(1, n_cpus / 4);
+  }
+}
+
+void fmt_sched_init(void)
+{
+  size_t n_cpus = MAX(1, g_get_num_processors());
+
+  memset(&sched, 0, sizeof(sched));
+  for (int c = 0; c < FMT_JOB_N_CLASSES; c++)
+  {
+    g_queue_init(&sched.queued[c]);
+    sched.limits[c] = default_limit((FmtJobClass)c, n_cpus);
+  }
+  sched.next_id = 1;
+}
+
+void fmt_sched_deinit(void)
+{
+  // Owners still get their callback, flagged as cancelled
+  for (int c = 0; c < FMT_JOB_N_CLASSES; c++)
+  {
+    FmtJob *job;
+    while ((job = g_queue_pop_head(&sched.queued[c])) != NULL)
+    {
+      job->cancelled = true;
+      job_complete(job);
+    }
+  }
+
+  // The main loop won't finish them anymore, on_job_done() takes each
+  // off the running list and frees the formatting state along with it
+  while (sched.running)
+  {
+    FmtJob *job = sched.running->data;
+    job->cancelled = true;
+    fmt_process_abort(job->proc);
+  }
+
+  if (sched.retry_source > 0)
+    g_source_remove(sched.retry_source);
+  memset(&sched, 0, sizeof(sched));
+}
+
+unsigned int fmt_sched_submit(FmtJob *job, FmtJobFunc callback,
+                              gpointer user_data)
+{
+  g_return_val_if_fail(job, 0);
+  g_return_val_if_fail(sched.next_id > 0, 0);
+
+  job->id = sched.next_id++;
+  job->callback = callback;
+  job->user_data = user_data;
+  job->queued_at = g_get_monotonic_time();
+  fmt_trace_job(job);
+
+  if (job->supersedes && job->doc && fmt_job_is_whole_document(job))
+    cancel_queued_where(job_is_superseded, job);
+
+  g_queue_push_tail(&sched.queued[job->job_class], job);
+  dispatch();
+
+  return job->id;
+}
+
+bool fmt_sched_run_sync(FmtJob *job)
+{
+  g_return_val_if_fail(job, false);
+
+  if (job->supersedes && job->doc && fmt_job_is_whole_document(job))
+    cancel_queued_where(job_is_superseded, job);
+
+  job->queued_at = job->started_at = g_get_monotonic_time();
+  fmt_trace_job(job);
+  if (job->code->len > 0 && job->ranges)
+  {
+    job->result = fmt_clang_format_ranges(job->file_name, job->code->str,
+                                          job->code->len, &job->cursor,
+                                          job->ranges, job->xml_replacements);
+  }
+  else if (job->code->len > 0 && job->lines)
+  {
+    job->result = fmt_clang_format_lines(job->file_name, job->code->str,
+                                         job->code->len, &job->cursor,
+                                         job->lines, job->xml_replacements);
+  }
+  else if (job->code->len > 0 && job->length > 0)
+  {
+    job->result = fmt_clang_format(job->file_name, job->code->str,
+                                   job->code->len, &job->cursor, job->offset,
+                                   job->length, job->xml_replacements);
+  }
+  job->finished_at = g_get_monotonic_time();
+  job->failed = !job->result && job_has_work(job);
+  fmt_trace_job_done(job);
+  fmt_breaker_record(job);
+
+  return job->result != NULL;
+}
+
+void fmt_sched_cancel_document(GeanyDocument *doc)
+{
+  cancel_queued_where(job_is_for_document, doc);
+  cancel_running_where(job_is_for_document, doc);
+}
+
+void fmt_sched_cancel_class(FmtJobClass job_class)
+{
+  cancel_queued_where(job_is_in_class, GINT_TO_POINTER(job_class));
+  cancel_running_where(job_is_in_class, GINT_TO_POINTER(job_class));
+}
+
+void fmt_sched_cancel_tag(gconstpointer tag)
+{
+  g_return_if_fail(tag);
+  cancel_queued_where(job_has_tag, (gpointer)tag);
+  cancel_running_where(job_has_tag, (gpointer)tag);
+}
+
+size_t fmt_sched_get_pending(FmtJobClass job_class)
+{
+  g_return_val_if_fail(job_class < FMT_JOB_N_CLASSES, 0);
+  return g_queue_get_length(&sched.queued[job_class]) +
+         sched.n_running[job_class];
+}
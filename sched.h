@@ -0,0 +1,123 @@
+/*
+ * sched.h
+ *
+ * Copyright 2013 Matthew <mbrush@codebrainz.ca>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+
+#ifndef FMT_SCHED_H
+#define FMT_SCHED_H
+
+#include "plugin.h"
+#include "process.h"
+
+G_BEGIN_DECLS
+
+/**
+ * Priority classes for formatting work, most urgent first.
+ */
+typedef enum
+{
+  FMT_JOB_INTERACTIVE = 0, // auto-format triggered while typing
+  FMT_JOB_EXPLICIT,        // keybindings and menu items
+  FMT_JOB_SAVE,            // format-on-save
+  FMT_JOB_SESSION,         // formatting all open documents
+  FMT_JOB_BACKGROUND,      // project-wide and idle-time work
+  FMT_JOB_N_CLASSES
+} FmtJobClass;
+
+typedef struct FmtJob FmtJob;
+
+/**
+ * Called exactly once for every submitted job, when it has finished,
+ * failed or was cancelled. The job is freed after this returns, steal
+ * the @c result field (set it to @c NULL) to keep it.
+ */
+typedef void (*FmtJobFunc)(FmtJob *job, gpointer user_data);
+
+struct FmtJob
+{
+  unsigned int id;
+  FmtJobClass job_class;
+  GeanyDocument *doc;        // NULL when not tied to an open document
+  gconstpointer tag;         // owner tag for fmt_sched_cancel_tag()
+  unsigned long doc_version; // document version the snapshot was taken at
+  char *file_name;
+  GString *code; // snapshot of the text to format
+  size_t cursor; // cursor in the snapshot, new cursor on success
+  size_t offset, length;
+  GArray *ranges; // FmtRange to format instead of offset/length
+  GArray *lines;  // FmtLineRange to format instead of offset/length
+  bool xml_replacements;
+  bool supersedes; // the result is applied, replacing older ones
+
+  GString *result; // formatted text, NULL on failure or cancellation
+  bool cancelled;
+  bool failed; // clang-format couldn't be run or reported an error
+  gint64 queued_at, started_at, finished_at; // monotonic time
+
+  // Private to the scheduler
+  FmtJobFunc callback;
+  gpointer user_data;
+  FmtProcess *proc;
+  bool suspended;
+};
+
+FmtJob *fmt_job_new(FmtJobClass job_class, const char *file_name,
+                    const char *code, size_t code_len, size_t cursor,
+                    size_t offset, size_t length, bool xml_replacements);
+void fmt_job_free(FmtJob *job);
+
+/**
+ * Whether @a job formats its entire snapshot rather than some ranges.
+ */
+bool fmt_job_is_whole_document(FmtJob *job);
+
+void fmt_sched_init(void);
+void fmt_sched_deinit(void);
+
+/**
+ * Queues @a job and starts it as soon as its class has a free slot.
+ *
+ * Interactive and explicit jobs are always started before anything
+ * else, and background jobs are suspended while more urgent work is
+ * pending. When @a job supersedes and covers the whole document, the
+ * queued superseding jobs of the same or lower class for that document
+ * are cancelled, jobs whose results aren't applied are left alone.
+ *
+ * @return The job's id.
+ */
+unsigned int fmt_sched_submit(FmtJob *job, FmtJobFunc callback,
+                              gpointer user_data);
+
+/**
+ * Runs @a job immediately, blocking until it finishes. Used where the
+ * result is needed right away, like just before saving.
+ *
+ * @return @c true if the job produced a result.
+ */
+bool fmt_sched_run_sync(FmtJob *job);
+
+void fmt_sched_cancel_document(GeanyDocument *doc);
+void fmt_sched_cancel_class(FmtJobClass job_class);
+void fmt_sched_cancel_tag(gconstpointer tag);
+
+size_t fmt_sched_get_pending(FmtJobClass job_class);
+
+G_END_DECLS
+
+#endif // FMT_SCHED_H
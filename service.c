@@ -0,0 +1,120 @@
+/*
+ * service.c
+ *
+ * Copyright 2013 Matthew <mbrush@codebrainz.ca>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "service.h"
+#include "prefs.h"
+#include "protocol.h"
+
+#ifdef G_OS_UNIX
+#include <unistd.h>
+#endif
+
+// How long a freshly started service may take to listen
+#define START_TIMEOUT_US G_USEC_PER_SEC
+
+// How long to spawn processes directly after the service failed
+#define RETRY_DELAY_US (30 * G_USEC_PER_SEC)
+
+static gint64 retry_after = 0;
+// Until when the service is coming up after being started, 0 if it isn't
+static gint64 starting_until = 0;
+
+#ifdef G_OS_UNIX
+static void detach_service(G_GNUC_UNUSED gpointer user_data)
+{
+  // Runs in the child, which must outlive the Geany session
+  if (setsid() < 0)
+    errno = 0;
+}
+
+static bool start_service(const char *socket_path)
+{
+  const char *argv[] = { FMT_DAEMON_PATH, "--socket", socket_path, NULL };
+  GError *error = NULL;
+
+  // Without G_SPAWN_DO_NOT_REAP_CHILD the daemon gets re-parented
+  if (!g_spawn_async(NULL, (char **)argv, NULL,
+                     G_SPAWN_STDOUT_TO_DEV_NULL | G_SPAWN_STDERR_TO_DEV_NULL,
+                     detach_service, NULL, NULL, &error))
+  {
+    g_warning("Failed to start the formatting service: %s", error->message);
+    g_error_free(error);
+    return false;
+  }
+
+  return true;
+}
+
+static FmtProcess *connect_service(const char *work_dir,
+                                   const char *const *argv,
+                                   FmtProcessPriority priority)
+{
+  gint64 now = g_get_monotonic_time();
+  char *socket_path;
+  FmtProcess *proc;
+
+  socket_path = g_build_filename(g_get_user_runtime_dir(),
+                                 FMT_PROTOCOL_SOCKET_NAME, NULL);
+
+  proc = fmt_process_connect(socket_path, work_dir, argv, priority);
+  if (proc)
+    starting_until = 0;
+  // Nothing waits for the service to come up, processes are spawned
+  // directly until it listens
+  else if (starting_until == 0 && start_service(socket_path))
+    starting_until = now + START_TIMEOUT_US;
+  else if (now >= starting_until)
+  {
+    g_warning("Formatting service unavailable, running clang-format "
+              "directly");
+    retry_after = now + RETRY_DELAY_US;
+    starting_until = 0;
+  }
+
+  g_free(socket_path);
+
+  return proc;
+}
+#endif
+
+FmtProcess *fmt_service_open(const char *work_dir, const char *const *argv,
+                             FmtProcessPriority priority)
+{
+#ifdef G_OS_UNIX
+  if (fmt_prefs_get_use_service() && g_get_monotonic_time() >= retry_after)
+  {
+    FmtProcess *proc = connect_service(work_dir, argv, priority);
+    if (proc)
+      return proc;
+  }
+#endif
+  return fmt_process_open_with_priority(work_dir, argv, priority);
+}
+
+void fmt_service_reset(void)
+{
+  retry_after = 0;
+  starting_until = 0;
+}
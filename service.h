@@ -0,0 +1,49 @@
+/*
+ * service.h
+ *
+ * Copyright 2013 Matthew <mbrush@codebrainz.ca>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+
+#ifndef FMT_SERVICE_H
+#define FMT_SERVICE_H
+
+#include "plugin.h"
+#include "process.h"
+
+G_BEGIN_DECLS
+
+/**
+ * Opens a process for @a argv like fmt_process_open_with_priority().
+ *
+ * When the formatting service is enabled, the process runs through the
+ * code-format-daemon shared by every Geany instance and tool of the
+ * user, which is started on demand. Processes are spawned directly when
+ * it is disabled or can't be reached.
+ */
+FmtProcess *fmt_service_open(const char *work_dir, const char *const *argv,
+                             FmtProcessPriority priority);
+
+/**
+ * Forgets that the service couldn't be reached, so the next process
+ * tries it again.
+ */
+void fmt_service_reset(void);
+
+G_END_DECLS
+
+#endif // FMT_SERVICE_H
@@ -0,0 +1,252 @@
+/*
+ * speculate.c
+ *
+ * Copyright 2013 Matthew <mbrush@codebrainz.ca>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "speculate.h"
+#include "breaker.h"
+#include "docstate.h"
+#include "format.h"
+#include "prefs.h"
+#include "sched.h"
+#include "stats.h"
+
+static GeanyDocument *idle_doc = NULL;
+static unsigned int idle_timer = 0;
+
+static void drop_result(FmtDocState *state)
+{
+  if (!state->spec_repls)
+    return;
+  fmt_stats_record_speculation(FMT_SPEC_WASTED, state->spec_cost_ms);
+  g_array_free(state->spec_repls, true);
+  state->spec_repls = NULL;
+}
+
+// Takes @a config, the fmt_config_hash() the job was started with
+static void on_spec_job_done(FmtJob *job, char *config)
+{
+  FmtDocState *state = NULL;
+  double ms = 0.0;
+  GArray *repls;
+
+  if (job->started_at > 0)
+    ms = (job->finished_at - job->started_at) / 1000.0;
+
+  if (DOC_VALID(job->doc))
+    state = fmt_doc_state_lookup(job->doc);
+  if (state)
+    state->spec_running = false;
+
+  if (job->cancelled || !job->result || !state ||
+      state->version != job->doc_version)
+  {
+    if (job->started_at > 0)
+      fmt_stats_record_speculation(FMT_SPEC_WASTED, ms);
+    g_free(config);
+    return;
+  }
+
+  repls = fmt_replacements_parse(job->result->str, job->code->str,
+                                 job->code->len);
+  if (!repls)
+  {
+    g_free(config);
+    return;
+  }
+
+  drop_result(state);
+  state->spec_repls = repls;
+  state->spec_version = job->doc_version;
+  state->spec_cost_ms = ms;
+  g_free(state->spec_config);
+  state->spec_config = config;
+}
+
+void fmt_speculate_document(GeanyDocument *doc)
+{
+  ScintillaObject *sci;
+  FmtDocState *state;
+  const char *buf;
+  size_t len;
+  FmtJob *job;
+
+  if (!DOC_VALID(doc) || !doc->real_path || !fmt_is_supported_ft(doc) ||
+      fmt_stats_is_pathological(doc) || !fmt_breaker_allows(doc))
+    return;
+
+  state = fmt_doc_state_get(doc);
+  // Not while a result is still being applied, it's about to change
+  if (state->spec_running || state->apply ||
+      (state->spec_repls && state->spec_version == state->version))
+    return;
+
+  sci = doc->editor->sci;
+  len = sci_get_length(sci);
+  if (len == 0)
+    return;
+  buf = (const char *)scintilla_send_message(sci, SCI_GETCHARACTERPOINTER, 0,
+                                             0);
+
+  // Replacements rather than text, so the result still applies wherever
+  // the cursor moves to in the meantime
+  job = fmt_job_new(FMT_JOB_BACKGROUND, doc->file_name, buf, len,
+                    sci_get_current_position(sci), 0, len, true);
+  job->doc = doc;
+  job->doc_version = state->version;
+  // Tagged with the state, so edits only cancel this document's run
+  job->tag = state;
+
+  state->spec_running = true;
+  fmt_sched_submit(job, (FmtJobFunc)on_spec_job_done,
+                   fmt_config_hash(doc->real_path));
+}
+
+static gboolean on_spec_idle_timeout(G_GNUC_UNUSED gpointer user_data)
+{
+  GeanyDocument *doc = idle_doc;
+
+  idle_timer = 0;
+  idle_doc = NULL;
+
+  if (DOC_VALID(doc) && doc == document_get_current())
+    fmt_speculate_document(doc);
+
+  return false;
+}
+
+void fmt_speculate_note_edit(GeanyDocument *doc)
+{
+  FmtDocState *state = fmt_doc_state_lookup(doc);
+  unsigned int delay;
+
+  // Applying a result is the plugin's own edit, which leaves the text
+  // formatted, and other file types are never formatted
+  if (!fmt_is_supported_ft(doc) || (state && state->apply))
+    return;
+
+  if (state)
+  {
+    drop_result(state);
+    if (state->spec_running)
+      fmt_sched_cancel_tag(state);
+  }
+
+  delay = fmt_prefs_get_speculative_delay();
+  if (delay == 0)
+    return;
+
+  if (idle_timer > 0)
+    g_source_remove(idle_timer);
+  idle_doc = doc;
+  idle_timer = g_timeout_add_full(G_PRIORITY_LOW, delay, on_spec_idle_timeout,
+                                  NULL, NULL);
+}
+
+bool fmt_speculate_take(GeanyDocument *doc, GString **formatted,
+                        size_t *cursor)
+{
+  FmtDocState *state = fmt_doc_state_lookup(doc);
+  ScintillaObject *sci = doc->editor->sci;
+  const char *buf;
+  char *config;
+  size_t len, pos;
+
+  // Results also come from fmt_speculate_document() when disabled
+  if (!state || (fmt_prefs_get_speculative_delay() == 0 &&
+                 !state->spec_repls && !state->spec_running))
+    return false;
+
+  if (!state->spec_repls || state->spec_version != state->version)
+  {
+    // The request formats it anyway, whatever's still running is moot
+    if (state->spec_running)
+      fmt_sched_cancel_tag(state);
+    fmt_stats_record_speculation(FMT_SPEC_MISS, 0.0);
+    return false;
+  }
+
+  // Only changes to the effective style make it stale, see
+  // fmt_config_hash()
+  config = fmt_config_hash(doc->real_path);
+  if (g_strcmp0(config, state->spec_config) != 0)
+  {
+    g_free(config);
+    drop_result(state);
+    fmt_stats_record_speculation(FMT_SPEC_MISS, 0.0);
+    return false;
+  }
+  g_free(config);
+
+  pos = sci_get_current_position(sci);
+
+  // Already formatted, the result stays valid until the next edit
+  if (state->spec_repls->len == 0)
+  {
+    *formatted = NULL;
+    *cursor = pos;
+    fmt_stats_record_speculation(FMT_SPEC_HIT, 0.0);
+    return true;
+  }
+
+  len = sci_get_length(sci);
+  buf = (const char *)scintilla_send_message(sci, SCI_GETCHARACTERPOINTER, 0,
+                                             0);
+  *formatted = fmt_replacements_apply(buf, len, state->spec_repls, &pos);
+  if (!*formatted)
+  {
+    drop_result(state);
+    fmt_stats_record_speculation(FMT_SPEC_MISS, 0.0);
+    return false;
+  }
+
+  *cursor = pos;
+  g_array_free(state->spec_repls, true);
+  state->spec_repls = NULL;
+  fmt_stats_record_speculation(FMT_SPEC_HIT, 0.0);
+
+  return true;
+}
+
+void fmt_speculate_init(void)
+{
+  idle_doc = NULL;
+  idle_timer = 0;
+}
+
+void fmt_speculate_deinit(void)
+{
+  unsigned int i;
+
+  if (idle_timer > 0)
+    g_source_remove(idle_timer);
+  idle_timer = 0;
+  idle_doc = NULL;
+
+  foreach_document(i)
+  {
+    FmtDocState *state = fmt_doc_state_lookup(documents[i]);
+    if (state && state->spec_running)
+      fmt_sched_cancel_tag(state);
+  }
+}
@@ -0,0 +1,60 @@
+/*
+ * speculate.h
+ *
+ * Copyright 2013 Matthew <mbrush@codebrainz.ca>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+
+#ifndef FMT_SPECULATE_H
+#define FMT_SPECULATE_H
+
+#include "plugin.h"
+
+G_BEGIN_DECLS
+
+void fmt_speculate_init(void);
+void fmt_speculate_deinit(void);
+
+/**
+ * Notes that @a doc changed: drops its speculative result, cancels a
+ * speculative run in progress and restarts the idle timer after which
+ * it's formatted speculatively. Edits made while a formatting result is
+ * applied, and edits to file types that aren't formatted, are ignored.
+ */
+void fmt_speculate_note_edit(GeanyDocument *doc);
+
+/**
+ * Formats @a doc in the background right away, keeping the result for
+ * fmt_speculate_take() whatever the speculative delay is set to.
+ */
+void fmt_speculate_document(GeanyDocument *doc);
+
+/**
+ * Takes the speculative result for @a doc if it matches its current
+ * text.
+ *
+ * @param formatted Set to the formatted text, or to @c NULL when the
+ * document is already formatted.
+ * @param cursor Set to the new position of the document's cursor.
+ * @return @c true if there was a usable result.
+ */
+bool fmt_speculate_take(GeanyDocument *doc, GString **formatted,
+                        size_t *cursor);
+
+G_END_DECLS
+
+#endif // FMT_SPECULATE_H
@@ -0,0 +1,330 @@
+/*
+ * stats.c
+ *
+ * Copyright 2013 Matthew <mbrush@codebrainz.ca>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "stats.h"
+#include "breaker.h"
+#include "format.h"
+#include "prefs.h"
+#include "style.h"
+
+#ifndef N_
+#define N_(s) s
+#endif
+
+// Weight of a new sample in the moving averages
+#define EMA_ALPHA 0.3
+
+// A document's latency is halved every this long without new samples,
+// as a strategy that avoids a slow run also stops measuring it
+#define LATENCY_HALF_LIFE_US (30 * G_USEC_PER_SEC)
+
+// A line this long only shows up in minified or generated code
+#define PATHOLOGICAL_LINE_LENGTH 2000
+// ... and so does this average line length in a large document
+#define PATHOLOGICAL_AVG_LINE_LENGTH 300
+#define PATHOLOGICAL_MIN_SIZE (64 * 1024)
+
+typedef struct
+{
+  double ms_per_kb; // moving average of whole document latency per KiB
+  unsigned int n_samples;
+} ConfigStats;
+
+// config key -> ConfigStats*
+static GHashTable *config_stats = NULL;
+
+static unsigned int spec_hits = 0, spec_misses = 0, spec_wasted = 0;
+static double spec_wasted_ms = 0.0;
+
+static double ema_update(double avg, unsigned int n_samples, double sample)
+{
+  if (n_samples == 0)
+    return sample;
+  return avg + EMA_ALPHA * (sample - avg);
+}
+
+// The latency of @a strategy for @a state, aged since it was measured
+static double aged_latency(FmtDocState *state, FmtStrategy strategy)
+{
+  gint64 age = g_get_monotonic_time() - state->sampled_at[strategy];
+  double ms = state->latency_ms[strategy];
+
+  for (int i = 0; age >= LATENCY_HALF_LIFE_US && i < 32; i++)
+  {
+    ms /= 2;
+    age -= LATENCY_HALF_LIFE_US;
+  }
+  return ms;
+}
+
+// Documents sharing a .clang-format file (or preset style) share a key
+char *fmt_stats_config_key(GeanyDocument *doc)
+{
+  char *fn = NULL;
+
+  if (fmt_prefs_get_style() == FORMAT_STYLE_CUSTOM && doc->real_path)
+    fn = fmt_lookup_clang_format_dot_file(doc->real_path);
+  if (fn)
+    return fn;
+
+  return g_strdup(fmt_style_get_name(fmt_prefs_get_style()));
+}
+
+void fmt_stats_init(void)
+{
+  if (config_stats)
+    return;
+  config_stats =
+      g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+}
+
+void fmt_stats_deinit(void)
+{
+  spec_hits = spec_misses = spec_wasted = 0;
+  spec_wasted_ms = 0.0;
+
+  if (config_stats)
+  {
+    g_hash_table_destroy(config_stats);
+    config_stats = NULL;
+  }
+}
+
+void fmt_stats_record(FmtJob *job)
+{
+  FmtDocState *state;
+  FmtStrategy strategy;
+  ConfigStats *cs;
+  double ms;
+
+  // Low priority work gets throttled and suspended, its timing says
+  // nothing about how fast the document formats
+  if (job->cancelled || !job->result || job->job_class > FMT_JOB_SAVE)
+    return;
+  if (!DOC_VALID(job->doc) || job->started_at == 0 ||
+      job->finished_at < job->started_at)
+    return;
+
+  state = fmt_doc_state_lookup(job->doc);
+  if (!state)
+    return;
+
+  ms = (job->finished_at - job->started_at) / 1000.0;
+  strategy = fmt_job_is_whole_document(job) ? FMT_STRATEGY_DOCUMENT
+                                            : FMT_STRATEGY_REGION;
+
+  state->latency_ms[strategy] = ema_update(
+      aged_latency(state, strategy), state->n_samples[strategy], ms);
+  state->n_samples[strategy]++;
+  state->sampled_at[strategy] = g_get_monotonic_time();
+
+  if (strategy != FMT_STRATEGY_DOCUMENT || job->code->len == 0)
+    return;
+
+  g_free(state->config_key);
+  state->config_key = fmt_stats_config_key(job->doc);
+
+  cs = g_hash_table_lookup(config_stats, state->config_key);
+  if (!cs)
+  {
+    cs = g_new0(ConfigStats, 1);
+    g_hash_table_insert(config_stats, g_strdup(state->config_key), cs);
+  }
+  cs->ms_per_kb = ema_update(cs->ms_per_kb, cs->n_samples,
+                             ms / (job->code->len / 1024.0));
+  cs->n_samples++;
+}
+
+// Estimates the whole document latency from similar documents, or
+// returns a negative value when there's nothing to go on
+static double predict_document_latency(GeanyDocument *doc,
+                                       FmtDocState *state)
+{
+  ConfigStats *cs;
+
+  if (!state->config_key)
+    state->config_key = fmt_stats_config_key(doc);
+
+  cs = g_hash_table_lookup(config_stats, state->config_key);
+  if (!cs || cs->n_samples == 0)
+    return -1.0;
+
+  return cs->ms_per_kb * (sci_get_length(doc->editor->sci) / 1024.0);
+}
+
+FmtStrategy fmt_stats_get_strategy(GeanyDocument *doc)
+{
+  FmtDocState *state;
+  unsigned int budget;
+  double doc_ms;
+
+  budget = fmt_prefs_get_latency_budget();
+  if (budget == 0 || !DOC_VALID(doc))
+    return FMT_STRATEGY_DOCUMENT;
+
+  state = fmt_doc_state_get(doc);
+
+  // Once an old measurement fades below the budget, the whole document
+  // is formatted again and measured anew
+  if (state->n_samples[FMT_STRATEGY_DOCUMENT] > 0)
+    doc_ms = aged_latency(state, FMT_STRATEGY_DOCUMENT);
+  else
+    doc_ms = predict_document_latency(doc, state);
+  if (doc_ms <= budget)
+    return FMT_STRATEGY_DOCUMENT;
+
+  // Formatting a region still parses the whole file, so it may be no
+  // faster, which only measuring it tells
+  if (state->n_samples[FMT_STRATEGY_REGION] == 0 ||
+      aged_latency(state, FMT_STRATEGY_REGION) <= budget)
+    return FMT_STRATEGY_REGION;
+
+  return FMT_STRATEGY_DEFERRED;
+}
+
+bool fmt_stats_is_pathological(GeanyDocument *doc)
+{
+  ScintillaObject *sci;
+  FmtDocState *state;
+  int n_lines, longest = 0, longest_line = 0;
+  size_t len;
+
+  if (!DOC_VALID(doc))
+    return false;
+
+  state = fmt_doc_state_get(doc);
+  if (state->scanned)
+    return state->pathological;
+  state->scanned = true;
+
+  sci = doc->editor->sci;
+  n_lines = sci_get_line_count(sci);
+  len = sci_get_length(sci);
+
+  for (int i = 0; i < n_lines; i++)
+  {
+    int line_len = sci_get_line_length(sci, i);
+    if (line_len > longest)
+    {
+      longest = line_len;
+      longest_line = i;
+    }
+  }
+
+  state->pathological =
+      longest >= PATHOLOGICAL_LINE_LENGTH ||
+      (len >= PATHOLOGICAL_MIN_SIZE && n_lines > 0 &&
+       len / n_lines >= PATHOLOGICAL_AVG_LINE_LENGTH);
+
+  if (state->pathological)
+  {
+    char *name = document_get_basename_for_display(doc, -1);
+    msgwin_status_add(_("Code Format: %s looks minified or generated (line "
+                        "%d is %d bytes long), it won't be auto-formatted."),
+                      name, longest_line + 1, longest);
+    g_free(name);
+  }
+
+  return state->pathological;
+}
+
+void fmt_stats_record_speculation(FmtSpecOutcome outcome, double cost_ms)
+{
+  switch (outcome)
+  {
+    case FMT_SPEC_HIT:
+      spec_hits++;
+      break;
+    case FMT_SPEC_MISS:
+      spec_misses++;
+      break;
+    case FMT_SPEC_WASTED:
+      spec_wasted++;
+      spec_wasted_ms += cost_ms;
+      break;
+  }
+}
+
+static const char *strategy_names[FMT_STRATEGY_COUNT] = {
+  N_("whole document"), N_("region"), N_("deferred"),
+};
+
+void fmt_stats_show(void)
+{
+  GHashTableIter iter;
+  gpointer key, value;
+  guint i;
+
+  msgwin_clear_tab(MSG_MESSAGE);
+  msgwin_switch_tab(MSG_MESSAGE, false);
+
+  msgwin_msg_add(COLOR_BLACK, -1, NULL,
+                 _("Latency budget: %u ms (0 disables adaptation)"),
+                 fmt_prefs_get_latency_budget());
+
+  if (spec_hits + spec_misses + spec_wasted > 0)
+  {
+    unsigned int requests = spec_hits + spec_misses;
+    msgwin_msg_add(COLOR_BLACK, -1, NULL,
+                   _("Speculative formatting: %u hits, %u misses (%.0f%% hit "
+                     "rate), %u results wasted costing %.2f s of formatting"),
+                   spec_hits, spec_misses,
+                   requests > 0 ? 100.0 * spec_hits / requests : 0.0,
+                   spec_wasted, spec_wasted_ms / 1000.0);
+  }
+
+  foreach_document(i)
+  {
+    GeanyDocument *doc = documents[i];
+    FmtDocState *state = fmt_doc_state_lookup(doc);
+    char *name;
+
+    if (!state)
+      continue;
+
+    name = document_get_basename_for_display(doc, -1);
+    msgwin_msg_add(COLOR_BLACK, -1, doc,
+                   _("%s: %s, whole document %.1f ms (%u samples), region "
+                     "%.1f ms (%u samples)%s"),
+                   name, _(strategy_names[fmt_stats_get_strategy(doc)]),
+                   aged_latency(state, FMT_STRATEGY_DOCUMENT),
+                   state->n_samples[FMT_STRATEGY_DOCUMENT],
+                   aged_latency(state, FMT_STRATEGY_REGION),
+                   state->n_samples[FMT_STRATEGY_REGION],
+                   state->pathological ? _(", minified or generated") : "");
+    g_free(name);
+  }
+
+  g_hash_table_iter_init(&iter, config_stats);
+  while (g_hash_table_iter_next(&iter, &key, &value))
+  {
+    ConfigStats *cs = value;
+    msgwin_msg_add(COLOR_BLACK, -1, NULL,
+                   _("Configuration %s: %.2f ms per KiB (%u samples)"),
+                   (const char *)key, cs->ms_per_kb, cs->n_samples);
+  }
+
+  fmt_breaker_show();
+}
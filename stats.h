@@ -0,0 +1,79 @@
+/*
+ * stats.h
+ *
+ * Copyright 2013 Matthew <mbrush@codebrainz.ca>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+
+#ifndef FMT_STATS_H
+#define FMT_STATS_H
+
+#include "docstate.h"
+#include "sched.h"
+
+G_BEGIN_DECLS
+
+void fmt_stats_init(void);
+void fmt_stats_deinit(void);
+
+/**
+ * Records how long a finished formatting job took, for the document
+ * it belongs to and for the configuration the document uses.
+ */
+void fmt_stats_record(FmtJob *job);
+
+/**
+ * Names the configuration @a doc is formatted with, the path of its
+ * .clang-format file or the name of the preset style. Documents
+ * sharing it share their per-KiB latency.
+ */
+char *fmt_stats_config_key(GeanyDocument *doc);
+
+/**
+ * Picks the auto-format strategy for @a doc, the cheapest one whose
+ * measured (or, for new documents, predicted) latency fits within the
+ * latency budget preference.
+ */
+FmtStrategy fmt_stats_get_strategy(GeanyDocument *doc);
+
+/**
+ * Checks whether @a doc looks minified or generated, ie. has very
+ * long lines. The result is computed once per document.
+ */
+bool fmt_stats_is_pathological(GeanyDocument *doc);
+
+typedef enum
+{
+  FMT_SPEC_HIT,    // a request used a speculative result
+  FMT_SPEC_MISS,   // a request found no usable speculative result
+  FMT_SPEC_WASTED, // a speculative result or run was thrown away
+} FmtSpecOutcome;
+
+/**
+ * Counts what became of speculative formatting, @a cost_ms being the
+ * time the clang-format run took for wasted results.
+ */
+void fmt_stats_record_speculation(FmtSpecOutcome outcome, double cost_ms);
+
+/**
+ * Lists the collected statistics in the message window.
+ */
+void fmt_stats_show(void);
+
+G_END_DECLS
+
+#endif // FMT_STATS_H
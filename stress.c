@@ -0,0 +1,410 @@
+/*
+ * stress.c
+ *
+ * Copyright 2013 Matthew <mbrush@codebrainz.ca>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+
+/*
+ * code-format-stress, opens, runs and closes FmtProcess instances by
+ * the thousand against a stub child (`cat`) to make sure nothing leaks.
+ *
+ * Every round runs processes synchronously, opens and closes them
+ * without running them, then runs them asynchronously one at a time
+ * and several at once, cancelling some. It prints how many processes
+ * were spawned per second and how long the runs took, and exits with
+ * a non-zero status when a run failed or when the file descriptors,
+ * child processes, main loop sources or resident memory left behind
+ * grew from one round to the next.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "governor.h"
+#include "process.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Pages of resident memory the last round may add to the first
+#define RSS_SLACK_PAGES 256
+
+typedef struct
+{
+  unsigned int count;       // processes per phase
+  unsigned int concurrency; // asynchronous runs at once
+  unsigned int pending;
+  unsigned int failures;
+  GArray *times; // run times, in µs
+} Stress;
+
+typedef struct
+{
+  Stress *stress;
+  GString *out;
+  gint64 start;
+  bool cancelled;
+} Run;
+
+static const char *const stub_argv[] = { "cat", NULL };
+static const char stub_input[] = "int main(void) { return 0; }\n";
+
+// The governor's settings, as they are by default
+unsigned int fmt_prefs_get_max_processes(void)
+{
+  return 0;
+}
+
+int fmt_prefs_get_memory_limit(void)
+{
+  return 0;
+}
+
+bool fmt_prefs_get_use_cgroup(void)
+{
+  return false;
+}
+
+unsigned int fmt_prefs_get_pressure_threshold(void)
+{
+  return 0;
+}
+
+//======================================================================
+//
+// Counting resources
+//
+
+static unsigned int count_dir(const char *path)
+{
+  GDir *dir = g_dir_open(path, 0, NULL);
+  unsigned int n = 0;
+
+  if (!dir)
+    return 0;
+  while (g_dir_read_name(dir))
+    n++;
+  g_dir_close(dir);
+  return n;
+}
+
+static unsigned int count_fds(void)
+{
+  return count_dir("/proc/self/fd");
+}
+
+static unsigned int count_children(void)
+{
+  GDir *dir = g_dir_open("/proc", 0, NULL);
+  const char *name;
+  unsigned int n = 0;
+  int self = getpid();
+
+  if (!dir)
+    return 0;
+  while ((name = g_dir_read_name(dir)))
+  {
+    char *path, *contents = NULL, *end;
+    int ppid = 0;
+
+    if (!isdigit((unsigned char)name[0]))
+      continue;
+    path = g_build_filename("/proc", name, "stat", NULL);
+    // The command name may contain anything, the fields after it don't
+    if (g_file_get_contents(path, &contents, NULL, NULL) &&
+        (end = strrchr(contents, ')')) &&
+        sscanf(end + 1, " %*c %d", &ppid) == 1 && ppid == self)
+      n++;
+    g_free(contents);
+    g_free(path);
+  }
+  g_dir_close(dir);
+  return n;
+}
+
+static long resident_pages(void)
+{
+  char *contents = NULL;
+  long size = 0, resident = 0;
+
+  if (g_file_get_contents("/proc/self/statm", &contents, NULL, NULL))
+    sscanf(contents, "%ld %ld", &size, &resident);
+  g_free(contents);
+  return resident;
+}
+
+static gboolean on_probe(gpointer user_data)
+{
+  return G_SOURCE_REMOVE;
+}
+
+static unsigned int count_sources(void)
+{
+  // Source ids are handed out in order, so probe every one given out
+  guint last = g_idle_add(on_probe, NULL);
+  unsigned int n = 0;
+
+  g_source_remove(last);
+  for (guint id = 1; id < last; id++)
+  {
+    if (g_main_context_find_source_by_id(NULL, id))
+      n++;
+  }
+  return n;
+}
+
+// Lets reaped children and finished sources go away
+static void settle(void)
+{
+  for (int i = 0; i < 100; i++)
+  {
+    while (g_main_context_iteration(NULL, false))
+      ;
+    g_usleep(1000);
+  }
+}
+
+//======================================================================
+//
+// Running processes
+//
+
+static void run_sync(Stress *s)
+{
+  for (unsigned int i = 0; i < s->count; i++)
+  {
+    gint64 start = g_get_monotonic_time();
+    GString *out = g_string_new(NULL);
+    FmtProcess *proc = fmt_process_open(NULL, stub_argv);
+
+    if (!proc)
+    {
+      s->failures++;
+      g_string_free(out, true);
+      continue;
+    }
+    if (!fmt_process_run(proc, stub_input, strlen(stub_input), out) ||
+        strcmp(out->str, stub_input) != 0)
+      s->failures++;
+    if (fmt_process_close(proc) != 0)
+      s->failures++;
+    g_string_free(out, true);
+
+    start = g_get_monotonic_time() - start;
+    g_array_append_val(s->times, start);
+  }
+}
+
+static void open_close(Stress *s)
+{
+  for (unsigned int i = 0; i < s->count; i++)
+  {
+    FmtProcess *proc = fmt_process_open(NULL, stub_argv);
+
+    if (!proc)
+    {
+      s->failures++;
+      continue;
+    }
+    // Give the child watch a chance to be dispatched before closing
+    if (i % 2)
+      g_main_context_iteration(NULL, false);
+    fmt_process_close(proc);
+  }
+}
+
+static void on_run_done(FmtProcess *proc, bool success, GString *str_out,
+                        gpointer user_data)
+{
+  Run *run = user_data;
+  Stress *s = run->stress;
+  int status = fmt_process_close(proc);
+  gint64 elapsed = g_get_monotonic_time() - run->start;
+
+  if (run->cancelled ? success
+                     : !success || status != 0 ||
+                           strcmp(str_out->str, stub_input) != 0)
+    s->failures++;
+  g_array_append_val(s->times, elapsed);
+
+  g_string_free(run->out, true);
+  g_free(run);
+  s->pending--;
+}
+
+static void start_async(Stress *s, bool cancel)
+{
+  Run *run = g_new0(Run, 1);
+  FmtProcess *proc;
+
+  run->stress = s;
+  run->out = g_string_new(NULL);
+  run->start = g_get_monotonic_time();
+  run->cancelled = cancel;
+
+  proc = fmt_process_open(NULL, stub_argv);
+  if (!proc || !fmt_process_run_async(proc, stub_input, strlen(stub_input),
+                                      run->out, on_run_done, run))
+  {
+    if (proc)
+      fmt_process_close(proc);
+    g_string_free(run->out, true);
+    g_free(run);
+    s->failures++;
+    return;
+  }
+
+  s->pending++;
+  if (cancel)
+    fmt_process_cancel(proc);
+}
+
+static void wait_pending(Stress *s, unsigned int max)
+{
+  while (s->pending > max)
+    g_main_context_iteration(NULL, true);
+}
+
+static void run_async(Stress *s, unsigned int concurrency)
+{
+  for (unsigned int i = 0; i < s->count; i++)
+  {
+    // Cancel some of the concurrent runs, while their children live
+    start_async(s, concurrency > 1 && i % 7 == 0);
+    wait_pending(s, concurrency - 1);
+  }
+  wait_pending(s, 0);
+}
+
+//======================================================================
+//
+// Reporting
+//
+
+static int compare_times(gconstpointer a, gconstpointer b)
+{
+  gint64 x = *(const gint64 *)a, y = *(const gint64 *)b;
+  return (x > y) - (x < y);
+}
+
+static void print_times(Stress *s, const char *what, gint64 start)
+{
+  GArray *times = s->times;
+  double secs = (g_get_monotonic_time() - start) / 1e6;
+
+  if (times->len == 0)
+  {
+    g_print("%-16s none\n", what);
+    return;
+  }
+
+  g_array_sort(times, compare_times);
+#define AT(q) \
+  (g_array_index(times, gint64, (size_t)((times->len - 1) * (q))) / 1000.0)
+  g_print("%-16s n=%u %.0f/s p50=%.2fms p99=%.2fms max=%.2fms\n", what,
+          times->len, times->len / secs, AT(0.5), AT(0.99), AT(1.0));
+#undef AT
+  g_array_set_size(times, 0);
+}
+
+static void usage(const char *self)
+{
+  g_printerr("Usage: %s [--count N] [--concurrency N] [--rounds N]\n",
+             self);
+}
+
+int main(int argc, char **argv)
+{
+  Stress s = { 2000, 32, 0, 0, NULL };
+  unsigned int rounds = 2, fds, sources, children;
+  long pages = 0;
+  char *what;
+  int i;
+
+  for (i = 1; i < argc; i++)
+  {
+    if (strcmp(argv[i], "--count") == 0 && i + 1 < argc)
+      s.count = strtoul(argv[++i], NULL, 10);
+    else if (strcmp(argv[i], "--concurrency") == 0 && i + 1 < argc)
+      s.concurrency = strtoul(argv[++i], NULL, 10);
+    else if (strcmp(argv[i], "--rounds") == 0 && i + 1 < argc)
+      rounds = strtoul(argv[++i], NULL, 10);
+    else
+    {
+      usage(argv[0]);
+      return 2;
+    }
+  }
+
+  // The first round only warms up the allocators, memory is compared
+  // from the second one on
+  if (s.count == 0 || s.concurrency == 0 || rounds < 2)
+  {
+    usage(argv[0]);
+    return 2;
+  }
+
+  s.times = g_array_new(false, false, sizeof(gint64));
+  fmt_governor_init();
+  settle();
+  fds = count_fds();
+  sources = count_sources();
+
+  for (unsigned int round = 0; round < rounds; round++)
+  {
+    gint64 start = g_get_monotonic_time();
+
+    g_print("round %u\n", round + 1);
+    run_sync(&s);
+    print_times(&s, "sync", start);
+
+    open_close(&s);
+
+    start = g_get_monotonic_time();
+    run_async(&s, 1);
+    print_times(&s, "async", start);
+
+    start = g_get_monotonic_time();
+    run_async(&s, s.concurrency);
+    what = g_strdup_printf("async x%u", s.concurrency);
+    print_times(&s, what, start);
+    g_free(what);
+
+    settle();
+    if (round == 0)
+      pages = resident_pages();
+  }
+
+  children = count_children();
+  g_print("failures %u, fds %u -> %u, children %u, sources %u -> %u, "
+          "resident pages %ld -> %ld\n",
+          s.failures, fds, count_fds(), children, sources, count_sources(),
+          pages, resident_pages());
+
+  fmt_governor_deinit();
+  g_array_free(s.times, true);
+
+  if (s.failures || count_fds() != fds || children ||
+      count_sources() != sources || resident_pages() > pages + RSS_SLACK_PAGES)
+    return 1;
+  return 0;
+}
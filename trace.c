@@ -0,0 +1,256 @@
+/*
+ * trace.c
+ *
+ * Copyright 2013 Matthew <mbrush@codebrainz.ca>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "trace.h"
+#include "format.h"
+#include "prefs.h"
+#include "style.h"
+
+#include <errno.h>
+#include <glib/gstdio.h>
+#include <stdio.h>
+
+// Hex digits of the text hashes written, enough to spot divergence
+#define HASH_DIGITS 16
+
+static FILE *trace = NULL;
+static gint64 trace_start = 0;
+static GHashTable *trace_docs = NULL; // ids of the documents written
+
+static gint64 elapsed(void)
+{
+  return g_get_monotonic_time() - trace_start;
+}
+
+static char *text_hash(const char *text, size_t len)
+{
+  char *hash =
+      g_compute_checksum_for_data(G_CHECKSUM_SHA1, (guchar *)text, len);
+  hash[HASH_DIGITS] = '\0';
+  return hash;
+}
+
+static const char *document_text(GeanyDocument *doc, size_t *len)
+{
+  ScintillaObject *sci = doc->editor->sci;
+  *len = sci_get_length(sci);
+  return (const char *)scintilla_send_message(sci, SCI_GETCHARACTERPOINTER,
+                                              0, 0);
+}
+
+// Writes the whole text of @a doc the first time it shows up. Returns
+// whether it was written before, in which case records of changes to
+// it must follow.
+static bool ensure_document(GeanyDocument *doc)
+{
+  char *name, *encoded;
+  const char *text;
+  size_t len;
+
+  if (g_hash_table_contains(trace_docs, GUINT_TO_POINTER(doc->id)))
+    return true;
+  g_hash_table_add(trace_docs, GUINT_TO_POINTER(doc->id));
+
+  text = document_text(doc, &len);
+  name = g_strescape(doc->file_name ? doc->file_name : "", NULL);
+  encoded = g_base64_encode((const guchar *)text, len);
+  fprintf(trace, "open\t%" G_GINT64_FORMAT "\t%u\t%s\t%s\n", elapsed(),
+          doc->id, name, encoded);
+  g_free(encoded);
+  g_free(name);
+
+  return false;
+}
+
+void fmt_trace_init(void)
+{
+  const char *path = fmt_prefs_get_trace_file();
+  GDateTime *now;
+  char *date, *clang_format;
+
+  if (!path || !*path)
+    return;
+
+  trace = g_fopen(path, "a");
+  if (!trace)
+  {
+    g_warning("Failed to open trace file '%s': %s", path, g_strerror(errno));
+    return;
+  }
+
+  trace_start = g_get_monotonic_time();
+  trace_docs = g_hash_table_new(g_direct_hash, g_direct_equal);
+
+  now = g_date_time_new_now_local();
+  date = g_date_time_format(now, "%Y-%m-%dT%H:%M:%S%z");
+  clang_format = g_strescape(fmt_prefs_get_path(), NULL);
+  fprintf(trace, "start\t0\t%s\t%s\n", date, clang_format);
+  g_free(clang_format);
+  g_free(date);
+  g_date_time_unref(now);
+}
+
+void fmt_trace_deinit(void)
+{
+  if (!trace)
+    return;
+
+  fclose(trace);
+  trace = NULL;
+  g_hash_table_destroy(trace_docs);
+  trace_docs = NULL;
+}
+
+void fmt_trace_edit(GeanyDocument *doc, size_t pos, size_t deleted,
+                    const char *text, size_t inserted)
+{
+  char *encoded;
+
+  // A new document's text already includes the edit
+  if (!trace || !ensure_document(doc))
+    return;
+
+  if (deleted > 0)
+  {
+    fprintf(trace, "del\t%" G_GINT64_FORMAT "\t%u\t%lu\t%lu\n", elapsed(),
+            doc->id, (unsigned long)pos, (unsigned long)deleted);
+  }
+  if (inserted > 0)
+  {
+    encoded = g_base64_encode((const guchar *)text, inserted);
+    fprintf(trace, "ins\t%" G_GINT64_FORMAT "\t%u\t%lu\t%s\n", elapsed(),
+            doc->id, (unsigned long)pos, encoded);
+    g_free(encoded);
+  }
+}
+
+void fmt_trace_char(GeanyDocument *doc, int ch)
+{
+  if (!trace)
+    return;
+
+  ensure_document(doc);
+  fprintf(trace, "char\t%" G_GINT64_FORMAT "\t%u\t%d\n", elapsed(), doc->id,
+          ch);
+}
+
+static void append_ranges(GString *out, FmtJob *job)
+{
+  if (job->lines)
+  {
+    for (unsigned int i = 0; i < job->lines->len; i++)
+    {
+      FmtLineRange *range = &g_array_index(job->lines, FmtLineRange, i);
+      g_string_append_printf(out, "%sL%u:%u", i > 0 ? "," : "", range->first,
+                             range->last);
+    }
+  }
+  else if (job->ranges)
+  {
+    for (unsigned int i = 0; i < job->ranges->len; i++)
+    {
+      FmtRange *range = &g_array_index(job->ranges, FmtRange, i);
+      g_string_append_printf(out, "%s%lu+%lu", i > 0 ? "," : "",
+                             (unsigned long)range->offset,
+                             (unsigned long)range->length);
+    }
+  }
+  else
+  {
+    g_string_append_printf(out, "%lu+%lu", (unsigned long)job->offset,
+                           (unsigned long)job->length);
+  }
+}
+
+void fmt_trace_job(FmtJob *job)
+{
+  GString *ranges;
+  char *hash;
+
+  // Only formatting of open documents is part of the session
+  if (!trace || !DOC_VALID(job->doc))
+    return;
+
+  ensure_document(job->doc);
+  hash = text_hash(job->code->str, job->code->len);
+  ranges = g_string_new(NULL);
+  append_ranges(ranges, job);
+  fprintf(trace,
+          "job\t%" G_GINT64_FORMAT "\t%u\t%u\t%d\t%s\t%s\t%lu\t%d\t%s\n",
+          elapsed(), job->doc->id, job->id, (int)job->job_class,
+          fmt_style_get_cmd_name(fmt_prefs_get_style()), hash,
+          (unsigned long)job->cursor, job->xml_replacements ? 1 : 0,
+          ranges->str);
+  g_string_free(ranges, true);
+  g_free(hash);
+}
+
+void fmt_trace_job_done(FmtJob *job)
+{
+  const char *status = "ok";
+  gint64 started = job->started_at > 0 ? job->started_at : job->finished_at;
+
+  if (!trace || !job->doc)
+    return;
+
+  if (job->cancelled)
+    status = "cancelled";
+  else if (!job->result)
+    status = "failed";
+
+  fprintf(trace,
+          "done\t%" G_GINT64_FORMAT "\t%u\t%u\t%s\t%" G_GINT64_FORMAT
+          "\t%" G_GINT64_FORMAT "\n",
+          elapsed(), job->doc->id, job->id, status, started - job->queued_at,
+          job->finished_at - started);
+  // Keeps traces useful when Geany doesn't exit cleanly
+  fflush(trace);
+}
+
+void fmt_trace_apply(GeanyDocument *doc)
+{
+  const char *text;
+  size_t len;
+  char *hash;
+
+  if (!trace)
+    return;
+
+  ensure_document(doc);
+  text = document_text(doc, &len);
+  hash = text_hash(text, len);
+  fprintf(trace, "apply\t%" G_GINT64_FORMAT "\t%u\t%s\n", elapsed(), doc->id,
+          hash);
+  g_free(hash);
+}
+
+void fmt_trace_close(GeanyDocument *doc)
+{
+  if (!trace ||
+      !g_hash_table_remove(trace_docs, GUINT_TO_POINTER(doc->id)))
+    return;
+
+  fprintf(trace, "close\t%" G_GINT64_FORMAT "\t%u\n", elapsed(), doc->id);
+}
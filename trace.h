@@ -0,0 +1,69 @@
+/*
+ * trace.h
+ *
+ * Copyright 2013 Matthew <mbrush@codebrainz.ca>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+
+#ifndef FMT_TRACE_H
+#define FMT_TRACE_H
+
+#include "plugin.h"
+#include "sched.h"
+
+G_BEGIN_DECLS
+
+/*
+ * Records editing sessions for code-format-replay, when the
+ * session-trace-file setting names a file.
+ *
+ * A trace is a text file of records, one per line, with tab separated
+ * fields. The first two fields of every record are its type and the
+ * time in microseconds since the "start" record of the session:
+ *
+ *   start  TIME DATE CLANG-FORMAT
+ *   open   TIME DOC FILE-NAME TEXT
+ *   ins    TIME DOC POS TEXT
+ *   del    TIME DOC POS LENGTH
+ *   char   TIME DOC CHAR
+ *   job    TIME DOC JOB CLASS STYLE HASH CURSOR XML RANGES
+ *   done   TIME DOC JOB STATUS WAIT RUN
+ *   apply  TIME DOC HASH
+ *   close  TIME DOC
+ *
+ * DOC is Geany's document id, TEXT is base64 encoded, and file names
+ * are escaped like C strings. A document's "open" record holds its whole
+ * text the first time it shows up, and the records after it are
+ * relative to that. HASH identifies the document's text, RANGES is
+ * either "OFFSET+LENGTH,..." or "LFIRST:LAST,..." for lines, and WAIT
+ * and RUN are in microseconds. STATUS is "ok", "failed" or "cancelled".
+ */
+
+void fmt_trace_init(void);
+void fmt_trace_deinit(void);
+
+void fmt_trace_edit(GeanyDocument *doc, size_t pos, size_t deleted,
+                    const char *text, size_t inserted);
+void fmt_trace_char(GeanyDocument *doc, int ch);
+void fmt_trace_job(FmtJob *job);
+void fmt_trace_job_done(FmtJob *job);
+void fmt_trace_apply(GeanyDocument *doc);
+void fmt_trace_close(GeanyDocument *doc);
+
+G_END_DECLS
+
+#endif // FMT_TRACE_H
@@ -0,0 +1,273 @@
+/*
+ * trigger.c
+ *
+ * Copyright 2013 Matthew <mbrush@codebrainz.ca>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "trigger.h"
+#include "docstate.h"
+
+// How far back to look for the start of the current statement
+#define MAX_SCAN 8192
+
+// Style bit set by the C lexer on code in inactive #if branches
+#define INACTIVE_FLAG 0x40
+
+static bool is_inert_style(int lexer, int style)
+{
+  if (lexer == SCLEX_CPP)
+  {
+    style &= ~INACTIVE_FLAG;
+    if (style == SCE_C_PREPROCESSOR)
+      return true;
+  }
+  return highlighting_is_string_style(lexer, style) ||
+         highlighting_is_comment_style(lexer, style);
+}
+
+// Catches directives when the lexer styles their contents as code
+static bool in_directive(ScintillaObject *sci, int lexer, int pos)
+{
+  int line, start, end, n;
+
+  if (lexer != SCLEX_CPP)
+    return false;
+
+  line = sci_get_line_from_position(sci, pos);
+  for (n = 0; n < 100; n++)
+  {
+    start = sci_get_position_from_line(sci, line);
+    end = sci_get_line_end_position(sci, line);
+    while (start < end && g_ascii_isspace(sci_get_char_at(sci, start)))
+      start++;
+    if (start < end && sci_get_char_at(sci, start) == '#' &&
+        (sci_get_style_at(sci, start) & ~INACTIVE_FLAG) == SCE_C_PREPROCESSOR)
+      return true;
+    // Only a continued line can still be part of a directive
+    if (line == 0)
+      return false;
+    end = sci_get_line_end_position(sci, --line);
+    if (end == 0 || sci_get_char_at(sci, end - 1) != '\\')
+      return false;
+  }
+  return false;
+}
+
+// Returns characters and styles of [from, to) interleaved
+static char *get_styled_text(ScintillaObject *sci, int from, int to)
+{
+  struct Sci_TextRange tr;
+
+  tr.chrg.cpMin = from;
+  tr.chrg.cpMax = to;
+  tr.lpstrText = g_malloc(2 * (size_t)(to - from) + 2);
+  scintilla_send_message(sci, SCI_GETSTYLEDTEXT, 0, (sptr_t)&tr);
+  return tr.lpstrText;
+}
+
+// Counts the brackets left open in @a n styled characters, starting
+// from @a depth; braces end a statement and so reset it
+static unsigned int scan_depth(const char *styled, int n, int lexer,
+                               unsigned int depth)
+{
+  int i;
+
+  for (i = 0; i < n; i++)
+  {
+    if (is_inert_style(lexer, (unsigned char)styled[2 * i + 1]))
+      continue;
+    switch (styled[2 * i])
+    {
+      case '{':
+      case '}':
+        depth = 0;
+        break;
+      case '(':
+      case '[':
+        depth++;
+        break;
+      case ')':
+      case ']':
+        if (depth > 0)
+          depth--;
+        break;
+    }
+  }
+
+  return depth;
+}
+
+// Whether nothing before @a pos changed after version @a since
+static bool unchanged_before(FmtDocState *state, unsigned long since,
+                             size_t pos)
+{
+  unsigned int i;
+
+  if (since == 0)
+    return false;
+  if (state->version == since)
+    return true;
+  if (!state->edits || state->edits->len == 0)
+    return false;
+
+  for (i = state->edits->len; i > 0; i--)
+  {
+    FmtEdit *edit = &g_array_index(state->edits, FmtEdit, i - 1);
+    if (edit->version <= since)
+      return true;
+    if (edit->pos < pos)
+      return false;
+  }
+
+  // Every logged edit is newer, so the log must start right after it
+  return g_array_index(state->edits, FmtEdit, 0).version == since + 1;
+}
+
+static unsigned int get_depth(GeanyDocument *doc, int lexer, int pos)
+{
+  ScintillaObject *sci = doc->editor->sci;
+  FmtDocState *state = fmt_doc_state_get(doc);
+  unsigned int depth;
+  char *styled;
+  int from, n, i;
+
+  // Typing mostly appends to the text scanned last time, so carry on
+  // from there instead of searching the statement start again
+  if (state && state->trigger_pos <= (size_t)pos &&
+      pos - (int)state->trigger_pos <= MAX_SCAN &&
+      unchanged_before(state, state->trigger_version, state->trigger_pos))
+  {
+    from = state->trigger_pos;
+    styled = get_styled_text(sci, from, pos);
+    depth = scan_depth(styled, pos - from, lexer, state->trigger_depth);
+  }
+  else
+  {
+    from = MAX(0, pos - MAX_SCAN);
+    styled = get_styled_text(sci, from, pos);
+    n = pos - from;
+    for (i = n - 1; i >= 0; i--)
+    {
+      char c = styled[2 * i];
+      if ((c == '{' || c == '}') &&
+          !is_inert_style(lexer, (unsigned char)styled[2 * i + 1]))
+        break;
+    }
+    i = MAX(i, 0);
+    depth = scan_depth(styled + 2 * i, n - i, lexer, 0);
+  }
+  g_free(styled);
+
+  if (state)
+  {
+    state->trigger_version = state->version;
+    state->trigger_pos = pos;
+    state->trigger_depth = depth;
+  }
+
+  return depth;
+}
+
+bool fmt_trigger_should_format(GeanyDocument *doc, int ch)
+{
+  ScintillaObject *sci;
+  int lexer, pos, end_styled;
+
+  g_return_val_if_fail(DOC_VALID(doc), false);
+
+  sci = doc->editor->sci;
+  pos = sci_get_current_position(sci);
+  if (pos <= 0)
+    return true;
+
+  // Styling normally lags behind typing until the next redraw
+  lexer = sci_get_lexer(sci);
+  end_styled = scintilla_send_message(sci, SCI_GETENDSTYLED, 0, 0);
+  if (end_styled < pos)
+  {
+    int line = sci_get_line_from_position(sci, end_styled);
+    scintilla_send_message(sci, SCI_COLOURISE,
+                           sci_get_position_from_line(sci, line), pos);
+  }
+
+  if (is_inert_style(lexer, sci_get_style_at(sci, pos - 1)) ||
+      in_directive(sci, lexer, pos - 1))
+    return false;
+
+  // A closing brace always ends a statement
+  if (ch == '}' || ch == '{')
+    return true;
+
+  return get_depth(doc, lexer, pos) == 0;
+}
+
+static bool ends_statement(char c)
+{
+  return c == ';' || c == '{' || c == '}';
+}
+
+void fmt_trigger_widen_to_statements(GeanyDocument *doc, int *start, int *end)
+{
+  ScintillaObject *sci;
+  int lexer, from, to, end_styled, i;
+  char *styled;
+
+  g_return_if_fail(DOC_VALID(doc));
+
+  sci = doc->editor->sci;
+  lexer = sci_get_lexer(sci);
+  from = MAX(0, *start - MAX_SCAN);
+  to = MIN(sci_get_length(sci), *end + MAX_SCAN);
+
+  // Pasted text isn't styled until it's drawn
+  end_styled = scintilla_send_message(sci, SCI_GETENDSTYLED, 0, 0);
+  if (end_styled < to)
+  {
+    int line = sci_get_line_from_position(sci, end_styled);
+    scintilla_send_message(sci, SCI_COLOURISE,
+                           sci_get_position_from_line(sci, line), to);
+  }
+
+  styled = get_styled_text(sci, from, to);
+
+  for (i = *start - from; i > 0; i--)
+  {
+    if (ends_statement(styled[2 * (i - 1)]) &&
+        !is_inert_style(lexer, (unsigned char)styled[2 * (i - 1) + 1]))
+      break;
+  }
+  if (i > 0 || from == 0)
+    *start = from + i;
+
+  for (i = MAX(*end - 1, *start) - from; i < to - from; i++)
+  {
+    if (ends_statement(styled[2 * i]) &&
+        !is_inert_style(lexer, (unsigned char)styled[2 * i + 1]))
+      break;
+  }
+  if (i < to - from)
+    *end = from + i + 1;
+  else if (to == sci_get_length(sci))
+    *end = to;
+
+  g_free(styled);
+}
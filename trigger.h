@@ -0,0 +1,50 @@
+/*
+ * trigger.h
+ *
+ * Copyright 2013 Matthew <mbrush@codebrainz.ca>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+
+#ifndef FMT_TRIGGER_H
+#define FMT_TRIGGER_H
+
+#include "plugin.h"
+
+G_BEGIN_DECLS
+
+/**
+ * Whether the trigger character @a ch, just typed before the cursor of
+ * @a doc, should auto-format it.
+ *
+ * Trigger characters typed inside strings, character literals,
+ * comments or preprocessor directives don't, and neither do those
+ * typed while a parenthesis or square bracket of the current statement
+ * is still open, since formatting an unfinished statement cannot help.
+ */
+bool fmt_trigger_should_format(GeanyDocument *doc, int ch);
+
+/**
+ * Widens the range [@a start, @a end) of @a doc to the statements it
+ * touches, from just after the @c ; or brace before it to the first
+ * one at or after its last character. Ends of statements aren't looked
+ * for further than a few kilobytes away.
+ */
+void fmt_trigger_widen_to_statements(GeanyDocument *doc, int *start, int *end);
+
+G_END_DECLS
+
+#endif // FMT_TRIGGER_H
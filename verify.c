@@ -0,0 +1,1119 @@
+/*
+ * verify.c
+ *
+ * Copyright 2013 Matthew <mbrush@codebrainz.ca>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "verify.h"
+#include "dotfile.h"
+#include "prefs.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__GNUC__) && defined(__SSE2__) &&                               \
+    (defined(__x86_64__) || defined(__i386__))
+#define HAVE_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+typedef struct
+{
+  // Length of the common prefix of two strings of at least @a n bytes
+  size_t (*common_prefix)(const char *a, const char *b, size_t n);
+  // Length of the whitespace at the start of @a n bytes
+  size_t (*skip_space)(const char *p, size_t n);
+} Scanner;
+
+typedef enum
+{
+  LEX_CODE,
+  LEX_LINE_COMMENT,
+  LEX_BLOCK_COMMENT,
+  LEX_STRING,
+  LEX_CHAR,
+  LEX_RAW_STRING,
+  LEX_HEADER_NAME, // the <...> of an include
+} LexState;
+
+typedef struct
+{
+  const Scanner *scan;
+  const char *a, *b; // the code and the formatted code
+  size_t a_len, b_len;
+  size_t i, j; // how far they've been compared
+  FmtVerifyResult result;
+  FmtVerifySpaceFunc space_func; // told about whitespace that differs
+  gpointer user_data;
+
+  // The code's lexical state, as known up to lex_pos
+  LexState lex;
+  size_t lex_pos;
+  bool line_started, directive;
+  const char *raw_delim;
+  size_t raw_delim_len;
+} Compare;
+
+static inline bool is_space(char c)
+{
+  return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+static inline bool is_word_char(char c)
+{
+  return g_ascii_isalnum(c) || c == '_' || (c & 0x80);
+}
+
+//======================================================================
+//
+// Scanning
+//
+
+static size_t common_prefix_scalar(const char *a, const char *b, size_t n)
+{
+  size_t i = 0;
+
+  for (; i + sizeof(guint64) <= n; i += sizeof(guint64))
+  {
+    guint64 x, y;
+    memcpy(&x, a + i, sizeof(x));
+    memcpy(&y, b + i, sizeof(y));
+    if (x != y)
+      break;
+  }
+  while (i < n && a[i] == b[i])
+    i++;
+
+  return i;
+}
+
+static size_t skip_space_scalar(const char *p, size_t n)
+{
+  size_t i = 0;
+  while (i < n && is_space(p[i]))
+    i++;
+  return i;
+}
+
+#ifndef HAVE_X86_SIMD
+static const Scanner scalar_scanner = { common_prefix_scalar,
+                                        skip_space_scalar };
+#else
+static size_t common_prefix_sse2(const char *a, const char *b, size_t n)
+{
+  size_t i = 0;
+
+  for (; i + 16 <= n; i += 16)
+  {
+    __m128i x = _mm_loadu_si128((const __m128i *)(a + i));
+    __m128i y = _mm_loadu_si128((const __m128i *)(b + i));
+    unsigned int differ = ~_mm_movemask_epi8(_mm_cmpeq_epi8(x, y)) & 0xffff;
+    if (differ)
+      return i + __builtin_ctz(differ);
+  }
+
+  return i + common_prefix_scalar(a + i, b + i, n - i);
+}
+
+// Sets the bytes of @a x which are whitespace, '\t' to '\r' being 0 to 4
+// after subtracting '\t'
+static inline __m128i space_mask_sse2(__m128i x)
+{
+  __m128i ctl = _mm_sub_epi8(x, _mm_set1_epi8('\t'));
+  __m128i is_ctl = _mm_cmpeq_epi8(_mm_min_epu8(ctl, _mm_set1_epi8(4)), ctl);
+  return _mm_or_si128(is_ctl, _mm_cmpeq_epi8(x, _mm_set1_epi8(' ')));
+}
+
+static size_t skip_space_sse2(const char *p, size_t n)
+{
+  size_t i = 0;
+
+  for (; i + 16 <= n; i += 16)
+  {
+    __m128i x = _mm_loadu_si128((const __m128i *)(p + i));
+    unsigned int other = ~_mm_movemask_epi8(space_mask_sse2(x)) & 0xffff;
+    if (other)
+      return i + __builtin_ctz(other);
+  }
+
+  return i + skip_space_scalar(p + i, n - i);
+}
+
+static const Scanner sse2_scanner = { common_prefix_sse2, skip_space_sse2 };
+
+__attribute__((target("avx2"))) static size_t
+common_prefix_avx2(const char *a, const char *b, size_t n)
+{
+  size_t i = 0;
+
+  for (; i + 32 <= n; i += 32)
+  {
+    __m256i x = _mm256_loadu_si256((const __m256i *)(a + i));
+    __m256i y = _mm256_loadu_si256((const __m256i *)(b + i));
+    unsigned int differ = ~(unsigned int)_mm256_movemask_epi8(
+        _mm256_cmpeq_epi8(x, y));
+    if (differ)
+      return i + __builtin_ctz(differ);
+  }
+
+  return i + common_prefix_sse2(a + i, b + i, n - i);
+}
+
+__attribute__((target("avx2"))) static size_t
+skip_space_avx2(const char *p, size_t n)
+{
+  size_t i = 0;
+
+  for (; i + 32 <= n; i += 32)
+  {
+    __m256i x = _mm256_loadu_si256((const __m256i *)(p + i));
+    __m256i ctl = _mm256_sub_epi8(x, _mm256_set1_epi8('\t'));
+    __m256i is_ctl =
+        _mm256_cmpeq_epi8(_mm256_min_epu8(ctl, _mm256_set1_epi8(4)), ctl);
+    __m256i is_space =
+        _mm256_or_si256(is_ctl, _mm256_cmpeq_epi8(x, _mm256_set1_epi8(' ')));
+    unsigned int other = ~(unsigned int)_mm256_movemask_epi8(is_space);
+    if (other)
+      return i + __builtin_ctz(other);
+  }
+
+  return i + skip_space_sse2(p + i, n - i);
+}
+
+static const Scanner avx2_scanner = { common_prefix_avx2, skip_space_avx2 };
+#endif
+
+static const Scanner *get_scanner(void)
+{
+  static const Scanner *scanner = NULL;
+
+  if (!scanner)
+  {
+#ifdef HAVE_X86_SIMD
+    __builtin_cpu_init();
+    scanner =
+        __builtin_cpu_supports("avx2") ? &avx2_scanner : &sse2_scanner;
+#else
+    scanner = &scalar_scanner;
+#endif
+  }
+
+  return scanner;
+}
+
+//======================================================================
+//
+// Lexing, only done where the texts differ
+//
+
+// The byte at @a pos, or 0 past the end
+static inline char at(const char *s, size_t len, size_t pos)
+{
+  return pos < len ? s[pos] : '\0';
+}
+
+// Whether the quote at @a pos is a C++14 digit separator
+static bool is_digit_separator(const char *s, size_t pos)
+{
+  size_t start = pos;
+  while (start > 0 && is_word_char(s[start - 1]))
+    start--;
+  return start < pos && g_ascii_isdigit(s[start]);
+}
+
+// Whether the quote at @a pos starts a raw string, like R"x(...)x"
+static bool is_raw_string(const char *s, size_t pos)
+{
+  size_t start = pos;
+
+  if (pos == 0 || s[pos - 1] != 'R')
+    return false;
+  while (start > 0 && is_word_char(s[start - 1]))
+    start--;
+  // R, LR, uR, UR or u8R
+  switch (pos - start)
+  {
+    case 1:
+      return true;
+    case 2:
+      return strchr("LuU", s[start]) != NULL;
+    case 3:
+      return s[start] == 'u' && s[start + 1] == '8';
+    default:
+      return false;
+  }
+}
+
+// Whether the text before @a pos on its line is the directive @a name,
+// like "#  include "
+static bool follows_directive(const char *s, size_t pos, const char *name)
+{
+  size_t n = strlen(name);
+
+  while (pos > 0 && (s[pos - 1] == ' ' || s[pos - 1] == '\t'))
+    pos--;
+  if (pos < n || memcmp(s + pos - n, name, n) != 0)
+    return false;
+  pos -= n;
+  while (pos > 0 && (s[pos - 1] == ' ' || s[pos - 1] == '\t'))
+    pos--;
+  if (pos == 0 || s[pos - 1] != '#')
+    return false;
+  pos--;
+  while (pos > 0 && (s[pos - 1] == ' ' || s[pos - 1] == '\t'))
+    pos--;
+  return pos == 0 || s[pos - 1] == '\n';
+}
+
+// Whether the '<' at @a pos starts the header name of an include
+static bool is_header_name(const char *s, size_t pos)
+{
+  return follows_directive(s, pos, "include") ||
+         follows_directive(s, pos, "include_next") ||
+         follows_directive(s, pos, "import");
+}
+
+// Whether the word before @a pos is the name of a macro being defined,
+// a space after it turns a function-like macro into an object-like one
+static bool ends_macro_name(const char *s, size_t pos)
+{
+  size_t start = pos;
+
+  while (start > 0 && is_word_char(s[start - 1]))
+    start--;
+  return start < pos && follows_directive(s, start, "define");
+}
+
+// The characters which may change the lexical state of code, besides
+// the whitespace before a directive
+static const bool lex_special[256] = {
+  ['\n'] = true, ['"'] = true, ['#'] = true,  ['\''] = true,
+  ['/'] = true,  ['<'] = true, ['\\'] = true,
+};
+
+// Brings the code's lexical state up to @a end
+static void lex_to(Compare *c, size_t end)
+{
+  const char *s = c->a;
+  size_t len = c->a_len;
+  size_t p = c->lex_pos;
+  // Kept in locals, the compiler can't tell the text doesn't alias them
+  LexState lex = c->lex;
+  bool directive = c->directive, line_started = c->line_started;
+
+  while (p < end)
+  {
+    char ch = s[p];
+
+    switch (lex)
+    {
+      case LEX_CODE:
+        if (!lex_special[(unsigned char)ch])
+        {
+          if (is_space(ch))
+            break;
+          // Nothing changes until the next special character
+          line_started = true;
+          while (p + 1 < end && !lex_special[(unsigned char)s[p + 1]])
+            p++;
+          break;
+        }
+        if (ch == '#' && !line_started)
+          directive = true;
+        else if (ch == '\\' && at(s, len, p + 1) == '\r')
+          p++;
+        if (ch == '\\')
+          p++; // the directive goes on, or the newline doesn't matter
+        else if (ch == '\n')
+          directive = line_started = false;
+        else if (ch == '/' && at(s, len, p + 1) == '/')
+        {
+          lex = LEX_LINE_COMMENT;
+          p++;
+        }
+        else if (ch == '/' && at(s, len, p + 1) == '*')
+        {
+          lex = LEX_BLOCK_COMMENT;
+          p++;
+        }
+        else if (ch == '<' && directive && is_header_name(s, p))
+          lex = LEX_HEADER_NAME;
+        else if (ch == '"' && is_raw_string(s, p))
+        {
+          const char *paren = memchr(s + p + 1, '(', MIN(len - p - 1, 17));
+          if (paren)
+          {
+            lex = LEX_RAW_STRING;
+            c->raw_delim = s + p + 1;
+            c->raw_delim_len = paren - c->raw_delim;
+            p = paren - s;
+          }
+          else
+            lex = LEX_STRING;
+        }
+        else if (ch == '"')
+          lex = LEX_STRING;
+        else if (ch == '\'' && !is_digit_separator(s, p))
+          lex = LEX_CHAR;
+        if (!is_space(ch))
+          line_started = true;
+        break;
+      case LEX_LINE_COMMENT:
+        if (ch == '\\' && at(s, len, p + 1) == '\r')
+          p++;
+        if (ch == '\\')
+          p++; // continued on the next line
+        else if (ch == '\n')
+        {
+          lex = LEX_CODE;
+          directive = line_started = false;
+        }
+        else
+        {
+          // Only a backslash at the end of the line matters
+          const char *nl = memchr(s + p, '\n', end - p);
+          size_t stop = nl ? (size_t)(nl - s) : end;
+          if (stop > p + 4)
+            p = stop - 4;
+        }
+        break;
+      case LEX_BLOCK_COMMENT:
+        if (ch == '*' && at(s, len, p + 1) == '/')
+        {
+          lex = LEX_CODE;
+          p++;
+        }
+        else if (ch != '*')
+        {
+          const char *star = memchr(s + p, '*', end - p);
+          p = (star ? (size_t)(star - s) : end) - 1;
+        }
+        break;
+      case LEX_STRING:
+      case LEX_CHAR:
+        if (ch == '\\')
+          p++;
+        else if (ch == (lex == LEX_STRING ? '"' : '\'') || ch == '\n')
+          lex = LEX_CODE;
+        break;
+      case LEX_RAW_STRING:
+        if (ch == ')' && p + c->raw_delim_len + 1 < len &&
+            memcmp(s + p + 1, c->raw_delim, c->raw_delim_len) == 0 &&
+            s[p + 1 + c->raw_delim_len] == '"')
+        {
+          lex = LEX_CODE;
+          p += c->raw_delim_len + 1;
+        }
+        break;
+      case LEX_HEADER_NAME:
+        if (ch == '>')
+          lex = LEX_CODE;
+        else if (ch == '\n')
+        {
+          lex = LEX_CODE;
+          directive = line_started = false;
+        }
+        break;
+    }
+    p++;
+  }
+
+  c->lex = lex;
+  c->directive = directive;
+  c->line_started = line_started;
+  c->lex_pos = p;
+}
+
+// Where the comment starting at or containing @a pos ends
+static size_t comment_end(const char *s, size_t len, size_t pos,
+                          LexState lex)
+{
+  if (lex == LEX_BLOCK_COMMENT)
+  {
+    for (const char *star = s + pos;
+         (star = memchr(star, '*', s + len - star)) != NULL; star++)
+    {
+      if (star + 1 < s + len && star[1] == '/')
+        return star + 2 - s;
+    }
+    return len;
+  }
+
+  for (const char *nl = s + pos;
+       (nl = memchr(nl, '\n', s + len - nl)) != NULL; nl++)
+  {
+    // A backslash at the end continues the comment
+    const char *last = nl > s && nl[-1] == '\r' ? nl - 1 : nl;
+    if (last == s + pos || last[-1] != '\\')
+      return nl - s;
+  }
+  return len;
+}
+
+static LexState comment_start(const char *s, size_t len, size_t pos)
+{
+  if (at(s, len, pos) == '/' && at(s, len, pos + 1) == '/')
+    return LEX_LINE_COMMENT;
+  if (at(s, len, pos) == '/' && at(s, len, pos + 1) == '*')
+    return LEX_BLOCK_COMMENT;
+  return LEX_CODE;
+}
+
+//======================================================================
+//
+// Differences clang-format makes itself
+//
+
+static size_t line_start(const char *s, size_t pos)
+{
+  while (pos > 0 && s[pos - 1] != '\n')
+    pos--;
+  return pos;
+}
+
+static size_t line_end(const char *s, size_t len, size_t pos)
+{
+  const char *nl = memchr(s + pos, '\n', len - pos);
+  return nl ? (size_t)(nl - s) : len;
+}
+
+static bool has_prefix(const char *s, size_t len, const char *prefix)
+{
+  size_t n = strlen(prefix);
+  return len >= n && memcmp(s, prefix, n) == 0;
+}
+
+// Whether the line from @a start to @a end is one clang-format sorts
+// with its neighbours, like an include or a using declaration
+static bool is_sorted_line(const char *s, size_t start, size_t end)
+{
+  while (start < end && is_space(s[start]))
+    start++;
+
+  if (at(s, end, start) == '#')
+  {
+    start++;
+    while (start < end && is_space(s[start]))
+      start++;
+    return has_prefix(s + start, end - start, "include") ||
+           has_prefix(s + start, end - start, "import");
+  }
+
+  return has_prefix(s + start, end - start, "@import") ||
+         (has_prefix(s + start, end - start, "using") &&
+          is_space(at(s, end, start + 5)));
+}
+
+static bool is_blank_line(const char *s, size_t start, size_t end)
+{
+  while (start < end && is_space(s[start]))
+    start++;
+  return start == end;
+}
+
+// Collects the lines of the sorted block around @a pos without the
+// whitespace between their tokens, or returns NULL if @a pos isn't in one
+static GPtrArray *sorted_block(const char *s, size_t len, size_t pos,
+                               size_t *block_end)
+{
+  size_t start = line_start(s, pos), end = line_end(s, len, pos);
+  GPtrArray *lines;
+
+  if (!is_sorted_line(s, start, end))
+    return NULL;
+
+  // Blank lines between groups can be added or removed by sorting
+  while (start > 0)
+  {
+    size_t prev = line_start(s, start - 1);
+    if (!is_sorted_line(s, prev, start - 1) &&
+        !is_blank_line(s, prev, start - 1))
+      break;
+    start = prev;
+  }
+  while (end < len)
+  {
+    size_t next = line_end(s, len, end + 1);
+    if (!is_sorted_line(s, end + 1, next) && !is_blank_line(s, end + 1, next))
+      break;
+    end = next;
+  }
+
+  lines = g_ptr_array_new_with_free_func(g_free);
+  for (size_t p = start; p < end;)
+  {
+    size_t e = line_end(s, len, p);
+    if (!is_blank_line(s, p, e))
+    {
+      GString *line = g_string_sized_new(e - p);
+      char close = '\0'; // the end of the header name or string we're in
+      for (size_t k = p; k < e; k++)
+      {
+        if (close && s[k] == close)
+          close = '\0';
+        else if (!close && s[k] == '"')
+          close = '"';
+        else if (!close && s[k] == '<' && is_header_name(s, k))
+          close = '>';
+        else if (!close && is_space(s[k]))
+          continue;
+        g_string_append_c(line, s[k]);
+      }
+      g_ptr_array_add(lines, g_string_free(line, false));
+    }
+    p = e + 1;
+  }
+
+  *block_end = end;
+  return lines;
+}
+
+static int compare_lines(gconstpointer a, gconstpointer b)
+{
+  return strcmp(*(const char **)a, *(const char **)b);
+}
+
+// Skips the blocks of includes around the difference if they hold the
+// same lines in another order
+static bool skip_sorted_blocks(Compare *c)
+{
+  GPtrArray *a_lines, *b_lines;
+  size_t a_end = 0, b_end = 0;
+  bool same;
+
+  a_lines = sorted_block(c->a, c->a_len, c->i, &a_end);
+  if (!a_lines)
+    return false;
+  b_lines = sorted_block(c->b, c->b_len, c->j, &b_end);
+  if (!b_lines)
+  {
+    g_ptr_array_free(a_lines, true);
+    return false;
+  }
+
+  same = a_lines->len == b_lines->len;
+  if (same)
+  {
+    g_ptr_array_sort(a_lines, compare_lines);
+    g_ptr_array_sort(b_lines, compare_lines);
+    for (unsigned int k = 0; same && k < a_lines->len; k++)
+      same = strcmp(a_lines->pdata[k], b_lines->pdata[k]) == 0;
+  }
+  g_ptr_array_free(a_lines, true);
+  g_ptr_array_free(b_lines, true);
+
+  if (!same)
+    return false;
+
+  c->i = a_end;
+  c->j = b_end;
+  c->lex = LEX_CODE;
+  c->lex_pos = a_end;
+  c->result = MAX(c->result, FMT_VERIFY_REORDERED);
+  return true;
+}
+
+// Skips whitespace from @a pos to @a end, and the stars decorating the
+// lines of block comments
+static size_t skip_comment_space(const char *s, size_t pos, size_t end,
+                                 bool *line_start)
+{
+  for (; pos < end; pos++)
+  {
+    if (s[pos] == '\n')
+      *line_start = true;
+    else if (s[pos] == '*' && *line_start && at(s, end, pos + 1) != '/')
+      *line_start = false;
+    else if (!is_space(s[pos]))
+      break;
+  }
+  return pos;
+}
+
+// Whether the comments from @a i and @a j to their ends say the same
+static bool same_comment_text(const Compare *c, size_t i, size_t a_end,
+                              size_t j, size_t b_end)
+{
+  bool a_line = is_blank_line(c->a, line_start(c->a, i), i);
+  bool b_line = is_blank_line(c->b, line_start(c->b, j), j);
+
+  for (;;)
+  {
+    i = skip_comment_space(c->a, i, a_end, &a_line);
+    j = skip_comment_space(c->b, j, b_end, &b_line);
+    if (i == a_end || j == b_end)
+      return i == a_end && j == b_end;
+    if (c->a[i++] != c->b[j++])
+      return false;
+    a_line = b_line = false;
+  }
+}
+
+// Whether the line around @a pos closes a namespace with a comment
+// naming it, which clang-format adds and corrects
+static bool is_namespace_comment(const char *s, size_t len, size_t pos)
+{
+  static const char *const words[] = { "end", "of", "anonymous",
+                                       "unnamed" };
+  size_t p = line_start(s, pos), end = line_end(s, len, pos);
+  bool closes = false, more = true;
+
+  for (; p < end && (is_space(s[p]) || s[p] == '}'); p++)
+    closes = closes || s[p] == '}';
+  if (!closes || comment_start(s, end, p) == LEX_CODE)
+    return false;
+
+  for (p += 2; more;)
+  {
+    more = false;
+    while (p < end && is_space(s[p]))
+      p++;
+    for (unsigned int k = 0; !more && k < G_N_ELEMENTS(words); k++)
+    {
+      size_t n = strlen(words[k]);
+      if (has_prefix(s + p, end - p, words[k]) &&
+          !is_word_char(at(s, end, p + n)))
+      {
+        p += n;
+        more = true;
+      }
+    }
+  }
+
+  return has_prefix(s + p, end - p, "namespace") &&
+         !is_word_char(at(s, end, p + 9));
+}
+
+// Moves past a difference clang-format can make by itself, or returns
+// false if the code differs there
+static bool resync(Compare *c)
+{
+  LexState a_comment, b_comment;
+
+  lex_to(c, c->i);
+
+  if (c->lex != LEX_LINE_COMMENT && c->lex != LEX_BLOCK_COMMENT &&
+      skip_sorted_blocks(c))
+    return true;
+
+  // Reflowed comments, the formatted text is inside the same comment and
+  // only its whitespace and decoration differ
+  if (c->lex == LEX_LINE_COMMENT || c->lex == LEX_BLOCK_COMMENT)
+  {
+    size_t a_end = comment_end(c->a, c->a_len, c->i, c->lex);
+    size_t b_end = comment_end(c->b, c->b_len, c->j, c->lex);
+
+    if (!same_comment_text(c, c->i, a_end, c->j, b_end) &&
+        !(is_namespace_comment(c->a, c->a_len, c->i) &&
+          is_namespace_comment(c->b, c->b_len, c->j)))
+      return false;
+
+    c->i = a_end;
+    c->j = b_end;
+    c->lex = LEX_CODE;
+    c->lex_pos = c->i;
+    c->result = MAX(c->result, FMT_VERIFY_COMMENTS);
+    return true;
+  }
+
+  // Comments ending namespaces, added or removed
+  a_comment = c->lex == LEX_CODE ? comment_start(c->a, c->a_len, c->i)
+                                 : LEX_CODE;
+  b_comment = c->lex == LEX_CODE ? comment_start(c->b, c->b_len, c->j)
+                                 : LEX_CODE;
+  if (a_comment != LEX_CODE || b_comment != LEX_CODE)
+  {
+    if ((a_comment != LEX_CODE &&
+         !is_namespace_comment(c->a, c->a_len, c->i)) ||
+        (b_comment != LEX_CODE &&
+         !is_namespace_comment(c->b, c->b_len, c->j)))
+      return false;
+    if (a_comment != LEX_CODE)
+    {
+      c->i = comment_end(c->a, c->a_len, c->i + 2, a_comment);
+      c->lex_pos = c->i;
+    }
+    if (b_comment != LEX_CODE)
+      c->j = comment_end(c->b, c->b_len, c->j + 2, b_comment);
+    c->result = MAX(c->result, FMT_VERIFY_COMMENTS);
+    return true;
+  }
+
+  // Long directives continued on the next line, or joined back
+  if (c->directive && c->lex == LEX_CODE)
+  {
+    if (at(c->b, c->b_len, c->j) == '\\' &&
+        is_space(at(c->b, c->b_len, c->j + 1)))
+    {
+      c->j++;
+      return true;
+    }
+    if (at(c->a, c->a_len, c->i) == '\\' &&
+        is_space(at(c->a, c->a_len, c->i + 1)))
+    {
+      c->i++;
+      return true;
+    }
+  }
+
+  // Long strings broken in two, "abc" becoming "ab" "c"
+  if (c->lex == LEX_STRING && at(c->b, c->b_len, c->j) == '"')
+  {
+    size_t k = c->j + 1;
+    k += c->scan->skip_space(c->b + k, c->b_len - k);
+    if (at(c->b, c->b_len, k) == '"')
+    {
+      c->j = k + 1;
+      c->result = MAX(c->result, FMT_VERIFY_COMMENTS);
+      return true;
+    }
+  }
+
+  return false;
+}
+
+//======================================================================
+//
+// Whitespace changes
+//
+
+// Whether removing the whitespace of @a s between @a left and @a right
+// makes a different token
+static bool joins_tokens(const char *s, size_t len, size_t left,
+                         size_t right)
+{
+  static const char *const tokens[] = {
+    "++", "--", "&&", "||", "<<", "<=", ">=", "==", "!=", "->",
+    "+=", "-=", "*=", "/=", "%=", "&=", "|=", "^=", "::", "//",
+    "/*", "##", ">>=", "<<=", "...", "->*", "<=>",
+  };
+  static const char *const prefixes[] = {
+    "L", "u", "U", "u8", "R", "LR", "uR", "UR", "u8R",
+  };
+  char x = left > 0 ? s[left - 1] : '\0';
+  char y = at(s, len, right);
+  size_t word = left;
+
+  if (is_word_char(x) && is_word_char(y))
+    return true;
+  // Numbers, like .5 and 1.5
+  if ((x == '.' && g_ascii_isdigit(y)) ||
+      (g_ascii_isdigit(x) && y == '.' &&
+       g_ascii_isdigit(at(s, len, right + 1))))
+    return true;
+  // User-defined literals, like "x"_s
+  if ((x == '"' || x == '\'') && y == '_')
+    return true;
+
+  for (unsigned int k = 0; k < G_N_ELEMENTS(tokens); k++)
+  {
+    size_t n = strlen(tokens[k]);
+    for (size_t split = 1; split < n; split++)
+    {
+      if (split <= left &&
+          memcmp(s + left - split, tokens[k], split) == 0 &&
+          right + n - split <= len &&
+          memcmp(s + right, tokens[k] + split, n - split) == 0)
+        return true;
+    }
+  }
+
+  // Encoding prefixes, like L"x"
+  if (y != '"' && y != '\'')
+    return false;
+  while (word > 0 && is_word_char(s[word - 1]))
+    word--;
+  for (unsigned int k = 0; k < G_N_ELEMENTS(prefixes); k++)
+  {
+    if (left - word == strlen(prefixes[k]) &&
+        memcmp(s + word, prefixes[k], left - word) == 0)
+      return true;
+  }
+  return false;
+}
+
+// Whether the whitespace run of @a n bytes at @a pos ends a line, a
+// newline after a backslash only continues it
+static bool breaks_line(const char *s, size_t pos, size_t n)
+{
+  const char *nl = memchr(s + pos, '\n', n);
+
+  if (nl && pos > 0 && s[pos - 1] == '\\')
+    nl = memchr(nl + 1, '\n', s + pos + n - nl - 1);
+  return nl != NULL;
+}
+
+// Checks the whitespace runs of @a sa and @a sb bytes at the current
+// positions only separate the same tokens, and aren't part of a literal.
+// Where a line comment is reflowed, the run is extended over the slashes
+// continuing it.
+static bool space_changes_ok(Compare *c, size_t *sa, size_t *sb)
+{
+  bool a_nl, b_nl;
+
+  lex_to(c, c->i);
+  if (c->lex == LEX_STRING || c->lex == LEX_CHAR ||
+      c->lex == LEX_RAW_STRING || c->lex == LEX_HEADER_NAME)
+  {
+    // The string may be broken in two before the whitespace, resync()
+    // tells
+    if (c->lex == LEX_STRING && at(c->b, c->b_len, c->j) == '"')
+    {
+      *sa = *sb = 0;
+      return true;
+    }
+    return *sa == *sb && memcmp(c->a + c->i, c->b + c->j, *sa) == 0;
+  }
+
+  if ((*sa == 0) != (*sb == 0))
+  {
+    size_t right = c->i + *sa;
+    if (at(c->a, c->a_len, right) == at(c->b, c->b_len, c->j + *sb) &&
+        (joins_tokens(c->a, c->a_len, c->i, right) ||
+         (c->directive && at(c->a, c->a_len, right) == '(' &&
+          ends_macro_name(c->a, c->i))))
+      return false;
+  }
+
+  a_nl = breaks_line(c->a, c->i, *sa);
+  b_nl = breaks_line(c->b, c->j, *sb);
+  if (a_nl != b_nl && c->i + *sa < c->a_len && c->j + *sb < c->b_len)
+  {
+    // Joining or splitting lines must not move code into or out of a
+    // line comment or a directive
+    if (c->lex == LEX_LINE_COMMENT)
+    {
+      const char *s = a_nl ? c->a : c->b;
+      size_t len = a_nl ? c->a_len : c->b_len;
+      size_t pos = a_nl ? c->i : c->j;
+      size_t *n = a_nl ? sa : sb;
+      size_t end = pos + *n;
+
+      if (comment_start(s, len, end) != LEX_LINE_COMMENT)
+        return false;
+      while (at(s, len, end) == '/')
+        end++;
+      *n = end - pos;
+      c->result = MAX(c->result, FMT_VERIFY_COMMENTS);
+    }
+    else if (c->directive && c->lex != LEX_BLOCK_COMMENT)
+      return false;
+  }
+
+  return true;
+}
+
+static void compare_init(Compare *c, const char *code, size_t code_len,
+                         const char *formatted, size_t formatted_len)
+{
+  memset(c, 0, sizeof(*c));
+  c->scan = get_scanner();
+  c->a = code;
+  c->a_len = code_len;
+  c->b = formatted;
+  c->b_len = formatted_len;
+  c->result = FMT_VERIFY_WHITESPACE;
+  c->lex = LEX_CODE;
+}
+
+static void compare(Compare *c)
+{
+  for (;;)
+  {
+    size_t same, sa, sb;
+
+    same = c->scan->common_prefix(c->a + c->i, c->b + c->j,
+                                  MIN(c->a_len - c->i, c->b_len - c->j));
+    c->i += same;
+    c->j += same;
+
+    if (c->i == c->a_len && c->j == c->b_len)
+      break;
+
+    // Look at whole whitespace runs, their start may be the same
+    while (c->i > 0 && c->j > 0 && is_space(c->a[c->i - 1]) &&
+           c->a[c->i - 1] == c->b[c->j - 1])
+    {
+      c->i--;
+      c->j--;
+    }
+
+    sa = c->scan->skip_space(c->a + c->i, c->a_len - c->i);
+    sb = c->scan->skip_space(c->b + c->j, c->b_len - c->j);
+    if ((sa > 0 || sb > 0) && !space_changes_ok(c, &sa, &sb))
+    {
+      c->result = FMT_VERIFY_CODE;
+      break;
+    }
+    if (c->space_func &&
+        (sa != sb || memcmp(c->a + c->i, c->b + c->j, sa) != 0))
+      c->space_func(c->i, sa, c->j, sb, c->user_data);
+    c->i += sa;
+    c->j += sb;
+
+    if (c->i == c->a_len && c->j == c->b_len)
+      break;
+    if (c->i < c->a_len && c->j < c->b_len && c->a[c->i] == c->b[c->j])
+      continue;
+    if (!resync(c))
+    {
+      c->result = FMT_VERIFY_CODE;
+      break;
+    }
+  }
+}
+
+FmtVerifyResult fmt_verify_compare(const char *code, size_t code_len,
+                                   const char *formatted,
+                                   size_t formatted_len, size_t *code_pos,
+                                   size_t *formatted_pos)
+{
+  Compare c;
+
+  g_return_val_if_fail(code || code_len == 0, FMT_VERIFY_CODE);
+  g_return_val_if_fail(formatted || formatted_len == 0, FMT_VERIFY_CODE);
+
+  compare_init(&c, code, code_len, formatted, formatted_len);
+  compare(&c);
+
+  if (code_pos)
+    *code_pos = c.i;
+  if (formatted_pos)
+    *formatted_pos = c.j;
+
+  return c.result;
+}
+
+bool fmt_verify_whitespace(const char *code, size_t code_len,
+                           const char *formatted, size_t formatted_len,
+                           FmtVerifySpaceFunc func, gpointer user_data)
+{
+  Compare c;
+
+  g_return_val_if_fail(code || code_len == 0, false);
+  g_return_val_if_fail(formatted || formatted_len == 0, false);
+  g_return_val_if_fail(func != NULL, false);
+
+  compare_init(&c, code, code_len, formatted, formatted_len);
+  c.space_func = func;
+  c.user_data = user_data;
+  compare(&c);
+
+  return c.result == FMT_VERIFY_WHITESPACE;
+}
+
+//======================================================================
+//
+// Checking clang-format's output
+//
+
+static bool option_enabled(GHashTable *options, const char *name,
+                           const char *off)
+{
+  const char *value = g_hash_table_lookup(options, name);
+  return value && g_ascii_strcasecmp(value, off) != 0;
+}
+
+// Whether the style of @a path asks clang-format to change code
+static bool style_changes_code(const char *path)
+{
+  static const char *const switches[] = {
+    "InsertBraces", "RemoveBracesLLVM", "RemoveSemicolon",
+  };
+  static const char *const separators[] = {
+    "IntegerLiteralSeparator.Binary",
+    "IntegerLiteralSeparator.Decimal",
+    "IntegerLiteralSeparator.Hex",
+  };
+  FmtStyle preset = fmt_prefs_get_style();
+  const char *language = "Cpp";
+  GHashTable *options;
+  bool changes = false;
+  char *dir;
+
+  if (path)
+  {
+    const char *ext = strrchr(path, '.');
+    if (ext && (strcmp(ext, ".m") == 0 || strcmp(ext, ".mm") == 0))
+      language = "ObjC";
+    dir = g_path_get_dirname(path);
+  }
+  else
+    dir = g_get_current_dir();
+
+  options = fmt_dot_file_options(
+      dir,
+      preset != FORMAT_STYLE_CUSTOM ? fmt_style_get_cmd_name(preset) : NULL,
+      language);
+  g_free(dir);
+  if (!options)
+    return false;
+
+  for (unsigned int k = 0; !changes && k < G_N_ELEMENTS(switches); k++)
+    changes = option_enabled(options, switches[k], "false");
+  for (unsigned int k = 0; !changes && k < G_N_ELEMENTS(separators); k++)
+  {
+    const char *value = g_hash_table_lookup(options, separators[k]);
+    changes = value && atoi(value) != 0;
+  }
+  changes = changes ||
+            option_enabled(options, "QualifierAlignment", "Leave") ||
+            option_enabled(options, "RemoveParentheses", "Leave");
+
+  g_hash_table_destroy(options);
+  return changes;
+}
+
+bool fmt_verify_formatted(const char *path, const char *code,
+                          size_t code_len, const char *formatted,
+                          size_t formatted_len)
+{
+  size_t code_pos = 0, formatted_pos = 0;
+  unsigned int line = 1;
+  char *name;
+
+  if (!fmt_prefs_get_verify())
+    return true;
+
+  if (fmt_verify_compare(code, code_len, formatted, formatted_len,
+                         &code_pos, &formatted_pos) != FMT_VERIFY_CODE)
+    return true;
+
+  for (size_t k = 0; k < code_pos && k < code_len; k++)
+    line += code[k] == '\n';
+
+  if (style_changes_code(path))
+  {
+    g_debug("clang-format changed the code of %s on line %u, as its "
+            "style asks",
+            path ? path : "(untitled)", line);
+    return true;
+  }
+
+  name = path ? g_filename_display_basename(path) : g_strdup(_("untitled"));
+  msgwin_status_add(_("Code Format: clang-format changed the code of %s on "
+                      "line %u, its output was not used."),
+                    name, line);
+  g_free(name);
+
+  return false;
+}
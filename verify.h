@@ -0,0 +1,98 @@
+/*
+ * verify.h
+ *
+ * Copyright 2013 Matthew <mbrush@codebrainz.ca>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+
+#ifndef FMT_VERIFY_H
+#define FMT_VERIFY_H
+
+#include "plugin.h"
+
+G_BEGIN_DECLS
+
+typedef enum
+{
+  FMT_VERIFY_WHITESPACE = 0, // only whitespace differs
+  FMT_VERIFY_REORDERED,      // and blocks of includes were sorted
+  FMT_VERIFY_COMMENTS,       // and comments were reflowed or fixed, or
+                             // strings broken in two
+  FMT_VERIFY_CODE,           // the code itself differs
+} FmtVerifyResult;
+
+/**
+ * Called for a run of whitespace that differs, the @a code_len bytes at
+ * @a code_pos in the code becoming the @a formatted_len bytes at
+ * @a formatted_pos in the formatted code. The runs may start or end
+ * with the same whitespace.
+ */
+typedef void (*FmtVerifySpaceFunc)(size_t code_pos, size_t code_len,
+                                   size_t formatted_pos,
+                                   size_t formatted_len,
+                                   gpointer user_data);
+
+/**
+ * Compares @a code with its formatted version @a formatted, ignoring
+ * whitespace which doesn't join or split tokens and isn't inside a
+ * string, character literal or header name.
+ *
+ * Runs of identical text and of whitespace are skipped with SIMD
+ * instructions where available. Where the texts differ otherwise, the
+ * differences clang-format makes by itself are recognized: sorted blocks
+ * of includes and using declarations, comments reflowed with the same
+ * text, comments ending namespaces, and string literals broken in two.
+ *
+ * @param code_pos Return location for where the code first differs, or
+ *   @c NULL.
+ * @param formatted_pos Return location for the corresponding position in
+ *   @a formatted, or @c NULL.
+ * @return The largest kind of difference found.
+ */
+FmtVerifyResult fmt_verify_compare(const char *code, size_t code_len,
+                                   const char *formatted,
+                                   size_t formatted_len, size_t *code_pos,
+                                   size_t *formatted_pos);
+
+/**
+ * Compares @a code with @a formatted like fmt_verify_compare(), calling
+ * @a func for each run of whitespace that differs, in order.
+ *
+ * @return Whether only whitespace differs. Otherwise @a func may have
+ *   been called for the runs before the first other difference.
+ */
+bool fmt_verify_whitespace(const char *code, size_t code_len,
+                           const char *formatted, size_t formatted_len,
+                           FmtVerifySpaceFunc func, gpointer user_data);
+
+/**
+ * Checks that clang-format's output for the file @a path may replace
+ * its @a code, when the verify-formatting setting is enabled. Changes
+ * to the code itself are only accepted when the file's style enables
+ * options that make them, like InsertBraces, otherwise where they are
+ * is reported in the status messages.
+ *
+ * @param path The file's path, in the locale's encoding, or @c NULL.
+ * @return Whether @a formatted may be used.
+ */
+bool fmt_verify_formatted(const char *path, const char *code,
+                          size_t code_len, const char *formatted,
+                          size_t formatted_len);
+
+G_END_DECLS
+
+#endif // FMT_VERIFY_H